@@ -0,0 +1,35 @@
+/*
+ * filename: cache.h
+ *
+ * Result cache shared by all invocations of a plugin with the same
+ * arguments. With --cache-ttl a plugin calls cache_init() after parsing its
+ * arguments: a result younger than the TTL is printed and the plugin exits
+ * right away, without touching procfs. Otherwise the plugin runs as usual
+ * and output_exit() stores its output with cache_store().
+ *
+ * Every key (plugin, arguments and uid) has its own small shared memory
+ * segment in CACHE_DIR, written under a seqlock, so readers never block.
+ * Misses are serialized with flock() on the segment: the first process runs
+ * the check, the others wait a bounded time and then take its result.
+ * Entries which weren't written for a day are removed.
+ */
+
+#ifndef __cache_h
+#define __cache_h
+
+#include <stddef.h>
+
+#define CACHE_DIR       "/dev/shm"
+
+/* Largest output which is cached. */
+#define CACHE_MAXOUTPUT 16384
+
+/* Error message for a --cache-ttl without a valid value. */
+#define ECACHETTL       "--cache-ttl needs a number of seconds"
+
+void    cache_init(const char *plugin, int argc, char *argv[], double ttl);
+int     cache_active(void);
+void    cache_store(int rc, const char *output, size_t len, const char *text,
+                size_t text_len);
+
+#endif
@@ -13,10 +13,28 @@
 #define CRITICAL    2
 #define UNKNOWN     3
 
-const char  state[4][9] = {
-                "OK",
-                "WARNING",
-                "CRITICAL",
-                "UNKNOWN"};
+/*
+ * Name of the multi-call binary. If a plugin is invoked through this name,
+ * the plugin name is taken from the first argument instead of argv[0].
+ */
+#define MULTICALL_NAME  "monitoring-plugins"
+
+/*
+ * Every plugin defines its entry point with PLUGIN_MAIN(<plugin name>).
+ * In the multi-call binary all plugins are linked into one executable, so
+ * the entry point is renamed to <plugin name>_main and dispatched by
+ * plugins/multicall.c.
+ */
+#ifdef MULTICALL
+#define PLUGIN_MAIN(name)   name##_main
+#else
+#define PLUGIN_MAIN(name)   main
+#endif
+
+/* Textual representation of the return codes above, see lib/icinga.c. */
+extern const char  state[4][9];
+
+int check_option(const char *s_option, const char *s_short_opt,
+        const char *s_long_opt);
 
 #endif
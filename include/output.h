@@ -0,0 +1,50 @@
+/*
+ * filename: output.h
+ *
+ * Output layer shared by all plugins. A plugin collects its measurements
+ * with output_add() and finishes with output_exit(), which renders the
+ * status and the measurements in the requested format:
+ *
+ *  - nagios:      "STATE - message|label=value[uom];warn;crit;min;max ..."
+ *  - json:        one JSON object with status, message and metrics
+ *  - openmetrics: OpenMetrics text exposition, e.g. for Prometheus
+ *
+ * With output_set_textfile() the measurements are additionally written in
+ * OpenMetrics format to a file, which is renamed into place atomically, so
+ * the node_exporter textfile collector never sees a partial file.
+ *
+ * The output is process global, so plugins can bail out with output_exit()
+ * from anywhere.
+ */
+
+#ifndef __output_h
+#define __output_h
+
+#include <math.h>
+#include <stddef.h>
+
+/* Output formats. */
+#define OUTPUT_NAGIOS       0
+#define OUTPUT_JSON         1
+#define OUTPUT_OPENMETRICS  2
+
+/* Value for unset thresholds and ranges. */
+#define OUTPUT_UNSET        NAN
+
+/* Error message for an unknown --format. */
+#define EOUTPUTFORMAT   "unknown output format, use nagios, json or openmetrics"
+
+void    output_init(const char *plugin);
+int     output_set_format(const char *format);
+int     output_format(void);
+void    output_set_textfile(const char *path);
+int     output_cached_textfile(const char *text, size_t len);
+void    output_add(const char *name, const char *uom, double value,
+                double warn, double crit, double min, double max);
+void    output_add_labeled(const char *label, const char *label_value,
+                const char *name, const char *uom, double value,
+                double warn, double crit, double min, double max);
+void    output_exit(int rc, const char *format, ...)
+                __attribute__((format(printf, 2, 3), noreturn));
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * filename: procfs.h
+ *
+ * Access to the proc filesystem. All plugins build their procfs paths
+ * with procfs_path(), so they can be pointed to another procfs root, e.g.
+ * a synthetic tree generated by tools/mkprocfs for benchmarks.
+ */
+
+#ifndef __procfs_h
+#define __procfs_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Default procfs root and the environment variable to override it. */
+#define PROCFS_DEFAULT_ROOT "/proc"
+#define PROCFS_ROOT_ENV     "PROCFS_ROOT"
+
+/*
+ * Environment variable overriding procfs_clock_ns(), set by procrec replay
+ * to the time a snapshot was recorded at.
+ */
+#define PROCFS_CLOCK_ENV    "PROCFS_CLOCK_NS"
+
+void        procfs_set_root(const char *root);
+const char *procfs_root(void);
+int64_t     procfs_clock_ns(void);
+int         procfs_path(char *buffer, size_t buffer_len, const char *format, ...)
+                __attribute__((format(printf, 3, 4)));
+long        procfs_read(const char *path, char *buffer, size_t buffer_len);
+long        procfs_read_file(const char *path, char **buffer, size_t *size);
+
+/*
+ * Fields of /proc/<pid>/stat, numbered as in proc(5). procfs_split_stat()
+ * returns them starting with PROCFS_STAT_STATE at index 0, so use
+ * fields[PROCFS_STAT_INDEX(PROCFS_STAT_UTIME)].
+ */
+#define PROCFS_STAT_STATE       3
+#define PROCFS_STAT_PPID        4
+#define PROCFS_STAT_UTIME       14
+#define PROCFS_STAT_STIME       15
+#define PROCFS_STAT_NUM_THREADS 20
+#define PROCFS_STAT_STARTTIME   22
+#define PROCFS_STAT_INDEX(n)    ((n) - PROCFS_STAT_STATE)
+
+int         procfs_split_stat(char *buffer, char **comm, char **fields,
+                int max_fields);
+
+/*
+ * One file of procfs_read_batch(). result is the number of bytes read or
+ * -errno.
+ */
+typedef struct procfs_read {
+    char       *path;
+    char       *buffer;
+    size_t      buffer_len;
+    long        result;
+} procfs_read_t;
+
+void        procfs_set_uring(int enabled);
+int         procfs_uring_active(void);
+void        procfs_read_batch(procfs_read_t *reads, int n);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * filename: procsnap.h
+ *
+ * Columnar snapshot of the processes below the procfs root. procsnap_open()
+ * lists the pids once, procsnap_load() reads the columns a check asks for,
+ * of all rows or only of selected ones, so a column nobody asks for is
+ * never read and a check can filter on a cheap column before it loads an
+ * expensive one for the matching rows only. Several checks of one process
+ * share a snapshot: columns loaded for one are not read again for another.
+ *
+ * Every column is an array indexed by row (struct of arrays), so filters
+ * and sorts run over contiguous memory. Strings live in an arena, which is
+ * freed with the snapshot.
+ */
+
+#ifndef __procsnap_h
+#define __procsnap_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Columns, or'ed together for procsnap_load(). */
+#define PROCSNAP_COMM       0x0001  /* comm, from comm or with the stat */
+#define PROCSNAP_STAT       0x0002  /* state, ppid, utime, stime,
+                                       num_threads and starttime of stat */
+#define PROCSNAP_STATUS     0x0004  /* uid, Threads and the Vm* sizes of
+                                       status */
+#define PROCSNAP_LIMITS     0x0008  /* soft and hard resource limits */
+#define PROCSNAP_FDS        0x0010  /* number of open files */
+#define PROCSNAP_EXE        0x0020  /* target of the exe link */
+#define PROCSNAP_CGROUP     0x0040  /* cgroup v2 path */
+#define PROCSNAP_SCHEDSTAT  0x0080  /* run and wait time, timeslices */
+
+/* Resource limits of PROCSNAP_LIMITS, indexes of limit_soft/limit_hard. */
+#define PROCSNAP_LIMIT_NOFILE   0   /* Max open files */
+#define PROCSNAP_LIMIT_NPROC    1   /* Max processes */
+#define PROCSNAP_LIMIT_MEMLOCK  2   /* Max locked memory, bytes */
+#define PROCSNAP_LIMIT_STACK    3   /* Max stack size, bytes */
+#define PROCSNAP_LIMIT_AS       4   /* Max address space, bytes */
+#define PROCSNAP_NLIMITS        5
+
+#define PROCSNAP_COMMLEN    16
+#define PROCSNAP_UNLIMITED  UINT64_MAX
+
+/*
+ * Structure to hold a snapshot. Only the columns loaded so far are
+ * allocated. Values a process didn't permit to read are -1 (uid, fds),
+ * 0 or NULL (strings). Processes without an exe, like kernel threads, have
+ * a NULL exe.
+ *
+ * Members:
+ *  - size_t    count:       number of rows
+ *  - long     *pids:        pid of every row, ascending
+ *  - uint8_t  *gone:        1 once a file showed the process is gone
+ *  - uint16_t *loaded:      columns loaded per row
+ *  - int       threads:     threads procsnap_load() uses (default 1); with
+ *                           1 the files are read with procfs_read_batch()
+ *  - long      reads:       files and links read, directories listed
+ *
+ * The columns:
+ *  - comm                                              PROCSNAP_COMM
+ *  - state, ppid, utime, stime, num_threads, starttime PROCSNAP_STAT
+ *  - uid, num_threads, rss_kb, swap_kb, vm_size_kb,    PROCSNAP_STATUS
+ *    vm_lck_kb, vm_stk_kb
+ *  - limit_soft, limit_hard (PROCSNAP_LIMIT_*)         PROCSNAP_LIMITS
+ *  - fds                                               PROCSNAP_FDS
+ *  - exe                                               PROCSNAP_EXE
+ *  - cgroup                                            PROCSNAP_CGROUP
+ *  - run_ns, wait_ns, slices                           PROCSNAP_SCHEDSTAT
+ */
+typedef struct procsnap {
+    size_t          count;
+    long           *pids;
+    uint8_t        *gone;
+    uint16_t       *loaded;
+    int             threads;
+    long            reads;
+
+    char          (*comm)[PROCSNAP_COMMLEN];
+
+    char           *state;
+    long           *ppid;
+    uint64_t       *utime,
+                   *stime,
+                   *starttime;
+    long           *num_threads;
+
+    long           *uid;
+    uint64_t       *rss_kb,
+                   *swap_kb,
+                   *vm_size_kb,
+                   *vm_lck_kb,
+                   *vm_stk_kb;
+
+    uint64_t      (*limit_soft)[PROCSNAP_NLIMITS],
+                  (*limit_hard)[PROCSNAP_NLIMITS];
+
+    long           *fds;
+
+    const char    **exe;
+
+    const char    **cgroup;
+
+    uint64_t       *run_ns,
+                   *wait_ns,
+                   *slices;
+
+    struct procsnap_block *arena;
+} procsnap_t;
+
+int     procsnap_open(procsnap_t *snap);
+int     procsnap_open_until(procsnap_t *snap, int (*stop)(void));
+int     procsnap_load(procsnap_t *snap, unsigned columns, const size_t *rows,
+            size_t n_rows);
+size_t  procsnap_match_comm(const procsnap_t *snap, const char *comm,
+            size_t *rows);
+void    procsnap_close(procsnap_t *snap);
+
+#endif
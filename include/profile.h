@@ -0,0 +1,65 @@
+/*
+ * filename: profile.h
+ *
+ * Lightweight hot path instrumentation. Plugins wrap their phases in
+ * PROFILE_BEGIN()/PROFILE_END() (or PROFILE_SCOPE()) and count their procfs
+ * accesses with PROFILE_COUNT(). If profiling was enabled at runtime with
+ * --profile, output_exit() adds the phase timings, the counters and
+ * getrusage() figures to the measurements by profile_output().
+ *
+ * Everything compiles to nothing unless configured with --enable-profile,
+ * which defines ENABLE_PROFILE.
+ */
+
+#ifndef __profile_h
+#define __profile_h
+
+/* Counters for PROFILE_COUNT(). */
+#define PROFILE_OPENS       0
+#define PROFILE_READS       1
+#define PROFILE_READLINKS   2
+#define PROFILE_DIRENTS     3
+#define PROFILE_PIDS        4
+#define PROFILE_NCOUNTERS   5
+
+#ifdef ENABLE_PROFILE
+
+int     profile_enable(void);
+int     profile_enabled(void);
+void    profile_begin(const char *phase);
+void    profile_end(const char *phase);
+void    profile_scope_end(const char **phase);
+void    profile_count(int counter, long n);
+void    profile_output(void);
+
+#define PROFILE_BEGIN(phase)        profile_begin(phase)
+#define PROFILE_END(phase)          profile_end(phase)
+#define PROFILE_COUNT(counter)      profile_count(counter, 1)
+#define PROFILE_ADD(counter, n)     profile_count(counter, n)
+
+/*
+ * Times the rest of the enclosing block as phase.
+ */
+#define PROFILE_SCOPE(phase) \
+    const char *profile_scope_ __attribute__((cleanup(profile_scope_end))) = \
+        (profile_begin(phase), phase)
+
+#else
+
+#define profile_enable()            (0)
+#define profile_enabled()           (0)
+
+#define PROFILE_BEGIN(phase)        do { } while(0)
+#define PROFILE_END(phase)          do { } while(0)
+#define PROFILE_COUNT(counter)      do { } while(0)
+#define PROFILE_ADD(counter, n)     do { } while(0)
+#define PROFILE_SCOPE(phase)        do { } while(0)
+
+#define profile_output()            do { } while(0)
+
+#endif
+
+/* Error message for plugins if --profile is given without support. */
+#define ENOPROFILE  "profiling support not compiled in, see --enable-profile"
+
+#endif
@@ -0,0 +1,28 @@
+/*
+ * filename: tokenize.h
+ *
+ * Splits whitespace separated unsigned integers, like the counters of a
+ * /proc/stat line, /proc/interrupts or /proc/<pid>/stat, into an array.
+ * Besides the scalar baseline there are SSE4.2 and AVX2 kernels, the best
+ * one the cpu supports is selected at the first call.
+ *
+ * Numbers are separated by blanks (spaces and tabs). Tokenizing stops at
+ * the first character which is neither a digit nor a blank, e.g. a newline
+ * or the name of an interrupt, after max numbers or at the end of the
+ * input. Numbers above UINT64_MAX wrap. A '-' right before a number negates
+ * it like strtoull() does, so signed fields like the tpgid of
+ * /proc/<pid>/stat can be read as int64_t.
+ */
+
+#ifndef __tokenize_h
+#define __tokenize_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+size_t      tokenize_u64(const char *s, size_t len, uint64_t *values,
+                size_t max, size_t *used);
+const char *tokenize_kernel(void);
+int         tokenize_set_kernel(const char *name);
+
+#endif
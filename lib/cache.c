@@ -0,0 +1,384 @@
+/*
+ * filename: cache.c
+ *
+ * Result cache shared by all invocations of a plugin, see cache.h.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+
+/* Longest key (plugin and arguments) which is cached. */
+#define CACHE_MAXKEY    4096
+
+#define CACHE_MAGIC     0x32686361      /* "ach2" */
+
+/* How often a reader yields to a writer before it gives up. */
+#define CACHE_MAXSPINS  1000
+
+/*
+ * How long a miss waits for a concurrent invocation (in steps of
+ * CACHE_LOCKSTEP milliseconds) before it runs uncached.
+ */
+#define CACHE_LOCKWAIT  5000
+#define CACHE_LOCKSTEP  10
+
+/* Entries which weren't written for that many seconds are removed. */
+#define CACHE_MAXAGE    86400
+
+/*
+ * Structure of a cache segment.
+ *
+ * Members:
+ *  - uint32_t magic:    CACHE_MAGIC once the segment was written
+ *  - uint32_t sequence: seqlock, odd while a writer is updating the entry
+ *  - int64_t  taken:    CLOCK_MONOTONIC nanoseconds of the result
+ *  - int32_t  rc:       exit code of the plugin
+ *  - uint32_t key_len:  length of key, to tell hash collisions apart
+ *  - uint32_t len:      length of output
+ *  - uint32_t text_len: length of text, 0 without --textfile
+ *  - char     key[]:    plugin and arguments, separated by '\0'
+ *  - char     output[]: what the plugin printed
+ *  - char     text[]:   what the plugin wrote to its --textfile
+ */
+typedef struct cache_entry {
+    uint32_t    magic;
+    uint32_t    sequence;
+    int64_t     taken;
+    int32_t     rc;
+    uint32_t    key_len;
+    uint32_t    len;
+    uint32_t    text_len;
+    char        key[CACHE_MAXKEY];
+    char        output[CACHE_MAXOUTPUT];
+    char        text[CACHE_MAXOUTPUT];
+} cache_entry_t;
+
+/* The segment of this invocation, NULL if the cache is not in use. */
+static cache_entry_t   *cache_entry = NULL;
+static int              cache_fd = -1;
+static char             cache_key[CACHE_MAXKEY];
+static size_t           cache_key_len = 0;
+
+/*
+ * now_ns:
+ */
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * cache_read:
+ *
+ * Description:
+ *  Copies the entry out of the segment, retrying while a writer updates it.
+ *
+ * Return Value:
+ *  1 if the entry holds a result for our key which is younger than ttl
+ *  nanoseconds, 0 otherwise.
+ */
+static int cache_read(int64_t ttl, int *rc, char *output, size_t *len,
+        char *text, size_t *text_len)
+{
+    uint32_t    sequence;
+    int         spins = 0;
+
+    do
+    {
+        /*
+         * A writer killed while updating leaves the sequence odd, so give
+         * up after a while. The next writer repairs it.
+         */
+        while((sequence = __atomic_load_n(&cache_entry->sequence,
+                        __ATOMIC_ACQUIRE)) & 1)
+        {
+            if(++spins > CACHE_MAXSPINS)
+                return 0;
+            sched_yield();
+        }
+
+        if(cache_entry->magic != CACHE_MAGIC ||
+                cache_entry->key_len != cache_key_len ||
+                0 != memcmp(cache_entry->key, cache_key, cache_key_len) ||
+                now_ns() - cache_entry->taken > ttl ||
+                cache_entry->len > CACHE_MAXOUTPUT ||
+                cache_entry->text_len > CACHE_MAXOUTPUT)
+            *len = 0;
+        else
+        {
+            *rc = cache_entry->rc;
+            *len = cache_entry->len;
+            memcpy(output, cache_entry->output, *len);
+            *text_len = cache_entry->text_len;
+            memcpy(text, cache_entry->text, *text_len);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    while(sequence != __atomic_load_n(&cache_entry->sequence,
+                __ATOMIC_RELAXED));
+
+    return *len > 0;
+}
+
+/*
+ * cache_release:
+ *
+ * gives up the segment, the plugin runs uncached
+ */
+static void cache_release(void)
+{
+    munmap(cache_entry, sizeof(cache_entry_t));
+    close(cache_fd);
+    cache_entry = NULL;
+    cache_fd = -1;
+}
+
+/*
+ * cache_sweep:
+ *
+ * removes the entries of this user which weren't written for CACHE_MAXAGE
+ * seconds, e.g. of arguments which are no longer used. Entries locked by a
+ * running invocation are kept.
+ */
+static void cache_sweep(void)
+{
+    DIR            *dir;
+    struct dirent  *entry;
+    struct stat     t_stat;
+    char            prefix[64];
+    size_t          prefix_len;
+    time_t          now = time(NULL);
+    int             fd;
+
+    prefix_len = snprintf(prefix, sizeof(prefix), "%s.%u.", MULTICALL_NAME,
+            (unsigned) getuid());
+
+    if(!(dir = opendir(CACHE_DIR)))
+        return;
+
+    while((entry = readdir(dir)))
+    {
+        if(0 != strncmp(entry->d_name, prefix, prefix_len) ||
+                strlen(entry->d_name + prefix_len) != 16)
+            continue;
+
+        fd = openat(dirfd(dir), entry->d_name,
+                O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NONBLOCK);
+        if(fd < 0)
+            continue;
+
+        if(0 == fstat(fd, &t_stat) && S_ISREG(t_stat.st_mode) &&
+                t_stat.st_uid == getuid() &&
+                now - t_stat.st_mtime > CACHE_MAXAGE &&
+                0 == flock(fd, LOCK_EX | LOCK_NB))
+            unlinkat(dirfd(dir), entry->d_name, 0);
+
+        close(fd);
+    }
+
+    closedir(dir);
+}
+
+/*
+ * cache_init:
+ *
+ * Description:
+ *  Looks up the result of a former invocation with the same arguments. If
+ *  it is younger than ttl, it is printed, the textfile is written from it
+ *  and the plugin exits. Otherwise this invocation gets the lock of the
+ *  entry, so concurrent invocations wait for its result, and output_exit()
+ *  will store it.
+ *
+ *  The cache is best effort: if the segment can't be used or the lock isn't
+ *  released within CACHE_LOCKWAIT milliseconds, the plugin just runs
+ *  uncached. Creating a new entry sweeps the stale ones.
+ *
+ * Arguments:
+ *  - const char *plugin: name of the plugin
+ *  - int         argc:   arguments of the plugin, which are part of the key
+ *                        like the plugin and procfs_root()
+ *  - char       *argv[]
+ *  - double      ttl:    maximal age of a result in seconds
+ */
+void cache_init(const char *plugin, int argc, char *argv[], double ttl)
+{
+    static char     output[CACHE_MAXOUTPUT],
+                    text[CACHE_MAXOUTPUT];
+    struct timespec step = { 0, CACHE_LOCKSTEP * 1000000L };
+    struct stat     t_stat;
+    char            path[CACHE_MAXKEY];
+    uint64_t        hash = 14695981039346656037ULL;
+    size_t          len,
+                    text_len,
+                    i;
+    int64_t         ttl_ns = ttl * 1e9;
+    int             fd,
+                    rc,
+                    waited,
+                    n;
+
+    /*
+     * The key is the plugin, the procfs root (which may come from the
+     * environment) and all arguments, separated by '\0'.
+     */
+    for(n = -1; n < argc; n++)
+    {
+        const char *part = n < 0 ? plugin : n == 0 ? procfs_root() : argv[n];
+
+        len = strlen(part) + 1;
+        if(cache_key_len + len > sizeof(cache_key))
+            return;
+        memcpy(cache_key + cache_key_len, part, len);
+        cache_key_len += len;
+    }
+    for(i = 0; i < cache_key_len; i++)
+        hash = (hash ^ (unsigned char) cache_key[i]) * 1099511628211ULL;
+
+    /* Entries are per user, nobody else may feed us results. */
+    snprintf(path, sizeof(path), "%s/%s.%u.%016llx", CACHE_DIR, MULTICALL_NAME,
+            (unsigned) getuid(), (unsigned long long) hash);
+
+    fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if(fd < 0)
+        return;
+
+    if(0 != fstat(fd, &t_stat) || t_stat.st_uid != getuid() ||
+            (t_stat.st_mode & 077) ||
+            (t_stat.st_size < (off_t) sizeof(cache_entry_t) &&
+             0 != ftruncate(fd, sizeof(cache_entry_t))))
+    {
+        close(fd);
+        return;
+    }
+
+    if(t_stat.st_size == 0)
+        cache_sweep();
+
+    cache_entry = mmap(NULL, sizeof(cache_entry_t), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    if(cache_entry == MAP_FAILED)
+    {
+        cache_entry = NULL;
+        close(fd);
+        return;
+    }
+    cache_fd = fd;
+
+    if(cache_read(ttl_ns, &rc, output, &len, text, &text_len))
+        goto hit;
+
+    /*
+     * Miss: wait for a concurrent invocation, which may deliver the result.
+     * The lock is held until we exit, the fd is closed by then. A hung
+     * invocation holding the lock must not hang all others, so we poll.
+     */
+    for(waited = 0; 0 != flock(fd, LOCK_EX | LOCK_NB); waited += CACHE_LOCKSTEP)
+    {
+        if((errno != EWOULDBLOCK && errno != EINTR) ||
+                waited >= CACHE_LOCKWAIT)
+        {
+            cache_release();
+            return;
+        }
+        nanosleep(&step, NULL);
+
+        if(cache_read(ttl_ns, &rc, output, &len, text, &text_len))
+            goto hit;
+    }
+
+    if(cache_read(ttl_ns, &rc, output, &len, text, &text_len))
+        goto hit;
+
+    return;
+
+hit:
+    /* Without its textfile the result is of no use, so run the check. */
+    if(output_cached_textfile(text, text_len) != 0)
+    {
+        if(0 != flock(fd, LOCK_EX | LOCK_NB))
+            cache_release();
+        return;
+    }
+
+    fwrite(output, 1, len, stdout);
+    exit(rc);
+}
+
+/*
+ * cache_active:
+ *
+ * Description:
+ *  Returns 1 if the result of this invocation will be cached.
+ */
+int cache_active(void)
+{
+    return cache_entry != NULL;
+}
+
+/*
+ * cache_store:
+ *
+ * Description:
+ *  Stores the output, the textfile and the exit code of this invocation.
+ *  UNKNOWN results and outputs larger than CACHE_MAXOUTPUT are not cached,
+ *  so a failure is retried by the next invocation.
+ *
+ * Arguments:
+ *  - int         rc:       exit code
+ *  - const char *output:   what the plugin prints
+ *  - size_t      len
+ *  - const char *text:     what the plugin wrote to its textfile, NULL
+ *                          without one
+ *  - size_t      text_len
+ */
+void cache_store(int rc, const char *output, size_t len, const char *text,
+        size_t text_len)
+{
+    uint32_t    sequence;
+
+    if(!cache_entry || rc == UNKNOWN || len > CACHE_MAXOUTPUT ||
+            text_len > CACHE_MAXOUTPUT)
+        return;
+
+    /* We hold the flock(), so we are the only writer. */
+    sequence = cache_entry->sequence & ~1U;
+    __atomic_store_n(&cache_entry->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    cache_entry->magic = CACHE_MAGIC;
+    cache_entry->taken = now_ns();
+    cache_entry->rc = rc;
+    cache_entry->key_len = cache_key_len;
+    memcpy(cache_entry->key, cache_key, cache_key_len);
+    cache_entry->len = len;
+    memcpy(cache_entry->output, output, len);
+    cache_entry->text_len = text ? text_len : 0;
+    if(text)
+        memcpy(cache_entry->text, text, text_len);
+
+    __atomic_store_n(&cache_entry->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    /* Writes through the mapping don't reliably update the mtime. */
+    futimens(cache_fd, NULL);
+}
@@ -0,0 +1,44 @@
+/*
+ * filename: icinga.c
+ *
+ * Code shared by all plugins of this project. It is linked into every
+ * plugin as well as into the multi-call binary, so it exists only once in
+ * the latter.
+ */
+
+#include <string.h>
+
+#include "../include/icinga.h"
+
+/* Maximal length of an option we compare against. */
+#define MAXOPTLEN   512
+
+const char  state[4][9] = {
+                "OK",
+                "WARNING",
+                "CRITICAL",
+                "UNKNOWN"};
+
+/*
+ * check_option:
+ *
+ * Description:
+ * Checks a given option against short and long options.
+ *
+ * Arguments:
+ *  - const char *s_option:     the option read from we check against
+ *  - const char *s_short_opt:  the short option, e.g. "-h"
+ *  - const char *s_long_opt:  the long option, e.g. "--help"
+ *
+ * Return Values:
+ *  - 1 if either short or long option match the given option
+ *  - 0 otherwise
+ */
+int check_option(const char *s_option, const char *s_short_opt, const char *s_long_opt)
+{
+    if(0 == strncmp(s_option, s_short_opt, MAXOPTLEN) ||
+       0 == strncmp(s_option, s_long_opt, MAXOPTLEN))
+        return 1;
+
+    return 0;
+}
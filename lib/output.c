@@ -0,0 +1,634 @@
+/*
+ * filename: output.c
+ *
+ * Output layer shared by all plugins, see output.h.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/profile.h"
+
+#define MAXMSG      4096
+#define MAXNAME     256
+
+/*
+ * Structure to hold one measurement.
+ *
+ * Members:
+ *  - char  *name:        name of the measurement, e.g. "memavailable"
+ *  - char  *family:      OpenMetrics name, e.g. "check_meminfo_memavailable_bytes"
+ *  - char  *label:       optional label name, e.g. "device"
+ *  - char  *label_value: value of the label, e.g. "sda"
+ *  - const char *uom:    unit of measurement in nagios notation ("B", "KB",
+ *                        "%", "s", "ms", "us", "c" or "")
+ *  - double value, warn, crit, min, max: OUTPUT_UNSET if unknown
+ */
+typedef struct metric {
+    char           *name;
+    char           *family;
+    char           *label;
+    char           *label_value;
+    const char     *uom;
+    double          value;
+    double          warn;
+    double          crit;
+    double          min;
+    double          max;
+} metric_t;
+
+/*
+ * Structure to map a nagios unit to OpenMetrics.
+ *
+ * Members:
+ *  - const char *uom:    nagios unit of measurement
+ *  - const char *suffix: OpenMetrics unit suffix of the metric name
+ *  - const char *type:   OpenMetrics metric type
+ *  - double      scale:  factor to convert the value to the base unit
+ */
+typedef struct unit {
+    const char     *uom;
+    const char     *suffix;
+    const char     *type;
+    double          scale;
+} unit_t;
+
+static const unit_t units[] = {
+    { "B",  "_bytes",   "gauge",    1.0 },
+    { "KB", "_bytes",   "gauge",    1024.0 },
+    { "MB", "_bytes",   "gauge",    1024.0 * 1024 },
+    { "GB", "_bytes",   "gauge",    1024.0 * 1024 * 1024 },
+    { "TB", "_bytes",   "gauge",    1024.0 * 1024 * 1024 * 1024 },
+    { "%",  "_ratio",   "gauge",    0.01 },
+    { "s",  "_seconds", "gauge",    1.0 },
+    { "ms", "_seconds", "gauge",    1e-3 },
+    { "us", "_seconds", "gauge",    1e-6 },
+    { "c",  "_total",   "counter",  1.0 },
+    { "",   "",         "gauge",    1.0 }
+};
+
+static const char  *plugin_name = "plugin";
+static int          format = OUTPUT_NAGIOS;
+static const char  *textfile = NULL;
+static metric_t    *metrics = NULL;
+static int          n_metrics = 0;
+static int          max_metrics = 0;
+
+/*
+ * find_unit:
+ *
+ * returns the unit mapping of uom, the unitless mapping for unknown units
+ */
+static const unit_t *find_unit(const char *uom)
+{
+    const unit_t   *unit;
+
+    if(!uom)
+        uom = "";
+
+    for(unit = units; unit->uom[0]; unit++)
+        if(0 == strcmp(unit->uom, uom))
+            return unit;
+
+    return unit;
+}
+
+/*
+ * format_number:
+ *
+ * writes value to buffer without superfluous digits, or nothing if the value
+ * is unset
+ */
+static const char *format_number(char *buffer, size_t buffer_len, double value)
+{
+    char   *end;
+
+    if(isnan(value))
+    {
+        buffer[0] = '\0';
+        return buffer;
+    }
+
+    if(isinf(value))
+    {
+        snprintf(buffer, buffer_len, "%s", value > 0 ? "+Inf" : "-Inf");
+        return buffer;
+    }
+
+    if(value == (long long) value && fabs(value) < 1e15)
+    {
+        snprintf(buffer, buffer_len, "%lld", (long long) value);
+        return buffer;
+    }
+
+    snprintf(buffer, buffer_len, "%.6f", value);
+
+    /* Strip trailing zeros of the fraction. */
+    end = buffer + strlen(buffer) - 1;
+    while(end > buffer && *end == '0')
+        *end-- = '\0';
+    if(*end == '.')
+        *end = '\0';
+
+    return buffer;
+}
+
+/*
+ * metric_name:
+ *
+ * builds the OpenMetrics name <plugin>_<name><unit suffix> of a metric,
+ * replacing all characters not allowed in metric names by '_'
+ */
+static void metric_name(char *buffer, size_t buffer_len, const metric_t *metric)
+{
+    char   *c;
+
+    if(buffer_len == 0)
+        return;
+
+    snprintf(buffer, buffer_len, "%s_%s%s", plugin_name, metric->name,
+            find_unit(metric->uom)->suffix);
+
+    for(c = buffer; *c; c++)
+        if(!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+                    (*c >= '0' && *c <= '9') || *c == '_' || *c == ':'))
+            *c = '_';
+}
+
+/*
+ * cmp_family:
+ *
+ * qsort() callback to order metric indices by family and index
+ */
+static int cmp_family(const void *a, const void *b)
+{
+    int     ia = *(const int *) a,
+            ib = *(const int *) b,
+            cmp;
+
+    cmp = strcmp(metrics[ia].family, metrics[ib].family);
+
+    return cmp ? cmp : ia - ib;
+}
+
+/*
+ * print_json_escaped:
+ *
+ * prints s to stream as the contents of a JSON string
+ */
+static void print_json_escaped(FILE *stream, const char *s)
+{
+    for(; *s; s++)
+    {
+        if(*s == '"' || *s == '\\')
+            fprintf(stream, "\\%c", *s);
+        else if(*s == '\n')
+            fputs("\\n", stream);
+        else if((unsigned char) *s < 0x20)
+            fprintf(stream, "\\u%04x", *s);
+        else
+            fputc(*s, stream);
+    }
+}
+
+/*
+ * print_label_escaped:
+ *
+ * prints s to stream as an OpenMetrics label value, which only knows the
+ * escapes \\, \" and \n, all other characters are written as they are
+ */
+static void print_label_escaped(FILE *stream, const char *s)
+{
+    for(; *s; s++)
+    {
+        if(*s == '"' || *s == '\\')
+            fprintf(stream, "\\%c", *s);
+        else if(*s == '\n')
+            fputs("\\n", stream);
+        else
+            fputc(*s, stream);
+    }
+}
+
+/*
+ * print_quoted:
+ *
+ * prints a perfdata label in single quotes, with every quote in it doubled
+ * as the plugin guidelines require
+ */
+static void print_quoted(FILE *stream, const char *label_value,
+        const char *name)
+{
+    const char  *s;
+
+    fputc('\'', stream);
+    for(s = label_value; *s; s++)
+    {
+        if(*s == '\'')
+            fputc('\'', stream);
+        fputc(*s, stream);
+    }
+    fprintf(stream, "_%s'", name);
+}
+
+/*
+ * print_nagios:
+ *
+ * prints the status line and the perfdata in nagios plugin format
+ */
+static void print_nagios(FILE *stream, int rc, const char *message)
+{
+    char    value[64],
+            warn[64],
+            crit[64],
+            min[64],
+            max[64];
+    int     i;
+
+    fprintf(stream, "%s - %s", state[rc], message);
+
+    for(i = 0; i < n_metrics; i++)
+    {
+        const metric_t *m = &metrics[i];
+
+        fputs(i ? " " : " |", stream);
+
+        if(m->label)
+            print_quoted(stream, m->label_value, m->name);
+        else
+            fprintf(stream, "%s", m->name);
+
+        /* An unknown value is U, without a unit. */
+        fprintf(stream, "=%s%s;%s;%s;%s;%s",
+                isnan(m->value) ? "U" :
+                format_number(value, sizeof(value), m->value),
+                isnan(m->value) ? "" : m->uom,
+                format_number(warn, sizeof(warn), m->warn),
+                format_number(crit, sizeof(crit), m->crit),
+                format_number(min, sizeof(min), m->min),
+                format_number(max, sizeof(max), m->max));
+    }
+
+    fputc('\n', stream);
+}
+
+/*
+ * print_json:
+ *
+ * prints the status, message and all metrics as one JSON object
+ */
+static void print_json(FILE *stream, int rc, const char *message)
+{
+    char    number[64];
+    int     i;
+
+    fprintf(stream, "{\"plugin\":\"");
+    print_json_escaped(stream, plugin_name);
+    fprintf(stream, "\",\"status\":\"%s\",\"rc\":%d,\"message\":\"",
+            state[rc], rc);
+    print_json_escaped(stream, message);
+    fprintf(stream, "\",\"metrics\":[");
+
+    for(i = 0; i < n_metrics; i++)
+    {
+        const metric_t *m = &metrics[i];
+
+        fprintf(stream, "%s{\"name\":\"", i ? "," : "");
+        print_json_escaped(stream, m->name);
+        fprintf(stream, "\"");
+        if(m->label)
+        {
+            fprintf(stream, ",\"labels\":{\"");
+            print_json_escaped(stream, m->label);
+            fprintf(stream, "\":\"");
+            print_json_escaped(stream, m->label_value);
+            fprintf(stream, "\"}");
+        }
+        fprintf(stream, ",\"uom\":\"%s\"", m->uom);
+
+#define JSON_NUMBER(key, v) \
+        fprintf(stream, ",\"" key "\":%s", \
+                (isnan(v) || isinf(v)) ? "null" : \
+                format_number(number, sizeof(number), v))
+
+        JSON_NUMBER("value", m->value);
+        JSON_NUMBER("warn", m->warn);
+        JSON_NUMBER("crit", m->crit);
+        JSON_NUMBER("min", m->min);
+        JSON_NUMBER("max", m->max);
+
+#undef JSON_NUMBER
+
+        fputc('}', stream);
+    }
+
+    fprintf(stream, "]}\n");
+}
+
+/*
+ * print_openmetrics:
+ *
+ * prints all metrics in OpenMetrics text format, grouped by metric family,
+ * followed by the plugin status
+ */
+static void print_openmetrics(FILE *stream, int rc)
+{
+    char    number[64];
+    int    *order = NULL,
+            i;
+
+    /*
+     * All samples of a metric family have to be printed together, so print
+     * them sorted by family, in the order they were added otherwise.
+     */
+    if(n_metrics && !(order = malloc(n_metrics * sizeof(int))))
+        n_metrics = 0;
+    for(i = 0; i < n_metrics; i++)
+        order[i] = i;
+    if(n_metrics)
+        qsort(order, n_metrics, sizeof(int), cmp_family);
+
+    for(i = 0; i < n_metrics; i++)
+    {
+        const metric_t *m = &metrics[order[i]];
+        const unit_t   *unit = find_unit(m->uom);
+
+        if(i == 0 || 0 != strcmp(m->family, metrics[order[i - 1]].family))
+        {
+            /* Counters are announced without their _total suffix. */
+            if(0 == strcmp(unit->type, "counter"))
+                fprintf(stream, "# TYPE %.*s %s\n",
+                        (int) (strlen(m->family) - strlen(unit->suffix)),
+                        m->family, unit->type);
+            else
+                fprintf(stream, "# TYPE %s %s\n", m->family, unit->type);
+        }
+
+        if(isnan(m->value))
+            continue;
+
+        fputs(m->family, stream);
+        if(m->label)
+        {
+            fprintf(stream, "{%s=\"", m->label);
+            print_label_escaped(stream, m->label_value);
+            fputs("\"}", stream);
+        }
+        fprintf(stream, " %s\n", format_number(number, sizeof(number),
+                    m->value * unit->scale));
+    }
+
+    if(n_metrics)
+        free(order);
+
+    fprintf(stream, "# TYPE %s_status gauge\n", plugin_name);
+    fprintf(stream, "%s_status %d\n", plugin_name, rc);
+    fprintf(stream, "# EOF\n");
+}
+
+/*
+ * write_textfile:
+ *
+ * writes text to a temporary file next to textfile and renames it into place
+ */
+static int write_textfile(const char *text, size_t len)
+{
+    char    tmp_path[MAXMSG];
+    FILE   *file;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", textfile,
+            (long) getpid());
+
+    if(!(file = fopen(tmp_path, "w")))
+        return -1;
+
+    if(fwrite(text, 1, len, file) != len || fflush(file) != 0 ||
+            fsync(fileno(file)) != 0)
+    {
+        fclose(file);
+        unlink(tmp_path);
+        return -1;
+    }
+    fclose(file);
+
+    if(rename(tmp_path, textfile) != 0)
+    {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * output_init:
+ *
+ * Description:
+ *  Sets the plugin name, which prefixes all OpenMetrics names.
+ */
+void output_init(const char *plugin)
+{
+    plugin_name = plugin;
+}
+
+/*
+ * output_set_format:
+ *
+ * Description:
+ *  Selects the output format by name, e.g. from --format.
+ *
+ * Return Value:
+ *  - 0 on success
+ *  - -1 if the format is unknown
+ */
+int output_set_format(const char *name)
+{
+    if(0 == strcmp(name, "nagios"))
+        format = OUTPUT_NAGIOS;
+    else if(0 == strcmp(name, "json"))
+        format = OUTPUT_JSON;
+    else if(0 == strcmp(name, "openmetrics"))
+        format = OUTPUT_OPENMETRICS;
+    else
+        return -1;
+
+    return 0;
+}
+
+int output_format(void)
+{
+    return format;
+}
+
+/*
+ * output_set_textfile:
+ *
+ * Description:
+ *  Additionally write the metrics to path in OpenMetrics format, e.g. for
+ *  the node_exporter textfile collector.
+ */
+void output_set_textfile(const char *path)
+{
+    textfile = path;
+}
+
+/*
+ * output_cached_textfile:
+ *
+ * Description:
+ *  Writes the textfile of a cached result, see cache_init().
+ *
+ * Arguments:
+ *  - const char *text: OpenMetrics rendering stored with the result
+ *  - size_t      len:  its length, 0 if the result has none
+ *
+ * Return Value:
+ *  0 on success or if no textfile was requested, -1 if the textfile can't be
+ *  written from the cache and the plugin has to run.
+ */
+int output_cached_textfile(const char *text, size_t len)
+{
+    if(!textfile)
+        return 0;
+
+    if(len == 0)
+        return -1;
+
+    return write_textfile(text, len);
+}
+
+/*
+ * output_add_labeled:
+ *
+ * Description:
+ *  Adds a measurement of an object like a device or a process, identified
+ *  by label=label_value. In nagios perfdata the label value prefixes the
+ *  name. Thresholds and ranges which don't apply are OUTPUT_UNSET.
+ */
+void output_add_labeled(const char *label, const char *label_value,
+        const char *name, const char *uom, double value,
+        double warn, double crit, double min, double max)
+{
+    metric_t   *m;
+    char        family[MAXNAME];
+
+    if(n_metrics >= max_metrics)
+    {
+        max_metrics = max_metrics ? 2 * max_metrics : 32;
+        if(!(metrics = realloc(metrics, max_metrics * sizeof(metric_t))))
+            output_exit(UNKNOWN, "out of memory");
+    }
+
+    m = &metrics[n_metrics++];
+    m->name = strdup(name);
+    m->label = label ? strdup(label) : NULL;
+    m->label_value = label ? strdup(label_value) : NULL;
+    m->uom = find_unit(uom)->uom;
+    m->value = value;
+    m->warn = warn;
+    m->crit = crit;
+    m->min = min;
+    m->max = max;
+
+    metric_name(family, sizeof(family), m);
+    m->family = strdup(family);
+}
+
+/*
+ * output_add:
+ *
+ * Description:
+ *  Adds a measurement, see output_add_labeled().
+ */
+void output_add(const char *name, const char *uom, double value,
+        double warn, double crit, double min, double max)
+{
+    output_add_labeled(NULL, NULL, name, uom, value, warn, crit, min, max);
+}
+
+/*
+ * print_output:
+ *
+ * Description:
+ *  Prints the status and all measurements in the selected format.
+ */
+static void print_output(FILE *stream, int rc, const char *message)
+{
+    switch(format)
+    {
+        case OUTPUT_JSON:
+            print_json(stream, rc, message);
+            break;
+        case OUTPUT_OPENMETRICS:
+            print_openmetrics(stream, rc);
+            break;
+        default:
+            print_nagios(stream, rc, message);
+            break;
+    }
+}
+
+/*
+ * output_exit:
+ *
+ * Description:
+ *  Prints the status message and all measurements in the selected format,
+ *  writes the textfile if requested, and exits with return code rc. If the
+ *  textfile can't be written, the plugin exits with UNKNOWN.
+ */
+void output_exit(int rc, const char *fmt, ...)
+{
+    char        message[MAXMSG],
+               *buffer = NULL,
+               *text = NULL;
+    size_t      len = 0,
+                text_len = 0;
+    FILE       *stream;
+    va_list     ap;
+
+    va_start(ap, fmt);
+    vsnprintf(message, sizeof(message), fmt, ap);
+    va_end(ap);
+
+    if(rc < OK || rc > UNKNOWN)
+        rc = UNKNOWN;
+
+    profile_output();
+
+    /* The textfile is rendered into memory, so the cache can keep it. */
+    if(textfile && (stream = open_memstream(&text, &text_len)))
+    {
+        print_openmetrics(stream, rc);
+        fclose(stream);
+    }
+
+    if(textfile && (!text || write_textfile(text, text_len) != 0))
+    {
+        const char  *error = strerror(errno);
+        size_t       used = strlen(message);
+
+        snprintf(message + used, sizeof(message) - used,
+                " (could not write %s: %s)", textfile, error);
+        rc = UNKNOWN;
+    }
+
+    /* Render into memory first if the result goes to the cache, too. */
+    if(cache_active() && (stream = open_memstream(&buffer, &len)))
+    {
+        print_output(stream, rc, message);
+        fclose(stream);
+        cache_store(rc, buffer, len, text, text_len);
+        fwrite(buffer, 1, len, stdout);
+    }
+    else
+        print_output(stdout, rc, message);
+
+    exit(rc);
+}
@@ -0,0 +1,247 @@
+/*
+ * filename: procfs.c
+ *
+ * Access to the proc filesystem, see procfs.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/procfs.h"
+
+/* The procfs root in use, NULL until it was set or looked up. */
+static const char  *procfs_root_dir = NULL;
+
+/*
+ * procfs_set_root:
+ *
+ * Description:
+ *  Sets the procfs root, e.g. from a --procfs-root argument. This takes
+ *  precedence over PROCFS_ROOT_ENV.
+ *
+ * Arguments:
+ *  - const char *root: the new root, must stay valid while in use
+ */
+void procfs_set_root(const char *root)
+{
+    procfs_root_dir = root;
+}
+
+/*
+ * procfs_root:
+ *
+ * Description:
+ *  Returns the procfs root. If it was not set by procfs_set_root(), it is
+ *  taken from PROCFS_ROOT_ENV or falls back to PROCFS_DEFAULT_ROOT.
+ */
+const char *procfs_root(void)
+{
+    if(NULL == procfs_root_dir)
+        procfs_root_dir = getenv(PROCFS_ROOT_ENV);
+
+    if(NULL == procfs_root_dir || '\0' == *procfs_root_dir)
+        procfs_root_dir = PROCFS_DEFAULT_ROOT;
+
+    return procfs_root_dir;
+}
+
+/*
+ * procfs_clock_ns:
+ *
+ * Description:
+ *  Returns the time of a sample of the procfs root in CLOCK_BOOTTIME
+ *  nanoseconds, which plugins keep in their state files to compute rates.
+ *  Unlike CLOCK_MONOTONIC it goes on during suspend, like the time based
+ *  counters of e.g. diskstats.
+ *  PROCFS_CLOCK_ENV overrides it, so the rates of a recorded procfs root
+ *  follow the recorded intervals, not the time the plugin runs at.
+ */
+int64_t procfs_clock_ns(void)
+{
+    struct timespec  ts;
+    const char      *clock = getenv(PROCFS_CLOCK_ENV);
+
+    if(clock && *clock)
+        return strtoll(clock, NULL, 10);
+
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * procfs_path:
+ *
+ * Description:
+ *  Builds the full path of a file below the procfs root. The format and the
+ *  following arguments describe the path relative to the root, e.g.
+ *  procfs_path(buf, sizeof(buf), "%ld/limits", pid).
+ *
+ * Return Value:
+ *  The return value of snprintf(), so a value >= buffer_len means the path
+ *  was truncated.
+ */
+int procfs_path(char *buffer, size_t buffer_len, const char *format, ...)
+{
+    va_list     ap;
+    int         len;
+
+    len = snprintf(buffer, buffer_len, "%s/", procfs_root());
+    if(len < 0 || (size_t) len >= buffer_len)
+        return len;
+
+    va_start(ap, format);
+    len += vsnprintf(buffer + len, buffer_len - len, format, ap);
+    va_end(ap);
+
+    return len;
+}
+
+/*
+ * procfs_read:
+ *
+ * Description:
+ *  Reads a (small) procfs file with a single read(2), without the overhead
+ *  of stdio. The content is NUL terminated, so at most buffer_len - 1 bytes
+ *  are read.
+ *
+ * Return Value:
+ *  The number of bytes read or -1 with errno set.
+ */
+long procfs_read(const char *path, char *buffer, size_t buffer_len)
+{
+    ssize_t     len;
+    int         fd,
+                saved_errno;
+
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    do
+        len = read(fd, buffer, buffer_len - 1);
+    while(len < 0 && errno == EINTR);
+
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    if(len < 0)
+        return -1;
+
+    buffer[len] = '\0';
+
+    return len;
+}
+
+/*
+ * procfs_read_file:
+ *
+ * Description:
+ *  Reads a procfs file of any size, e.g. diskstats on hosts with hundreds of
+ *  devices. The buffer is grown with realloc() as needed and can be reused
+ *  by further calls; the content is NUL terminated.
+ *
+ * Arguments:
+ *  - const char  *path:   path of the file
+ *  - char       **buffer: buffer, may point to NULL initially
+ *  - size_t      *size:   size of the buffer
+ *
+ * Return Value:
+ *  The number of bytes read or -1 with errno set.
+ */
+long procfs_read_file(const char *path, char **buffer, size_t *size)
+{
+    ssize_t     n = 0;
+    size_t      len = 0;
+    char       *grown;
+    int         fd,
+                saved_errno;
+
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    for(;;)
+    {
+        if(len + 1 >= *size)
+        {
+            if(!(grown = realloc(*buffer, *size ? *size * 2 : 65536)))
+            {
+                errno = ENOMEM;
+                n = -1;
+                break;
+            }
+            *buffer = grown;
+            *size = *size ? *size * 2 : 65536;
+        }
+
+        n = read(fd, *buffer + len, *size - len - 1);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        len += n;
+    }
+
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    if(n < 0 || !*buffer)
+        return -1;
+
+    (*buffer)[len] = '\0';
+
+    return len;
+}
+
+/*
+ * procfs_split_stat:
+ *
+ * Description:
+ *  Splits the content of a /proc/<pid>/stat file in place. The comm field
+ *  is enclosed in parentheses and may itself contain spaces and
+ *  parentheses, so it ends at the last ')'. The remaining fields are
+ *  separated by single spaces.
+ *
+ * Arguments:
+ *  - char  *buffer:     content of the stat file, modified
+ *  - char **comm:       set to the comm field, without the parentheses
+ *  - char **fields:     set to the fields after comm, see PROCFS_STAT_INDEX()
+ *  - int    max_fields: size of fields
+ *
+ * Return Value:
+ *  The number of fields, -1 if buffer is not a stat line.
+ */
+int procfs_split_stat(char *buffer, char **comm, char **fields,
+        int max_fields)
+{
+    char       *open,
+               *close,
+               *p;
+    int         n = 0;
+
+    if(!(open = strchr(buffer, '(')) || !(close = strrchr(open, ')')))
+        return -1;
+
+    *close = '\0';
+    *comm = open + 1;
+
+    for(p = close + 1; *p == ' '; p++)
+        ;
+
+    while(*p && *p != '\n' && n < max_fields)
+    {
+        fields[n++] = p;
+        p += strcspn(p, " \n");
+        if(*p)
+            *p++ = '\0';
+    }
+
+    return n;
+}
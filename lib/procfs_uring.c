@@ -0,0 +1,398 @@
+/*
+ * filename: procfs_uring.c
+ *
+ * Batched reads of procfs files, see procfs_read_batch() in procfs.h.
+ *
+ * With io_uring every file of a batch is read by a chain of three requests:
+ * an openat into a slot of the registered file table (a "direct" descriptor,
+ * so no fd is ever installed in our fd table), a read from that slot and a
+ * close of the slot. The chains of a whole batch are submitted and reaped
+ * with a single io_uring_enter(), instead of open, read and close syscalls
+ * for every file. liburing is not required, the ring is set up with the raw
+ * syscalls.
+ *
+ * Unless enabled by procfs_set_uring() or without io_uring support (at
+ * compile time or in the kernel) the files are read one by one with
+ * procfs_read().
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef ENABLE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "../include/procfs.h"
+
+/*
+ * Use io_uring if possible: 1 yes, 0 no. procfs files can't be read
+ * without blocking, so io_uring punts the reads to its worker threads,
+ * which may cost more than the syscalls it saves. Hence it is opt-in.
+ */
+static int  procfs_uring_wanted = 0;
+
+/*
+ * procfs_set_uring:
+ *
+ * Description:
+ *  Enables or disables the io_uring backend of procfs_read_batch(). It is
+ *  disabled by default.
+ */
+void procfs_set_uring(int enabled)
+{
+    procfs_uring_wanted = enabled;
+}
+
+/*
+ * read_batch_sync:
+ *
+ * Description:
+ *  Reads every file of the batch with procfs_read().
+ */
+static void read_batch_sync(procfs_read_t *reads, int n)
+{
+    int     i;
+
+    for(i = 0; i < n; i++)
+    {
+        reads[i].result = procfs_read(reads[i].path, reads[i].buffer,
+                reads[i].buffer_len);
+        if(reads[i].result < 0)
+            reads[i].result = -errno;
+    }
+}
+
+#ifdef ENABLE_IO_URING
+
+/* Files per submission, every file takes three SQEs. */
+#define URING_BATCH     64
+#define URING_ENTRIES   (URING_BATCH * 3)
+
+/* Operations, kept in the low bits of user_data. */
+#define URING_OPEN      0
+#define URING_READ      1
+#define URING_CLOSE     2
+
+/*
+ * Structure to hold the mapped ring.
+ */
+typedef struct uring {
+    int                     fd;
+    char                   *sq;
+    size_t                  sq_len,
+                            sqes_len;
+    unsigned               *sq_head,
+                           *sq_tail,
+                           *sq_mask,
+                           *sq_array,
+                           *cq_head,
+                           *cq_tail,
+                           *cq_mask;
+    struct io_uring_sqe    *sqes;
+    struct io_uring_cqe    *cqes;
+} uring_t;
+
+/* The ring, set up on first use. state: 0 untried, 1 ready, -1 failed. */
+static uring_t  ring;
+static int      ring_state = 0;
+
+/*
+ * uring_teardown:
+ *
+ * Description:
+ *  Unmaps the rings and closes the ring for good.
+ */
+static void uring_teardown(void)
+{
+    if(ring.sqes != MAP_FAILED)
+        munmap(ring.sqes, ring.sqes_len);
+    if(ring.sq != MAP_FAILED)
+        munmap(ring.sq, ring.sq_len);
+    close(ring.fd);
+
+    ring.sq = MAP_FAILED;
+    ring.sqes = MAP_FAILED;
+    ring.fd = -1;
+}
+
+/*
+ * uring_setup:
+ *
+ * Description:
+ *  Sets up the ring and a sparse table of URING_BATCH registered files.
+ *
+ * Return Value:
+ *  1 if the ring is usable, 0 otherwise.
+ */
+static int uring_setup(void)
+{
+    struct io_uring_params          params;
+    struct io_uring_rsrc_register   files;
+    size_t                          cq_len;
+    char                           *cq;
+
+    memset(&params, 0, sizeof(params));
+    ring.sq = MAP_FAILED;
+    ring.sqes = MAP_FAILED;
+    ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if(ring.fd < 0)
+        return 0;
+
+    /* Only support kernels mapping both rings at once (5.4+). */
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP))
+        goto fail;
+
+    ring.sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_len = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if(cq_len > ring.sq_len)
+        ring.sq_len = cq_len;
+
+    ring.sq = mmap(NULL, ring.sq_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if(ring.sq == MAP_FAILED)
+        goto fail;
+    cq = ring.sq;
+
+    ring.sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if(ring.sqes == MAP_FAILED)
+        goto fail;
+
+    ring.sq_head = (unsigned *) (ring.sq + params.sq_off.head);
+    ring.sq_tail = (unsigned *) (ring.sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned *) (ring.sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *) (ring.sq + params.sq_off.array);
+    ring.cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring.cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    /* Direct descriptors need a (sparse) registered file table (5.19+). */
+    memset(&files, 0, sizeof(files));
+    files.nr = URING_BATCH;
+    files.flags = IORING_RSRC_REGISTER_SPARSE;
+    if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES2,
+                &files, sizeof(files)) < 0)
+        goto fail;
+
+    return 1;
+
+fail:
+    uring_teardown();
+    return 0;
+}
+
+/*
+ * uring_sqe:
+ *
+ * Description:
+ *  Fills the next SQE. Returns it for additional fields.
+ */
+static struct io_uring_sqe *uring_sqe(unsigned *tail, int opcode, int file,
+        int op, int index, int flags)
+{
+    unsigned                slot = *tail & *ring.sq_mask;
+    struct io_uring_sqe    *sqe = &ring.sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = file;
+    sqe->flags = flags;
+    sqe->user_data = ((uint64_t) index << 2) | op;
+    ring.sq_array[slot] = slot;
+    (*tail)++;
+
+    return sqe;
+}
+
+/*
+ * uring_reap:
+ *
+ * Description:
+ *  Reaps pending completions of a batch, waiting for the ones which are not
+ *  there yet. The buffers of a batch may be written until every submitted
+ *  request completed, so this only returns early if the ring can't be
+ *  waited on any more.
+ *
+ * Return Value:
+ *  0 once all completions were reaped, -1 if waiting failed.
+ */
+static int uring_reap(procfs_read_t *reads, int pending)
+{
+    struct io_uring_cqe    *cqe;
+    unsigned                head;
+    int                     i;
+
+    while(pending)
+    {
+        head = *ring.cq_head;
+        if(head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            if(syscall(__NR_io_uring_enter, ring.fd, 0, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+                    errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                return -1;
+            continue;
+        }
+
+        for(; pending && head != __atomic_load_n(ring.cq_tail,
+                    __ATOMIC_ACQUIRE); head++)
+        {
+            cqe = &ring.cqes[head & *ring.cq_mask];
+            i = cqe->user_data >> 2;
+
+            switch(cqe->user_data & 3)
+            {
+                case URING_OPEN:
+                    if(cqe->res < 0)
+                        reads[i].result = cqe->res;
+                    break;
+                case URING_READ:
+                    if(cqe->res != -ECANCELED || reads[i].result == -ECANCELED)
+                        reads[i].result = cqe->res;
+                    if(cqe->res >= 0)
+                        reads[i].buffer[cqe->res] = '\0';
+                    break;
+            }
+            pending--;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+/*
+ * uring_read_batch:
+ *
+ * Description:
+ *  Reads up to URING_BATCH files with one io_uring_enter().
+ *
+ * Return Value:
+ *  0 on success, -1 if the ring failed and the batch has to be read
+ *  synchronously. Every request which was submitted has completed by then,
+ *  so nothing writes into the buffers any more and no completion is left
+ *  for the next batch.
+ */
+static int uring_read_batch(procfs_read_t *reads, int n)
+{
+    struct io_uring_sqe    *sqe;
+    unsigned                tail = *ring.sq_tail;
+    int                     pending = n * 3,
+                            submitted,
+                            i;
+
+    for(i = 0; i < n; i++)
+    {
+        /* openat into slot i, linked to the read */
+        sqe = uring_sqe(&tail, IORING_OP_OPENAT, AT_FDCWD, URING_OPEN, i,
+                IOSQE_IO_LINK);
+        sqe->addr = (uintptr_t) reads[i].path;
+        sqe->open_flags = O_RDONLY;
+        sqe->file_index = i + 1;
+
+        /* read from slot i; hard linked, so the slot is closed anyway */
+        sqe = uring_sqe(&tail, IORING_OP_READ, i, URING_READ, i,
+                IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK);
+        sqe->addr = (uintptr_t) reads[i].buffer;
+        sqe->len = reads[i].buffer_len - 1;
+
+        sqe = uring_sqe(&tail, IORING_OP_CLOSE, 0, URING_CLOSE, i, 0);
+        sqe->file_index = i + 1;
+
+        reads[i].result = -ECANCELED;
+    }
+
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    do
+        submitted = syscall(__NR_io_uring_enter, ring.fd, pending, pending,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    while(submitted < 0 && errno == EINTR);
+
+    if(submitted == pending)
+        return uring_reap(reads, pending);
+
+    /*
+     * Short submit: drop the requests the kernel didn't take, so a later
+     * io_uring_enter() can't submit them, and wait for the ones it took.
+     */
+    __atomic_store_n(ring.sq_tail,
+            __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    if(submitted > 0)
+        uring_reap(reads, submitted);
+
+    return -1;
+}
+
+#endif
+
+/*
+ * procfs_read_batch:
+ *
+ * Description:
+ *  Reads n files at once, like procfs_read() for each of them. With io_uring
+ *  the files are read with one submission per 64 files.
+ *
+ * Arguments:
+ *  - procfs_read_t *reads: the files; path, buffer and buffer_len are set
+ *                          by the caller, result is set to the number of
+ *                          bytes read or to -errno
+ *  - int            n:     number of files
+ */
+void procfs_read_batch(procfs_read_t *reads, int n)
+{
+#ifdef ENABLE_IO_URING
+    int     done,
+            len;
+
+    if(procfs_uring_wanted && ring_state == 0)
+        ring_state = uring_setup() ? 1 : -1;
+
+    if(procfs_uring_wanted && ring_state == 1)
+    {
+        for(done = 0; done < n; done += len)
+        {
+            len = n - done < URING_BATCH ? n - done : URING_BATCH;
+            if(uring_read_batch(reads + done, len) < 0)
+            {
+                /* Don't try again, the state of the ring is unknown. */
+                ring_state = -1;
+                uring_teardown();
+                read_batch_sync(reads + done, n - done);
+                return;
+            }
+        }
+        return;
+    }
+#endif
+
+    read_batch_sync(reads, n);
+}
+
+/*
+ * procfs_uring_active:
+ *
+ * Description:
+ *  Returns 1 if procfs_read_batch() uses io_uring, 0 otherwise.
+ */
+int procfs_uring_active(void)
+{
+#ifdef ENABLE_IO_URING
+    if(procfs_uring_wanted && ring_state == 0)
+        ring_state = uring_setup() ? 1 : -1;
+
+    return procfs_uring_wanted && ring_state == 1;
+#else
+    return 0;
+#endif
+}
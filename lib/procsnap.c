@@ -0,0 +1,715 @@
+/*
+ * filename: procsnap.c
+ *
+ * Columnar snapshot of the processes, see procsnap.h.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/procfs.h"
+#include "../include/procsnap.h"
+#include "../include/profile.h"
+
+#define PATHLEN         512
+#define MAXTHREADS      64
+
+/* Rows a worker claims at once, also the size of a procfs_read_batch(). */
+#define CHUNK           64
+
+/* Pids listed between two calls of the stop callback of the listing. */
+#define STOPCHECK       256
+
+/* Arena blocks, larger strings get a block of their own. */
+#define BLOCKLEN        65536
+
+/* Buffer sizes of the files. */
+#define COMMLEN         64
+#define STATLEN         1024
+#define STATUSLEN       4096
+#define LIMITSLEN       2048
+#define CGROUPLEN       4096
+#define SCHEDSTATLEN    128
+
+/* Rows of the limits file, by PROCSNAP_LIMIT_*. */
+static const char *limit_rows[PROCSNAP_NLIMITS] = {
+    "Max open files",
+    "Max processes",
+    "Max locked memory",
+    "Max stack size",
+    "Max address space"
+};
+
+/*
+ * Block of the string arena.
+ */
+typedef struct procsnap_block {
+    struct procsnap_block  *next;
+    size_t                  used,
+                            size;
+    char                    data[];
+} procsnap_block_t;
+
+/*
+ * Structure to hold one procsnap_load(), shared by the workers.
+ *
+ * Members:
+ *  - procsnap_t   *snap:    the snapshot
+ *  - unsigned      columns: columns to load
+ *  - const size_t *rows:    rows to load or NULL for all
+ *  - size_t        n_rows:  number of rows
+ *  - size_t        next:    next row to claim
+ *  - int           batch:   1 to read with procfs_read_batch()
+ */
+typedef struct load {
+    procsnap_t     *snap;
+    unsigned        columns;
+    const size_t   *rows;
+    size_t          n_rows;
+    size_t          next;
+    int             batch;
+} load_t;
+
+/*
+ * Structure to hold the state of one worker.
+ *
+ * Members:
+ *  - load_t           *load:  the load
+ *  - procsnap_block_t *arena: strings of the worker, moved to the snapshot
+ *                             after the load
+ *  - long              reads: files read
+ */
+typedef struct worker {
+    load_t             *load;
+    procsnap_block_t   *arena;
+    long                reads;
+} worker_t;
+
+/*
+ * arena_strdup:
+ *
+ * copies len bytes of s and a terminating '\0' into the arena
+ */
+static const char *arena_strdup(procsnap_block_t **arena, const char *s,
+        size_t len)
+{
+    procsnap_block_t   *block = *arena;
+    size_t              size;
+    char               *copy;
+
+    if(!block || block->size - block->used < len + 1)
+    {
+        size = len + 1 > BLOCKLEN ? len + 1 : BLOCKLEN;
+        if(!(block = malloc(sizeof(procsnap_block_t) + size)))
+            return NULL;
+        block->next = *arena;
+        block->used = 0;
+        block->size = size;
+        *arena = block;
+    }
+
+    copy = block->data + block->used;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    block->used += len + 1;
+
+    return copy;
+}
+
+/*
+ * cmp_pid:
+ *
+ * compares two pids
+ */
+static int cmp_pid(const void *a, const void *b)
+{
+    long    x = *(const long *) a,
+            y = *(const long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * procsnap_open:
+ *
+ * Description:
+ *  Lists the pids below the procfs root into an empty snapshot, no file
+ *  of a process is read yet.
+ *
+ * Return Value:
+ *  0 on success, -1 with errno set.
+ */
+int procsnap_open(procsnap_t *snap)
+{
+    return procsnap_open_until(snap, NULL);
+}
+
+/*
+ * procsnap_open_until:
+ *
+ * Description:
+ *  Like procsnap_open(), but asks stop every few pids whether the listing
+ *  has to end, e.g. at a deadline. The snapshot has the pids listed so far
+ *  then.
+ *
+ * Arguments:
+ *  - procsnap_t *snap:        the snapshot
+ *  - int       (*stop)(void): returns 1 to stop the listing, or NULL
+ *
+ * Return Value:
+ *  0 on success, 1 if stop ended the listing, -1 with errno set.
+ */
+int procsnap_open_until(procsnap_t *snap, int (*stop)(void))
+{
+    DIR             *dir_proc;
+    struct dirent   *dir_entry;
+    size_t           size = 0;
+    long            *grown;
+    int              saved_errno,
+                     stopped = 0;
+
+    memset(snap, 0, sizeof(*snap));
+    snap->threads = 1;
+
+    if(!(dir_proc = opendir(procfs_root())))
+        return -1;
+
+    while(NULL != (dir_entry = readdir(dir_proc)))
+    {
+        PROFILE_COUNT(PROFILE_DIRENTS);
+        if(dir_entry->d_name[0] < '1' || dir_entry->d_name[0] > '9')
+            continue;
+
+        if(stop && snap->count % STOPCHECK == 0 && snap->count && stop())
+        {
+            stopped = 1;
+            break;
+        }
+
+        if(snap->count == size)
+        {
+            size = size ? size * 2 : 1024;
+            if(!(grown = realloc(snap->pids, size * sizeof(long))))
+            {
+                closedir(dir_proc);
+                procsnap_close(snap);
+                errno = ENOMEM;
+                return -1;
+            }
+            snap->pids = grown;
+        }
+        snap->pids[snap->count++] = atol(dir_entry->d_name);
+    }
+    saved_errno = errno;
+    closedir(dir_proc);
+    PROFILE_ADD(PROFILE_PIDS, snap->count);
+
+    /* readdir() lists them in the order of the pid hash */
+    qsort(snap->pids, snap->count, sizeof(long), cmp_pid);
+
+    if(!(snap->gone = calloc(snap->count + 1, sizeof(uint8_t))) ||
+            !(snap->loaded = calloc(snap->count + 1, sizeof(uint16_t))))
+    {
+        procsnap_close(snap);
+        errno = saved_errno ? saved_errno : ENOMEM;
+        return -1;
+    }
+
+    return stopped;
+}
+
+/*
+ * alloc_column:
+ *
+ * allocates a column of the snapshot unless it is there already, filled
+ * with the byte fill. Returns 0 if out of memory.
+ */
+static int alloc_column(const procsnap_t *snap, void *column, size_t size,
+        int fill)
+{
+    void    **array = column;
+
+    if(*array)
+        return 1;
+    if(!(*array = malloc((snap->count + 1) * size)))
+        return 0;
+    memset(*array, fill, (snap->count + 1) * size);
+
+    return 1;
+}
+
+/*
+ * alloc_columns:
+ *
+ * allocates the arrays of the columns. Returns 0 if out of memory.
+ */
+static int alloc_columns(procsnap_t *snap, unsigned columns)
+{
+    int     ok = 1;
+
+    if(columns & (PROCSNAP_COMM | PROCSNAP_STAT))
+        ok &= alloc_column(snap, &snap->comm, PROCSNAP_COMMLEN, 0);
+    if(columns & PROCSNAP_STAT)
+        ok &= alloc_column(snap, &snap->state, sizeof(char), 0) &&
+            alloc_column(snap, &snap->ppid, sizeof(long), 0) &&
+            alloc_column(snap, &snap->utime, sizeof(uint64_t), 0) &&
+            alloc_column(snap, &snap->stime, sizeof(uint64_t), 0) &&
+            alloc_column(snap, &snap->starttime, sizeof(uint64_t), 0);
+    if(columns & (PROCSNAP_STAT | PROCSNAP_STATUS))
+        ok &= alloc_column(snap, &snap->num_threads, sizeof(long), 0);
+    if(columns & PROCSNAP_STATUS)
+        ok &= alloc_column(snap, &snap->uid, sizeof(long), 0xff) &&
+            alloc_column(snap, &snap->rss_kb, sizeof(uint64_t), 0) &&
+            alloc_column(snap, &snap->swap_kb, sizeof(uint64_t), 0) &&
+            alloc_column(snap, &snap->vm_size_kb, sizeof(uint64_t), 0) &&
+            alloc_column(snap, &snap->vm_lck_kb, sizeof(uint64_t), 0) &&
+            alloc_column(snap, &snap->vm_stk_kb, sizeof(uint64_t), 0);
+    if(columns & PROCSNAP_LIMITS)
+        ok &= alloc_column(snap, &snap->limit_soft,
+                sizeof(*snap->limit_soft), 0) &&
+            alloc_column(snap, &snap->limit_hard,
+                sizeof(*snap->limit_hard), 0);
+    if(columns & PROCSNAP_FDS)
+        ok &= alloc_column(snap, &snap->fds, sizeof(long), 0xff);
+    if(columns & PROCSNAP_EXE)
+        ok &= alloc_column(snap, &snap->exe, sizeof(char *), 0);
+    if(columns & PROCSNAP_CGROUP)
+        ok &= alloc_column(snap, &snap->cgroup, sizeof(char *), 0);
+    if(columns & PROCSNAP_SCHEDSTAT)
+        ok &= alloc_column(snap, &snap->run_ns, sizeof(uint64_t), 0) &&
+            alloc_column(snap, &snap->wait_ns, sizeof(uint64_t), 0) &&
+            alloc_column(snap, &snap->slices, sizeof(uint64_t), 0);
+
+    return ok;
+}
+
+/*
+ * status_value:
+ *
+ * returns the first number of the line starting with key in a status
+ * file, or fallback if there is none
+ */
+static long long status_value(const char *buffer, const char *key,
+        long long fallback)
+{
+    const char  *line = buffer;
+    size_t       len = strlen(key);
+
+    for(; line; line = strchr(line, '\n'), line = line ? line + 1 : NULL)
+        if(0 == strncmp(line, key, len))
+            return strtoll(line + len, NULL, 10);
+
+    return fallback;
+}
+
+/*
+ * parse_limit:
+ *
+ * parses a limit of the limits file, "unlimited" is PROCSNAP_UNLIMITED
+ */
+static uint64_t parse_limit(const char *s, char **end)
+{
+    while(*s == ' ')
+        s++;
+    if(0 == strncmp(s, "unlimited", 9))
+    {
+        *end = (char *) s + 9;
+        return PROCSNAP_UNLIMITED;
+    }
+
+    return strtoull(s, end, 10);
+}
+
+/*
+ * parse_file:
+ *
+ * parses the content of a file of column into row
+ */
+static void parse_file(procsnap_t *snap, size_t row, unsigned column,
+        char *buffer, procsnap_block_t **arena)
+{
+    char    *fields[PROCFS_STAT_INDEX(PROCFS_STAT_STARTTIME) + 1],
+            *comm,
+            *line,
+            *end;
+    int      i;
+
+    switch(column)
+    {
+        case PROCSNAP_COMM:
+            snprintf(snap->comm[row], PROCSNAP_COMMLEN, "%.*s",
+                    (int) strcspn(buffer, "\n"), buffer);
+            break;
+
+        case PROCSNAP_STAT:
+            if(procfs_split_stat(buffer, &comm, fields,
+                        PROCFS_STAT_INDEX(PROCFS_STAT_STARTTIME) + 1) <
+                    PROCFS_STAT_INDEX(PROCFS_STAT_STARTTIME) + 1)
+                break;
+            snprintf(snap->comm[row], PROCSNAP_COMMLEN, "%s", comm);
+            snap->state[row] = *fields[PROCFS_STAT_INDEX(PROCFS_STAT_STATE)];
+            snap->ppid[row] = atol(fields[PROCFS_STAT_INDEX(PROCFS_STAT_PPID)]);
+            snap->utime[row] = strtoull(
+                    fields[PROCFS_STAT_INDEX(PROCFS_STAT_UTIME)], NULL, 10);
+            snap->stime[row] = strtoull(
+                    fields[PROCFS_STAT_INDEX(PROCFS_STAT_STIME)], NULL, 10);
+            snap->num_threads[row] = atol(
+                    fields[PROCFS_STAT_INDEX(PROCFS_STAT_NUM_THREADS)]);
+            snap->starttime[row] = strtoull(
+                    fields[PROCFS_STAT_INDEX(PROCFS_STAT_STARTTIME)], NULL, 10);
+            break;
+
+        case PROCSNAP_STATUS:
+            snap->uid[row] = status_value(buffer, "Uid:", -1);
+            snap->num_threads[row] = status_value(buffer, "Threads:", 0);
+            snap->rss_kb[row] = status_value(buffer, "VmRSS:", 0);
+            snap->swap_kb[row] = status_value(buffer, "VmSwap:", 0);
+            snap->vm_size_kb[row] = status_value(buffer, "VmSize:", 0);
+            snap->vm_lck_kb[row] = status_value(buffer, "VmLck:", 0);
+            snap->vm_stk_kb[row] = status_value(buffer, "VmStk:", 0);
+            break;
+
+        case PROCSNAP_LIMITS:
+            for(i = 0; i < PROCSNAP_NLIMITS; i++)
+            {
+                if(!(line = strstr(buffer, limit_rows[i])))
+                    continue;
+                snap->limit_soft[row][i] = parse_limit(
+                        line + strlen(limit_rows[i]), &end);
+                snap->limit_hard[row][i] = parse_limit(end, &end);
+            }
+            break;
+
+        case PROCSNAP_CGROUP:
+            /* the line of the unified hierarchy, "0::/system.slice/..." */
+            for(line = buffer; line && strncmp(line, "0::", 3);
+                    line = strchr(line, '\n'), line = line ? line + 1 : NULL)
+                ;
+            if(line)
+                snap->cgroup[row] = arena_strdup(arena, line + 3,
+                        strcspn(line + 3, "\n"));
+            break;
+
+        case PROCSNAP_SCHEDSTAT:
+            /* "<run ns> <wait ns> <timeslices>" */
+            snap->run_ns[row] = strtoull(buffer, &end, 10);
+            snap->wait_ns[row] = strtoull(end, &end, 10);
+            snap->slices[row] = strtoull(end, &end, 10);
+            break;
+    }
+}
+
+/*
+ * count_fds:
+ *
+ * returns the number of open files of pid, -1 if they can't be listed
+ */
+static long count_fds(long pid)
+{
+    char             path[PATHLEN];
+    DIR             *dir_fds;
+    struct dirent   *dir_entry;
+    long             count = 0;
+
+    procfs_path(path, sizeof(path), "%ld/fd", pid);
+    if(!(dir_fds = opendir(path)))
+        return -1;
+
+    while(NULL != (dir_entry = readdir(dir_fds)))
+        count += dir_entry->d_name[0] != '.';
+    closedir(dir_fds);
+
+    return count;
+}
+
+/*
+ * load_chunk:
+ *
+ * loads the columns of n rows, reading every file of them at once
+ */
+static void load_chunk(worker_t *worker, const size_t *rows, size_t n)
+{
+    static const struct {
+        unsigned    column;
+        const char *file;
+        size_t      len;
+    } files[] = {
+        { PROCSNAP_COMM,        "comm",         COMMLEN },
+        { PROCSNAP_STAT,        "stat",         STATLEN },
+        { PROCSNAP_STATUS,      "status",       STATUSLEN },
+        { PROCSNAP_LIMITS,      "limits",       LIMITSLEN },
+        { PROCSNAP_CGROUP,      "cgroup",       CGROUPLEN },
+        { PROCSNAP_SCHEDSTAT,   "schedstat",    SCHEDSTATLEN }
+    };
+    load_t         *load = worker->load;
+    procsnap_t     *snap = load->snap;
+    procfs_read_t   reads[CHUNK];
+    size_t          chunk_rows[CHUNK];
+    char            paths[CHUNK][PATHLEN],
+                    target[PATHLEN],
+                   *buffers = NULL;
+    unsigned        column;
+    size_t          f,
+                    i,
+                    m,
+                    row;
+    ssize_t         len;
+
+    for(f = 0; f < sizeof(files) / sizeof(files[0]); f++)
+    {
+        column = files[f].column;
+
+        /* comm comes with the stat, if that is loaded as well */
+        if(!(load->columns & column) || (column == PROCSNAP_COMM &&
+                    (load->columns & PROCSNAP_STAT)))
+            continue;
+
+        if(!buffers && !(buffers = malloc(CHUNK * STATUSLEN)))
+            return;
+
+        /* only the rows which miss this column */
+        for(m = 0, i = 0; i < n; i++)
+        {
+            if(snap->loaded[rows[i]] & column)
+                continue;
+            chunk_rows[m] = rows[i];
+            procfs_path(paths[m], PATHLEN, "%ld/%s", snap->pids[rows[i]],
+                    files[f].file);
+            reads[m].path = paths[m];
+            reads[m].buffer = buffers + m * files[f].len;
+            reads[m].buffer_len = files[f].len;
+            m++;
+        }
+        if(load->batch)
+            procfs_read_batch(reads, m);
+        else
+            for(i = 0; i < m; i++)
+                if((reads[i].result = procfs_read(reads[i].path,
+                                reads[i].buffer, reads[i].buffer_len)) < 0)
+                    reads[i].result = -errno;
+        worker->reads += m;
+
+        for(i = 0; i < m; i++)
+        {
+            row = chunk_rows[i];
+            if(reads[i].result == -ENOENT || reads[i].result == -ESRCH)
+                snap->gone[row] = 1;
+            else if(reads[i].result > 0)
+                parse_file(snap, row, column, reads[i].buffer,
+                        &worker->arena);
+        }
+    }
+    free(buffers);
+
+    for(i = 0; (load->columns & PROCSNAP_FDS) && i < n; i++)
+    {
+        row = rows[i];
+        if(snap->loaded[row] & PROCSNAP_FDS)
+            continue;
+        if((snap->fds[row] = count_fds(snap->pids[row])) < 0 &&
+                (errno == ENOENT || errno == ESRCH))
+            snap->gone[row] = 1;
+        worker->reads++;
+    }
+
+    for(i = 0; (load->columns & PROCSNAP_EXE) && i < n; i++)
+    {
+        row = rows[i];
+        if(snap->loaded[row] & PROCSNAP_EXE)
+            continue;
+        /* kernel threads have no exe, ENOENT doesn't tell they are gone */
+        procfs_path(paths[0], PATHLEN, "%ld/exe", snap->pids[row]);
+        if((len = readlink(paths[0], target, sizeof(target))) > 0)
+            snap->exe[row] = arena_strdup(&worker->arena, target, len);
+        worker->reads++;
+    }
+
+    for(i = 0; i < n; i++)
+        snap->loaded[rows[i]] |= load->columns |
+            (load->columns & PROCSNAP_STAT ? PROCSNAP_COMM : 0);
+}
+
+/*
+ * load_worker:
+ *
+ * loads the rows of the load, chunk by chunk
+ */
+static void *load_worker(void *arg)
+{
+    worker_t   *worker = arg;
+    load_t     *load = worker->load;
+    size_t      rows[CHUNK],
+                i,
+                end,
+                n;
+
+    while((i = __atomic_fetch_add(&load->next, CHUNK, __ATOMIC_RELAXED)) <
+            load->n_rows)
+    {
+        end = i + CHUNK < load->n_rows ? i + CHUNK : load->n_rows;
+        for(n = 0; i < end; i++)
+        {
+            size_t  row = load->rows ? load->rows[i] : i;
+
+            /* only what is missing of the processes still there */
+            if(!load->snap->gone[row] &&
+                    (load->snap->loaded[row] & load->columns) != load->columns)
+                rows[n++] = row;
+        }
+        if(n)
+            load_chunk(worker, rows, n);
+    }
+
+    return NULL;
+}
+
+/*
+ * procsnap_load:
+ *
+ * Description:
+ *  Loads columns of the snapshot, for the given rows or all of them.
+ *  Columns a row has loaded already are not read again, rows of processes
+ *  which are gone are skipped.
+ *
+ * Arguments:
+ *  - procsnap_t   *snap:    the snapshot
+ *  - unsigned      columns: PROCSNAP_* or'ed together
+ *  - const size_t *rows:    the rows to load or NULL for all
+ *  - size_t        n_rows:  number of rows, ignored for all rows
+ *
+ * Return Value:
+ *  0 on success, -1 if out of memory.
+ */
+int procsnap_load(procsnap_t *snap, unsigned columns, const size_t *rows,
+        size_t n_rows)
+{
+    load_t              load = { snap, columns, rows,
+                                 rows ? n_rows : snap->count, 0, 0 };
+    worker_t            workers[MAXTHREADS];
+    pthread_t           threads[MAXTHREADS];
+    procsnap_block_t   *block;
+    long                reads = 0;
+    int                 n_threads = snap->threads,
+                        started = 0,
+                        i;
+
+    if(!alloc_columns(snap, columns))
+        return -1;
+
+    if(n_threads < 1)
+        n_threads = 1;
+    if(n_threads > MAXTHREADS)
+        n_threads = MAXTHREADS;
+
+    /* procfs_read_batch() and its ring are not made for several threads */
+    load.batch = n_threads == 1;
+
+    /* procfs_root() caches the root, look it up before the threads do. */
+    procfs_root();
+
+    memset(workers, 0, sizeof(workers));
+    for(i = 0; i < n_threads; i++)
+        workers[i].load = &load;
+    for(i = 1; i < n_threads; i++)
+        if(0 == pthread_create(&threads[started], NULL, load_worker,
+                    &workers[started + 1]))
+            started++;
+    load_worker(&workers[0]);
+    for(i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    /* hand the strings of the workers over to the snapshot */
+    for(i = 0; i <= started; i++)
+    {
+        reads += workers[i].reads;
+        while((block = workers[i].arena))
+        {
+            workers[i].arena = block->next;
+            block->next = snap->arena;
+            snap->arena = block;
+        }
+    }
+
+    snap->reads += reads;
+    PROFILE_ADD(PROFILE_OPENS, reads);
+    PROFILE_ADD(PROFILE_READS, reads);
+
+    return 0;
+}
+
+/*
+ * procsnap_match_comm:
+ *
+ * Description:
+ *  Selects the rows of the processes named comm, PROCSNAP_COMM has to be
+ *  loaded.
+ *
+ * Arguments:
+ *  - const procsnap_t *snap: the snapshot
+ *  - const char       *comm: the name
+ *  - size_t           *rows: set to the matching rows, room for count
+ *
+ * Return Value:
+ *  The number of matching rows.
+ */
+size_t procsnap_match_comm(const procsnap_t *snap, const char *comm,
+        size_t *rows)
+{
+    size_t  row,
+            n = 0;
+
+    for(row = 0; snap->comm && row < snap->count; row++)
+        if(!snap->gone[row] && 0 == strcmp(snap->comm[row], comm))
+            rows[n++] = row;
+
+    return n;
+}
+
+/*
+ * procsnap_close:
+ *
+ * Description:
+ *  Frees the columns and the strings of the snapshot.
+ */
+void procsnap_close(procsnap_t *snap)
+{
+    procsnap_block_t   *block;
+
+    while((block = snap->arena))
+    {
+        snap->arena = block->next;
+        free(block);
+    }
+
+    free(snap->pids);
+    free(snap->gone);
+    free(snap->loaded);
+    free(snap->comm);
+    free(snap->state);
+    free(snap->ppid);
+    free(snap->utime);
+    free(snap->stime);
+    free(snap->starttime);
+    free(snap->num_threads);
+    free(snap->uid);
+    free(snap->rss_kb);
+    free(snap->swap_kb);
+    free(snap->vm_size_kb);
+    free(snap->vm_lck_kb);
+    free(snap->vm_stk_kb);
+    free(snap->limit_soft);
+    free(snap->limit_hard);
+    free(snap->fds);
+    free(snap->exe);
+    free(snap->cgroup);
+    free(snap->run_ns);
+    free(snap->wait_ns);
+    free(snap->slices);
+
+    memset(snap, 0, sizeof(*snap));
+}
@@ -0,0 +1,209 @@
+/*
+ * filename: profile.c
+ *
+ * Hot path instrumentation, see profile.h.
+ */
+
+#include "../include/output.h"
+#include "../include/profile.h"
+
+#ifdef ENABLE_PROFILE
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+/* Maximal number of distinct phases per plugin. */
+#define PROFILE_MAXPHASES   16
+
+/*
+ * Structure to hold the accumulated time of one phase.
+ *
+ * Members:
+ *  - const char     *name:     name of the phase, used in the perfdata
+ *  - struct timespec started:  start of the currently running interval
+ *  - double          seconds:  accumulated time of all finished intervals
+ */
+typedef struct profile_phase {
+    const char         *name;
+    struct timespec     started;
+    double              seconds;
+} profile_phase_t;
+
+static int              profile_on = 0;
+static int              n_phases = 0;
+static profile_phase_t  phases[PROFILE_MAXPHASES];
+static long             counters[PROFILE_NCOUNTERS];
+static struct timespec  profile_started;
+
+static const char      *counter_names[PROFILE_NCOUNTERS] = {
+                            "opens",
+                            "reads",
+                            "readlinks",
+                            "dirents",
+                            "pids"};
+
+/*
+ * find_phase:
+ *
+ * returns the phase called name, creating it if needed, or NULL if there
+ * are too many phases
+ */
+static profile_phase_t *find_phase(const char *name)
+{
+    int     i;
+
+    for(i = 0; i < n_phases; i++)
+        if(phases[i].name == name || 0 == strcmp(phases[i].name, name))
+            return &phases[i];
+
+    if(n_phases >= PROFILE_MAXPHASES)
+        return NULL;
+
+    phases[n_phases].name = name;
+    phases[n_phases].seconds = 0.0;
+
+    return &phases[n_phases++];
+}
+
+/*
+ * elapsed:
+ *
+ * returns the seconds passed since start
+ */
+static double elapsed(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) +
+        (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * profile_enable:
+ *
+ * Description:
+ *  Enables profiling at runtime, e.g. on --profile.
+ *
+ * Return Value:
+ *  - 1, profiling is compiled in
+ */
+int profile_enable(void)
+{
+    profile_on = 1;
+    clock_gettime(CLOCK_MONOTONIC, &profile_started);
+
+    return 1;
+}
+
+int profile_enabled(void)
+{
+    return profile_on;
+}
+
+/*
+ * profile_begin:
+ *
+ * Description:
+ *  Starts a new interval of phase. Phases may nest, but a phase must not be
+ *  started again before it ended.
+ */
+void profile_begin(const char *phase)
+{
+    profile_phase_t *p;
+
+    if(!profile_on || !(p = find_phase(phase)))
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &p->started);
+}
+
+/*
+ * profile_end:
+ *
+ * Description:
+ *  Ends the current interval of phase and adds it to the phase total.
+ */
+void profile_end(const char *phase)
+{
+    profile_phase_t *p;
+
+    if(!profile_on || !(p = find_phase(phase)))
+        return;
+
+    p->seconds += elapsed(&p->started);
+}
+
+/*
+ * profile_scope_end:
+ *
+ * Description:
+ *  Cleanup handler of PROFILE_SCOPE().
+ */
+void profile_scope_end(const char **phase)
+{
+    profile_end(*phase);
+}
+
+void profile_count(int counter, long n)
+{
+    if(profile_on && counter >= 0 && counter < PROFILE_NCOUNTERS)
+        counters[counter] += n;
+}
+
+/*
+ * profile_output:
+ *
+ * Description:
+ *  Adds the time of all phases, the counters and the resource usage of this
+ *  process to the measurements of the plugin, if profiling is enabled.
+ */
+void profile_output(void)
+{
+    struct rusage   usage;
+    char            name[64];
+    int             i;
+
+    if(!profile_on)
+        return;
+
+    output_add("profile_total", "s", elapsed(&profile_started),
+            OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+
+    for(i = 0; i < n_phases; i++)
+    {
+        snprintf(name, sizeof(name), "profile_%s", phases[i].name);
+        output_add(name, "s", phases[i].seconds,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    }
+
+    for(i = 0; i < PROFILE_NCOUNTERS; i++)
+    {
+        snprintf(name, sizeof(name), "profile_%s", counter_names[i]);
+        output_add(name, "", counters[i],
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    }
+
+    if(0 == getrusage(RUSAGE_SELF, &usage))
+    {
+        output_add("profile_utime", "s",
+                usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        output_add("profile_stime", "s",
+                usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        output_add("profile_maxrss", "KB", usage.ru_maxrss,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    }
+}
+
+#else
+
+/* ISO C forbids an empty translation unit. */
+typedef int profile_disabled_t;
+
+#endif
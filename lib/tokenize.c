@@ -0,0 +1,420 @@
+/*
+ * filename: tokenize.c
+ *
+ * Integer tokenizer with runtime selected SIMD kernels, see tokenize.h.
+ *
+ * The SIMD kernels classify a block of 16 (SSE4.2) or 32 (AVX2) bytes at
+ * once into digits and blanks, find the numbers in the block with bit scans
+ * on the masks and convert every number of less than 16 digits with a few
+ * multiply-adds on a 16 byte vector ending at its last digit. Numbers which
+ * run past the block start the next block, longer numbers and the tail of
+ * the input are left to the scalar code.
+ */
+
+#include <string.h>
+
+#include "../include/tokenize.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define TOKENIZE_X86
+#include <immintrin.h>
+#define TOKENIZE_SSE    __attribute__((target("sse4.2")))
+#define TOKENIZE_AVX2   __attribute__((target("avx2")))
+#endif
+
+typedef size_t (*tokenize_t)(const char *s, size_t len, uint64_t *values,
+        size_t max, size_t *used);
+
+/*
+ * Structure to describe a kernel.
+ *
+ * Members:
+ *  - const char *name:      name, for tokenize_set_kernel()
+ *  - const char *feature:   cpu feature it needs, NULL for none
+ *  - tokenize_t  tokenize:  the kernel
+ */
+typedef struct kernel {
+    const char *name;
+    const char *feature;
+    tokenize_t  tokenize;
+} kernel_t;
+
+/* The selected kernel, NULL until the first call. */
+static const kernel_t *selected = NULL;
+
+/*
+ * is_digit:
+ */
+static inline int is_digit(char c)
+{
+    return (unsigned char) (c - '0') <= 9;
+}
+
+/*
+ * is_negative:
+ *
+ * Description:
+ *  Returns 1 if s[i] is a '-' directly before a digit.
+ */
+static inline int is_negative(const char *s, size_t len, size_t i)
+{
+    return s[i] == '-' && i + 1 < len && is_digit(s[i + 1]);
+}
+
+/*
+ * tokenize_scalar:
+ *
+ * Description:
+ *  The baseline, one character after the other.
+ */
+static size_t tokenize_scalar(const char *s, size_t len, uint64_t *values,
+        size_t max, size_t *used)
+{
+    uint64_t    value;
+    size_t      i = 0,
+                n = 0;
+    int         negative;
+
+    while(n < max)
+    {
+        while(i < len && (s[i] == ' ' || s[i] == '\t'))
+            i++;
+        if(i >= len)
+            break;
+        negative = is_negative(s, len, i);
+        if(!negative && !is_digit(s[i]))
+            break;
+
+        for(value = 0, i += negative; i < len && is_digit(s[i]); i++)
+            value = value * 10 + (s[i] - '0');
+        values[n++] = negative ? -value : value;
+    }
+
+    *used = i;
+
+    return n;
+}
+
+#ifdef TOKENIZE_X86
+/*
+ * convert16:
+ *
+ * Description:
+ *  Converts the len (< 16) digits before end, which must be preceded by
+ *  16 - len readable bytes. The digits are weighted pairwise (10, 1), the
+ *  pairs (100, 1) and then the groups of four (10000, 1), which leaves the
+ *  upper and the lower eight digits.
+ */
+TOKENIZE_SSE static inline uint64_t convert16(const char *end, int len)
+{
+    __m128i     digits;
+
+    digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i *) (end - 16)),
+            _mm_set1_epi8('0'));
+    digits = _mm_and_si128(digits, _mm_cmpgt_epi8(
+                _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                    8, 9, 10, 11, 12, 13, 14, 15),
+                _mm_set1_epi8(15 - len)));
+
+    digits = _mm_maddubs_epi16(digits, _mm_setr_epi8(10, 1, 10, 1, 10, 1,
+                10, 1, 10, 1, 10, 1, 10, 1, 10, 1));
+    digits = _mm_madd_epi16(digits, _mm_setr_epi16(100, 1, 100, 1,
+                100, 1, 100, 1));
+    digits = _mm_packus_epi32(digits, digits);
+    digits = _mm_madd_epi16(digits, _mm_setr_epi16(10000, 1, 10000, 1,
+                10000, 1, 10000, 1));
+
+    return (uint64_t) (uint32_t) _mm_cvtsi128_si32(digits) * 100000000 +
+        (uint32_t) _mm_extract_epi32(digits, 1);
+}
+
+/*
+ * tokenize_block:
+ *
+ * Description:
+ *  Converts the numbers of the block of width bytes at s + *i, given the
+ *  masks of its digits and its blanks, and moves *i past them. A number
+ *  touching the end of the block may go on in the next one, so *i stops
+ *  at its first digit.
+ *
+ * Return Value:
+ *  1 if tokenizing is done: at a character which is neither a digit nor
+ *  a blank (*i points to it) or with max values, 0 otherwise.
+ */
+TOKENIZE_SSE static inline int tokenize_block(const char *s, size_t *i,
+        uint32_t digit, uint32_t blank, int width, uint64_t *values,
+        size_t max, size_t *n)
+{
+    uint64_t    all = (1ULL << width) - 1,
+                rest,
+                value;
+    size_t      end,
+                k;
+    int         pos = 0,
+                len;
+
+    for(;;)
+    {
+        rest = ~(uint64_t) blank & all & (~0ULL << pos);
+        if(!rest)
+        {
+            *i += width;
+            return 0;
+        }
+        pos = __builtin_ctzll(rest);
+
+        if(!(digit >> pos & 1))
+        {
+            *i += pos;
+            return 1;
+        }
+
+        len = __builtin_ctzll(~((uint64_t) digit >> pos));
+        if(pos + len >= width)
+        {
+            *i += pos;
+            return 0;
+        }
+
+        /* Short numbers, like the many zeros of the intr line, are cheaper
+         * to convert one digit after the other. */
+        end = *i + pos + len;
+        if(end >= 16 && len > 4 && len < 16)
+            value = convert16(s + end, len);
+        else
+            for(value = 0, k = end - len; k < end; k++)
+                value = value * 10 + (s[k] - '0');
+        values[(*n)++] = value;
+
+        if(*n == max)
+        {
+            *i = end;
+            return 1;
+        }
+        pos += len;
+    }
+}
+
+/*
+ * tokenize_long:
+ *
+ * Description:
+ *  Converts a number at s + *i with the scalar code, for numbers of at
+ *  least a block of digits and negative ones.
+ */
+static void tokenize_long(const char *s, size_t len, size_t *i,
+        uint64_t *value)
+{
+    for(*value = 0; *i < len && is_digit(s[*i]); (*i)++)
+        *value = *value * 10 + (s[*i] - '0');
+}
+
+/*
+ * tokenize_sse42:
+ */
+TOKENIZE_SSE static size_t tokenize_sse42(const char *s, size_t len,
+        uint64_t *values, size_t max, size_t *used)
+{
+    __m128i     chars,
+                digits;
+    size_t      i = 0,
+                n = 0,
+                start,
+                rest;
+
+    while(n < max && i + 16 <= len)
+    {
+        chars = _mm_loadu_si128((const __m128i *) (s + i));
+        digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+
+        start = i;
+        if(tokenize_block(s, &i,
+                    _mm_movemask_epi8(_mm_cmpeq_epi8(digits,
+                            _mm_min_epu8(digits, _mm_set1_epi8(9)))),
+                    _mm_movemask_epi8(_mm_or_si128(
+                            _mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')),
+                            _mm_cmpeq_epi8(chars, _mm_set1_epi8('\t')))),
+                    16, values, max, &n))
+        {
+            if(n == max || !is_negative(s, len, i))
+            {
+                *used = i;
+                return n;
+            }
+            i++;
+            tokenize_long(s, len, &i, &values[n]);
+            values[n] = -values[n];
+            n++;
+        }
+        else if(i == start)
+            tokenize_long(s, len, &i, &values[n++]);
+    }
+
+    n += tokenize_scalar(s + i, len - i, values + n, max - n, &rest);
+    *used = i + rest;
+
+    return n;
+}
+
+/*
+ * tokenize_avx2:
+ */
+TOKENIZE_AVX2 static size_t tokenize_avx2(const char *s, size_t len,
+        uint64_t *values, size_t max, size_t *used)
+{
+    __m256i     chars,
+                digits;
+    size_t      i = 0,
+                n = 0,
+                start,
+                rest;
+
+    while(n < max && i + 32 <= len)
+    {
+        chars = _mm256_loadu_si256((const __m256i *) (s + i));
+        digits = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+
+        start = i;
+        if(tokenize_block(s, &i,
+                    _mm256_movemask_epi8(_mm256_cmpeq_epi8(digits,
+                            _mm256_min_epu8(digits, _mm256_set1_epi8(9)))),
+                    _mm256_movemask_epi8(_mm256_or_si256(
+                            _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\t')))),
+                    32, values, max, &n))
+        {
+            if(n == max || !is_negative(s, len, i))
+            {
+                *used = i;
+                return n;
+            }
+            i++;
+            tokenize_long(s, len, &i, &values[n]);
+            values[n] = -values[n];
+            n++;
+        }
+        else if(i == start)
+            tokenize_long(s, len, &i, &values[n++]);
+    }
+
+    n += tokenize_sse42(s + i, len - i, values + n, max - n, &rest);
+    *used = i + rest;
+
+    return n;
+}
+#endif
+
+/* The kernels, the best one first. */
+static const kernel_t kernels[] =
+{
+#ifdef TOKENIZE_X86
+    { "avx2",   "avx2",   tokenize_avx2 },
+    { "sse4.2", "sse4.2", tokenize_sse42 },
+#endif
+    { "scalar", NULL,     tokenize_scalar }
+};
+
+#define NKERNELS    (sizeof(kernels) / sizeof(kernels[0]))
+
+/*
+ * supported:
+ *
+ * Description:
+ *  Returns 1 if the cpu has the feature a kernel needs.
+ */
+static int supported(const kernel_t *kernel)
+{
+    if(!kernel->feature)
+        return 1;
+
+#ifdef TOKENIZE_X86
+    __builtin_cpu_init();
+    if(0 == strcmp(kernel->feature, "avx2"))
+        return __builtin_cpu_supports("avx2");
+    if(0 == strcmp(kernel->feature, "sse4.2"))
+        return __builtin_cpu_supports("sse4.2");
+#endif
+
+    return 0;
+}
+
+/*
+ * select_kernel:
+ *
+ * Description:
+ *  Returns the selected kernel, selecting the best supported one first.
+ *  Threads racing here select the same one.
+ */
+static const kernel_t *select_kernel(void)
+{
+    const kernel_t  *kernel = __atomic_load_n(&selected, __ATOMIC_RELAXED);
+    size_t           k;
+
+    if(kernel)
+        return kernel;
+
+    for(k = 0; k < NKERNELS - 1 && !supported(&kernels[k]); k++)
+        ;
+    kernel = &kernels[k];
+    __atomic_store_n(&selected, kernel, __ATOMIC_RELAXED);
+
+    return kernel;
+}
+
+/*
+ * tokenize_u64:
+ *
+ * Description:
+ *  Splits the blank separated unsigned integers at the beginning of s into
+ *  values, see tokenize.h. Leading blanks are skipped.
+ *
+ * Arguments:
+ *  - const char *s:      the input, needs no terminating '\0'
+ *  - size_t      len:    length of s
+ *  - uint64_t   *values: array for the numbers
+ *  - size_t      max:    size of values
+ *  - size_t     *used:   set to the number of characters consumed, i.e.
+ *                        the offset of the character tokenizing stopped at
+ *
+ * Return Value:
+ *  The number of values.
+ */
+size_t tokenize_u64(const char *s, size_t len, uint64_t *values, size_t max,
+        size_t *used)
+{
+    return select_kernel()->tokenize(s, len, values, max, used);
+}
+
+/*
+ * tokenize_kernel:
+ *
+ * Description:
+ *  Returns the name of the selected kernel.
+ */
+const char *tokenize_kernel(void)
+{
+    return select_kernel()->name;
+}
+
+/*
+ * tokenize_set_kernel:
+ *
+ * Description:
+ *  Selects a kernel by name, e.g. to compare them in a benchmark.
+ *
+ * Return Value:
+ *  1 on success, 0 if the kernel is unknown or not supported by the cpu.
+ */
+int tokenize_set_kernel(const char *name)
+{
+    size_t  k;
+
+    for(k = 0; k < NKERNELS; k++)
+        if(0 == strcmp(kernels[k].name, name) && supported(&kernels[k]))
+        {
+            __atomic_store_n(&selected, &kernels[k], __ATOMIC_RELAXED);
+            return 1;
+        }
+
+    return 0;
+}
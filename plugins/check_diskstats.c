@@ -0,0 +1,690 @@
+/*
+ * filename: check_diskstats.c
+ *
+ * Checks the I/O of block devices from /proc/diskstats: read and write IOPS
+ * and throughput, discards, flushes, the average await, the average queue
+ * depth and the utilisation of every device since the last run, like
+ * iostat -x. The counters of the last run are kept in
+ * $TMPDIR/check_diskstats.tmp together with a nanosecond timestamp.
+ *
+ * diskstats is parsed by hand, as hosts with hundreds of NVMe namespaces,
+ * partitions and device mapper targets list thousands of counters.
+ */
+
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/profile.h"
+
+#define VERSION "0.1"
+#define PROCFS_DISKSTATS "diskstats"
+#define BUFFER_LEN 1024
+
+#define STATE_FILE      "/check_diskstats.tmp"
+#define STATE_MAGIC     0x31736b64      /* "dks1" */
+#define DEVNAME_LEN     32
+#define MAXDEVICES      16
+
+/* Bytes per sector of the sector counters, regardless of the device. */
+#define SECTOR_SIZE     512
+
+/*
+ * Counters of a line of /proc/diskstats after major, minor and name, see
+ * Documentation/admin-guide/iostats.rst. Kernels before 4.18 have no
+ * discard counters, kernels before 5.5 no flush counters; missing ones
+ * stay 0.
+ */
+#define DS_READS            0
+#define DS_READS_MERGED     1
+#define DS_SECTORS_READ     2
+#define DS_MS_READING       3
+#define DS_WRITES           4
+#define DS_WRITES_MERGED    5
+#define DS_SECTORS_WRITTEN  6
+#define DS_MS_WRITING       7
+#define DS_IN_FLIGHT        8
+#define DS_MS_IO            9
+#define DS_MS_WEIGHTED      10
+#define DS_DISCARDS         11
+#define DS_DISCARDS_MERGED  12
+#define DS_SECTORS_DISCARDED 13
+#define DS_MS_DISCARDING    14
+#define DS_FLUSHES          15
+#define DS_MS_FLUSHING      16
+#define DS_COUNTERS         17
+
+/*
+ * define error messages
+ */
+#define EDEVICES    "too many --device patterns, at most 16 are allowed"
+
+/*
+ * Structure to hold the counters of one device. This is also the record of
+ * the state file, so keep it free of padding.
+ *
+ * Members:
+ *  - char     name[]:     name of the device, e.g. "nvme0n1"
+ *  - uint64_t counters[]: the DS_* counters
+ */
+typedef struct disk
+{
+    char        name[DEVNAME_LEN];
+    uint64_t    counters[DS_COUNTERS];
+} disk_t;
+
+/*
+ * Header of the state file.
+ *
+ * Members:
+ *  - uint32_t magic: STATE_MAGIC
+ *  - uint32_t count: number of devices following the header
+ *  - int64_t  taken: CLOCK_BOOTTIME nanoseconds of the sample
+ */
+typedef struct state_header
+{
+    uint32_t    magic;
+    uint32_t    count;
+    int64_t     taken;
+} state_header_t;
+
+/*
+ * Structure to hold the rates of one device over the interval.
+ */
+typedef struct disk_rates
+{
+    double      reads,
+                writes,
+                read_bytes,
+                write_bytes,
+                discards,
+                flushes,
+                read_await,
+                write_await,
+                await,
+                queue_depth,
+                util;
+} disk_rates_t;
+
+static char fallback_tmpdir[] = "/tmp/";
+
+/*
+ * print_help:
+ *
+ * print help output to stdout
+ */
+static void print_help (const char *progname)
+{
+    printf("Usage:\n");
+    printf(" %s [options]\n", progname);
+    printf("\n");
+    printf("Options\n");
+    printf(" -d, --device\t\tcheck the devices matching this pattern, may be\n"
+           "\t\t\tgiven up to 16 times (default: all devices with I/O)\n");
+    printf(" -w, --warning\t\twarning threshold of the average await (ms)\n");
+    printf(" -c, --critical\t\tcritical threshold of the average await (ms)\n");
+    printf(" -W, --warning-util\twarning threshold of the utilisation (%%)\n");
+    printf(" -C, --critical-util\tcritical threshold of the utilisation (%%)\n");
+    printf(" -v, --verbose\t\tverbose output\n");
+    printf(" -F, --format\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("     --textfile\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("     --profile\t\tappend timings of the plugin to the perfdata\n");
+    printf(" -P, --procfs-root\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf("     --cache-ttl\tshare results younger than this (seconds)\n"
+           "\t\t\twith invocations with the same arguments\n");
+    printf("\n");
+    printf(" -h, --help\t\tdisplay this help text\n");
+    printf(" -V, --version\t\toutput version information\n");
+}
+
+/*
+ * print_version:
+ *
+ * prints version information to stdout
+ */
+static void print_version()
+{
+    printf("check_diskstats (%s)\n", VERSION);
+}
+
+/*
+ * exit_with_message:
+ *
+ * print a message to stdout and exit with return code rc
+ */
+static void exit_with_message(int rc, char *message)
+{
+    output_exit(rc, "%s", message);
+}
+
+/*
+ * get_tmpdir:
+ *
+ * returns TMPDIR or TMP from the environment, "/tmp/" if both are unset
+ */
+static char* get_tmpdir()
+{
+    char    *tmpdir;
+    tmpdir = getenv("TMPDIR");
+
+    if(NULL == tmpdir)
+        tmpdir = getenv("TMP");
+
+    if(NULL == tmpdir)
+        tmpdir = fallback_tmpdir;
+
+    return tmpdir;
+}
+
+/*
+ * parse_number:
+ *
+ * parses a decimal number after optional blanks, diskstats has hundreds of
+ * lines of 20 numbers on large hosts
+ */
+static char *parse_number(char *p, uint64_t *value)
+{
+    uint64_t    n = 0;
+
+    while(*p == ' ' || *p == '\t')
+        p++;
+    while(*p >= '0' && *p <= '9')
+        n = n * 10 + (*p++ - '0');
+    *value = n;
+
+    return p;
+}
+
+/*
+ * parse_diskstats:
+ *
+ * parses all lines of buffer into a newly allocated array of devices and
+ * returns the number of devices
+ */
+static size_t parse_diskstats(char *buffer, disk_t **disks)
+{
+    disk_t     *disk;
+    uint64_t    dummy;
+    size_t      count = 0,
+                size = 0;
+    char       *p = buffer,
+               *name;
+    int         len,
+                i;
+
+    *disks = NULL;
+
+    while(*p)
+    {
+        if(count == size)
+        {
+            size = size ? size * 2 : 64;
+            if(!(*disks = realloc(*disks, size * sizeof(disk_t))))
+                exit_with_message(UNKNOWN, "out of memory");
+        }
+        disk = &(*disks)[count];
+
+        /* major and minor */
+        p = parse_number(p, &dummy);
+        p = parse_number(p, &dummy);
+
+        while(*p == ' ' || *p == '\t')
+            p++;
+        for(name = p; *p && *p != ' ' && *p != '\n'; p++)
+            ;
+        len = p - name;
+
+        memset(disk->counters, 0, sizeof(disk->counters));
+        for(i = 0; i < DS_COUNTERS && *p == ' '; i++)
+            p = parse_number(p, &disk->counters[i]);
+
+        /* skip unknown counters of newer kernels */
+        while(*p && *p != '\n')
+            p++;
+        if(*p)
+            p++;
+
+        if(len == 0 || len >= DEVNAME_LEN || i < DS_MS_WEIGHTED + 1)
+            continue;
+
+        memcpy(disk->name, name, len);
+        memset(disk->name + len, 0, DEVNAME_LEN - len);
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * read_state:
+ *
+ * reads the devices of the last run. Returns the number of devices, 0 if
+ * there is no (valid) state.
+ */
+static size_t read_state(char *tmpdir, state_header_t *header, disk_t **disks)
+{
+    FILE    *state_file;
+    char     path[BUFFER_LEN];
+    size_t   count = 0;
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, STATE_FILE);
+
+    *disks = NULL;
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    if(1 == fread(header, sizeof(state_header_t), 1, state_file) &&
+            header->magic == STATE_MAGIC &&
+            (*disks = malloc((header->count + 1) * sizeof(disk_t))) &&
+            header->count == fread(*disks, sizeof(disk_t), header->count,
+                state_file))
+        count = header->count;
+
+    fclose(state_file);
+
+    return count;
+}
+
+/*
+ * write_state:
+ *
+ * writes the devices of this run for the next one. The file is replaced
+ * atomically, so concurrent runs never read a partial state.
+ */
+static void write_state(char *tmpdir, int64_t taken, const disk_t *disks,
+        size_t count)
+{
+    FILE            *state_file;
+    state_header_t   header = { STATE_MAGIC, count, taken };
+    char             path[BUFFER_LEN],
+                     tmp_path[BUFFER_LEN + 32];
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, STATE_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the state file "
+                "for writing");
+
+    fwrite(&header, sizeof(header), 1, state_file);
+    fwrite(disks, sizeof(disk_t), count, state_file);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the state file");
+    }
+}
+
+/*
+ * find_disk:
+ *
+ * returns the previous sample of disk or NULL. Devices are listed in the
+ * same order every time, so the slot of the same index is tried first and
+ * the others are only searched if devices came or went.
+ */
+static const disk_t *find_disk(const disk_t *old, size_t n_old, size_t index,
+        const disk_t *disk)
+{
+    size_t  i;
+
+    if(index < n_old && 0 == strcmp(old[index].name, disk->name))
+        return &old[index];
+
+    for(i = 0; i < n_old; i++)
+        if(0 == strcmp(old[i].name, disk->name))
+            return &old[i];
+
+    return NULL;
+}
+
+/*
+ * ratio:
+ */
+static double ratio(uint64_t a, uint64_t b)
+{
+    return b ? (double) a / b : 0;
+}
+
+/*
+ * counter_delta:
+ *
+ * returns the increase of a counter in delta. The time counters of 32 bit
+ * kernels wrap at 2^32; any other decrease means the counters were reset
+ * (e.g. by re-attaching the device), then 0 is returned.
+ */
+static int counter_delta(uint64_t value, uint64_t old, uint64_t *delta)
+{
+    if(value >= old)
+    {
+        *delta = value - old;
+        return 1;
+    }
+
+    /* a wrap only if the old value was in the upper half */
+    if(old <= UINT32_MAX && old - value > UINT32_MAX / 2)
+    {
+        *delta = value + ((uint64_t) UINT32_MAX + 1) - old;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * compute_rates:
+ *
+ * computes the rates of a device over seconds like iostat -x. Returns 0 if
+ * a counter was reset, the device has no rates this run then.
+ */
+static int compute_rates(const disk_t *disk, const disk_t *old,
+        double seconds, disk_rates_t *rates)
+{
+    uint64_t    d[DS_COUNTERS];
+    int         i;
+
+    /* in flight is the only gauge, it is not used for the rates */
+    for(i = 0; i < DS_COUNTERS; i++)
+        if(i != DS_IN_FLIGHT &&
+                !counter_delta(disk->counters[i], old->counters[i], &d[i]))
+            return 0;
+
+    rates->reads = d[DS_READS] / seconds;
+    rates->writes = d[DS_WRITES] / seconds;
+    rates->read_bytes = (double) d[DS_SECTORS_READ] * SECTOR_SIZE / seconds;
+    rates->write_bytes = (double) d[DS_SECTORS_WRITTEN] * SECTOR_SIZE / seconds;
+    rates->discards = d[DS_DISCARDS] / seconds;
+    rates->flushes = d[DS_FLUSHES] / seconds;
+    rates->read_await = ratio(d[DS_MS_READING], d[DS_READS]);
+    rates->write_await = ratio(d[DS_MS_WRITING], d[DS_WRITES]);
+    rates->await = ratio(d[DS_MS_READING] + d[DS_MS_WRITING] +
+            d[DS_MS_DISCARDING] + d[DS_MS_FLUSHING],
+            d[DS_READS] + d[DS_WRITES] + d[DS_DISCARDS] + d[DS_FLUSHES]);
+    rates->queue_depth = d[DS_MS_WEIGHTED] / (seconds * 1000);
+    rates->util = d[DS_MS_IO] / (seconds * 10);
+    if(rates->util > 100)
+        rates->util = 100;
+
+    return 1;
+}
+
+/*
+ * add_rates:
+ *
+ * adds the measurements of a device
+ */
+static void add_rates(const char *name, const disk_rates_t *rates,
+        double w_await, double c_await, double w_util, double c_util)
+{
+    output_add_labeled("device", name, "reads_per_second", "", rates->reads,
+            OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "writes_per_second", "", rates->writes,
+            OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "read_bytes_per_second", "",
+            rates->read_bytes, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "write_bytes_per_second", "",
+            rates->write_bytes, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "discards_per_second", "",
+            rates->discards, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "flushes_per_second", "",
+            rates->flushes, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "read_await", "ms", rates->read_await,
+            OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "write_await", "ms", rates->write_await,
+            OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "await", "ms", rates->await,
+            w_await, c_await, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "queue_depth", "", rates->queue_depth,
+            OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add_labeled("device", name, "util", "%", rates->util,
+            w_util, c_util, 0, 100);
+}
+
+/*
+ * device_selected:
+ *
+ * returns 1 if the device matches one of the patterns. Without patterns
+ * all devices which ever did I/O are selected, which skips unused ram and
+ * loop devices.
+ */
+static int device_selected(const disk_t *disk, char **patterns, int n_patterns)
+{
+    int     i;
+
+    if(n_patterns == 0)
+        return disk->counters[DS_READS] || disk->counters[DS_WRITES];
+
+    for(i = 0; i < n_patterns; i++)
+        if(0 == fnmatch(patterns[i], disk->name, 0))
+            return 1;
+
+    return 0;
+}
+
+int PLUGIN_MAIN(check_diskstats)(int argc, char *argv[])
+{
+    state_header_t   header;
+    disk_rates_t     rates;
+    disk_t          *disks,
+                    *old_disks;
+    const disk_t    *old;
+    const char      *progname,
+                    *arg,
+                    *max_util_name = "",
+                    *max_await_name = "";
+
+    char             err_message[BUFFER_LEN],
+                     path[BUFFER_LEN],
+                     message[BUFFER_LEN] = "",
+                    *patterns[MAXDEVICES],
+                    *tmpdir,
+                    *buffer = NULL;
+
+    size_t           buffer_size = 0,
+                     n_disks,
+                     n_old,
+                     i;
+
+    int64_t          taken;
+
+    int              verbose = 0,
+                     n_patterns = 0,
+                     n_selected = 0,
+                     n_checked = 0,
+                     rc = OK,
+                     dev_rc,
+                     len = 0;
+
+    double           seconds,
+                     cache_ttl = 0,
+                     max_util = 0,
+                     max_await = 0,
+                     w_await = OUTPUT_UNSET,
+                     c_await = OUTPUT_UNSET,
+                     w_util = OUTPUT_UNSET,
+                     c_util = OUTPUT_UNSET;
+
+    output_init("check_diskstats");
+
+    tmpdir = get_tmpdir();
+
+    /*
+     * parse the given arguments
+     */
+    if(argc > 0)
+    {
+        progname = argv[0];
+        for(i = 1; i < (size_t) argc; i++)
+        {
+            arg = argv[i];
+
+            /*
+             * if we got a parameter without a value, complain about it
+             */
+            if((check_option(arg, "-d", "--device") ||
+               check_option(arg, "-w", "--warning") ||
+               check_option(arg, "-c", "--critical") ||
+               check_option(arg, "-W", "--warning-util") ||
+               check_option(arg, "-C", "--critical-util") ||
+               check_option(arg, "-P", "--procfs-root") ||
+               check_option(arg, "-F", "--format") ||
+               check_option(arg, "--textfile", "--textfile") ||
+               check_option(arg, "--cache-ttl", "--cache-ttl")) &&
+               i + 1 >= (size_t) argc)
+            {
+                snprintf(err_message, BUFFER_LEN,
+                        "you have to provide a value for %s", arg);
+                exit_with_message(UNKNOWN, err_message);
+            }
+
+            if(check_option(arg, "-d", "--device"))
+            {
+                if(n_patterns == MAXDEVICES)
+                    exit_with_message(UNKNOWN, EDEVICES);
+                patterns[n_patterns++] = argv[++i];
+            }
+            if(check_option(arg, "-w", "--warning"))
+                w_await = atof(argv[++i]);
+            if(check_option(arg, "-c", "--critical"))
+                c_await = atof(argv[++i]);
+            if(check_option(arg, "-W", "--warning-util"))
+                w_util = atof(argv[++i]);
+            if(check_option(arg, "-C", "--critical-util"))
+                c_util = atof(argv[++i]);
+            if(check_option(arg, "-P", "--procfs-root"))
+                procfs_set_root(argv[++i]);
+            if(check_option(arg, "-F", "--format") &&
+                    output_set_format(argv[++i]) != 0)
+                exit_with_message(UNKNOWN, EOUTPUTFORMAT);
+            if(check_option(arg, "--textfile", "--textfile"))
+                output_set_textfile(argv[++i]);
+            if(check_option(arg, "--cache-ttl", "--cache-ttl") &&
+                    (cache_ttl = atof(argv[++i])) <= 0)
+                exit_with_message(UNKNOWN, ECACHETTL);
+            if(check_option(arg, "-v", "--verbose"))
+                verbose = 1;
+            if(check_option(arg, "--profile", "--profile") && !profile_enable())
+                exit_with_message(UNKNOWN, ENOPROFILE);
+            if(check_option(arg, "-h", "--help"))
+            {
+                print_help(progname);
+                exit(OK);
+            }
+            if(check_option(arg, "-V", "--version"))
+            {
+                print_version();
+                exit(OK);
+            }
+        }
+    }
+
+    if(verbose)
+    {
+        printf("Environment Variables used:\n");
+        printf("  - tmpdir: %s\n", tmpdir);
+        printf("  - procfs root: %s\n", procfs_root());
+        printf("Parameters:\n");
+        printf("  - devices: %d patterns\n", n_patterns);
+        printf("  - await: warning %f critical %f\n", w_await, c_await);
+        printf("  - util: warning %f critical %f\n", w_util, c_util);
+    }
+
+    if(cache_ttl > 0)
+        cache_init("check_diskstats", argc, argv, cache_ttl);
+
+    PROFILE_BEGIN("read");
+    procfs_path(path, sizeof(path), PROCFS_DISKSTATS);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read_file(path, &buffer, &buffer_size) < 0)
+        output_exit(UNKNOWN, "could not read %s", path);
+    taken = procfs_clock_ns();
+    n_disks = parse_diskstats(buffer, &disks);
+    PROFILE_END("read");
+
+    PROFILE_BEGIN("state");
+    n_old = read_state(tmpdir, &header, &old_disks);
+    write_state(tmpdir, taken, disks, n_disks);
+    PROFILE_END("state");
+
+    seconds = n_old ? (taken - header.taken) / 1e9 : 0;
+    if(verbose)
+        printf("Devices: %zu, previous: %zu, seconds: %f\n", n_disks, n_old,
+                seconds);
+
+    /* After a reboot the state is newer than the counters. */
+    if(n_old == 0 || seconds <= 0)
+        output_exit(OK, "%zu devices, %s", n_disks,
+                n_old ? "no time passed" : "no previous sample");
+
+    for(i = 0; i < n_disks; i++)
+    {
+        if(!device_selected(&disks[i], patterns, n_patterns))
+            continue;
+        n_selected++;
+
+        /* new device, or counters reset by re-attaching it */
+        old = find_disk(old_disks, n_old, i, &disks[i]);
+        if(!old || !compute_rates(&disks[i], old, seconds, &rates))
+            continue;
+
+        add_rates(disks[i].name, &rates, w_await, c_await, w_util, c_util);
+        n_checked++;
+
+        if(verbose)
+            printf("  - %s: r/s %.2f w/s %.2f rB/s %.0f wB/s %.0f await %.2f "
+                    "aqu-sz %.2f util %.2f\n", disks[i].name, rates.reads,
+                    rates.writes, rates.read_bytes, rates.write_bytes,
+                    rates.await, rates.queue_depth, rates.util);
+
+        if(rates.util >= max_util)
+        {
+            max_util = rates.util;
+            max_util_name = disks[i].name;
+        }
+        if(rates.await >= max_await)
+        {
+            max_await = rates.await;
+            max_await_name = disks[i].name;
+        }
+
+        dev_rc = OK;
+        if(rates.await > w_await || rates.util > w_util)
+            dev_rc = WARNING;
+        if(rates.await > c_await || rates.util > c_util)
+            dev_rc = CRITICAL;
+        if(dev_rc == OK)
+            continue;
+        if(dev_rc > rc)
+            rc = dev_rc;
+
+        /* name the devices exceeding a threshold */
+        if(len >= 0 && (size_t) len < sizeof(message))
+            len += snprintf(message + len, sizeof(message) - len,
+                    "%s%s await %.2fms util %.2f%%", len ? ", " : "",
+                    disks[i].name, rates.await, rates.util);
+    }
+
+    if(n_selected == 0)
+        exit_with_message(n_patterns ? UNKNOWN : OK, n_patterns ?
+                "no device matches" : "no device did I/O");
+    if(n_checked == 0)
+        output_exit(OK, "%d devices, no previous sample", n_selected);
+
+    if(rc == OK)
+        snprintf(message, sizeof(message), "%d devices, max util %.2f%% (%s), "
+                "max await %.2fms (%s)", n_checked, max_util, max_util_name,
+                max_await, max_await_name);
+
+    output_exit(rc, "%s", message);
+
+    /* suppress compiler warnings */
+    return rc;
+}
@@ -0,0 +1,913 @@
+/*
+ * filename: check_dstate.c
+ *
+ * Checks the tasks in uninterruptible sleep (state D). A task stuck in D
+ * waits in the kernel for a disk, an NFS server or a lock and can't be
+ * killed; a handful of them stalls a database long before the load
+ * average points anywhere. The tasks are grouped by their wchan and, as
+ * root, by the first frame of their kernel stack above the scheduler and
+ * the generic wait and lock functions, which names the blocking subsystem
+ * (filemap_fault, nfs4_do_call_sync, ...).
+ *
+ * The stat of every process comes from a process snapshot, the task
+ * directory is only listed for processes with more than one thread and
+ * the stats of the threads are read in batches. Of a stat only the byte
+ * after the comm is looked at, the lines of tasks in D are split, and only
+ * their wchan and stack are read.
+ *
+ * Tasks in D are kept in $TMPDIR/check_dstate.tmp by tid and starttime,
+ * with the time they were first seen blocked. A task found blocked in
+ * consecutive runs counts as blocked since then, even if it ran in
+ * between, so the duration is accurate to the check interval.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/procsnap.h"
+#include "../include/profile.h"
+
+#define VERSION "0.1"
+#define PROCFS_STAT "stat"
+#define BUFFER_LEN 1024
+
+#define STATE_FILE      "/check_dstate.tmp"
+#define STATE_MAGIC     0x31747364      /* "dst1" */
+
+#define DEFAULT_TOP     5
+#define MAXTOP          64
+#define BATCH           64              /* thread stats per batch */
+#define STAT_LEN        1024
+#define SYMBOL_LEN      64
+#define STACK_LEN       4096
+
+/*
+ * Structure to hold a task in uninterruptible sleep.
+ *
+ * Members:
+ *  - long     pid:       process of the task
+ *  - long     tid:       the task, pid for the main thread
+ *  - uint64_t starttime: starttime of the task, tells a reused tid apart
+ *  - int64_t  since:     CLOCK_BOOTTIME nanoseconds it was first seen in D
+ *  - char     comm:      name of the task
+ *  - char     wchan:     where it waits, "unknown" if not readable
+ *  - char     frame:     first frame of the stack above the waiting
+ *                        functions, empty without a stack
+ */
+typedef struct dtask
+{
+    long        pid;
+    long        tid;
+    uint64_t    starttime;
+    int64_t     since;
+    char        comm[PROCSNAP_COMMLEN];
+    char        wchan[SYMBOL_LEN];
+    char        frame[SYMBOL_LEN];
+} dtask_t;
+
+typedef struct dtasks
+{
+    dtask_t    *tasks;
+    size_t      count;
+    size_t      allocated;
+} dtasks_t;
+
+/*
+ * Structure to hold the tasks of one wchan or frame.
+ *
+ * Members:
+ *  - const char *name:    the wchan or frame
+ *  - long        count:   tasks
+ *  - int64_t     since:   first seen blocked, of the longest one
+ */
+typedef struct group
+{
+    const char *name;
+    long        count;
+    int64_t     since;
+} group_t;
+
+/*
+ * Header of the state file, followed by n_tasks state_task_t sorted by
+ * tid and starttime.
+ */
+typedef struct state_header
+{
+    uint32_t    magic;
+    uint32_t    n_tasks;
+    int64_t     taken;
+} state_header_t;
+
+typedef struct state_task
+{
+    int64_t     tid;
+    uint64_t    starttime;
+    int64_t     since;
+} state_task_t;
+
+/*
+ * Thread stats read with one procfs_read_batch().
+ */
+typedef struct batch
+{
+    procfs_read_t   reads[BATCH];
+    char            paths[BATCH][BUFFER_LEN];
+    char            buffers[BATCH][STAT_LEN];
+    long            pids[BATCH];
+    long            tids[BATCH];
+    int             n;
+} batch_t;
+
+/*
+ * Functions the blocked tasks wait in, which say nothing about why. The
+ * frame of a stack is the first one which starts with none of them.
+ */
+static const char *wait_functions[] = {
+    "schedule", "__schedule", "io_schedule", "preempt_schedule",
+    "wait_", "__wait_", "bit_wait", "out_of_line_wait", "folio_wait",
+    "__folio_lock", "__lock_page", "rwsem_", "down_", "__down", "mutex_",
+    "__mutex", "rt_mutex", "__rt_mutex", "rpc_wait", "__rpc_wait", NULL
+};
+
+static char fallback_tmpdir[] = "/tmp/";
+
+static batch_t batch;
+
+/*
+ * print_help:
+ *
+ * print help output to stdout
+ */
+static void print_help (const char *progname)
+{
+    printf("Usage:\n");
+    printf(" %s [options]\n", progname);
+    printf("\n");
+    printf("Options\n");
+    printf(" -t, --top\t\treport the top N wchans and frames (default: %d)\n",
+            DEFAULT_TOP);
+    printf(" -w, --warning\t\twarning threshold of the tasks in D state\n");
+    printf(" -c, --critical\t\tcritical threshold of the tasks in D state\n");
+    printf("     --warning-duration\twarning threshold of the longest time\n"
+           "\t\t\ta task is blocked (seconds)\n");
+    printf("     --critical-duration\tcritical threshold of the longest\n"
+           "\t\t\ttime a task is blocked (seconds)\n");
+    printf("     --no-threads\tonly check the main thread of every process,\n"
+           "\t\t\tone read per process\n");
+    printf(" -v, --verbose\t\tverbose output, with every blocked task\n");
+    printf(" -F, --format\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("     --textfile\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("     --profile\t\tappend timings of the plugin to the perfdata\n");
+    printf(" -P, --procfs-root\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf("     --cache-ttl\tshare results younger than this (seconds)\n"
+           "\t\t\twith invocations with the same arguments\n");
+    printf("\n");
+    printf("Without root, the kernel stacks are not readable and the tasks\n"
+           "are only grouped by their wchan.\n");
+    printf("\n");
+    printf(" -h, --help\t\tdisplay this help text\n");
+    printf(" -V, --version\t\toutput version information\n");
+}
+
+/*
+ * print_version:
+ *
+ * prints version information to stdout
+ */
+static void print_version()
+{
+    printf("check_dstate (%s)\n", VERSION);
+}
+
+/*
+ * exit_with_message:
+ *
+ * print a message to stdout and exit with return code rc
+ */
+static void exit_with_message(int rc, char *message)
+{
+    output_exit(rc, "%s", message);
+}
+
+/*
+ * get_tmpdir:
+ *
+ * returns TMPDIR or TMP from the environment, "/tmp/" if both are unset
+ */
+static char* get_tmpdir()
+{
+    char    *tmpdir;
+    tmpdir = getenv("TMPDIR");
+
+    if(NULL == tmpdir)
+        tmpdir = getenv("TMP");
+
+    if(NULL == tmpdir)
+        tmpdir = fallback_tmpdir;
+
+    return tmpdir;
+}
+
+/*
+ * add_task:
+ *
+ * appends a task to tasks and returns it
+ */
+static dtask_t* add_task(dtasks_t *tasks, long pid, long tid,
+        uint64_t starttime, const char *comm)
+{
+    dtask_t     *task;
+
+    if(tasks->count == tasks->allocated)
+    {
+        tasks->allocated = tasks->allocated ? tasks->allocated * 2 : 64;
+        if(!(tasks->tasks = realloc(tasks->tasks,
+                        tasks->allocated * sizeof(dtask_t))))
+            exit_with_message(UNKNOWN, "out of memory");
+    }
+
+    task = &tasks->tasks[tasks->count++];
+    memset(task, 0, sizeof(dtask_t));
+    task->pid = pid;
+    task->tid = tid;
+    task->starttime = starttime;
+    snprintf(task->comm, sizeof(task->comm), "%s", comm);
+
+    return task;
+}
+
+/*
+ * parse_task:
+ *
+ * adds the task of a stat line to tasks if it is in D. The state follows
+ * the last ')', only the lines of blocked tasks are split.
+ */
+static void parse_task(long pid, long tid, char *buffer, dtasks_t *tasks)
+{
+    char    *close,
+            *comm,
+            *fields[PROCFS_STAT_INDEX(PROCFS_STAT_STARTTIME) + 1];
+
+    if(!(close = strrchr(buffer, ')')) || close[1] != ' ' || close[2] != 'D')
+        return;
+
+    if(procfs_split_stat(buffer, &comm, fields,
+                PROCFS_STAT_INDEX(PROCFS_STAT_STARTTIME) + 1) <
+            PROCFS_STAT_INDEX(PROCFS_STAT_STARTTIME) + 1)
+        return;
+
+    add_task(tasks, pid, tid, strtoull(
+                fields[PROCFS_STAT_INDEX(PROCFS_STAT_STARTTIME)], NULL, 10),
+            comm);
+}
+
+/*
+ * flush_batch:
+ *
+ * reads the thread stats of the batch and adds the blocked ones to tasks
+ */
+static void flush_batch(dtasks_t *tasks)
+{
+    int     i;
+
+    if(!batch.n)
+        return;
+
+    procfs_read_batch(batch.reads, batch.n);
+    PROFILE_ADD(PROFILE_OPENS, batch.n);
+    PROFILE_ADD(PROFILE_READS, batch.n);
+
+    /* threads gone in between fail with ENOENT or ESRCH */
+    for(i = 0; i < batch.n; i++)
+        if(batch.reads[i].result > 0)
+        {
+            batch.buffers[i][batch.reads[i].result] = '\0';
+            parse_task(batch.pids[i], batch.tids[i], batch.buffers[i], tasks);
+        }
+
+    batch.n = 0;
+}
+
+/*
+ * scan_threads:
+ *
+ * queues the stats of all threads of process pid but the main one, whose
+ * state is already known. Returns the number of threads queued.
+ */
+static long scan_threads(long pid, dtasks_t *tasks)
+{
+    DIR             *dir;
+    struct dirent   *entry;
+    char             path[BUFFER_LEN],
+                    *end;
+    long             tid,
+                     n = 0;
+
+    procfs_path(path, sizeof(path), "%ld/task", pid);
+    if(!(dir = opendir(path)))
+        return 0;
+
+    while((entry = readdir(dir)))
+    {
+        PROFILE_COUNT(PROFILE_DIRENTS);
+        tid = strtol(entry->d_name, &end, 10);
+        if(*end || end == entry->d_name || tid == pid)
+            continue;
+
+        procfs_path(batch.paths[batch.n], BUFFER_LEN, "%ld/task/%ld/stat",
+                pid, tid);
+        batch.reads[batch.n].path = batch.paths[batch.n];
+        batch.reads[batch.n].buffer = batch.buffers[batch.n];
+        batch.reads[batch.n].buffer_len = STAT_LEN - 1;
+        batch.pids[batch.n] = pid;
+        batch.tids[batch.n] = tid;
+        n++;
+
+        if(++batch.n == BATCH)
+            flush_batch(tasks);
+    }
+
+    closedir(dir);
+
+    return n;
+}
+
+/*
+ * scan_tasks:
+ *
+ * adds all tasks in D to tasks, with threads unless no_threads is set.
+ * Returns the number of tasks looked at.
+ */
+static long scan_tasks(dtasks_t *tasks, int no_threads)
+{
+    procsnap_t   snap;
+    size_t       i;
+    long         n = 0;
+
+    if(procsnap_open(&snap) < 0 ||
+            procsnap_load(&snap, PROCSNAP_STAT, NULL, 0) < 0)
+        exit_with_message(UNKNOWN, "could not list the processes");
+
+    for(i = 0; i < snap.count; i++)
+    {
+        /* gone in between */
+        if(snap.gone[i])
+            continue;
+
+        n++;
+        if(snap.state[i] == 'D')
+            add_task(tasks, snap.pids[i], snap.pids[i], snap.starttime[i],
+                    snap.comm[i]);
+
+        if(!no_threads && snap.num_threads[i] > 1)
+            n += scan_threads(snap.pids[i], tasks);
+    }
+
+    flush_batch(tasks);
+    procsnap_close(&snap);
+
+    return n;
+}
+
+/*
+ * read_symbol:
+ *
+ * copies the function name at s, up to the offset, to symbol
+ */
+static void read_symbol(char *symbol, const char *s)
+{
+    size_t  len = strcspn(s, "+ \n");
+
+    if(len >= SYMBOL_LEN)
+        len = SYMBOL_LEN - 1;
+    memcpy(symbol, s, len);
+    symbol[len] = '\0';
+}
+
+/*
+ * is_wait_function:
+ *
+ * returns 1 if the function is one of the generic ones a task waits in
+ */
+static int is_wait_function(const char *symbol)
+{
+    int     i;
+
+    if(strstr(symbol, "schedule"))
+        return 1;
+
+    for(i = 0; wait_functions[i]; i++)
+        if(0 == strncmp(symbol, wait_functions[i], strlen(wait_functions[i])))
+            return 1;
+
+    return 0;
+}
+
+/*
+ * read_details:
+ *
+ * reads the wchan and, if stacks is set, the stack of a blocked task.
+ * Frames are lines like "[<0>] filemap_fault+0x5c4/0xa10". Returns 0 if
+ * the stack is not readable, so the stacks of the other tasks aren't
+ * tried either.
+ */
+static int read_details(dtask_t *task, int stacks)
+{
+    char     path[BUFFER_LEN],
+             buffer[STACK_LEN],
+             symbol[SYMBOL_LEN],
+            *line;
+    long     len;
+
+    procfs_path(path, sizeof(path), "%ld/task/%ld/wchan", task->pid,
+            task->tid);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    len = procfs_read(path, buffer, SYMBOL_LEN);
+
+    /* "0" if the kernel doesn't tell */
+    if(len > 0 && strcmp(buffer, "0") != 0)
+        read_symbol(task->wchan, buffer);
+    else
+        snprintf(task->wchan, sizeof(task->wchan), "unknown");
+
+    if(!stacks)
+        return 0;
+
+    procfs_path(path, sizeof(path), "%ld/task/%ld/stack", task->pid,
+            task->tid);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if((len = procfs_read(path, buffer, sizeof(buffer))) < 0 &&
+            (errno == EACCES || errno == EPERM))
+        return 0;
+
+    for(line = buffer; len > 0 && (line = strstr(line, "] ")); line += 2)
+    {
+        read_symbol(symbol, line + 2);
+
+        /* the first frame, unless one above says more */
+        if(!task->frame[0] || !is_wait_function(symbol))
+            memcpy(task->frame, symbol, SYMBOL_LEN);
+        if(!is_wait_function(symbol))
+            break;
+    }
+
+    return 1;
+}
+
+/*
+ * read_procs_blocked:
+ *
+ * returns procs_blocked of stat, the tasks in D the kernel counts as
+ * waiting for I/O, -1 if it is missing
+ */
+static long read_procs_blocked(void)
+{
+    char    path[BUFFER_LEN],
+           *buffer = NULL,
+           *line;
+    size_t  size = 0;
+    long    blocked = -1;
+
+    procfs_path(path, sizeof(path), PROCFS_STAT);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read_file(path, &buffer, &size) >= 0 &&
+            (line = strstr(buffer, "\nprocs_blocked ")))
+        blocked = atol(line + 15);
+
+    free(buffer);
+
+    return blocked;
+}
+
+/*
+ * cmp_state_task:
+ *
+ * compares two state_task_t by tid and starttime
+ */
+static int cmp_state_task(const void *a, const void *b)
+{
+    const state_task_t  *x = a,
+                        *y = b;
+
+    if(x->tid != y->tid)
+        return x->tid < y->tid ? -1 : 1;
+
+    return x->starttime < y->starttime ? -1 : x->starttime > y->starttime;
+}
+
+/*
+ * read_state:
+ *
+ * reads the tasks blocked at the last run, returns their number
+ */
+static long read_state(const char *path, int64_t now, state_task_t **tasks)
+{
+    FILE            *state_file;
+    state_header_t   header;
+    long             n = 0;
+
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    /* CLOCK_BOOTTIME starts over after a reboot */
+    if(1 == fread(&header, sizeof(header), 1, state_file) &&
+            header.magic == STATE_MAGIC && header.taken <= now &&
+            header.n_tasks &&
+            (*tasks = malloc(header.n_tasks * sizeof(state_task_t))))
+    {
+        if(header.n_tasks == fread(*tasks, sizeof(state_task_t),
+                    header.n_tasks, state_file))
+            n = header.n_tasks;
+    }
+
+    fclose(state_file);
+
+    return n;
+}
+
+/*
+ * write_state:
+ *
+ * writes the blocked tasks, the file is replaced atomically
+ */
+static void write_state(const char *path, int64_t now, const dtasks_t *tasks)
+{
+    FILE            *state_file;
+    state_header_t   header = { STATE_MAGIC, tasks->count, now };
+    state_task_t    *sorted;
+    char             tmp_path[BUFFER_LEN + 32];
+    size_t           i;
+
+    if(!(sorted = malloc((tasks->count + 1) * sizeof(state_task_t))))
+        exit_with_message(UNKNOWN, "out of memory");
+    for(i = 0; i < tasks->count; i++)
+    {
+        sorted[i].tid = tasks->tasks[i].tid;
+        sorted[i].starttime = tasks->tasks[i].starttime;
+        sorted[i].since = tasks->tasks[i].since;
+    }
+    qsort(sorted, tasks->count, sizeof(state_task_t), cmp_state_task);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the state file for writing");
+
+    fwrite(&header, sizeof(header), 1, state_file);
+    if(tasks->count)
+        fwrite(sorted, sizeof(state_task_t), tasks->count, state_file);
+    free(sorted);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the state file");
+    }
+}
+
+/*
+ * add_to_group:
+ *
+ * counts a task in the group of name, the groups are few
+ */
+static long add_to_group(group_t *groups, long n, const char *name,
+        int64_t since)
+{
+    long    i;
+
+    for(i = 0; i < n && strcmp(groups[i].name, name) != 0; i++)
+        ;
+
+    if(i == n)
+    {
+        groups[n].name = name;
+        groups[n].count = 0;
+        groups[n].since = since;
+        n++;
+    }
+
+    groups[i].count++;
+    if(since < groups[i].since)
+        groups[i].since = since;
+
+    return n;
+}
+
+/*
+ * cmp_group:
+ *
+ * compares two groups by their tasks, descending, then by how long they
+ * are blocked
+ */
+static int cmp_group(const void *a, const void *b)
+{
+    const group_t   *x = a,
+                    *y = b;
+
+    if(x->count != y->count)
+        return x->count > y->count ? -1 : 1;
+
+    return x->since < y->since ? -1 : x->since > y->since;
+}
+
+/*
+ * report_groups:
+ *
+ * adds the perfdata of the top n_top groups, named after prefix, and
+ * appends them to message. Returns the new length of message.
+ */
+static int report_groups(const char *label, const char *prefix,
+        group_t *groups, long n_groups, int n_top, int64_t now, char *message,
+        size_t size, int len)
+{
+    char    blocked[32],
+            longest[48];
+    long    i;
+
+    snprintf(blocked, sizeof(blocked), "%s_blocked", prefix);
+    snprintf(longest, sizeof(longest), "%s_blocked_longest", prefix);
+
+    qsort(groups, n_groups, sizeof(group_t), cmp_group);
+
+    for(i = 0; i < n_groups && i < n_top; i++)
+    {
+        output_add_labeled(label, groups[i].name, blocked, "",
+                groups[i].count, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        output_add_labeled(label, groups[i].name, longest, "s",
+                (now - groups[i].since) / 1e9, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+                OUTPUT_UNSET);
+
+        if(len >= 0 && (size_t) len < size)
+            len += snprintf(message + len, size - len, "%s%s%s%s %ld",
+                    i ? ", " : "; ", i ? "" : prefix, i ? "" : ": ",
+                    groups[i].name, groups[i].count);
+    }
+
+    return len;
+}
+
+/*
+ * check_option_value:
+ *
+ * returns 1 if arg is one of the options taking a value
+ */
+static int check_option_value(const char *arg)
+{
+    return check_option(arg, "-t", "--top") ||
+        check_option(arg, "-w", "--warning") ||
+        check_option(arg, "-c", "--critical") ||
+        check_option(arg, "--warning-duration", "--warning-duration") ||
+        check_option(arg, "--critical-duration", "--critical-duration") ||
+        check_option(arg, "-P", "--procfs-root") ||
+        check_option(arg, "-F", "--format") ||
+        check_option(arg, "--textfile", "--textfile") ||
+        check_option(arg, "--cache-ttl", "--cache-ttl");
+}
+
+int PLUGIN_MAIN(check_dstate)(int argc, char *argv[])
+{
+    dtasks_t         tasks = { NULL, 0, 0 };
+    dtask_t         *task,
+                    *longest = NULL;
+    state_task_t    *old = NULL,
+                    *found,
+                     key;
+    group_t         *wchans,
+                    *frames;
+    const char      *progname,
+                    *arg;
+
+    char             err_message[BUFFER_LEN],
+                     path[BUFFER_LEN],
+                     message[4 * BUFFER_LEN],
+                    *tmpdir;
+
+    int64_t          now;
+
+    long             n_tasks,
+                     n_old,
+                     n_wchans = 0,
+                     n_frames = 0,
+                     procs_blocked;
+
+    size_t           i;
+
+    int              verbose = 0,
+                     no_threads = 0,
+                     stacks = 1,
+                     n_top = DEFAULT_TOP,
+                     rc = OK,
+                     len,
+                     j;
+
+    double           cache_ttl = 0,
+                     duration = 0,
+                     w_count = OUTPUT_UNSET,
+                     c_count = OUTPUT_UNSET,
+                     w_duration = OUTPUT_UNSET,
+                     c_duration = OUTPUT_UNSET;
+
+    output_init("check_dstate");
+
+    tmpdir = get_tmpdir();
+
+    /*
+     * parse the given arguments
+     */
+    if(argc > 0)
+    {
+        progname = argv[0];
+        for(j = 1; j < argc; j++)
+        {
+            arg = argv[j];
+
+            /*
+             * if we got a parameter without a value, complain about it
+             */
+            if(check_option_value(arg) && j + 1 >= argc)
+            {
+                snprintf(err_message, BUFFER_LEN,
+                        "you have to provide a value for %s", arg);
+                exit_with_message(UNKNOWN, err_message);
+            }
+
+            if(check_option(arg, "-t", "--top") &&
+                    ((n_top = atoi(argv[++j])) < 1 || n_top > MAXTOP))
+                exit_with_message(UNKNOWN, "--top must be between 1 and 64");
+            if(check_option(arg, "-w", "--warning") &&
+                    (w_count = atof(argv[++j])) < 0)
+                exit_with_message(UNKNOWN, "invalid warning threshold");
+            if(check_option(arg, "-c", "--critical") &&
+                    (c_count = atof(argv[++j])) < 0)
+                exit_with_message(UNKNOWN, "invalid critical threshold");
+            if(check_option(arg, "--warning-duration", "--warning-duration") &&
+                    (w_duration = atof(argv[++j])) < 0)
+                exit_with_message(UNKNOWN,
+                        "invalid warning-duration threshold");
+            if(check_option(arg, "--critical-duration",
+                        "--critical-duration") &&
+                    (c_duration = atof(argv[++j])) < 0)
+                exit_with_message(UNKNOWN,
+                        "invalid critical-duration threshold");
+            if(check_option(arg, "--no-threads", "--no-threads"))
+                no_threads = 1;
+            if(check_option(arg, "-P", "--procfs-root"))
+                procfs_set_root(argv[++j]);
+            if(check_option(arg, "-F", "--format") &&
+                    output_set_format(argv[++j]) != 0)
+                exit_with_message(UNKNOWN, EOUTPUTFORMAT);
+            if(check_option(arg, "--textfile", "--textfile"))
+                output_set_textfile(argv[++j]);
+            if(check_option(arg, "--cache-ttl", "--cache-ttl") &&
+                    (cache_ttl = atof(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, ECACHETTL);
+            if(check_option(arg, "-v", "--verbose"))
+                verbose = 1;
+            if(check_option(arg, "--profile", "--profile") && !profile_enable())
+                exit_with_message(UNKNOWN, ENOPROFILE);
+            if(check_option(arg, "-h", "--help"))
+            {
+                print_help(progname);
+                exit(OK);
+            }
+            if(check_option(arg, "-V", "--version"))
+            {
+                print_version();
+                exit(OK);
+            }
+        }
+    }
+
+    if(verbose)
+    {
+        printf("Environment Variables used:\n");
+        printf("  - tmpdir: %s\n", tmpdir);
+        printf("  - procfs root: %s\n", procfs_root());
+        printf("Parameters:\n");
+        printf("  - top: %d\n", n_top);
+        printf("  - threads: %s\n", no_threads ? "no" : "yes");
+        printf("  - blocked: warning %f critical %f\n", w_count, c_count);
+        printf("  - duration: warning %f critical %f\n", w_duration,
+                c_duration);
+    }
+
+    if(cache_ttl > 0)
+        cache_init("check_dstate", argc, argv, cache_ttl);
+
+    PROFILE_BEGIN("scan");
+    now = procfs_clock_ns();
+    n_tasks = scan_tasks(&tasks, no_threads);
+    procs_blocked = read_procs_blocked();
+    PROFILE_END("scan");
+
+    PROFILE_BEGIN("details");
+    for(i = 0; i < tasks.count; i++)
+        stacks = read_details(&tasks.tasks[i], stacks);
+    PROFILE_END("details");
+
+    /* a task blocked at the last run is blocked since then */
+    PROFILE_BEGIN("state");
+    snprintf(path, sizeof(path), "%s%s", tmpdir, STATE_FILE);
+    n_old = read_state(path, now, &old);
+    for(i = 0; i < tasks.count; i++)
+    {
+        task = &tasks.tasks[i];
+        key.tid = task->tid;
+        key.starttime = task->starttime;
+        found = n_old ? bsearch(&key, old, n_old, sizeof(state_task_t),
+                cmp_state_task) : NULL;
+        task->since = found && found->since <= now ? found->since : now;
+
+        if(!longest || task->since < longest->since)
+            longest = task;
+    }
+    write_state(path, now, &tasks);
+    free(old);
+    PROFILE_END("state");
+
+    if(longest)
+        duration = (now - longest->since) / 1e9;
+
+    if(verbose)
+    {
+        printf("tasks: %ld, procs_blocked: %ld\n", n_tasks, procs_blocked);
+        if(!stacks && tasks.count)
+            printf("the kernel stacks are not readable\n");
+        for(i = 0; i < tasks.count; i++)
+        {
+            task = &tasks.tasks[i];
+            printf("  - %ld/%ld %s: %s%s%s, %.0fs\n", task->pid, task->tid,
+                    task->comm, task->wchan, task->frame[0] ? " in " : "",
+                    task->frame, (now - task->since) / 1e9);
+        }
+    }
+
+    /* comparisons with unset (NaN) thresholds are false */
+    if(tasks.count > w_count || duration > w_duration)
+        rc = WARNING;
+    if(tasks.count > c_count || duration > c_duration)
+        rc = CRITICAL;
+
+    output_add("blocked", "", tasks.count, w_count, c_count, 0, n_tasks);
+    output_add("blocked_longest", "s", duration, w_duration, c_duration, 0,
+            OUTPUT_UNSET);
+    output_add("tasks", "", n_tasks, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+            OUTPUT_UNSET);
+    if(procs_blocked >= 0)
+        output_add("procs_blocked", "", procs_blocked, OUTPUT_UNSET,
+                OUTPUT_UNSET, 0, OUTPUT_UNSET);
+
+    if(!longest)
+    {
+        snprintf(message, sizeof(message),
+                "no task in uninterruptible sleep (%ld tasks)", n_tasks);
+        free(tasks.tasks);
+        exit_with_message(rc, message);
+    }
+
+    len = snprintf(message, sizeof(message),
+            "%zu of %ld tasks in uninterruptible sleep, longest %s (%ld/%ld) "
+            "for %.0fs in %s", tasks.count, n_tasks, longest->comm,
+            longest->pid, longest->tid, duration,
+            longest->frame[0] ? longest->frame : longest->wchan);
+
+    /* the tasks by wchan and, with the stacks, by frame */
+    if(!(wchans = malloc(tasks.count * sizeof(group_t))) ||
+            !(frames = malloc(tasks.count * sizeof(group_t))))
+        exit_with_message(UNKNOWN, "out of memory");
+    for(i = 0; i < tasks.count; i++)
+    {
+        task = &tasks.tasks[i];
+        n_wchans = add_to_group(wchans, n_wchans, task->wchan, task->since);
+        if(task->frame[0])
+            n_frames = add_to_group(frames, n_frames, task->frame,
+                    task->since);
+    }
+
+    len = report_groups("wchan", "wchan", wchans, n_wchans, n_top, now,
+            message, sizeof(message), len);
+    len = report_groups("frame", "stack", frames, n_frames, n_top, now,
+            message, sizeof(message), len);
+    if(!stacks && len >= 0 && (size_t) len < sizeof(message))
+        snprintf(message + len, sizeof(message) - len,
+                "; stacks not readable");
+
+    free(wchans);
+    free(frames);
+    free(tasks.tasks);
+
+    exit_with_message(rc, message);
+
+    return rc;
+}
@@ -0,0 +1,914 @@
+/*
+ * filename: check_interrupts.c
+ *
+ * Checks how interrupts and softirqs are spread over the cpus. Network
+ * throughput collapses when the queue interrupts of a NIC or the NET_RX
+ * softirqs all land on one cpu, long before the host looks busy. Lines of
+ * /proc/interrupts (-i) and /proc/softirqs (-s) are grouped by name
+ * patterns; for every group the per-cpu rates since the last run give the
+ * share of the hottest cpu and the ratio of its rate to the mean over all
+ * cpus.
+ *
+ * Both files are matrices of one column per cpu, thousands of columns wide
+ * on large hosts. They are parsed a chunk at a time as they are read, and
+ * only the counters of lines a group matches are split with
+ * tokenize_u64(), the names are found by the fixed width of the counters.
+ * The summed per-cpu counters of every group are kept in a state file in
+ * $TMPDIR as LEB128 varints, as most cpus see few or no interrupts of a
+ * group: a counter below 128 takes one byte instead of eight.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/profile.h"
+#include "../include/tokenize.h"
+
+#define VERSION "0.1"
+#define PROCFS_INTERRUPTS "interrupts"
+#define PROCFS_SOFTIRQS "softirqs"
+#define BUFFER_LEN 1024
+
+#define STATE_FILE      "check_interrupts"
+#define STATE_MAGIC     0x31717269      /* "irq1" */
+#define MAXGROUPS       16
+#define MAXCPUS         65536
+#define VARINT_MAX      10              /* bytes of a 64 bit varint */
+#define HASH_INIT       14695981039346656037ULL
+#define CHUNK_LEN       262144
+
+/* Groups are only rated against the thresholds above this rate. */
+#define DEFAULT_MIN_RATE    100
+
+/*
+ * define error messages
+ */
+#define EGROUPS     "too many patterns, at most 16 are allowed"
+
+/*
+ * Structure to hold one group of interrupt or softirq lines.
+ *
+ * Members:
+ *  - const char *pattern:  fnmatch() pattern of the group
+ *  - int         softirq:  1 for a group of /proc/softirqs lines
+ *  - uint64_t    key:      hash of the pattern and the file
+ *  - uint64_t    members:  hash of the labels of the matching lines, tells
+ *                          a change of the lines apart from a reset
+ *  - int         n_lines:  number of matching lines
+ *  - uint64_t   *counters: sum of the matching lines per cpu
+ *  - uint64_t   *old:      counters of the last run or NULL
+ */
+typedef struct group
+{
+    const char *pattern;
+    int         softirq;
+    uint64_t    key;
+    uint64_t    members;
+    int         n_lines;
+    uint64_t   *counters;
+    uint64_t   *old;
+} group_t;
+
+/*
+ * Header of the state file. Every group follows as a state_group_t and
+ * the varints of its counters.
+ *
+ * Members:
+ *  - uint32_t magic:    STATE_MAGIC
+ *  - uint32_t n_groups: number of groups
+ *  - uint32_t n_cpus:   number of cpu columns
+ *  - uint32_t reserved: padding
+ *  - uint64_t cpus:     hash of the cpu numbers, tells a cpu hotplug apart
+ *  - int64_t  taken:    CLOCK_BOOTTIME nanoseconds of the sample
+ */
+typedef struct state_header
+{
+    uint32_t    magic;
+    uint32_t    n_groups;
+    uint32_t    n_cpus;
+    uint32_t    reserved;
+    uint64_t    cpus;
+    int64_t     taken;
+} state_header_t;
+
+typedef struct state_group
+{
+    uint64_t    key;
+    uint64_t    members;
+    uint32_t    size;
+    uint32_t    reserved;
+} state_group_t;
+
+/*
+ * Structure to hold the cpu columns of the files.
+ *
+ * Members:
+ *  - int      *ids:    number of the cpu of every column
+ *  - int       count:  number of columns
+ *  - uint64_t  hash:   hash of the cpu numbers
+ */
+typedef struct cpus
+{
+    int        *ids;
+    int         count;
+    uint64_t    hash;
+} cpus_t;
+
+static char fallback_tmpdir[] = "/tmp/";
+
+/*
+ * print_help:
+ *
+ * print help output to stdout
+ */
+static void print_help (const char *progname)
+{
+    printf("Usage:\n");
+    printf(" %s [options]\n", progname);
+    printf("\n");
+    printf("Options\n");
+    printf(" -i, --irq\t\tgroup the interrupts whose number, label or name\n"
+           "\t\t\tmatches this pattern, e.g. 'eth0-TxRx-*'\n");
+    printf(" -s, --softirq\t\tgroup the softirqs matching this pattern\n"
+           "\t\t\t(default: NET_RX and NET_TX)\n");
+    printf(" -w, --warning\t\twarning threshold of the share of the hottest\n"
+           "\t\t\tcpu (%%)\n");
+    printf(" -c, --critical\t\tcritical threshold of the share of the hottest\n"
+           "\t\t\tcpu (%%)\n");
+    printf("     --warning-ratio\twarning threshold of the ratio of the\n"
+           "\t\t\thottest cpu to the mean\n");
+    printf("     --critical-ratio\tcritical threshold of the ratio of the\n"
+           "\t\t\thottest cpu to the mean\n");
+    printf("     --min-rate\t\tonly rate groups above this many per second\n"
+           "\t\t\t(default: %d)\n", DEFAULT_MIN_RATE);
+    printf(" -v, --verbose\t\tverbose output, with the rate of every cpu\n");
+    printf(" -F, --format\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("     --textfile\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("     --profile\t\tappend timings of the plugin to the perfdata\n");
+    printf(" -P, --procfs-root\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf("     --cache-ttl\tshare results younger than this (seconds)\n"
+           "\t\t\twith invocations with the same arguments\n");
+    printf("\n");
+    printf("Each -i and -s (up to 16) is a group of its own.\n");
+    printf("\n");
+    printf(" -h, --help\t\tdisplay this help text\n");
+    printf(" -V, --version\t\toutput version information\n");
+}
+
+/*
+ * print_version:
+ *
+ * prints version information to stdout
+ */
+static void print_version()
+{
+    printf("check_interrupts (%s)\n", VERSION);
+}
+
+/*
+ * exit_with_message:
+ *
+ * print a message to stdout and exit with return code rc
+ */
+static void exit_with_message(int rc, char *message)
+{
+    output_exit(rc, "%s", message);
+}
+
+/*
+ * get_tmpdir:
+ *
+ * returns TMPDIR or TMP from the environment, "/tmp/" if both are unset
+ */
+static char* get_tmpdir()
+{
+    char    *tmpdir;
+    tmpdir = getenv("TMPDIR");
+
+    if(NULL == tmpdir)
+        tmpdir = getenv("TMP");
+
+    if(NULL == tmpdir)
+        tmpdir = fallback_tmpdir;
+
+    return tmpdir;
+}
+
+/*
+ * hash_bytes:
+ *
+ * continues the FNV-1a hash with len bytes
+ */
+static uint64_t hash_bytes(uint64_t hash, const char *s, size_t len)
+{
+    for(; len > 0; len--, s++)
+        hash = (hash ^ (unsigned char) *s) * 1099511628211ULL;
+
+    return hash;
+}
+
+/*
+ * parse_cpus:
+ *
+ * parses the header line "CPU0 CPU1 ..." into the cpu columns
+ */
+static void parse_cpus(const char *line, cpus_t *cpus)
+{
+    char   *p = (char *) line;
+    int     size = 0;
+
+    cpus->count = 0;
+    cpus->hash = HASH_INIT;
+
+    while((p = strstr(p, "CPU")))
+    {
+        if(cpus->count == size)
+        {
+            size = size ? size * 2 : 64;
+            if(!(cpus->ids = realloc(cpus->ids, size * sizeof(int))))
+                exit_with_message(UNKNOWN, "out of memory");
+        }
+        p += 3;
+        cpus->ids[cpus->count] = strtol(p, &p, 10);
+        cpus->hash = hash_bytes(cpus->hash,
+                (const char *) &cpus->ids[cpus->count], sizeof(int));
+        cpus->count++;
+    }
+}
+
+/*
+ * line_matches:
+ *
+ * returns 1 if the pattern matches the label of the line (the irq number
+ * or e.g. NET_RX) or a word of its description, e.g. the name of the
+ * device after the chip and the trigger of /proc/interrupts
+ */
+static int line_matches(const char *pattern, const char *label,
+        const char *desc, size_t desc_len)
+{
+    char    word[BUFFER_LEN];
+    size_t  i = 0,
+            len;
+
+    if(0 == fnmatch(pattern, label, 0))
+        return 1;
+
+    while(i < desc_len)
+    {
+        while(i < desc_len && (desc[i] == ' ' || desc[i] == '\t'))
+            i++;
+        for(len = 0; i + len < desc_len && desc[i + len] != ' ' &&
+                desc[i + len] != '\t'; len++);
+
+        /* several handlers of a shared irq are separated by ", " */
+        if(len > 0 && len < sizeof(word))
+        {
+            memcpy(word, desc + i, len);
+            word[len - (desc[i + len - 1] == ',')] = '\0';
+            if(0 == fnmatch(pattern, word, 0))
+                return 1;
+        }
+        i += len;
+    }
+
+    return 0;
+}
+
+/*
+ * find_desc:
+ *
+ * returns where the description after the counters of a line starts
+ * without splitting them, NULL if the line is not laid out as expected.
+ * The kernel prints every counter right aligned in 10 characters after a
+ * blank, and as the counters are 32 bit they never need more.
+ */
+static char *find_desc(char *counters, char *eol, int n_cpus)
+{
+    char    *desc = counters + (size_t) 11 * n_cpus;
+
+    if(desc > eol || desc[-1] < '0' || desc[-1] > '9' ||
+            (desc < eol && desc[0] != ' ' && desc[0] != '\t'))
+        return NULL;
+
+    return desc;
+}
+
+/*
+ * parse_line:
+ *
+ * adds the per-cpu counters of a line of /proc/interrupts or /proc/softirqs
+ * to the groups of that file matching it. Only the counters of matching
+ * lines are split. Lines with a single counter for all cpus (ERR and MIS)
+ * belong to no group.
+ */
+static void parse_line(char *line, char *eol, int softirq, group_t *groups,
+        int n_groups, const cpus_t *cpus, uint64_t *values)
+{
+    char       *colon,
+               *desc;
+    size_t      used;
+    int         g,
+                c,
+                split = 0;
+
+    while(*line == ' ')
+        line++;
+    if(!(colon = memchr(line, ':', eol - line)))
+        return;
+    *colon = '\0';
+
+    if(!(desc = find_desc(colon + 1, eol, cpus->count)))
+    {
+        if(tokenize_u64(colon + 1, eol - colon - 1, values, cpus->count,
+                    &used) != (size_t) cpus->count)
+            return;
+        desc = colon + 1 + used;
+        split = 1;
+    }
+
+    for(g = 0; g < n_groups; g++)
+    {
+        if(groups[g].softirq != softirq || !line_matches(groups[g].pattern,
+                    line, desc, eol - desc))
+            continue;
+
+        if(!split)
+        {
+            if(tokenize_u64(colon + 1, desc - colon - 1, values, cpus->count,
+                        &used) != (size_t) cpus->count)
+                return;
+            split = 1;
+        }
+
+        if(!groups[g].counters && !(groups[g].counters =
+                    calloc(cpus->count, sizeof(uint64_t))))
+            exit_with_message(UNKNOWN, "out of memory");
+        for(c = 0; c < cpus->count; c++)
+            groups[g].counters[c] += values[c];
+        groups[g].members = hash_bytes(groups[g].members, line,
+                colon - line + 1);
+        groups[g].n_lines++;
+    }
+}
+
+/*
+ * read_matrix:
+ *
+ * reads /proc/interrupts or /proc/softirqs into the groups of that file.
+ * The file is parsed line by line as it is read, a chunk at a time: on
+ * large hosts /proc/interrupts has tens of megabytes, which would
+ * otherwise all have to be faulted in.
+ */
+static void read_matrix(const char *name, int softirq, group_t *groups,
+        int n_groups, cpus_t *cpus)
+{
+    char        path[BUFFER_LEN],
+               *buffer,
+               *start,
+               *end,
+               *eol;
+    uint64_t   *values = NULL;
+    size_t      size = CHUNK_LEN,
+                have = 0;
+    ssize_t     n;
+    int         fd;
+
+    procfs_path(path, sizeof(path), "%s", name);
+    PROFILE_COUNT(PROFILE_OPENS);
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 ||
+            !(buffer = malloc(size)))
+        output_exit(UNKNOWN, "could not read %s", path);
+
+    for(;;)
+    {
+        /* a line longer than the buffer */
+        if(have + 1 >= size && !(buffer = realloc(buffer, size *= 2)))
+            exit_with_message(UNKNOWN, "out of memory");
+
+        PROFILE_COUNT(PROFILE_READS);
+        if((n = read(fd, buffer + have, size - have - 1)) < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            output_exit(UNKNOWN, "could not read %s", path);
+        have += n;
+
+        for(start = buffer, end = buffer + have; start < end; start = eol + 1)
+        {
+            if(!(eol = memchr(start, '\n', end - start)))
+            {
+                /* the rest of the line is still to be read */
+                if(n > 0)
+                    break;
+                eol = end;
+            }
+            *eol = '\0';
+
+            if(values)
+                parse_line(start, eol, softirq, groups, n_groups, cpus,
+                        values);
+            else
+            {
+                parse_cpus(start, cpus);
+                if(cpus->count == 0 || cpus->count > MAXCPUS ||
+                        !(values = malloc(cpus->count * sizeof(uint64_t))))
+                    exit_with_message(UNKNOWN, "could not parse the cpus");
+            }
+        }
+
+        if(start > end)
+            start = end;
+        have = end - start;
+        memmove(buffer, start, have);
+        if(n == 0)
+            break;
+    }
+
+    close(fd);
+    free(buffer);
+    free(values);
+
+    if(cpus->count == 0)
+        exit_with_message(UNKNOWN, "could not parse the cpus");
+}
+
+/*
+ * put_varint:
+ *
+ * appends value as LEB128 varint, returns the number of bytes
+ */
+static size_t put_varint(unsigned char *p, uint64_t value)
+{
+    size_t  n = 0;
+
+    for(; value >= 0x80; value >>= 7)
+        p[n++] = (value & 0x7f) | 0x80;
+    p[n++] = value;
+
+    return n;
+}
+
+/*
+ * get_varint:
+ *
+ * reads a LEB128 varint from p of at most len bytes, returns the number of
+ * bytes or 0 if it is truncated
+ */
+static size_t get_varint(const unsigned char *p, size_t len, uint64_t *value)
+{
+    size_t  n;
+    int     shift = 0;
+
+    *value = 0;
+    for(n = 0; n < len && n < VARINT_MAX; n++, shift += 7)
+    {
+        *value |= (uint64_t) (p[n] & 0x7f) << shift;
+        if(!(p[n] & 0x80))
+            return n + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * state_path:
+ *
+ * builds the path of the state file from a hash of the groups, so checks
+ * of different groups don't share their state
+ */
+static void state_path(char *path, size_t len, const char *tmpdir,
+        const group_t *groups, int n_groups)
+{
+    uint64_t    hash = HASH_INIT;
+    int         g;
+
+    for(g = 0; g < n_groups; g++)
+        hash = hash_bytes(hash, (const char *) &groups[g].key,
+                sizeof(groups[g].key));
+    snprintf(path, len, "%s/%s-%016llx.tmp", tmpdir, STATE_FILE,
+            (unsigned long long) hash);
+}
+
+/*
+ * read_state:
+ *
+ * reads the counters of the last run into the groups whose lines and cpus
+ * are the same, returns the time of the sample or 0
+ */
+static int64_t read_state(const char *path, group_t *groups, int n_groups,
+        const cpus_t *cpus)
+{
+    FILE            *state_file;
+    state_header_t   header;
+    state_group_t    record;
+    unsigned char   *bytes = NULL;
+    size_t           used,
+                     n;
+    uint32_t         n_cpus,
+                     i;
+    int              g,
+                     c;
+
+    /* read_matrix() accepts 1 to MAXCPUS columns only */
+    n_cpus = (uint32_t) cpus->count;
+
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    if(1 != fread(&header, sizeof(header), 1, state_file) ||
+            header.magic != STATE_MAGIC || header.n_cpus != n_cpus ||
+            header.cpus != cpus->hash ||
+            !(bytes = malloc(cpus->count * VARINT_MAX)))
+        header.n_groups = 0;
+
+    for(i = 0; i < header.n_groups; i++)
+    {
+        if(1 != fread(&record, sizeof(record), 1, state_file) ||
+                record.size > n_cpus * VARINT_MAX ||
+                record.size != fread(bytes, 1, record.size, state_file))
+            break;
+
+        for(g = 0; g < n_groups; g++)
+            if(groups[g].key == record.key && groups[g].counters &&
+                    groups[g].members == record.members)
+                break;
+        if(g == n_groups || !(groups[g].old = malloc(cpus->count *
+                        sizeof(uint64_t))))
+            continue;
+
+        for(used = 0, c = 0; c < cpus->count; c++, used += n)
+            if(!(n = get_varint(bytes + used, record.size - used,
+                            &groups[g].old[c])))
+                break;
+        if(c < cpus->count)
+        {
+            free(groups[g].old);
+            groups[g].old = NULL;
+        }
+    }
+
+    free(bytes);
+    fclose(state_file);
+
+    return header.n_groups ? header.taken : 0;
+}
+
+/*
+ * write_state:
+ *
+ * writes the counters of this run, the file is replaced atomically
+ */
+static void write_state(const char *path, int64_t taken,
+        const group_t *groups, int n_groups, const cpus_t *cpus)
+{
+    FILE            *state_file;
+    state_header_t   header = { STATE_MAGIC, 0, cpus->count, 0, cpus->hash,
+                                taken };
+    state_group_t    record = { 0, 0, 0, 0 };
+    unsigned char   *bytes;
+    char             tmp_path[BUFFER_LEN + 32];
+    int              g,
+                     c;
+
+    if(!(bytes = malloc(cpus->count * VARINT_MAX)))
+        exit_with_message(UNKNOWN, "out of memory");
+
+    for(g = 0; g < n_groups; g++)
+        header.n_groups += groups[g].counters != NULL;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the state file "
+                "for writing");
+
+    fwrite(&header, sizeof(header), 1, state_file);
+    for(g = 0; g < n_groups; g++)
+    {
+        if(!groups[g].counters)
+            continue;
+
+        record.key = groups[g].key;
+        record.members = groups[g].members;
+        for(record.size = 0, c = 0; c < cpus->count; c++)
+            record.size += put_varint(bytes + record.size,
+                    groups[g].counters[c]);
+        fwrite(&record, sizeof(record), 1, state_file);
+        fwrite(bytes, 1, record.size, state_file);
+    }
+    free(bytes);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the state file");
+    }
+}
+
+/*
+ * counter_delta:
+ *
+ * returns the increase of a sum of counters. The kernel counts in 32 bit
+ * per cpu and line, so a decrease is a wrap of one (or more) of them.
+ */
+static uint64_t counter_delta(uint64_t value, uint64_t old)
+{
+    if(value < old)
+        value += (((old - value) >> 32) + 1) << 32;
+
+    return value - old;
+}
+
+/*
+ * add_group:
+ */
+static void add_group(group_t *groups, int *n_groups, const char *pattern,
+        int softirq)
+{
+    group_t    *group;
+
+    if(*n_groups == MAXGROUPS)
+        exit_with_message(UNKNOWN, EGROUPS);
+
+    group = &groups[(*n_groups)++];
+    memset(group, 0, sizeof(*group));
+    group->pattern = pattern;
+    group->softirq = softirq;
+    group->key = hash_bytes(HASH_INIT, pattern, strlen(pattern) + 1);
+    group->key = hash_bytes(group->key, softirq ? "s" : "i", 1);
+    group->members = HASH_INIT;
+}
+
+/*
+ * check_option_value:
+ *
+ * returns 1 if arg is one of the options taking a value
+ */
+static int check_option_value(const char *arg)
+{
+    return check_option(arg, "-i", "--irq") ||
+        check_option(arg, "-s", "--softirq") ||
+        check_option(arg, "-w", "--warning") ||
+        check_option(arg, "-c", "--critical") ||
+        check_option(arg, "--warning-ratio", "--warning-ratio") ||
+        check_option(arg, "--critical-ratio", "--critical-ratio") ||
+        check_option(arg, "--min-rate", "--min-rate") ||
+        check_option(arg, "-P", "--procfs-root") ||
+        check_option(arg, "-F", "--format") ||
+        check_option(arg, "--textfile", "--textfile") ||
+        check_option(arg, "--cache-ttl", "--cache-ttl");
+}
+
+int PLUGIN_MAIN(check_interrupts)(int argc, char *argv[])
+{
+    group_t          groups[MAXGROUPS];
+    group_t         *group;
+    cpus_t           cpus = { NULL, 0, 0 },
+                     soft_cpus = { NULL, 0, 0 };
+    const char      *progname,
+                    *arg;
+
+    char             err_message[BUFFER_LEN],
+                     path[BUFFER_LEN],
+                     message[BUFFER_LEN] = "",
+                    *tmpdir;
+
+    uint64_t         delta,
+                     max;
+
+    int64_t          taken,
+                     old_taken;
+
+    int              verbose = 0,
+                     n_groups = 0,
+                     n_irq = 0,
+                     n_checked = 0,
+                     rc = OK,
+                     group_rc,
+                     hottest,
+                     active,
+                     len = 0,
+                     g,
+                     c,
+                     j;
+
+    double           seconds,
+                     rate,
+                     share,
+                     ratio,
+                     cache_ttl = 0,
+                     min_rate = DEFAULT_MIN_RATE,
+                     w_share = OUTPUT_UNSET,
+                     c_share = OUTPUT_UNSET,
+                     w_ratio = OUTPUT_UNSET,
+                     c_ratio = OUTPUT_UNSET;
+
+    output_init("check_interrupts");
+
+    tmpdir = get_tmpdir();
+
+    /*
+     * parse the given arguments
+     */
+    if(argc > 0)
+    {
+        progname = argv[0];
+        for(j = 1; j < argc; j++)
+        {
+            arg = argv[j];
+
+            /*
+             * if we got a parameter without a value, complain about it
+             */
+            if(check_option_value(arg) && j + 1 >= argc)
+            {
+                snprintf(err_message, BUFFER_LEN,
+                        "you have to provide a value for %s", arg);
+                exit_with_message(UNKNOWN, err_message);
+            }
+
+            if(check_option(arg, "-i", "--irq"))
+                add_group(groups, &n_groups, argv[++j], 0);
+            if(check_option(arg, "-s", "--softirq"))
+                add_group(groups, &n_groups, argv[++j], 1);
+            if(check_option(arg, "-w", "--warning"))
+                w_share = atof(argv[++j]);
+            if(check_option(arg, "-c", "--critical"))
+                c_share = atof(argv[++j]);
+            if(check_option(arg, "--warning-ratio", "--warning-ratio"))
+                w_ratio = atof(argv[++j]);
+            if(check_option(arg, "--critical-ratio", "--critical-ratio"))
+                c_ratio = atof(argv[++j]);
+            if(check_option(arg, "--min-rate", "--min-rate") &&
+                    (min_rate = atof(argv[++j])) < 0)
+                exit_with_message(UNKNOWN, "--min-rate must not be negative");
+            if(check_option(arg, "-P", "--procfs-root"))
+                procfs_set_root(argv[++j]);
+            if(check_option(arg, "-F", "--format") &&
+                    output_set_format(argv[++j]) != 0)
+                exit_with_message(UNKNOWN, EOUTPUTFORMAT);
+            if(check_option(arg, "--textfile", "--textfile"))
+                output_set_textfile(argv[++j]);
+            if(check_option(arg, "--cache-ttl", "--cache-ttl") &&
+                    (cache_ttl = atof(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, ECACHETTL);
+            if(check_option(arg, "-v", "--verbose"))
+                verbose = 1;
+            if(check_option(arg, "--profile", "--profile") && !profile_enable())
+                exit_with_message(UNKNOWN, ENOPROFILE);
+            if(check_option(arg, "-h", "--help"))
+            {
+                print_help(progname);
+                exit(OK);
+            }
+            if(check_option(arg, "-V", "--version"))
+            {
+                print_version();
+                exit(OK);
+            }
+        }
+    }
+
+    if(n_groups == 0)
+    {
+        add_group(groups, &n_groups, "NET_RX", 1);
+        add_group(groups, &n_groups, "NET_TX", 1);
+    }
+    for(g = 0; g < n_groups; g++)
+        n_irq += !groups[g].softirq;
+
+    if(verbose)
+    {
+        printf("Environment Variables used:\n");
+        printf("  - tmpdir: %s\n", tmpdir);
+        printf("  - procfs root: %s\n", procfs_root());
+        printf("Parameters:\n");
+        for(g = 0; g < n_groups; g++)
+            printf("  - group: %s %s\n", groups[g].softirq ? "softirq" : "irq",
+                    groups[g].pattern);
+        printf("  - share: warning %f critical %f\n", w_share, c_share);
+        printf("  - ratio: warning %f critical %f\n", w_ratio, c_ratio);
+        printf("  - min rate: %f\n", min_rate);
+    }
+
+    if(cache_ttl > 0)
+        cache_init("check_interrupts", argc, argv, cache_ttl);
+
+    /* Only the files of the groups are read. */
+    PROFILE_BEGIN("read");
+    taken = procfs_clock_ns();
+    if(n_irq > 0)
+        read_matrix(PROCFS_INTERRUPTS, 0, groups, n_groups, &cpus);
+    if(n_irq < n_groups)
+    {
+        read_matrix(PROCFS_SOFTIRQS, 1, groups, n_groups, &soft_cpus);
+        if(n_irq > 0 && (soft_cpus.count != cpus.count ||
+                    soft_cpus.hash != cpus.hash))
+            exit_with_message(UNKNOWN, "the cpus of the interrupts and "
+                    "softirqs differ");
+        if(n_irq == 0)
+            cpus = soft_cpus;
+        else
+            free(soft_cpus.ids);
+    }
+    PROFILE_END("read");
+
+    for(g = 0; g < n_groups; g++)
+    {
+        if(groups[g].n_lines > 0)
+            continue;
+        snprintf(err_message, BUFFER_LEN, "no %s matches %s",
+                groups[g].softirq ? "softirq" : "interrupt", groups[g].pattern);
+        exit_with_message(UNKNOWN, err_message);
+    }
+
+    PROFILE_BEGIN("state");
+    state_path(path, sizeof(path), tmpdir, groups, n_groups);
+    old_taken = read_state(path, groups, n_groups, &cpus);
+    write_state(path, taken, groups, n_groups, &cpus);
+    PROFILE_END("state");
+
+    seconds = (taken - old_taken) / 1e9;
+    for(g = 0; g < n_groups; g++)
+    {
+        group = &groups[g];
+        if(!group->old || !old_taken || seconds <= 0)
+            continue;
+
+        rate = 0;
+        max = 0;
+        hottest = 0;
+        for(c = 0; c < cpus.count; c++)
+        {
+            delta = counter_delta(group->counters[c], group->old[c]);
+            group->counters[c] = delta;
+            rate += delta;
+            if(delta > max)
+            {
+                max = delta;
+                hottest = c;
+            }
+        }
+
+        /* Cpus handling at least a tenth of the mean, stray ones aside. */
+        for(active = 0, c = 0; c < cpus.count; c++)
+            active += group->counters[c] > 0 &&
+                group->counters[c] * 10 * cpus.count >= rate;
+
+        share = rate > 0 ? max / rate * 100 : 0;
+        ratio = rate > 0 ? max / (rate / cpus.count) : 0;
+        rate /= seconds;
+
+        if(verbose)
+        {
+            printf("  - %s %s: %d lines\n", group->softirq ? "softirq" : "irq",
+                    group->pattern, group->n_lines);
+            for(c = 0; c < cpus.count; c++)
+                if(group->counters[c])
+                    printf("      cpu%d: %.2f/s\n", cpus.ids[c],
+                            group->counters[c] / seconds);
+        }
+
+        output_add_labeled("group", group->pattern, "rate", "", rate, OUTPUT_UNSET,
+                OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        output_add_labeled("group", group->pattern, "hottest_share", "%", share,
+                w_share, c_share, 0, 100);
+        output_add_labeled("group", group->pattern, "max_mean_ratio", "", ratio,
+                w_ratio, c_ratio, 0, cpus.count);
+        output_add_labeled("group", group->pattern, "active_cpus", "", active,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, cpus.count);
+        n_checked++;
+
+        /* comparisons with unset (NaN) thresholds are false */
+        group_rc = OK;
+        if(rate >= min_rate && (share > w_share || ratio > w_ratio))
+            group_rc = WARNING;
+        if(rate >= min_rate && (share > c_share || ratio > c_ratio))
+            group_rc = CRITICAL;
+        if(group_rc > rc)
+            rc = group_rc;
+
+        if(len >= 0 && (size_t) len < sizeof(message))
+            len += snprintf(message + len, sizeof(message) - len,
+                    "%s%s %.0f/s, %.2f%% on cpu%d (%.2fx mean, %d cpus)",
+                    len ? ", " : "", group->pattern, rate, share,
+                    cpus.ids[hottest], ratio, active);
+    }
+
+    if(n_checked == 0)
+        output_exit(OK, "%d groups, no previous sample", n_groups);
+
+    output_exit(rc, "%s", message);
+
+    /* suppress compiler warnings */
+    return rc;
+}
@@ -17,12 +17,26 @@
    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/profile.h"
+#include "../include/tokenize.h"
 
 #define VERSION "0.1.1"
-#define PROCFS_MEMINFO "/proc/meminfo"
+#define PROCFS_MEMINFO "meminfo"
+#define PROCFS_BUDDYINFO "buddyinfo"
+#define PROCFS_PAGETYPEINFO "pagetypeinfo"
+#define PROCFS_VMSTAT "vmstat"
 #define BUFFER_LEN 127
 #define MAX_LEN_STATE 7
 
@@ -31,12 +45,86 @@
 #define B_TO_MB ((double) 1024 * 1024) 
 #define B_TO_KB ((double) 1024)
 
+#define FRAG_STATE_FILE     "/check_meminfo_fragmentation.tmp"
+#define FRAG_STATE_MAGIC    0x31676672      /* "rfg1" */
+#define MAX_ORDERS          16              /* buddyinfo has 11 on most kernels */
+
+/*
+ * Order of the --fragmentation mode with its thresholds on the unusable
+ * free space index (in percent).
+ */
+typedef struct order
+{
+    int         order;
+    double      warning;
+    double      critical;
+} order_t;
+
+/*
+ * Free blocks per order of all zones of a node.
+ *
+ * Members:
+ *  - int      node:   number of the node
+ *  - uint64_t blocks: free blocks per order
+ */
+typedef struct node_free
+{
+    int         node;
+    uint64_t    blocks[MAX_ORDERS];
+} node_free_t;
+
+typedef struct nodes
+{
+    node_free_t *nodes;
+    size_t       count;
+    size_t       size;
+    int          n_orders;
+} nodes_t;
+
+/*
+ * Free blocks per order of a migrate type of all zones of a node.
+ */
+typedef struct pagetype
+{
+    int         node;
+    char        type[32];
+    uint64_t    blocks[MAX_ORDERS];
+} pagetype_t;
+
+typedef struct pagetypes
+{
+    pagetype_t *types;
+    size_t      count;
+    size_t      size;
+} pagetypes_t;
+
+/*
+ * State file of the --fragmentation mode.
+ *
+ * Members:
+ *  - uint32_t magic:    FRAG_STATE_MAGIC
+ *  - uint32_t reserved: padding
+ *  - int64_t  taken:    CLOCK_BOOTTIME nanoseconds of the sample
+ *  - uint64_t stall:    compact_stall of vmstat
+ *  - uint64_t fail:     compact_fail of vmstat
+ */
+typedef struct frag_state
+{
+    uint32_t    magic;
+    uint32_t    reserved;
+    int64_t     taken;
+    uint64_t    stall;
+    uint64_t    fail;
+} frag_state_t;
+
+static char fallback_tmpdir[] = "/tmp/";
+
 /*
  * print_help:
  *
  * print help output to stdout
  */
-void print_help (char* progname)
+static void print_help (char* progname)
 {
     printf("Usage:\n");
     printf(" %s [options]\n", progname);
@@ -47,6 +135,25 @@ void print_help (char* progname)
     printf(" -W, --Warning\t\twarning threshold (in percent)\n");
     printf(" -C, --Critical\t\tcriticalthreshold (in percent)\n");
     printf(" -v, --verbose\t\tverbose output\n");
+    printf(" -F, --format\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("     --textfile\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("     --profile\t\tappend timings of the plugin to the perfdata\n");
+    printf("     --cache-ttl\tshare results younger than this (seconds) with\n"
+           "\t\t\tinvocations with the same arguments\n");
+    printf(" -P, --procfs-root\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf("\n");
+    printf("Fragmentation\n");
+    printf("     --fragmentation\tcheck the free memory of every node in blocks of\n"
+           "\t\t\tthe orders of --order from buddyinfo and the rate of\n"
+           "\t\t\tdirect compaction stalls from vmstat\n");
+    printf("     --order\t\tN[:warning[:critical]], rate the share of the free\n"
+           "\t\t\tmemory in blocks below order N (the unusable free\n"
+           "\t\t\tspace index, in percent), repeatable (default: 3 and 9)\n");
+    printf("     --pagetypeinfo\talso report the free memory per migrate type\n"
+           "\t\t\tfrom pagetypeinfo (readable by root only)\n");
+    printf("     --warning-stalls\twarning threshold (compaction stalls per second)\n");
+    printf("     --critical-stalls\tcritical threshold (compaction stalls per second)\n");
     printf("\n");
     printf(" -h, --help\t\tdisplay this help text\n");
     printf(" -V, --version\t\toutput version information\n");
@@ -57,7 +164,7 @@ void print_help (char* progname)
  *
  * prints version information to stdout
  */
-void print_version()
+static void print_version()
 {
     printf("check_meminfo (%s)\n", VERSION);
 }
@@ -65,13 +172,12 @@ void print_version()
 /*
  * print_error:
  *
- * prints a error message to stderr and exit with
+ * prints a error message and exit with
  * return code 3 (UNKNOWN)
  */
-void print_error(char* s_error)
+static void print_error(char* s_error)
 {
-    fprintf(stderr, "%s\n", s_error);
-    exit(3);
+    output_exit(UNKNOWN, "%s", s_error);
 }
 
 /*
@@ -81,7 +187,7 @@ void print_error(char* s_error)
  * It wirte the size of any long int number in a human readable format (kB, MB,
  * GB, TB).
  */
-void make_human_readable(char* human_readable, long int number)
+static void make_human_readable(char* human_readable, long int number)
 {
     if(number >  B_TO_TB)
         sprintf(human_readable, "%.2lf TB", (double) number / B_TO_TB);
@@ -95,16 +201,496 @@ void make_human_readable(char* human_readable, long int number)
         sprintf(human_readable, "%.2lf B", (double)  number);
 }
 
-int main (int argc, char** argv)
+/*
+ * get_tmpdir:
+ *
+ * returns TMPDIR or TMP from the environment, "/tmp/" if both are unset
+ */
+static char* get_tmpdir()
+{
+    char    *tmpdir;
+    tmpdir = getenv("TMPDIR");
+
+    if(NULL == tmpdir)
+        tmpdir = getenv("TMP");
+
+    if(NULL == tmpdir)
+        tmpdir = fallback_tmpdir;
+
+    return tmpdir;
+}
+
+/*
+ * parse_order:
+ *
+ * parses an --order argument "N[:warning[:critical]]"
+ */
+static void parse_order(const char *arg, order_t *order)
+{
+    char    *end;
+
+    order->order = strtol(arg, &end, 10);
+    order->warning = OUTPUT_UNSET;
+    order->critical = OUTPUT_UNSET;
+    if(end == arg || order->order < 0 || order->order >= MAX_ORDERS)
+        print_error("--order must be between 0 and 15");
+
+    if(*end == ':')
+    {
+        arg = end + 1;
+        order->warning = strtod(arg, &end);
+        if(end == arg)
+            order->warning = OUTPUT_UNSET;
+    }
+    if(*end == ':')
+    {
+        arg = end + 1;
+        order->critical = strtod(arg, &end);
+        if(end == arg)
+            order->critical = OUTPUT_UNSET;
+    }
+    if(*end)
+        print_error("--order needs N[:warning[:critical]]");
+}
+
+/*
+ * find_node:
+ *
+ * returns the free blocks of a node, added at the end if it is new. The
+ * files list the zones node after node, so only the last one is compared.
+ */
+static node_free_t *find_node(nodes_t *nodes, int node)
+{
+    node_free_t *last;
+    size_t       i;
+
+    if(nodes->count > 0)
+    {
+        last = &nodes->nodes[nodes->count - 1];
+        if(last->node == node)
+            return last;
+        for(i = 0; i + 1 < nodes->count; i++)
+            if(nodes->nodes[i].node == node)
+                return &nodes->nodes[i];
+    }
+
+    if(nodes->count == nodes->size)
+    {
+        nodes->size = nodes->size ? nodes->size * 2 : 4;
+        if(!(nodes->nodes = realloc(nodes->nodes,
+                        nodes->size * sizeof(node_free_t))))
+            print_error("out of memory");
+    }
+
+    last = &nodes->nodes[nodes->count++];
+    memset(last, 0, sizeof(*last));
+    last->node = node;
+
+    return last;
+}
+
+/*
+ * read_buddyinfo:
+ *
+ * sums the free blocks per order of all zones of every node from
+ * buddyinfo: "Node 0, zone   Normal   3598   3788 ..."
+ */
+static void read_buddyinfo(nodes_t *nodes, int verbose)
+{
+    char        path[BUFFER_LEN],
+               *buffer = NULL,
+               *line,
+               *next;
+    size_t      size = 0,
+                used,
+                n,
+                k;
+    uint64_t    counts[MAX_ORDERS];
+    char        zone[32];
+    int         node,
+                offset;
+    node_free_t *sum;
+
+    procfs_path(path, sizeof(path), PROCFS_BUDDYINFO);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read_file(path, &buffer, &size) < 0)
+        output_exit(UNKNOWN, "%s: %s", path, strerror(errno));
+
+    for(line = buffer; *line; line = next)
+    {
+        next = line + strcspn(line, "\n");
+        if(*next)
+            *next++ = '\0';
+
+        if(2 != sscanf(line, "Node %d, zone %31s%n", &node, zone, &offset))
+            continue;
+        n = tokenize_u64(line + offset, strlen(line + offset), counts,
+                MAX_ORDERS, &used);
+
+        sum = find_node(nodes, node);
+        for(k = 0; k < n; k++)
+            sum->blocks[k] += counts[k];
+        if((int) n > nodes->n_orders)
+            nodes->n_orders = n;
+
+        if(verbose)
+            printf("  - node %d zone %s: %zu orders\n", node, zone, n);
+    }
+
+    free(buffer);
+
+    if(nodes->count == 0)
+        output_exit(UNKNOWN, "%s: no zones", path);
+}
+
+/*
+ * read_pagetypeinfo:
+ *
+ * adds the free blocks per order of every node and migrate type from
+ * pagetypeinfo to types. It is only readable by root, returns 0 if it
+ * can't be read.
+ */
+static int read_pagetypeinfo(pagetypes_t *types)
+{
+    char        path[BUFFER_LEN],
+               *buffer = NULL,
+               *line,
+               *next;
+    size_t      size = 0,
+                used,
+                n,
+                k;
+    uint64_t    counts[MAX_ORDERS];
+    char        zone[32],
+                type[32];
+    int         node,
+                offset;
+    size_t      i;
+    pagetype_t *pagetype;
+
+    procfs_path(path, sizeof(path), PROCFS_PAGETYPEINFO);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read_file(path, &buffer, &size) < 0)
+    {
+        free(buffer);
+        return 0;
+    }
+
+    for(line = buffer; *line; line = next)
+    {
+        next = line + strcspn(line, "\n");
+        if(*next)
+            *next++ = '\0';
+
+        if(3 != sscanf(line, "Node %d, zone %31[^,], type %31s%n", &node,
+                    zone, type, &offset))
+            continue;
+        n = tokenize_u64(line + offset, strlen(line + offset), counts,
+                MAX_ORDERS, &used);
+
+        for(i = 0; i < types->count; i++)
+            if(types->types[i].node == node &&
+                    0 == strcmp(types->types[i].type, type))
+                break;
+        if(i == types->count)
+        {
+            if(types->count == types->size)
+            {
+                types->size = types->size ? types->size * 2 : 8;
+                if(!(types->types = realloc(types->types,
+                                types->size * sizeof(pagetype_t))))
+                    print_error("out of memory");
+            }
+            memset(&types->types[i], 0, sizeof(pagetype_t));
+            types->types[i].node = node;
+            snprintf(types->types[i].type, sizeof(types->types[i].type),
+                    "%s", type);
+            types->count++;
+        }
+
+        pagetype = &types->types[i];
+        for(k = 0; k < n; k++)
+            pagetype->blocks[k] += counts[k];
+    }
+
+    free(buffer);
+
+    return 1;
+}
+
+/*
+ * read_compaction:
+ *
+ * reads the compaction counters from vmstat, returns 0 if there are none
+ */
+static int read_compaction(frag_state_t *state)
+{
+    char        path[BUFFER_LEN],
+               *buffer = NULL,
+               *line,
+               *next;
+    size_t      size = 0;
+    int         found = 0;
+
+    procfs_path(path, sizeof(path), PROCFS_VMSTAT);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read_file(path, &buffer, &size) < 0)
+    {
+        free(buffer);
+        return 0;
+    }
+
+    for(line = buffer; *line; line = next)
+    {
+        next = line + strcspn(line, "\n");
+        if(*next)
+            *next++ = '\0';
+
+        if(0 == strncmp(line, "compact_stall ", 14))
+            found += 1 == sscanf(line + 14, "%" SCNu64, &state->stall);
+        else if(0 == strncmp(line, "compact_fail ", 13))
+            found += 1 == sscanf(line + 13, "%" SCNu64, &state->fail);
+    }
+
+    free(buffer);
+
+    return found == 2;
+}
+
+/*
+ * read_frag_state:
+ *
+ * reads the compaction counters of the last run, returns 0 if there are none
+ */
+static int read_frag_state(const char *tmpdir, frag_state_t *state)
+{
+    FILE    *state_file;
+    char     path[BUFFER_LEN];
+    int      rc;
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, FRAG_STATE_FILE);
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    rc = 1 == fread(state, sizeof(*state), 1, state_file) &&
+        state->magic == FRAG_STATE_MAGIC;
+    fclose(state_file);
+
+    return rc;
+}
+
+/*
+ * write_frag_state:
+ *
+ * writes the compaction counters of this run, the file is replaced
+ * atomically
+ */
+static void write_frag_state(const char *tmpdir, const frag_state_t *state)
+{
+    FILE    *state_file;
+    char     path[BUFFER_LEN],
+             tmp_path[BUFFER_LEN + 32];
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, FRAG_STATE_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+    if(!(state_file = fopen(tmp_path, "w")))
+        print_error("could not open the state file for writing");
+
+    fwrite(state, sizeof(*state), 1, state_file);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        print_error("could not write the state file");
+    }
+}
+
+/*
+ * free_pages:
+ *
+ * returns the free pages in blocks of at least order
+ */
+static uint64_t free_pages(const uint64_t *blocks, int n_orders, int order)
+{
+    uint64_t    pages = 0;
+    int         k;
+
+    for(k = order; k < n_orders; k++)
+        pages += blocks[k] << k;
+
+    return pages;
+}
+
+/*
+ * check_fragmentation:
+ *
+ * checks for every order how much of the free memory of every node is in
+ * blocks of at least that order, i.e. usable for such an allocation, and
+ * the unusable free space index: the share of the free memory in smaller
+ * blocks. Pairs it with the rate of direct compaction stalls and their
+ * failures since the last run, which tell whether the fragmentation
+ * actually hurts allocations. Exits with the result.
+ */
+static void check_fragmentation(const order_t *orders, int n_orders,
+        int pagetypeinfo, double w_stalls, double c_stalls, int verbose)
+{
+    nodes_t          nodes = { NULL, 0, 0, 0 };
+    pagetypes_t      types = { NULL, 0, 0 };
+    frag_state_t     state = { FRAG_STATE_MAGIC, 0, 0, 0, 0 },
+                     old;
+    const pagetype_t *pagetype;
+    char             message[4 * BUFFER_LEN],
+                     human[BUFFER_LEN],
+                     name[BUFFER_LEN],
+                     node[32],
+                    *tmpdir = get_tmpdir();
+    uint64_t         total,
+                     usable;
+    double           unusable,
+                     worst,
+                     seconds,
+                     stalls,
+                     failed;
+    long             page_size = sysconf(_SC_PAGESIZE);
+    size_t           i,
+                     worst_node,
+                     t;
+    int              rc = OK,
+                     order_rc,
+                     have_types,
+                     compaction,
+                     len,
+                     o;
+
+    PROFILE_BEGIN("read");
+    read_buddyinfo(&nodes, verbose);
+    have_types = pagetypeinfo && read_pagetypeinfo(&types);
+    state.taken = procfs_clock_ns();
+    compaction = read_compaction(&state);
+    PROFILE_END("read");
+
+    PROFILE_BEGIN("state");
+    compaction = compaction && read_frag_state(tmpdir, &old) &&
+        state.taken > old.taken;
+    write_frag_state(tmpdir, &state);
+    PROFILE_END("state");
+
+    len = snprintf(message, sizeof(message), "%s", "");
+    for(o = 0; o < n_orders; o++)
+    {
+        if(orders[o].order >= nodes.n_orders)
+            output_exit(UNKNOWN, "order %d is above the largest order %d",
+                    orders[o].order, nodes.n_orders - 1);
+
+        worst = -1;
+        worst_node = 0;
+        for(i = 0; i < nodes.count; i++)
+        {
+            total = free_pages(nodes.nodes[i].blocks, nodes.n_orders, 0);
+            usable = free_pages(nodes.nodes[i].blocks, nodes.n_orders,
+                    orders[o].order);
+            /* Nothing free, no block of this order either. */
+            unusable = total ? (double) (total - usable) / total * 100 : 100;
+
+            snprintf(node, sizeof(node), "%d", nodes.nodes[i].node);
+            snprintf(name, sizeof(name), "free_order%d", orders[o].order);
+            output_add_labeled("node", node, name, "B",
+                    (double) usable * page_size, OUTPUT_UNSET, OUTPUT_UNSET,
+                    0, (double) total * page_size);
+            snprintf(name, sizeof(name), "unusable_order%d", orders[o].order);
+            output_add_labeled("node", node, name, "%", unusable,
+                    orders[o].warning, orders[o].critical, 0, 100);
+
+            for(t = 0; have_types && t < types.count; t++)
+            {
+                pagetype = &types.types[t];
+                if(pagetype->node != nodes.nodes[i].node)
+                    continue;
+                snprintf(name, sizeof(name), "free_order%d_%s",
+                        orders[o].order, pagetype->type);
+                output_add_labeled("node", node, name, "B", (double)
+                        free_pages(pagetype->blocks, nodes.n_orders,
+                            orders[o].order) * page_size,
+                        OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+            }
+
+            if(unusable > worst)
+            {
+                worst = unusable;
+                worst_node = i;
+            }
+        }
+
+        /* comparisons with unset (NaN) thresholds are false */
+        order_rc = OK;
+        if(worst > orders[o].warning)
+            order_rc = WARNING;
+        if(worst > orders[o].critical)
+            order_rc = CRITICAL;
+        if(order_rc > rc)
+            rc = order_rc;
+
+        make_human_readable(human, (long) free_pages(
+                    nodes.nodes[worst_node].blocks, nodes.n_orders,
+                    orders[o].order) * page_size);
+        if(len >= 0 && (size_t) len < sizeof(message))
+            len += snprintf(message + len, sizeof(message) - len,
+                    "%sorder %d: %.2f%% unusable on node %d (%s free)",
+                    o ? ", " : "", orders[o].order, worst,
+                    nodes.nodes[worst_node].node, human);
+    }
+
+    if(compaction)
+    {
+        seconds = (state.taken - old.taken) / 1e9;
+        stalls = (state.stall >= old.stall ? state.stall - old.stall : 0) /
+            seconds;
+        failed = state.fail >= old.fail ? state.fail - old.fail : 0;
+        failed = stalls > 0 ? failed / seconds / stalls * 100 : 0;
+
+        output_add("compact_stalls", "", stalls, w_stalls, c_stalls, 0,
+                OUTPUT_UNSET);
+        output_add("compact_failed", "%", failed, OUTPUT_UNSET, OUTPUT_UNSET,
+                0, 100);
+
+        order_rc = OK;
+        if(stalls > w_stalls)
+            order_rc = WARNING;
+        if(stalls > c_stalls)
+            order_rc = CRITICAL;
+        if(order_rc > rc)
+            rc = order_rc;
+
+        if(len >= 0 && (size_t) len < sizeof(message))
+            snprintf(message + len, sizeof(message) - len,
+                    "; compaction: %.2f stalls/s, %.2f%% failed", stalls,
+                    failed);
+    }
+    else if(len >= 0 && (size_t) len < sizeof(message))
+        snprintf(message + len, sizeof(message) - len,
+                "; compaction: no previous sample");
+
+    if(pagetypeinfo && !have_types && verbose)
+        printf("%s is not readable, migrate types are skipped\n",
+                PROCFS_PAGETYPEINFO);
+
+    free(nodes.nodes);
+    free(types.types);
+
+    output_exit(rc, "%s", message);
+}
+
+int PLUGIN_MAIN(check_meminfo) (int argc, char** argv)
 {
 	FILE                *fd;
 
 	char                 buffer[BUFFER_LEN],
-                        *progname;
-    char                 state[3][9] = {
-                            "OK",
-                            "WARNING",
-                            "CRITICAL"},
+                         meminfo_path[BUFFER_LEN],
+                        *progname,
                          memavailable_human_readable[BUFFER_LEN];
 
 	long int             memtotal = 0,
@@ -128,8 +714,20 @@ int main (int argc, char** argv)
                          i = 0,
                          state_rc = 0;
 
-    double               memavailable_percent = 0;
+    double               memavailable_percent = 0,
+                         cache_ttl = 0;
+
+    order_t              orders[MAX_ORDERS];
+
+    double               warning_stalls = OUTPUT_UNSET,
+                         critical_stalls = OUTPUT_UNSET;
 
+    int                  fragmentation = 0,
+                         pagetypeinfo = 0,
+                         n_orders = 0;
+
+
+    output_init("check_meminfo");
 
     /*
      * parse arguments
@@ -139,7 +737,7 @@ int main (int argc, char** argv)
         progname = argv[0];
         for(i=0; i<argc; i++)
         {
-            if(strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+            if(check_option(argv[i], "-h", "--help"))
             {
                 /*
                  * print help and out
@@ -147,36 +745,89 @@ int main (int argc, char** argv)
                 print_help(progname);
                 exit(0);
             }
-            else if(strcmp(argv[i], "-V") == 0 || strcmp(argv[i], "--version") == 0)
+            else if(check_option(argv[i], "-V", "--version"))
             {
                 print_version();
                 exit(0);
             }
-            else if(strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--warning") == 0)
+            else if(check_option(argv[i], "-w", "--warning"))
             {
                 if(i >= argc-1)
                     print_error("you have to provide a value for warning");
                 warning = atoi(argv[++i]);
             }
-            else if(strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--critical") == 0)
+            else if(check_option(argv[i], "-c", "--critical"))
             {
                 if(i >= argc-1)
                     print_error("you have to provide a value for critical");
                 critical = atoi(argv[++i]);
             }
-            else if(strcmp(argv[i], "-W") == 0 || strcmp(argv[i], "--Warning") == 0)
+            else if(check_option(argv[i], "-W", "--Warning"))
             {
                 if(i >= argc-1)
                     print_error("you have to provide a value for Warning");
                 warning_percent = atoi(argv[++i]);
             }
-            else if(strcmp(argv[i], "-C") == 0 || strcmp(argv[i], "--Critical") == 0)
+            else if(check_option(argv[i], "-C", "--Critical"))
             {
                 if(i >= argc-1)
                     print_error("you have to provide a value for Critical");
                 critical_percent = atoi(argv[++i]);
             }
-            else if(strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0)
+            else if(check_option(argv[i], "-P", "--procfs-root"))
+            {
+                if(i >= argc-1)
+                    print_error("you have to provide a value for procfs-root");
+                procfs_set_root(argv[++i]);
+            }
+            else if(check_option(argv[i], "-F", "--format"))
+            {
+                if(i >= argc-1)
+                    print_error("you have to provide a value for format");
+                if(output_set_format(argv[++i]) != 0)
+                    print_error(EOUTPUTFORMAT);
+            }
+            else if(check_option(argv[i], "--textfile", "--textfile"))
+            {
+                if(i >= argc-1)
+                    print_error("you have to provide a value for textfile");
+                output_set_textfile(argv[++i]);
+            }
+            else if(check_option(argv[i], "--profile", "--profile"))
+            {
+                if(!profile_enable())
+                    print_error(ENOPROFILE);
+            }
+            else if(check_option(argv[i], "--cache-ttl", "--cache-ttl"))
+            {
+                if(i >= argc-1 || (cache_ttl = atof(argv[++i])) <= 0)
+                    print_error(ECACHETTL);
+            }
+            else if(check_option(argv[i], "--fragmentation", "--fragmentation"))
+                fragmentation = 1;
+            else if(check_option(argv[i], "--order", "--order"))
+            {
+                if(i >= argc-1)
+                    print_error("you have to provide a value for order");
+                if(n_orders == MAX_ORDERS)
+                    print_error("too many orders");
+                parse_order(argv[++i], &orders[n_orders++]);
+            }
+            else if(check_option(argv[i], "--pagetypeinfo", "--pagetypeinfo"))
+                pagetypeinfo = 1;
+            else if(check_option(argv[i], "--warning-stalls", "--warning-stalls"))
+            {
+                if(i >= argc-1)
+                    print_error("you have to provide a value for warning-stalls");
+                warning_stalls = atof(argv[++i]);
+            }
+            else if(check_option(argv[i], "--critical-stalls", "--critical-stalls"))
+            {
+                if(i >= argc-1)
+                    print_error("you have to provide a value for critical-stalls");
+                critical_stalls = atof(argv[++i]);
+            }
+            else if(check_option(argv[i], "-v", "--verbose"))
                 verbose = 1;
         }
     }
@@ -213,6 +864,19 @@ int main (int argc, char** argv)
     if(critical_percent != -1 && (critical_percent < 0 || critical_percent > 100))
         print_error("Critical can't be smaler then 0 or greater then 100");
 
+    if(cache_ttl > 0)
+        cache_init("check_meminfo", argc, argv, cache_ttl);
+
+    if(fragmentation)
+    {
+        if(n_orders == 0)
+        {
+            parse_order("3", &orders[n_orders++]);
+            parse_order("9", &orders[n_orders++]);
+        }
+        check_fragmentation(orders, n_orders, pagetypeinfo, warning_stalls,
+                critical_stalls, verbose);
+    }
 
     if(verbose)
         printf("fopen PROGFS_MEMINFO\n");
@@ -220,9 +884,12 @@ int main (int argc, char** argv)
     /*
      * try to open PROGFS_MEMINFO, exit with error any errror occur
      */
-	if ((fd = fopen (PROCFS_MEMINFO, "r")) == NULL)
+    PROFILE_BEGIN("read");
+    procfs_path(meminfo_path, sizeof(meminfo_path), PROCFS_MEMINFO);
+    PROFILE_COUNT(PROFILE_OPENS);
+	if ((fd = fopen (meminfo_path, "r")) == NULL)
     {
-        perror("fopen() (PROGFS_MEMINFO) failed"); exit(3);
+        output_exit(UNKNOWN, "%s: %s", meminfo_path, strerror(errno));
     }
 
     /*
@@ -230,6 +897,7 @@ int main (int argc, char** argv)
      * Because the in PROCFS_MEMINFO are kB we have to multiply this with 1024.
      */
 	while ( fgets(buffer, BUFFER_LEN, fd) != NULL) {
+        PROFILE_COUNT(PROFILE_READS);
 
 		if (sscanf (buffer, "MemTotal:%ldkB", &memtotal)) {
             memtotal *= 1024;
@@ -248,6 +916,7 @@ int main (int argc, char** argv)
 	}
 
 	fclose (fd);
+    PROFILE_END("read");
 
     if(verbose)
         printf("fclose PROGFS_MEMINFO\n");
@@ -256,8 +925,7 @@ int main (int argc, char** argv)
      * if memory is zero we did something wrong
      */
     if (memtotal == 0) {
-        fprintf(stderr, "No memory? quitting..\n");
-        exit(3);
+        print_error("No memory? quitting..");
     }
 
 	memused = memtotal - memfree - membuffer - memcached;
@@ -313,18 +981,17 @@ int main (int argc, char** argv)
 
     make_human_readable((char*)&memavailable_human_readable, memavailable);
 
-	printf(
-        "%s - Free: %4.2f %% (%s) "
-        "|memavailable=%ldB;%ld;%ld;0.0, memtotal=%ld;0.0;0.0;0.0; "
-        "memused=%ld;0.0;0.0;0.0; membuffer=%ld;0.0;0.0;0.0; "
-        "memcached=%ld;0.0;0.0;0.0; swaptotal=%ld;0.0;0.0;0.0; "
-        "swapused=%ld;0.0;0.0;0.0;\n",
-		state[state_rc], memavailable_percent, memavailable_human_readable,
-        memavailable, warning,
-        critical, memtotal,
-        memused, membuffer,
-        memcached, swaptotal,
-        swapused);
-
-    exit(state_rc);
+    /*
+     * all values are bytes, ranging from 0 to the respective total
+     */
+    output_add("memavailable", "B", memavailable, warning, critical, 0, memtotal);
+    output_add("memtotal", "B", memtotal, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add("memused", "B", memused, OUTPUT_UNSET, OUTPUT_UNSET, 0, memtotal);
+    output_add("membuffer", "B", membuffer, OUTPUT_UNSET, OUTPUT_UNSET, 0, memtotal);
+    output_add("memcached", "B", memcached, OUTPUT_UNSET, OUTPUT_UNSET, 0, memtotal);
+    output_add("swaptotal", "B", swaptotal, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add("swapused", "B", swapused, OUTPUT_UNSET, OUTPUT_UNSET, 0, swaptotal);
+
+    output_exit(state_rc, "Free: %4.2f %% (%s)",
+            memavailable_percent, memavailable_human_readable);
 }
@@ -0,0 +1,948 @@
+/*
+ * filename: check_netdev.c
+ *
+ * Checks the traffic of network interfaces: bits, packets, drops and errors
+ * per second in both directions since the last run, and the utilisation
+ * relative to the link speed from sysfs. The counters of the last run are
+ * kept in $TMPDIR/check_netdev.tmp with a nanosecond timestamp per
+ * interface, so checks of different interfaces share the state file.
+ *
+ * The counters are read from /proc/net/dev. Interfaces are filtered by name
+ * before their counters are parsed, as container hosts list thousands of
+ * veth interfaces. With --sysfs the counters of the given interfaces are
+ * read from <sysfs>/class/net/<interface>/statistics/ instead, so the kernel
+ * doesn't format the counters of all other interfaces at all. Patterns with
+ * wildcards are expanded by listing <sysfs>/class/net.
+ */
+
+#include <dirent.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/profile.h"
+
+#define VERSION "0.1"
+#define PROCFS_NETDEV "net/dev"
+#define SYSFS_DEFAULT_ROOT "/sys"
+#define BUFFER_LEN 1024
+
+#define STATE_FILE      "/check_netdev.tmp"
+#define STATE_MAGIC     0x3176646e      /* "ndv1" */
+#define IFNAME_LEN      32
+
+/*
+ * Without a listing of all interfaces, interfaces of the state file which
+ * were not sampled for this long (ns) are dropped, e.g. veths of removed
+ * containers with --sysfs.
+ */
+#define STATE_MAX_AGE   (3600 * 1000000000LL)
+#define MAXPATTERNS     16
+
+/* Counters kept per interface. */
+#define NET_RX_BYTES    0
+#define NET_RX_PACKETS  1
+#define NET_RX_ERRORS   2
+#define NET_RX_DROPS    3
+#define NET_TX_BYTES    4
+#define NET_TX_PACKETS  5
+#define NET_TX_ERRORS   6
+#define NET_TX_DROPS    7
+#define NET_COUNTERS    8
+
+/* Columns of /proc/net/dev: 8 receive and 8 transmit counters. */
+#define NETDEV_COLUMNS  16
+
+/*
+ * define error messages
+ */
+#define EPATTERNS   "too many interface patterns, at most 16 are allowed"
+#define ESYSFS      "--sysfs needs interface names given with -i"
+
+/* Column of /proc/net/dev and file in sysfs of every counter. */
+static const int netdev_columns[NET_COUNTERS] = { 0, 1, 2, 3, 8, 9, 10, 11 };
+static const char *sysfs_counters[NET_COUNTERS] = {
+    "rx_bytes", "rx_packets", "rx_errors", "rx_dropped",
+    "tx_bytes", "tx_packets", "tx_errors", "tx_dropped"
+};
+
+/*
+ * Structure to hold the counters of one interface. This is also the record
+ * of the state file, so keep it free of padding.
+ *
+ * Members:
+ *  - char     name[]:     name of the interface
+ *  - int64_t  taken:      CLOCK_BOOTTIME nanoseconds of the sample
+ *  - uint64_t counters[]: the NET_* counters
+ */
+typedef struct netdev
+{
+    char        name[IFNAME_LEN];
+    int64_t     taken;
+    uint64_t    counters[NET_COUNTERS];
+} netdev_t;
+
+/*
+ * Header of the state file, the interfaces follow sorted by name.
+ */
+typedef struct state_header
+{
+    uint32_t    magic;
+    uint32_t    count;
+} state_header_t;
+
+/*
+ * Structure to hold the selection of interfaces.
+ */
+typedef struct selection
+{
+    char       *includes[MAXPATTERNS];
+    char       *excludes[MAXPATTERNS];
+    int         n_includes,
+                n_excludes;
+} selection_t;
+
+/*
+ * Structure to hold the interfaces of this and of the last run.
+ *
+ * Members:
+ *  - netdev_t *devs:  interfaces selected in this run
+ *  - netdev_t *old:   interfaces of the state file, sorted by name
+ *  - char     *seen:  per old interface: still listed in /proc/net/dev
+ *                     or <sysfs>/class/net
+ *  - char     *used:  per old interface: selected in this run
+ *  - int       listed: 1 if all interfaces were listed, so seen is
+ *                      complete
+ */
+typedef struct netdevs
+{
+    netdev_t   *devs,
+               *old;
+    char       *seen,
+               *used;
+    size_t      count,
+                size,
+                n_old;
+    int         listed;
+} netdevs_t;
+
+static char fallback_tmpdir[] = "/tmp/";
+
+/*
+ * print_help:
+ *
+ * print help output to stdout
+ */
+static void print_help (const char *progname)
+{
+    printf("Usage:\n");
+    printf(" %s [options]\n", progname);
+    printf("\n");
+    printf("Options\n");
+    printf(" -i, --interface\tcheck the interfaces matching this pattern, may\n"
+           "\t\t\tbe given up to 16 times (default: all but lo)\n");
+    printf(" -x, --exclude\t\tskip the interfaces matching this pattern\n");
+    printf(" -w, --warning\t\twarning threshold of the utilisation (%%)\n");
+    printf(" -c, --critical\t\tcritical threshold of the utilisation (%%)\n");
+    printf("     --warning-drops\twarning threshold of drops per second\n");
+    printf("     --critical-drops\tcritical threshold of drops per second\n");
+    printf("     --warning-errors\twarning threshold of errors per second\n");
+    printf("     --critical-errors\tcritical threshold of errors per second\n");
+    printf("     --speed\t\tlink speed in Mbit/s (default: from sysfs)\n");
+    printf("     --sysfs\t\tread the counters of the -i interfaces from sysfs\n");
+    printf("     --sysfs-root\tsysfs root (default: %s)\n", SYSFS_DEFAULT_ROOT);
+    printf(" -v, --verbose\t\tverbose output\n");
+    printf(" -F, --format\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("     --textfile\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("     --profile\t\tappend timings of the plugin to the perfdata\n");
+    printf(" -P, --procfs-root\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf("     --cache-ttl\tshare results younger than this (seconds)\n"
+           "\t\t\twith invocations with the same arguments\n");
+    printf("\n");
+    printf(" -h, --help\t\tdisplay this help text\n");
+    printf(" -V, --version\t\toutput version information\n");
+}
+
+/*
+ * print_version:
+ *
+ * prints version information to stdout
+ */
+static void print_version()
+{
+    printf("check_netdev (%s)\n", VERSION);
+}
+
+/*
+ * exit_with_message:
+ *
+ * print a message to stdout and exit with return code rc
+ */
+static void exit_with_message(int rc, char *message)
+{
+    output_exit(rc, "%s", message);
+}
+
+/*
+ * get_tmpdir:
+ *
+ * returns TMPDIR or TMP from the environment, "/tmp/" if both are unset
+ */
+static char* get_tmpdir()
+{
+    char    *tmpdir;
+    tmpdir = getenv("TMPDIR");
+
+    if(NULL == tmpdir)
+        tmpdir = getenv("TMP");
+
+    if(NULL == tmpdir)
+        tmpdir = fallback_tmpdir;
+
+    return tmpdir;
+}
+
+/*
+ * parse_number:
+ *
+ * parses a decimal number after optional blanks
+ */
+static char *parse_number(char *p, uint64_t *value)
+{
+    uint64_t    n = 0;
+
+    while(*p == ' ' || *p == '\t')
+        p++;
+    while(*p >= '0' && *p <= '9')
+        n = n * 10 + (*p++ - '0');
+    *value = n;
+
+    return p;
+}
+
+/*
+ * cmp_netdev:
+ */
+static int cmp_netdev(const void *a, const void *b)
+{
+    return strcmp(((const netdev_t *) a)->name, ((const netdev_t *) b)->name);
+}
+
+/*
+ * interface_selected:
+ *
+ * returns 1 if the interface matches an include pattern (or is not lo
+ * without include patterns) and no exclude pattern
+ */
+static int interface_selected(const selection_t *sel, const char *name)
+{
+    int     i;
+
+    for(i = 0; i < sel->n_excludes; i++)
+        if(0 == fnmatch(sel->excludes[i], name, 0))
+            return 0;
+
+    if(sel->n_includes == 0)
+        return 0 != strcmp(name, "lo");
+
+    for(i = 0; i < sel->n_includes; i++)
+        if(0 == fnmatch(sel->includes[i], name, 0))
+            return 1;
+
+    return 0;
+}
+
+/*
+ * find_old:
+ *
+ * returns the index of the interface in the state or -1
+ */
+static long find_old(const netdevs_t *nd, const char *name)
+{
+    const netdev_t  *old;
+    netdev_t         key;
+
+    if(strlen(name) >= IFNAME_LEN)
+        return -1;
+    strcpy(key.name, name);
+
+    old = bsearch(&key, nd->old, nd->n_old, sizeof(netdev_t), cmp_netdev);
+
+    return old ? old - nd->old : -1;
+}
+
+/*
+ * add_netdev:
+ *
+ * returns a new interface of this run
+ */
+static netdev_t *add_netdev(netdevs_t *nd, const char *name, size_t len,
+        int64_t taken)
+{
+    netdev_t   *dev;
+
+    if(nd->count == nd->size)
+    {
+        nd->size = nd->size ? nd->size * 2 : 16;
+        if(!(nd->devs = realloc(nd->devs, nd->size * sizeof(netdev_t))))
+            exit_with_message(UNKNOWN, "out of memory");
+    }
+
+    dev = &nd->devs[nd->count++];
+    memset(dev, 0, sizeof(*dev));
+    memcpy(dev->name, name, len);
+    dev->taken = taken;
+
+    return dev;
+}
+
+/*
+ * parse_netdev:
+ *
+ * parses the selected interfaces of /proc/net/dev. Names are matched before
+ * the counters are parsed, the old interfaces of all listed ones are marked
+ * as seen.
+ */
+static void parse_netdev(char *buffer, const selection_t *sel, netdevs_t *nd,
+        int64_t taken)
+{
+    netdev_t   *dev;
+    uint64_t    columns[NETDEV_COLUMNS];
+    char       *p,
+               *next,
+               *name,
+               *colon;
+    long        old;
+    int         i;
+
+    /* skip the two header lines */
+    p = buffer;
+    for(i = 0; i < 2 && (p = strchr(p, '\n')); i++)
+        p++;
+
+    for(; p && *p; p = next)
+    {
+        if((next = strchr(p, '\n')))
+            *next++ = '\0';
+
+        while(*p == ' ')
+            p++;
+        if(!(colon = strchr(p, ':')) || colon - p >= IFNAME_LEN)
+            continue;
+        name = p;
+        *colon = '\0';
+        p = colon + 1;
+
+        if((old = find_old(nd, name)) >= 0)
+            nd->seen[old] = 1;
+
+        if(!interface_selected(sel, name))
+            continue;
+
+        for(i = 0; i < NETDEV_COLUMNS; i++)
+            p = parse_number(p, &columns[i]);
+
+        dev = add_netdev(nd, name, colon - name, taken);
+        for(i = 0; i < NET_COUNTERS; i++)
+            dev->counters[i] = columns[netdev_columns[i]];
+    }
+
+    nd->listed = 1;
+}
+
+/*
+ * has_wildcard:
+ *
+ * returns 1 if the pattern is not a plain interface name
+ */
+static int has_wildcard(const char *pattern)
+{
+    return NULL != strpbrk(pattern, "*?[");
+}
+
+/*
+ * read_sysfs_counters:
+ *
+ * reads the counters of one interface from sysfs. If that fails, the
+ * plugin exits with UNKNOWN if the interface was named explicitly, otherwise it
+ * is gone since the listing and dropped.
+ */
+static void read_sysfs_counters(const char *sysfs_root, netdevs_t *nd,
+        netdev_t *dev, int named)
+{
+    char        path[BUFFER_LEN],
+                buffer[64];
+    int         j;
+
+    for(j = 0; j < NET_COUNTERS; j++)
+    {
+        snprintf(path, sizeof(path), "%s/class/net/%s/statistics/%s",
+                sysfs_root, dev->name, sysfs_counters[j]);
+        PROFILE_COUNT(PROFILE_OPENS);
+        PROFILE_COUNT(PROFILE_READS);
+        if(procfs_read(path, buffer, sizeof(buffer)) <= 0)
+        {
+            if(!named)
+            {
+                nd->count--;
+                return;
+            }
+            output_exit(UNKNOWN, "could not read %s", path);
+        }
+        dev->counters[j] = strtoull(buffer, NULL, 10);
+    }
+}
+
+/*
+ * read_sysfs:
+ *
+ * reads the counters of the interfaces selected by the include patterns
+ * from sysfs. Plain names are read directly, only wildcards need a listing
+ * of <sysfs>/class/net, which marks the old interfaces of all listed ones
+ * as seen.
+ */
+static void read_sysfs(const char *sysfs_root, const selection_t *sel,
+        netdevs_t *nd, int64_t taken)
+{
+    DIR            *dir;
+    struct dirent  *entry;
+    char            path[BUFFER_LEN];
+    long            old;
+    int             wildcards = 0,
+                    literal,
+                    i;
+
+    for(i = 0; i < sel->n_includes; i++)
+    {
+        if(has_wildcard(sel->includes[i]))
+        {
+            wildcards = 1;
+            continue;
+        }
+        if(strlen(sel->includes[i]) >= IFNAME_LEN ||
+                !interface_selected(sel, sel->includes[i]))
+            continue;
+
+        read_sysfs_counters(sysfs_root, nd, add_netdev(nd, sel->includes[i],
+                    strlen(sel->includes[i]), taken), 1);
+    }
+
+    if(!wildcards)
+        return;
+
+    snprintf(path, sizeof(path), "%s/class/net", sysfs_root);
+    PROFILE_COUNT(PROFILE_OPENS);
+    if(!(dir = opendir(path)))
+        output_exit(UNKNOWN, "could not list %s", path);
+
+    while((entry = readdir(dir)))
+    {
+        if(entry->d_name[0] == '.' || strlen(entry->d_name) >= IFNAME_LEN)
+            continue;
+
+        if((old = find_old(nd, entry->d_name)) >= 0)
+            nd->seen[old] = 1;
+
+        if(!interface_selected(sel, entry->d_name))
+            continue;
+
+        /* plain names were read above */
+        for(literal = 0, i = 0; i < sel->n_includes && !literal; i++)
+            literal = !has_wildcard(sel->includes[i]) &&
+                0 == strcmp(sel->includes[i], entry->d_name);
+        if(literal)
+            continue;
+
+        read_sysfs_counters(sysfs_root, nd, add_netdev(nd, entry->d_name,
+                    strlen(entry->d_name), taken), 0);
+    }
+
+    closedir(dir);
+    nd->listed = 1;
+}
+
+/*
+ * read_state:
+ *
+ * reads the interfaces of the former runs
+ */
+static void read_state(char *tmpdir, netdevs_t *nd)
+{
+    FILE            *state_file;
+    state_header_t   header;
+    char             path[BUFFER_LEN];
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, STATE_FILE);
+
+    if(!(state_file = fopen(path, "r")))
+        return;
+
+    if(1 == fread(&header, sizeof(header), 1, state_file) &&
+            header.magic == STATE_MAGIC &&
+            (nd->old = malloc((header.count + 1) * sizeof(netdev_t))) &&
+            header.count == fread(nd->old, sizeof(netdev_t), header.count,
+                state_file))
+        nd->n_old = header.count;
+
+    fclose(state_file);
+}
+
+/*
+ * write_state:
+ *
+ * writes the interfaces of this run and those of former runs which are
+ * still listed but were not selected, sorted by name. If the interfaces
+ * were not listed, those of former runs are kept for STATE_MAX_AGE after
+ * their sample was taken. The file is replaced atomically, so concurrent
+ * runs never read a partial state.
+ */
+static void write_state(char *tmpdir, netdevs_t *nd, int64_t taken)
+{
+    FILE            *state_file;
+    state_header_t   header = { STATE_MAGIC, 0 };
+    netdev_t        *all;
+    char             path[BUFFER_LEN],
+                     tmp_path[BUFFER_LEN + 32];
+    size_t           i;
+
+    if(!(all = malloc((nd->count + nd->n_old + 1) * sizeof(netdev_t))))
+        exit_with_message(UNKNOWN, "out of memory");
+
+    memcpy(all, nd->devs, nd->count * sizeof(netdev_t));
+    header.count = nd->count;
+    for(i = 0; i < nd->n_old; i++)
+        if(!nd->used[i] && (nd->listed ? nd->seen[i] :
+                    nd->old[i].taken <= taken &&
+                    taken - nd->old[i].taken < STATE_MAX_AGE))
+            all[header.count++] = nd->old[i];
+    qsort(all, header.count, sizeof(netdev_t), cmp_netdev);
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, STATE_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the state file "
+                "for writing");
+
+    fwrite(&header, sizeof(header), 1, state_file);
+    fwrite(all, sizeof(netdev_t), header.count, state_file);
+    free(all);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the state file");
+    }
+}
+
+/*
+ * counter_delta:
+ *
+ * returns the increase of a counter in delta. Counters of 32 bit drivers
+ * wrap at 2^32; any other decrease means the interface was reset (e.g.
+ * recreated or its driver reloaded), then 0 is returned.
+ */
+static int counter_delta(uint64_t value, uint64_t old, uint64_t *delta)
+{
+    if(value >= old)
+    {
+        *delta = value - old;
+        return 1;
+    }
+
+    /* a wrap only if the old value was in the upper half */
+    if(old <= UINT32_MAX && old - value > UINT32_MAX / 2)
+    {
+        *delta = value + ((uint64_t) UINT32_MAX + 1) - old;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * read_speed:
+ *
+ * returns the link speed of the interface in Mbit/s from sysfs, 0 if it is
+ * unknown, e.g. for virtual interfaces
+ */
+static long read_speed(const char *sysfs_root, const char *name)
+{
+    char    path[BUFFER_LEN],
+            buffer[64];
+    long    speed;
+
+    snprintf(path, sizeof(path), "%s/class/net/%s/speed", sysfs_root, name);
+    PROFILE_COUNT(PROFILE_OPENS);
+    if(procfs_read(path, buffer, sizeof(buffer)) <= 0)
+        return 0;
+
+    speed = atol(buffer);
+
+    return speed > 0 ? speed : 0;
+}
+
+/*
+ * format_bits:
+ *
+ * formats bits per second with a unit prefix
+ */
+static const char *format_bits(char *buffer, size_t len, double bits)
+{
+    if(bits >= 1e9)
+        snprintf(buffer, len, "%.2fGbit/s", bits / 1e9);
+    else if(bits >= 1e6)
+        snprintf(buffer, len, "%.2fMbit/s", bits / 1e6);
+    else if(bits >= 1e3)
+        snprintf(buffer, len, "%.2fkbit/s", bits / 1e3);
+    else
+        snprintf(buffer, len, "%.0fbit/s", bits);
+
+    return buffer;
+}
+
+/*
+ * check_option_value:
+ *
+ * returns 1 if arg is one of the options taking a value
+ */
+static int check_option_value(const char *arg)
+{
+    return check_option(arg, "-i", "--interface") ||
+        check_option(arg, "-x", "--exclude") ||
+        check_option(arg, "-w", "--warning") ||
+        check_option(arg, "-c", "--critical") ||
+        check_option(arg, "--warning-drops", "--warning-drops") ||
+        check_option(arg, "--critical-drops", "--critical-drops") ||
+        check_option(arg, "--warning-errors", "--warning-errors") ||
+        check_option(arg, "--critical-errors", "--critical-errors") ||
+        check_option(arg, "--speed", "--speed") ||
+        check_option(arg, "--sysfs-root", "--sysfs-root") ||
+        check_option(arg, "-P", "--procfs-root") ||
+        check_option(arg, "-F", "--format") ||
+        check_option(arg, "--textfile", "--textfile") ||
+        check_option(arg, "--cache-ttl", "--cache-ttl");
+}
+
+int PLUGIN_MAIN(check_netdev)(int argc, char *argv[])
+{
+    selection_t      sel;
+    netdevs_t        nd;
+    const netdev_t  *dev,
+                    *old;
+    const char      *progname,
+                    *arg,
+                    *sysfs_root = SYSFS_DEFAULT_ROOT;
+
+    char             err_message[BUFFER_LEN],
+                     path[BUFFER_LEN],
+                     message[BUFFER_LEN] = "",
+                     rx_bits[32],
+                     tx_bits[32],
+                    *tmpdir,
+                    *buffer = NULL;
+
+    uint64_t         d[NET_COUNTERS];
+
+    size_t           buffer_size = 0,
+                     i;
+
+    int64_t          taken;
+    long             index,
+                     speed,
+                     link_speed = 0;
+
+    int              verbose = 0,
+                     use_sysfs = 0,
+                     n_checked = 0,
+                     n_new = 0,
+                     rc = OK,
+                     dev_rc,
+                     len = 0,
+                     j;
+
+    double           seconds,
+                     cache_ttl = 0,
+                     rx_bps,
+                     tx_bps,
+                     rx_drops,
+                     tx_drops,
+                     rx_errors,
+                     tx_errors,
+                     util,
+                     total_rx = 0,
+                     total_tx = 0,
+                     total_drops = 0,
+                     total_errors = 0,
+                     w_util = OUTPUT_UNSET,
+                     c_util = OUTPUT_UNSET,
+                     w_drops = OUTPUT_UNSET,
+                     c_drops = OUTPUT_UNSET,
+                     w_errors = OUTPUT_UNSET,
+                     c_errors = OUTPUT_UNSET;
+
+    output_init("check_netdev");
+
+    memset(&sel, 0, sizeof(sel));
+    memset(&nd, 0, sizeof(nd));
+    tmpdir = get_tmpdir();
+
+    /*
+     * parse the given arguments
+     */
+    if(argc > 0)
+    {
+        progname = argv[0];
+        for(j = 1; j < argc; j++)
+        {
+            arg = argv[j];
+
+            /*
+             * if we got a parameter without a value, complain about it
+             */
+            if(check_option_value(arg) && j + 1 >= argc)
+            {
+                snprintf(err_message, BUFFER_LEN,
+                        "you have to provide a value for %s", arg);
+                exit_with_message(UNKNOWN, err_message);
+            }
+
+            if(check_option(arg, "-i", "--interface"))
+            {
+                if(sel.n_includes == MAXPATTERNS)
+                    exit_with_message(UNKNOWN, EPATTERNS);
+                sel.includes[sel.n_includes++] = argv[++j];
+            }
+            if(check_option(arg, "-x", "--exclude"))
+            {
+                if(sel.n_excludes == MAXPATTERNS)
+                    exit_with_message(UNKNOWN, EPATTERNS);
+                sel.excludes[sel.n_excludes++] = argv[++j];
+            }
+            if(check_option(arg, "-w", "--warning"))
+                w_util = atof(argv[++j]);
+            if(check_option(arg, "-c", "--critical"))
+                c_util = atof(argv[++j]);
+            if(check_option(arg, "--warning-drops", "--warning-drops"))
+                w_drops = atof(argv[++j]);
+            if(check_option(arg, "--critical-drops", "--critical-drops"))
+                c_drops = atof(argv[++j]);
+            if(check_option(arg, "--warning-errors", "--warning-errors"))
+                w_errors = atof(argv[++j]);
+            if(check_option(arg, "--critical-errors", "--critical-errors"))
+                c_errors = atof(argv[++j]);
+            if(check_option(arg, "--speed", "--speed") &&
+                    (link_speed = atol(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, "--speed needs Mbit/s");
+            if(check_option(arg, "--sysfs", "--sysfs"))
+                use_sysfs = 1;
+            if(check_option(arg, "--sysfs-root", "--sysfs-root"))
+                sysfs_root = argv[++j];
+            if(check_option(arg, "-P", "--procfs-root"))
+                procfs_set_root(argv[++j]);
+            if(check_option(arg, "-F", "--format") &&
+                    output_set_format(argv[++j]) != 0)
+                exit_with_message(UNKNOWN, EOUTPUTFORMAT);
+            if(check_option(arg, "--textfile", "--textfile"))
+                output_set_textfile(argv[++j]);
+            if(check_option(arg, "--cache-ttl", "--cache-ttl") &&
+                    (cache_ttl = atof(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, ECACHETTL);
+            if(check_option(arg, "-v", "--verbose"))
+                verbose = 1;
+            if(check_option(arg, "--profile", "--profile") && !profile_enable())
+                exit_with_message(UNKNOWN, ENOPROFILE);
+            if(check_option(arg, "-h", "--help"))
+            {
+                print_help(progname);
+                exit(OK);
+            }
+            if(check_option(arg, "-V", "--version"))
+            {
+                print_version();
+                exit(OK);
+            }
+        }
+    }
+
+    if(use_sysfs && sel.n_includes == 0)
+        exit_with_message(UNKNOWN, ESYSFS);
+
+    if(verbose)
+    {
+        printf("Environment Variables used:\n");
+        printf("  - tmpdir: %s\n", tmpdir);
+        printf("  - procfs root: %s\n", procfs_root());
+        printf("  - sysfs root: %s\n", sysfs_root);
+        printf("Parameters:\n");
+        printf("  - interfaces: %d patterns, %d excludes\n", sel.n_includes,
+                sel.n_excludes);
+        printf("  - util: warning %f critical %f\n", w_util, c_util);
+        printf("  - drops: warning %f critical %f\n", w_drops, c_drops);
+        printf("  - errors: warning %f critical %f\n", w_errors, c_errors);
+    }
+
+    if(cache_ttl > 0)
+        cache_init("check_netdev", argc, argv, cache_ttl);
+
+    PROFILE_BEGIN("state");
+    read_state(tmpdir, &nd);
+    nd.seen = calloc(nd.n_old + 1, 1);
+    nd.used = calloc(nd.n_old + 1, 1);
+    if(!nd.seen || !nd.used)
+        exit_with_message(UNKNOWN, "out of memory");
+    PROFILE_END("state");
+
+    PROFILE_BEGIN("read");
+    taken = procfs_clock_ns();
+    if(use_sysfs)
+        read_sysfs(sysfs_root, &sel, &nd, taken);
+    else
+    {
+        procfs_path(path, sizeof(path), PROCFS_NETDEV);
+        PROFILE_COUNT(PROFILE_OPENS);
+        PROFILE_COUNT(PROFILE_READS);
+        if(procfs_read_file(path, &buffer, &buffer_size) < 0)
+            output_exit(UNKNOWN, "could not read %s", path);
+        parse_netdev(buffer, &sel, &nd, taken);
+    }
+    PROFILE_END("read");
+
+    if(nd.count == 0)
+        exit_with_message(UNKNOWN, "no interface matches");
+
+    for(i = 0; i < nd.count; i++)
+    {
+        dev = &nd.devs[i];
+
+        if((index = find_old(&nd, dev->name)) < 0)
+        {
+            n_new++;
+            continue;
+        }
+        nd.used[index] = 1;
+        old = &nd.old[index];
+
+        seconds = (dev->taken - old->taken) / 1e9;
+        if(seconds <= 0)
+        {
+            n_new++;
+            continue;
+        }
+
+        for(j = 0; j < NET_COUNTERS; j++)
+            if(!counter_delta(dev->counters[j], old->counters[j], &d[j]))
+                break;
+        if(j < NET_COUNTERS)
+        {
+            if(verbose)
+                printf("  - %s: counters were reset\n", dev->name);
+            n_new++;
+            continue;
+        }
+
+        rx_bps = d[NET_RX_BYTES] * 8 / seconds;
+        tx_bps = d[NET_TX_BYTES] * 8 / seconds;
+        rx_drops = d[NET_RX_DROPS] / seconds;
+        tx_drops = d[NET_TX_DROPS] / seconds;
+        rx_errors = d[NET_RX_ERRORS] / seconds;
+        tx_errors = d[NET_TX_ERRORS] / seconds;
+
+        output_add_labeled("interface", dev->name, "rx_bits_per_second", "",
+                rx_bps, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        output_add_labeled("interface", dev->name, "tx_bits_per_second", "",
+                tx_bps, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        output_add_labeled("interface", dev->name, "rx_packets_per_second", "",
+                d[NET_RX_PACKETS] / seconds, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+                OUTPUT_UNSET);
+        output_add_labeled("interface", dev->name, "tx_packets_per_second", "",
+                d[NET_TX_PACKETS] / seconds, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+                OUTPUT_UNSET);
+        output_add_labeled("interface", dev->name, "rx_drops_per_second", "",
+                rx_drops, w_drops, c_drops, 0, OUTPUT_UNSET);
+        output_add_labeled("interface", dev->name, "tx_drops_per_second", "",
+                tx_drops, w_drops, c_drops, 0, OUTPUT_UNSET);
+        output_add_labeled("interface", dev->name, "rx_errors_per_second", "",
+                rx_errors, w_errors, c_errors, 0, OUTPUT_UNSET);
+        output_add_labeled("interface", dev->name, "tx_errors_per_second", "",
+                tx_errors, w_errors, c_errors, 0, OUTPUT_UNSET);
+
+        /* The link speed is only looked up if it is needed. */
+        util = OUTPUT_UNSET;
+        if(!isnan(w_util) || !isnan(c_util))
+        {
+            speed = link_speed ? link_speed : read_speed(sysfs_root, dev->name);
+            if(speed > 0)
+            {
+                util = (rx_bps > tx_bps ? rx_bps : tx_bps) / (speed * 1e6) *
+                    100;
+                output_add_labeled("interface", dev->name, "util", "%", util,
+                        w_util, c_util, 0, 100);
+            }
+        }
+
+        n_checked++;
+        total_rx += rx_bps;
+        total_tx += tx_bps;
+        total_drops += rx_drops + tx_drops;
+        total_errors += rx_errors + tx_errors;
+
+        if(verbose)
+            printf("  - %s: rx %.0f bit/s tx %.0f bit/s drops %.2f/%.2f "
+                    "errors %.2f/%.2f util %f\n", dev->name, rx_bps, tx_bps,
+                    rx_drops, tx_drops, rx_errors, tx_errors, util);
+
+        /* comparisons with unset (NaN) thresholds are false */
+        dev_rc = OK;
+        if(util > w_util || rx_drops > w_drops || tx_drops > w_drops ||
+                rx_errors > w_errors || tx_errors > w_errors)
+            dev_rc = WARNING;
+        if(util > c_util || rx_drops > c_drops || tx_drops > c_drops ||
+                rx_errors > c_errors || tx_errors > c_errors)
+            dev_rc = CRITICAL;
+        if(dev_rc == OK)
+            continue;
+        if(dev_rc > rc)
+            rc = dev_rc;
+
+        /* name the interfaces exceeding a threshold */
+        if(len >= 0 && (size_t) len < sizeof(message))
+            len += snprintf(message + len, sizeof(message) - len,
+                    "%s%s rx %s tx %s", len ? ", " : "", dev->name,
+                    format_bits(rx_bits, sizeof(rx_bits), rx_bps),
+                    format_bits(tx_bits, sizeof(tx_bits), tx_bps));
+        if(!isnan(util) && len >= 0 && (size_t) len < sizeof(message))
+            len += snprintf(message + len, sizeof(message) - len,
+                    " (%.2f%%)", util);
+        if(len >= 0 && (size_t) len < sizeof(message))
+            len += snprintf(message + len, sizeof(message) - len,
+                    " drops %.2f/s errors %.2f/s", rx_drops + tx_drops,
+                    rx_errors + tx_errors);
+    }
+
+    PROFILE_BEGIN("state");
+    write_state(tmpdir, &nd, taken);
+    PROFILE_END("state");
+
+    if(n_checked == 0)
+        output_exit(OK, "%d interfaces, no previous sample", n_new);
+
+    if(rc == OK)
+        snprintf(message, sizeof(message), "%d interfaces, rx %s tx %s, "
+                "%.2f drops/s, %.2f errors/s", n_checked,
+                format_bits(rx_bits, sizeof(rx_bits), total_rx),
+                format_bits(tx_bits, sizeof(tx_bits), total_tx),
+                total_drops, total_errors);
+
+    output_exit(rc, "%s", message);
+
+    /* suppress compiler warnings */
+    return rc;
+}
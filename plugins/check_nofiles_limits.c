@@ -21,40 +21,60 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include <dirent.h>
 #include <errno.h>
-#include <libgen.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/kcmp.h>
 
+#include "../include/cache.h"
 #include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/procsnap.h"
+#include "../include/profile.h"
 
 /* Program information. */
 #define AUTHOR      "Adrian Vondendriesch"
 #define PROCNAME    "check_nofiles_limits"
 #define VERSION     "0.1"
 
-/* Some procfs variables. */
-#define PROCFS      "/proc/"
-#define EXE         "/exe"
-#define FDSDIR      "/fd"
-#define LIMITFILE   "/limits"
-#define STATUSFILE  "/status"
-
-/* Numeric Chars to resolve "piddir" */
-#define PIDCHARS    "0123456789"
-
 /* Array limits. */
 #define MAXBUF      512
-#define MAXPIDS     8192
+#define MAXMSG      (4 * MAXBUF)
+
+/* Rows of the process snapshot loaded at once, see procsnap_load(). */
+#define BATCH       256
 
 /* Define default warning and critical values. */
 #define DEFAULTWARN 70.0
 #define DEFAULTCRIT 80.0
 
+/*
+ * --deadline-ms: the scan stops after this share of the budget, the rest
+ * is left for the evaluation and the output. The clock is read between
+ * the loads of BATCH rows of the process snapshot.
+ */
+#define DEADLINESHARE   0.9
+
+/*
+ * Listing /proc stops after LISTSHARE and matching the pids after
+ * MATCHSHARE of the scan budget, so there is time left to check the
+ * processes found so far.
+ */
+#define LISTSHARE       0.3
+#define MATCHSHARE      0.6
+
+/* Matching pids of the last --deadline-ms run, which are scanned first. */
+#define STATEFILE   "check_nofiles_limits"
+#define STATEMAGIC  0x31666e63      /* "cnf1" */
+#define STATEMAX    4194304         /* PID_MAX_LIMIT */
+
 /* Define some error messages. */
 #define ENOEXECNAME    " No executable name specified."
 #define ENOPNAME       " No processname specified."
@@ -62,24 +82,87 @@
 #define ENOSUCHEXEC    " No executable found with specified name."
 #define ENOWARNVALUE   " No value for parameter warning specified."
 #define ENOCRITVALUE   " No value for parameter critical specified."
+#define ENOPROCFSROOT  " No value for parameter procfs-root specified."
+#define ENOFORMAT      " No value for parameter format specified."
+#define ENOTEXTFILE    " No value for parameter textfile specified."
+#define ENOLIMITS      " No value for parameter limits specified."
+#define ENODEADLINE    " No or invalid value for parameter deadline-ms given."
+#define ENOHARDWARN    " No value for parameter warning-hard specified."
+#define ENOHARDCRIT    " No value for parameter critical-hard specified."
+#define EUNKNOWNLIMIT  " Unknown limit specified."
 #define EWARNINVALID   " Invalid value for warning threshold."
 #define ECRITINVALID   " Invalid value for critical threshold."
 #define EWARNCRIT      " Critical threshold must be greater then warning."
+#define EHARDWARNCRIT  " Critical-hard must be greater then warning-hard."
+#define ENOMEMORY      " Out of memory."
+
+/*
+ * The resource limits which can be checked, see limits[]. They index the
+ * limits of the process snapshot, too.
+ */
+enum {
+    LIMIT_NOFILE = PROCSNAP_LIMIT_NOFILE,
+    LIMIT_NPROC = PROCSNAP_LIMIT_NPROC,
+    LIMIT_MEMLOCK = PROCSNAP_LIMIT_MEMLOCK,
+    LIMIT_STACK = PROCSNAP_LIMIT_STACK,
+    LIMIT_AS = PROCSNAP_LIMIT_AS,
+    NLIMITS = PROCSNAP_NLIMITS
+};
+
+/*
+ * Structure to describe a resource limit.
+ *
+ * Members:
+ *  - const char   *name:   name of the limit, as given to --limits
+ *  - const char   *title:  title of the limit in the message
+ *  - const char   *uom:    unit of the usage in the perfdata
+ *  - unsigned long unit:   divisor from the unit of the limit to the one
+ *                          of the usage, e.g. bytes to kB
+ */
+typedef struct limit {
+    const char     *name;
+    const char     *title;
+    const char     *uom;
+    unsigned long   unit;
+} limit_t;
+
+static const limit_t limits[NLIMITS] =
+{
+    { "nofile",  "Files in use",  "",   1 },
+    { "nproc",   "User threads",  "",   1 },
+    { "memlock", "Locked memory", "KB", 1024 },
+    { "stack",   "Stack",         "KB", 1024 },
+    { "as",      "Address space", "KB", 1024 }
+};
 
 /*
  * Structure to hold variables for each process.
  *
  * Members:
  *  - long          pid:        pid of process
- *  - unsigned long current:    current number of open files
- *  - unsigned long soft_limit: soft limit for nofiles
- *  - unsigned long hard_limit: hard limit for nofiles
+ *  - size_t        row:        row of the process in the snapshot
+ *  - long          uid:        real uid of the process, for nproc
+ *  - unsigned long current:    current usage per limit, e.g. the number of
+ *                              open files
+ *  - unsigned long soft_limit: soft limit per limit, 0 for unlimited
+ *  - unsigned long hard_limit: hard limit per limit, 0 for unlimited
+ *  - int           table:      index of the process whose fd table was
+ *                              counted, the own index unless the table is
+ *                              shared (CLONE_FILES)
+ *  - int           kcmp:       1 if kcmp() may compare this process
+ *  - int           scanned:    1 once the usage is known, 0 if the
+ *                              deadline passed before
  */
 typedef struct nofiles {
     long      pid;
-    unsigned long current;
-    unsigned long soft_limit;
-    unsigned long hard_limit;
+    size_t    row;
+    long      uid;
+    unsigned long current[NLIMITS];
+    unsigned long soft_limit[NLIMITS];
+    unsigned long hard_limit[NLIMITS];
+    int       table;
+    int       kcmp;
+    int       scanned;
 } nofiles_t;
 
 /*
@@ -90,8 +173,31 @@ typedef struct arguments {
     const char    *s_process_name;
     double         nofiles_warn_threshold;
     double         nofiles_crit_threshold;
+    double         hard_warn_threshold;
+    double         hard_crit_threshold;
+    unsigned int   limits;
 } arguments_t;
 
+/*
+ * Header of the state file of --deadline-ms, followed by count pids
+ * (int32_t) in ascending order.
+ */
+typedef struct state_header {
+    uint32_t    magic;
+    uint32_t    count;
+} state_header_t;
+
+/*
+ * CLOCK_MONOTONIC ns the plugin started at and the scan has to stop at,
+ * the latter is 0 without --deadline-ms.
+ */
+static int64_t  started = 0;
+static int64_t  deadline = 0;
+
+/* Set once the deadline passed. */
+static int      partial = 0;
+
+
 /*
  * print_version:
  *
@@ -101,7 +207,7 @@ typedef struct arguments {
  * Note:
  *  Will always exit with return code 0.
  */
-void print_version()
+static void print_version()
 {
     printf("%s, version: %s, author: %s\n",
             PROCNAME, VERSION, AUTHOR);
@@ -118,7 +224,7 @@ void print_version()
  * Note:
  *  Will always exit with return code 0.
  */
-void print_help(const char *s_this_name)
+static void print_help(const char *s_this_name)
 {
     printf("Usage: %s [option] (-e <executable_name> | -n <process_name>)\n"
            "\t Process identifier:\n"
@@ -126,356 +232,819 @@ void print_help(const char *s_this_name)
            "\t -n, --processname:\tprocess name\n"
            "\n"
            "\tThresholds:\n"
-           "\t -w, --warning:    \twarning threshold (percent)\n"
-           "\t -c, --critical:   \tcritical threshold (percent)\n"
+           "\t -w, --warning:    \twarning threshold (%% of soft limit)\n"
+           "\t -c, --critical:   \tcritical threshold (%% of soft limit)\n"
+           "\t     --warning-hard:\twarning threshold (%% of hard limit)\n"
+           "\t     --critical-hard:\tcritical threshold (%% of hard limit)\n"
+           "\n"
+           "\tLimits:\n"
+           "\t -l, --limits:     \tcomma separated limits to check: nofile,\n"
+           "\t                   \tnproc, memlock, stack and as\n"
+           "\n"
+           "\tProcfs:\n"
+           "\t -P, --procfs-root:\tprocfs root (default: $%s or %s)\n"
+           "\t     --io-uring:   \tbatch procfs reads with io_uring\n"
+           "\t     --cache-ttl:  \tshare results younger than this (seconds)\n"
+           "\t                   \twith invocations with the same arguments\n"
+           "\t     --deadline-ms:\tstop scanning before this many ms passed\n"
+           "\t                   \tand report the processes checked so far\n"
+           "\n"
+           "\tOutput:\n"
+           "\t -F, --format:     \tnagios (default), json or openmetrics\n"
+           "\t     --textfile:   \talso write OpenMetrics to this file\n"
            "\n"
            "\tAdditional information:\n"
+           "\t     --profile:    \tappend timings of the plugin to the perfdata\n"
            "\t -h, --help:       \tprint this help message\n"
            "\t -V, --version:    \tprint version information\n"
            "\n"
            "\tDefault Values:\n"
+           "\t limits:           \tnofile\n"
            "\t warning:          \t%2.1lf %%\n"
            "\t critical:         \t%2.1lf %%\n",
-           s_this_name, DEFAULTWARN, DEFAULTCRIT);
+           s_this_name, PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT,
+           DEFAULTWARN, DEFAULTCRIT);
 
     exit(0);
 }
 
 
 /*
- * check_option:
+ * write_message:
  *
  * Description:
- * Checks a given option against short and long options.
+ *  Prints a message of the following format
+ *    "OK/WARNING/CRITICAL/UNKNOWN - msg\n"
+ *  based on rc and exits with return code rc.
  *
  * Arguments:
- *  - const char *s_option:     the option read from we check against
- *  - const char *s_short_opt:  the short option, e.g. "-h"
- *  - const char *s_long_opt:  the long option, e.g. "--help"
+ *  - char *s_message:  the message that will be printed
+ *  - int   rc:         exit code
+ */
+static void write_message(char *s_message, int rc)
+{
+    output_exit(rc, "%s", s_message);
+}
+
+/*
+ * now_ns:
+ */
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * share_reached:
  *
- * Return Values:
- *  - 1 if either short or long option match the given option
- *  - 0 otherwise
+ * Description:
+ *  Returns 1 if --deadline-ms was given and a phase which may use the
+ *  given share of the scan budget has to stop. The output is marked
+ *  partial then.
  */
-int check_option(const char *s_option, const char *s_short_opt, const char *s_long_opt)
+static int share_reached(double share)
 {
-    if(0 == strncmp(s_option, s_short_opt, MAXBUF) ||
-       0 == strncmp(s_option, s_long_opt, MAXBUF))
-        return 1;
+    if(!deadline || now_ns() < started + (int64_t) ((deadline - started) *
+                share))
+        return 0;
+
+    partial = 1;
 
-    return 0;
+    return 1;
 }
 
 /*
- * write_message:
+ * deadline_reached:
  *
  * Description:
- *  Prints a message of the following format
- *    "OK/WARNING/CRITICAL/UNKNOWN - msg\n"
- *  based on rc and exits with return code rc.
+ *  Returns 1 if --deadline-ms was given and its scan budget is used up.
+ */
+static int deadline_reached(void)
+{
+    return share_reached(1.0);
+}
+
+/*
+ * listing_reached:
  *
- * Arguments:
- *  - char *s_message:  the message that will be printed
- *  - int   rc:         exit code
+ * Description:
+ *  Returns 1 if listing /proc used up its share of the scan budget, see
+ *  procsnap_open_until().
+ */
+static int listing_reached(void)
+{
+    return share_reached(LISTSHARE);
+}
+
+/*
+ * state_path:
+ *
+ * Description:
+ *  Builds the path of the state file of --deadline-ms, which includes
+ *  a hash of the procfs root and the process identifier, so checks of
+ *  different processes don't share their state.
  */
-void write_message(char *s_message, int rc)
+static void state_path(char *s_path, size_t path_len, const arguments_t *args)
 {
-    printf("%s - %s\n", state[rc], s_message);
+    const char  *parts[3] = { procfs_root(), args->s_executable,
+                              args->s_process_name };
+    const char  *s_tmpdir = getenv("TMPDIR");
+    const char  *c;
+    uint64_t     hash = 14695981039346656037ULL;
+    int          i;
+
+    if(!s_tmpdir)
+        s_tmpdir = getenv("TMP");
+    if(!s_tmpdir)
+        s_tmpdir = "/tmp";
+
+    for(i = 0; i < 3; i++)
+        for(c = parts[i] ? parts[i] : ""; ; c++)
+        {
+            hash = (hash ^ (unsigned char) *c) * 1099511628211ULL;
+            if(!*c)
+                break;
+        }
 
-    exit(rc);
+    snprintf(s_path, path_len, "%s/%s-%016llx.tmp", s_tmpdir, STATEFILE,
+            (unsigned long long) hash);
 }
 
 /*
- * read_nofiles_limit:
+ * cmp_pid:
  *
  * Description:
- *  Reads soft an hard limits for "Max Open Files" from
- *  PROCFS/<pid>/LIMITS.
+ *  qsort() and bsearch() callback for int32_t pids.
+ */
+static int cmp_pid(const void *p1, const void *p2)
+{
+    int32_t pid1 = *(const int32_t *) p1;
+    int32_t pid2 = *(const int32_t *) p2;
+
+    return (pid1 > pid2) - (pid1 < pid2);
+}
+
+/*
+ * read_state:
  *
- * Arguments:
- *  - struct nofiles *t_nofiles: structure where soft and hard limits will be
- *                               written tohold
+ * Description:
+ *  Reads the matching pids of the last --deadline-ms run.
  *
  * Return Value:
- *  returns the filled struct nofiles *t_nofiles
+ *  The pids in ascending order, NULL if there is no valid state.
+ */
+static int32_t *read_state(const char *s_path, uint32_t *count)
+{
+    state_header_t   header;
+    int32_t         *state_pids = NULL;
+    FILE            *f;
+
+    if(!(f = fopen(s_path, "r")))
+        return NULL;
+
+    if(1 == fread(&header, sizeof(header), 1, f) &&
+            header.magic == STATEMAGIC && header.count <= STATEMAX &&
+            (state_pids = malloc((header.count + 1) * sizeof(int32_t))) &&
+            header.count != fread(state_pids, sizeof(int32_t), header.count,
+                f))
+    {
+        free(state_pids);
+        state_pids = NULL;
+    }
+    fclose(f);
+
+    *count = state_pids ? header.count : 0;
+
+    return state_pids;
+}
+
+/*
+ * write_state:
  *
- * Note:
- *  Will not return if something went wrong.
+ * Description:
+ *  Writes the matching pids for the next --deadline-ms run, replacing the
+ *  state file atomically. The pids are sorted in place. Errors are
+ *  ignored, the state only speeds up the next run.
  */
-struct nofiles*
-read_nofiles_limit(struct nofiles *t_nofiles)
+static void write_state(const char *s_path, int32_t *state_pids,
+        uint32_t count)
 {
-    FILE    *fd_limits;
-    char     s_limits_path[MAXBUF];
-    char     s_buffer[MAXBUF];
-    char     s_limit_name[MAXBUF];
-    char     s_limit_soft[MAXBUF];
-    char     s_limit_hard[MAXBUF];
+    state_header_t   header = { STATEMAGIC, count };
+    char             s_tmp_path[MAXBUF + 32];
+    FILE            *f;
 
-    /* Build the path to our limits file */
-    snprintf(s_limits_path, sizeof(s_limits_path), "%s%ld%s",
-            PROCFS, t_nofiles->pid, LIMITFILE);
+    qsort(state_pids, count, sizeof(int32_t), cmp_pid);
 
-    /*
-     * Try to open the limits file, if this step fails we will fail too.
-     */
-    if(!(fd_limits = fopen(s_limits_path, "r")))
-    {
-        /* If we got here, a error occurred that should be reported */
-        char    s_message[MAXBUF];
+    snprintf(s_tmp_path, sizeof(s_tmp_path), "%s.%ld", s_path,
+            (long) getpid());
+    if(!(f = fopen(s_tmp_path, "w")))
+        return;
 
-        snprintf(s_message, sizeof(s_message), "ERROR \"%s\", while open %s.",
-                strerror(errno), s_limits_path);
-        write_message(s_message, UNKNOWN);
-    }
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(state_pids, sizeof(int32_t), count, f);
+    if(0 != fclose(f) || 0 != rename(s_tmp_path, s_path))
+        unlink(s_tmp_path);
+}
 
-    /*
-     * Scan for the line "Max open files" and read the associated limits.
-     */
-    while(fgets(s_buffer, MAXBUF, fd_limits))
-    {
-        sscanf(s_buffer, "%*s %*s %s %s %s",
-                s_limit_name, s_limit_soft, s_limit_hard);
-        if(0 == strncmp(s_limit_name, "files", MAXBUF))
-        {
-            t_nofiles->soft_limit = atol(s_limit_soft);
-            t_nofiles->hard_limit = atol(s_limit_hard);
+/*
+ * keep_unexamined:
+ *
+ * Description:
+ *  Appends those of the processes the deadline stopped before matching to
+ *  state_pids, which matched last time. They are still of interest.
+ */
+static void keep_unexamined(const procsnap_t *snap, const size_t *rows,
+        size_t n_rows, const int32_t *previous, uint32_t n_previous,
+        int32_t *state_pids, uint32_t *count)
+{
+    int32_t  pid;
+    size_t   i;
 
-            /*
-             * We found what we searched for,
-             * stop scanning the file.
-             */
-            break;
-        }
+    for(i = 0; i < n_rows && n_previous; i++)
+    {
+        pid = snap->pids[rows[i]];
+        if(bsearch(&pid, previous, n_previous, sizeof(int32_t), cmp_pid))
+            state_pids[(*count)++] = pid;
     }
+}
+
+/*
+ * keep_unlisted:
+ *
+ * Description:
+ *  Appends the pids which matched last time but weren't listed, because
+ *  the deadline stopped the listing, to state_pids. Both the pids of the
+ *  snapshot and previous are sorted.
+ */
+static void keep_unlisted(const procsnap_t *snap, const int32_t *previous,
+        uint32_t n_previous, int32_t *state_pids, uint32_t *count)
+{
+    size_t   row = 0;
+    uint32_t i;
 
-    /* Return the original t_nofiles structure. */
-    return t_nofiles;
+    for(i = 0; i < n_previous; i++)
+    {
+        while(row < snap->count && snap->pids[row] < previous[i])
+            row++;
+        if(row == snap->count || snap->pids[row] != previous[i])
+            state_pids[(*count)++] = previous[i];
+    }
 }
 
 /*
- * read_num_open_files:
+ * parse_limit_names:
  *
  * Description:
- *  Returns the number of currently opened files of a process,
- *  specified by pid.
+ *  Parses a comma separated list of limit names, e.g. "nofile,nproc".
  *
  * Arguments:
- *  - long  pid:    pid of the process
+ *  - const char *s_names: the list of names
  *
- * Return Values:
- *  - n: the number of open files hold by this process
- *
- * Note:
- *  Will not return on error.
+ * Return Value:
+ *  A bit mask of the limits (1 << LIMIT_*), 0 on unknown names.
  */
-int read_num_open_files(long pid)
+static unsigned int parse_limit_names(const char *s_names)
 {
-    int              n_open_files=0;
-    char             s_fds_path[MAXBUF];
-    DIR             *dir_fds;
-    struct dirent   *dir_entry;
-
-    /* Build the full path to our fd directory. */
-    snprintf(s_fds_path, sizeof(s_fds_path), "%s%ld%s",
-            PROCFS, pid, FDSDIR);
+    unsigned int mask = 0;
+    size_t       len;
+    int          i;
 
-    if( ! (dir_fds = opendir(s_fds_path)) )
+    for(; *s_names; s_names += len + (s_names[len] == ','))
     {
-        /*
-         * If there is any error opening the fd directory bail out.
-         */
-        char    msg[MAXBUF];
-
-        snprintf(msg, MAXBUF, "ERROR: while open fd dir \"%s\": \"%s\"",
-                s_fds_path, strerror(errno));
-
-        write_message(msg, UNKNOWN);
+        len = strcspn(s_names, ",");
+        for(i = 0; i < NLIMITS; i++)
+            if(strlen(limits[i].name) == len &&
+                    0 == strncmp(s_names, limits[i].name, len))
+                break;
+        if(i == NLIMITS)
+            return 0;
+        mask |= 1U << i;
     }
 
-    /* Every file is one direntry. */
-    while(NULL != (dir_entry = readdir(dir_fds)))
-        n_open_files++;
+    return mask;
+}
 
-    closedir(dir_fds);
+/*
+ * order_rows:
+ *
+ * Description:
+ *  Lists the rows of the snapshot to match, those of the pids which
+ *  matched last time first, so a partial scan most likely covers them.
+ *
+ * Return Value:
+ *  The number of rows, all rows of the snapshot.
+ */
+static size_t order_rows(const procsnap_t *snap, const int32_t *previous,
+        uint32_t n_previous, size_t *rows)
+{
+    int32_t  pid;
+    size_t   n = 0;
+    size_t   row;
+    int      pass;
+    int      known;
+
+    for(pass = 0; pass < 2; pass++)
+        for(row = 0; row < snap->count; row++)
+        {
+            pid = snap->pids[row];
+            known = n_previous && bsearch(&pid, previous, n_previous,
+                    sizeof(int32_t), cmp_pid);
+            if(known == (pass == 0))
+                rows[n++] = row;
+        }
 
-    return n_open_files;
+    return n;
 }
 
 /*
- * cmp_process_name:
+ * match_rows:
  *
  * Description:
- *  Returns the name of a process based on /proc/<pid>/status as
- *  "Name: ...".
+ *  Keeps those of the rows whose process has the given name (by comm) and
+ *  executable (by the basename of the exe link). The comm is loaded first,
+ *  the exe link only of the processes of that name. Processes without an
+ *  exe, like kernel threads, or which we may not inspect never match an
+ *  executable.
  *
  * Arguments:
- *  - long        pid:  pid of the process
- *  - const char *name: searched process name
+ *  - procsnap_t        *snap:        the snapshot
+ *  - size_t            *rows:        the rows, the matching ones are moved
+ *                                    to the front
+ *  - size_t             n_rows:      number of rows
+ *  - const arguments_t *t_arguments: the name and the executable
  *
  * Return Value:
- *  - 1 if name of the process equals s_name
- *  - 0 otherwise
- *
- * Note:
- *  Will not return on error.
+ *  The number of matching rows.
  */
-int
-cmp_process_name(long pid, const char *s_name)
+static size_t match_rows(procsnap_t *snap, size_t *rows, size_t n_rows,
+        const arguments_t *t_arguments)
 {
-    FILE    *fd_status_file;
+    const char  *s_exe;
+    const char  *s_slash;
+    size_t       n;
+    size_t       i;
 
-    char     s_title[MAXBUF];
-    char     s_pname[MAXBUF];
-    char     s_path[MAXBUF];
+    if(t_arguments->s_process_name)
+    {
+        if(procsnap_load(snap, PROCSNAP_COMM, rows, n_rows) < 0)
+            write_message(ENOMEMORY, UNKNOWN);
+
+        for(n = 0, i = 0; i < n_rows; i++)
+            if(!snap->gone[rows[i]] && 0 == strcmp(snap->comm[rows[i]],
+                        t_arguments->s_process_name))
+                rows[n++] = rows[i];
+        n_rows = n;
+    }
 
+    if(t_arguments->s_executable && n_rows)
+    {
+        if(procsnap_load(snap, PROCSNAP_EXE, rows, n_rows) < 0)
+            write_message(ENOMEMORY, UNKNOWN);
 
-    /* Build the full path to our status file. */
-    snprintf(s_path, sizeof(s_path), "%s%ld%s",
-            PROCFS, pid, STATUSFILE);
+        for(n = 0, i = 0; i < n_rows; i++)
+        {
+            if(snap->gone[rows[i]] || !(s_exe = snap->exe[rows[i]]))
+                continue;
+            s_slash = strrchr(s_exe, '/');
+            if(0 == strcmp(s_slash ? s_slash + 1 : s_exe,
+                        t_arguments->s_executable))
+                rows[n++] = rows[i];
+        }
+        n_rows = n;
+    }
 
-    /*
-     * Try to open the status file.
-     */
-    if( ! (fd_status_file = fopen(s_path, "r")) )
-    {
-        /*
-         * If there is any error opening the status file bail out.
-         */
-        char    s_message[MAXBUF];
+    return n_rows;
+}
 
-        snprintf(s_message, MAXBUF,
-                "ERROR: while open status file \"%s\": \"%s\"",
-                s_path, strerror(errno));
+/*
+ * read_process:
+ *
+ * Description:
+ *  Takes the soft and hard values of the requested limits and the usage
+ *  of those but the open files and nproc from the snapshot. "unlimited"
+ *  is stored as 0, like a limit the limits file doesn't have.
+ *
+ * Arguments:
+ *  - nofiles_t        *t_nofiles: structure the process is written to
+ *  - const procsnap_t *snap:      the snapshot, with PROCSNAP_LIMITS and,
+ *                                 for any limit but nofile, PROCSNAP_STATUS
+ *                                 loaded
+ *  - size_t            row:       row of the process
+ *  - unsigned int      mask:      the limits to take (1 << LIMIT_*)
+ */
+static void read_process(nofiles_t *t_nofiles, const procsnap_t *snap,
+        size_t row, unsigned int mask)
+{
+    uint64_t     soft;
+    uint64_t     hard;
+    int          i;
 
-        write_message(s_message, UNKNOWN);
-    }
+    memset(t_nofiles, 0, sizeof(*t_nofiles));
+    t_nofiles->pid = snap->pids[row];
+    t_nofiles->row = row;
+    t_nofiles->uid = snap->uid ? snap->uid[row] : -1;
+    t_nofiles->scanned = 1;
 
-    /*
-     * We need the first line. TODO Error handling.
-     */
-    if( EOF == fscanf(fd_status_file, "%s %s", s_title, s_pname))
+    for(i = 0; i < NLIMITS; i++)
     {
-        /*
-         * If there is any error opening the status file bail out.
-         */
-        char    s_message[MAXBUF];
-
-        fclose(fd_status_file);
-        snprintf(s_message, MAXBUF,
-                "ERROR: while reading status file \"%s\": \"%s\"\n",
-                s_path, strerror(errno));
+        if(!(mask & (1U << i)))
+            continue;
 
-        write_message(s_message, UNKNOWN);
+        soft = snap->limit_soft[row][i];
+        hard = snap->limit_hard[row][i];
+        t_nofiles->soft_limit[i] = soft == PROCSNAP_UNLIMITED ? 0 :
+            soft / limits[i].unit;
+        t_nofiles->hard_limit[i] = hard == PROCSNAP_UNLIMITED ? 0 :
+            hard / limits[i].unit;
     }
 
-    fclose(fd_status_file);
+    if(mask & (1U << LIMIT_MEMLOCK))
+        t_nofiles->current[LIMIT_MEMLOCK] = snap->vm_lck_kb[row];
+    if(mask & (1U << LIMIT_STACK))
+        t_nofiles->current[LIMIT_STACK] = snap->vm_stk_kb[row];
+    if(mask & (1U << LIMIT_AS))
+        t_nofiles->current[LIMIT_AS] = snap->vm_size_kb[row];
+}
 
-    if(0 != strcmp("Name:", s_title))
+/*
+ * cmp_uid:
+ *
+ * Description:
+ *  qsort() and bsearch() callback for uids.
+ */
+static int cmp_uid(const void *p1, const void *p2)
+{
+    long uid1 = *(const long *) p1;
+    long uid2 = *(const long *) p2;
+
+    return (uid1 > uid2) - (uid1 < uid2);
+}
+
+/*
+ * count_user_threads:
+ *
+ * Description:
+ *  RLIMIT_NPROC limits the threads of the real user, so the usage of
+ *  nproc is the sum of the threads of all processes of the user, matched
+ *  or not. The status of every process is loaded for it, BATCH rows at a
+ *  time; once the deadline passed the sums are lower bounds.
+ *
+ * Arguments:
+ *  - procsnap_t *snap:      the snapshot
+ *  - nofiles_t  *t_nofiles: the processes
+ *  - int         n_pids:    number of processes
+ */
+static void count_user_threads(procsnap_t *snap, nofiles_t *t_nofiles,
+        int n_pids)
+{
+    long            *uids;
+    long            *uid;
+    unsigned long   *threads;
+    size_t           rows[BATCH];
+    size_t           row;
+    size_t           n;
+    size_t           j;
+    int              n_uids;
+    int              i;
+
+    if(!(uids = calloc(n_pids + 1, sizeof(long))) ||
+            !(threads = calloc(n_pids + 1, sizeof(unsigned long))))
+        write_message(ENOMEMORY, UNKNOWN);
+
+    /* The distinct uids of the matched processes. */
+    for(i = 0; i < n_pids; i++)
+        uids[i] = t_nofiles[i].uid;
+    qsort(uids, n_pids, sizeof(long), cmp_uid);
+    for(n_uids = 0, i = 0; i < n_pids; i++)
+        if(n_uids == 0 || uids[n_uids - 1] != uids[i])
+            uids[n_uids++] = uids[i];
+
+    for(row = 0; row < snap->count && !deadline_reached(); row += n)
     {
-        /*
-         * If the status file don't begin with "Name: ...", bail out.
-         */
-        char    s_message[MAXBUF];
+        for(n = 0; n < BATCH && row + n < snap->count; n++)
+            rows[n] = row + n;
 
-        snprintf(s_message, MAXBUF,
-                "ERROR: status file \"%s\" has wrong format.",
-                s_path);
+        if(procsnap_load(snap, PROCSNAP_STATUS, rows, n) < 0)
+            write_message(ENOMEMORY, UNKNOWN);
 
-        write_message(s_message, UNKNOWN);
+        for(j = 0; j < n; j++)
+            if(!snap->gone[rows[j]] && (uid = bsearch(&snap->uid[rows[j]],
+                            uids, n_uids, sizeof(long), cmp_uid)))
+                threads[uid - uids] += snap->num_threads[rows[j]];
     }
 
-    /* Processname matches. */
-    if(0 == strcmp(s_name, s_pname))
-        return 1;
+    for(i = 0; i < n_pids; i++)
+    {
+        uid = bsearch(&t_nofiles[i].uid, uids, n_uids, sizeof(long), cmp_uid);
+        t_nofiles[i].current[LIMIT_NPROC] = threads[uid - uids];
+    }
 
-    /* Processname doesn't match. */
-    return 0;
+    free(threads);
+    free(uids);
 }
 
 /*
- * build_exe_link:
+ * kcmp_files:
  *
  * Description:
- *  Simple function to build the path of a exe link usage PROCFS and <pid>.
+ *  Compares the fd tables of two processes with kcmp(KCMP_FILES).
  *
- * Arguments:
- *  - char     *buffer:     preallocated char *buffer
- *  - char      pid:        pid we whant to build the link for
- *  - size_t    buffer_len: length of the preallocated char* buffer
+ * Return Values:
+ *  - 0 if both share one fd table
+ *  - 1 or 2 if the first table orders before or after the second one
+ *  - -1 on error, e.g. if kcmp() is not permitted or not available
+ */
+static int kcmp_files(long pid1, long pid2)
+{
+#ifdef SYS_kcmp
+    return syscall(SYS_kcmp, (pid_t) pid1, (pid_t) pid2, KCMP_FILES, 0, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * cmp_fd_tables:
  *
- * Return Codes:
- *  - 0 if no preallocated string is given or buffer_len is 0
- *  - 1 on success.
+ * Description:
+ *  qsort() callback to order processes by their fd table, so processes
+ *  sharing one table are adjacent.
  */
-int build_exe_link(char* s_buffer, long pid, size_t buffer_len)
+static int cmp_fd_tables(const void *p1, const void *p2)
 {
-    /*
-     * We shoudl be sure that s_buffer is allocated.
-     */
-    if(buffer_len == 0 || !s_buffer)
-        return 0;
+    const nofiles_t *t1 = *(nofiles_t * const *) p1;
+    const nofiles_t *t2 = *(nofiles_t * const *) p2;
 
-    snprintf(s_buffer, buffer_len, "%s%ld%s",
-            PROCFS, pid, EXE);
+    switch(kcmp_files(t1->pid, t2->pid))
+    {
+        case 0:
+            return 0;
+        case 1:
+            return -1;
+        case 2:
+            return 1;
+    }
 
-    return 1;
+    /* The process is gone, any consistent order will do. */
+    return (t1->pid > t2->pid) - (t1->pid < t2->pid);
 }
 
 /*
- * read_exe_s_link:
+ * count_fd_tables:
  *
  * Description:
- *  Resolves the target of a specified softling.
+ *  Counts the open files of all processes. Processes sharing one fd table
+ *  (CLONE_FILES) are detected with kcmp(KCMP_FILES): sorted by their table,
+ *  they are adjacent and the table is read only once. Every process gets
+ *  the number of files of its table.
+ *
+ *  Processes kcmp() can't compare (it is not available, or they are below
+ *  another procfs root) are counted on their own. Nothing else proves a
+ *  shared table: forked processes with the same fds, e.g. prefork workers,
+ *  have tables of their own.
+ *
+ *  The tables are read as PROCSNAP_FDS of the snapshot, BATCH at a time.
+ *  Once the deadline passed, no more tables are read or compared; only
+ *  the processes of the tables read so far are marked scanned. Processes
+ *  which are gone before their table is read are not scanned either.
  *
  * Arguments:
- *  - char  *s_link:        path to link that should be resoved
- *  - char  *s_buffer:      buffer where the resolved path will be
- *                          written to
- *  - size_t buffer_len:    length of s_buffer
+ *  - procsnap_t *snap:      the snapshot
+ *  - nofiles_t  *t_nofiles: the processes
+ *  - int         n_pids:    number of processes
  *
  * Return Value:
- *  Returns the end position of buffer. Points at '\0'.
+ *  The number of distinct fd tables read.
  *
  * Note:
- *  If a error occured this function will not return.
+ *  Will not return if the fds of a process can't be listed.
  */
-size_t linktarget(char *s_link, char *s_buffer, size_t buffer_len)
+static int count_fd_tables(procsnap_t *snap, nofiles_t *t_nofiles,
+        int n_pids)
 {
-    int  pos;
+    nofiles_t   **t_sorted;
+    nofiles_t    *t;
+    size_t        rows[BATCH];
+    int           tables[BATCH];
+    int           n_sorted = 0;
+    int           n_tables = 0;
+    int           live;
+    int           n;
+    int           i;
+    int           j;
+
+    if(!(t_sorted = calloc(n_pids + 1, sizeof(nofiles_t *))))
+        write_message(ENOMEMORY, UNKNOWN);
+
+    /* kcmp() compares live processes, not those of another procfs root. */
+    live = (0 == strcmp(procfs_root(), PROCFS_DEFAULT_ROOT));
+
+    for(i = 0; i < n_pids; i++)
+    {
+        t_nofiles[i].table = i;
+        t_nofiles[i].scanned = 0;
+        t_nofiles[i].kcmp = live && !deadline_reached() &&
+            (0 == kcmp_files(t_nofiles[i].pid, t_nofiles[i].pid));
+        if(t_nofiles[i].kcmp)
+            t_sorted[n_sorted++] = &t_nofiles[i];
+    }
 
-    /* Do the actual s_link lookup. */
-    pos = readlink(s_link, s_buffer, buffer_len);
+    qsort(t_sorted, n_sorted, sizeof(nofiles_t *), cmp_fd_tables);
+    for(i = 1; i < n_sorted && !deadline_reached(); i++)
+        if(0 == kcmp_files(t_sorted[i - 1]->pid, t_sorted[i]->pid))
+            t_sorted[i]->table = t_sorted[i - 1]->table;
 
-    /*
-     * We should check if any error occured and bail out if any.
-     */
-    if(0 > pos && errno != EACCES)
+    free(t_sorted);
+
+    /* Read every table once. */
+    for(i = 0; i < n_pids && !deadline_reached(); )
     {
-        char    s_message[MAXBUF];
+        for(n = 0; n < BATCH && i < n_pids; i++)
+            if(t_nofiles[i].table == i)
+            {
+                tables[n] = i;
+                rows[n++] = t_nofiles[i].row;
+            }
 
-        snprintf(s_message, MAXBUF,
-                "ERROR: while resolving softs_link \"%s\", \"%s\"",
-                s_link, strerror(errno));
+        if(procsnap_load(snap, PROCSNAP_FDS, rows, n) < 0)
+            write_message(ENOMEMORY, UNKNOWN);
 
-        write_message(s_message, UNKNOWN);
+        for(j = 0; j < n; j++)
+        {
+            t = &t_nofiles[tables[j]];
+
+            /* A process exiting during the scan is skipped. */
+            if(snap->gone[t->row])
+                continue;
+
+            if(snap->fds[t->row] < 0)
+            {
+                char    s_message[MAXBUF];
+
+                snprintf(s_message, MAXBUF,
+                        "ERROR: while open fd dir of PID %ld", t->pid);
+                write_message(s_message, UNKNOWN);
+            }
+
+            t->current[LIMIT_NOFILE] = snap->fds[t->row];
+            t->scanned = 1;
+            n_tables++;
+        }
     }
 
-    if(0 > pos)
-        return pos;
+    for(i = 0; i < n_pids; i++)
+    {
+        t_nofiles[i].current[LIMIT_NOFILE] =
+            t_nofiles[t_nofiles[i].table].current[LIMIT_NOFILE];
+        t_nofiles[i].scanned = t_nofiles[t_nofiles[i].table].scanned;
+    }
 
-    /*
-     * Because reads_link do not insert a training '\0',
-     * we do it manualy.
-     */
-    s_buffer[pos] = '\0';
+    return n_tables;
+}
+
+/*
+ * check_limit:
+ *
+ * Description:
+ *  Checks the usage of one limit of every process against the thresholds
+ *  of the soft and the hard limit and appends the processes by their
+ *  state to the message, e.g. "Threads of user: per PID -  OK PIDs ...".
+ *  A limit of 0 means "unlimited" and is never exceeded. Processes not
+ *  scanned before the deadline are left out.
+ *
+ * Arguments:
+ *  - const nofiles_t   *t_nofiles:   the processes
+ *  - int                n_pids:      number of processes
+ *  - int                limit:       the limit to check, LIMIT_*
+ *  - const arguments_t *t_arguments: the thresholds
+ *  - char              *s_message:   the message to append to
+ *  - size_t             message_len: size of s_message
+ *  - double            *max_soft:    set to the highest usage in percent
+ *                                    of the soft limit
+ *  - double            *max_hard:    set to the highest usage in percent
+ *                                    of the hard limit
+ *
+ * Return Value:
+ *  The state of the limit, OK, WARNING or CRITICAL.
+ */
+static int check_limit(const nofiles_t *t_nofiles, int n_pids, int limit,
+        const arguments_t *t_arguments, char *s_message, size_t message_len,
+        double *max_soft, double *max_hard)
+{
+    const limit_t   *t_limit = &limits[limit];
+    const nofiles_t *t;
+    double           soft_percent;
+    double           hard_percent;
+    int              rc = OK;
+    int              n_files_total = 0;
+    int              count;
+    char             s_message_pids[MAXBUF];
+    char             s_message_pids_warn[MAXBUF];
+    char             s_message_pids_crit[MAXBUF];
+    char             s_message_tmp[MAXBUF];
+    char            *s_list;
+
+    s_message_pids[0] = '\0';
+    s_message_pids_warn[0] = '\0';
+    s_message_pids_crit[0] = '\0';
+    *max_soft = 0.0;
+    *max_hard = 0.0;
+
+    for(count = 0; count < n_pids; count++)
+    {
+        t = &t_nofiles[count];
+        if(!t->scanned)
+            continue;
+
+        /*
+         * Count the total number of files, that where in use by all
+         * processes. A shared fd table is counted once.
+         */
+        if(limit == LIMIT_NOFILE && t->table != count)
+            snprintf(s_message_tmp, MAXBUF, " %ld (%lu/%lu, files of %ld)",
+                    t->pid, t->current[limit], t->soft_limit[limit],
+                    t_nofiles[t->table].pid);
+        else if(limit == LIMIT_NOFILE || t->soft_limit[limit])
+        {
+            if(limit == LIMIT_NOFILE)
+                n_files_total += t->current[limit];
+            snprintf(s_message_tmp, MAXBUF, " %ld (%lu/%lu%s)",
+                    t->pid, t->current[limit], t->soft_limit[limit],
+                    t_limit->uom);
+        }
+        else
+            snprintf(s_message_tmp, MAXBUF, " %ld (%lu%s/unlimited)",
+                    t->pid, t->current[limit], t_limit->uom);
+
+        soft_percent = 0.0;
+        if(t->soft_limit[limit])
+            soft_percent = (double) t->current[limit] /
+                t->soft_limit[limit] * 100;
+        hard_percent = 0.0;
+        if(t->hard_limit[limit])
+            hard_percent = (double) t->current[limit] /
+                t->hard_limit[limit] * 100;
+
+        if(soft_percent > *max_soft)
+            *max_soft = soft_percent;
+        if(hard_percent > *max_hard)
+            *max_hard = hard_percent;
+
+        /* Unset hard thresholds are NaN, which never compares greater. */
+        if(soft_percent > t_arguments->nofiles_crit_threshold ||
+                hard_percent > t_arguments->hard_crit_threshold)
+        {
+            rc = CRITICAL;
+            s_list = s_message_pids_crit;
+        }
+        else if(soft_percent > t_arguments->nofiles_warn_threshold ||
+                hard_percent > t_arguments->hard_warn_threshold)
+        {
+            if(rc < WARNING)
+                rc = WARNING;
+            s_list = s_message_pids_warn;
+        }
+        else
+            s_list = s_message_pids;
+
+        strncat(s_list, s_message_tmp, MAXBUF - strlen(s_list) - 1);
+    }
 
     /*
-     * Finaly we return the number of bytes that where
-     * written to 's_buffer'. Just in case someone need
-     * this position.
+     * Build the coresponding message.
      */
-    return pos;
+    if(s_message[0])
+        strncat(s_message, "; ", message_len - strlen(s_message) - 1);
+    if(limit == LIMIT_NOFILE)
+        snprintf(s_message_tmp, MAXBUF, "%s: total: %d / per PID - ",
+                t_limit->title, n_files_total);
+    else
+        snprintf(s_message_tmp, MAXBUF, "%s: per PID - ", t_limit->title);
+    strncat(s_message, s_message_tmp, message_len - strlen(s_message) - 1);
+
+    if(strlen(s_message_pids_crit))
+    {
+        strncat(s_message, " CRITICAL PIDs ",
+                message_len - strlen(s_message) - 1);
+        strncat(s_message, s_message_pids_crit,
+                message_len - strlen(s_message) - 1);
+    }
+    if(strlen(s_message_pids_warn))
+    {
+        strncat(s_message, " WARNING PIDs ",
+                message_len - strlen(s_message) - 1);
+        strncat(s_message, s_message_pids_warn,
+                message_len - strlen(s_message) - 1);
+    }
+    strncat(s_message, " OK PIDs ", message_len - strlen(s_message) - 1);
+    strncat(s_message, s_message_pids, message_len - strlen(s_message) - 1);
+
+    return rc;
 }
 
 /*
@@ -484,35 +1053,50 @@ size_t linktarget(char *s_link, char *s_buffer, size_t buffer_len)
  * Description:
  *  Main function.
  */
-int main(int argc, const char *argv[])
+int PLUGIN_MAIN(check_nofiles_limits)(int argc, char *argv[])
 {
     int              count;
     int              n_pids = 0;
     int              n_files_total = 0;
+    int              n_tables = 0;
     int              rc = 0;
-
-    double           limit_percent = 0.0;
-    double           limit_percent_max = 0.0;
-
-    DIR             *dir_proc;
-    struct dirent   *dir_entry;
+    int              state;
+    unsigned int     status_limits;
+    unsigned int     columns;
+
+    double           max_soft;
+    double           max_hard;
+    double           cache_ttl = 0.0;
+
+    long             deadline_ms = 0;
+    int              n_listed = 0;
+    int              listed = 0;
+    int              n_unexamined = 0;
+    int              n_matched = 0;
+    int              n_scanned = 0;
+    int32_t         *previous = NULL;
+    int32_t         *state_pids = NULL;
+    uint32_t         n_previous = 0;
+    uint32_t         n_state = 0;
+    char             s_state_path[MAXBUF];
+    char             s_partial[MAXBUF];
+
+    /* The processes, rows of the snapshot in the order they are matched. */
+    procsnap_t       snap;
+    size_t          *rows;
+    size_t           n_rows;
+    size_t           n_batch;
+    size_t           n_match;
+    size_t           j;
+    int              i;
 
     const char      *option;
     const char      *s_this_name = NULL;
 
-    char            *s_exe_name;
-    char             s_exe_link[MAXBUF];
-    char             s_exe_link_target[MAXBUF];
-    char             s_message[MAXBUF];
-    char             s_message_pids[MAXBUF];
-    char             s_message_pids_warn[MAXBUF];
-    char             s_message_pids_crit[MAXBUF];
-    char             s_message_perfdata[MAXBUF];
-    char             s_message_tmp[MAXBUF];
-
+    char             s_message[MAXMSG];
 
     /* Structure to hold our pid information */
-    nofiles_t        t_nofiles[MAXPIDS];
+    nofiles_t       *t_nofiles;
 
     /* Structure to hold our arguments */
     arguments_t      t_arguments =
@@ -520,9 +1104,15 @@ int main(int argc, const char *argv[])
         NULL,
         NULL,
         DEFAULTWARN,
-        DEFAULTCRIT
+        DEFAULTCRIT,
+        OUTPUT_UNSET,
+        OUTPUT_UNSET,
+        1U << LIMIT_NOFILE
     };
 
+    started = now_ns();
+    output_init(PROCNAME);
+
     /*
      * Save the executable name.
      */
@@ -541,6 +1131,38 @@ int main(int argc, const char *argv[])
             print_help(s_this_name);
         else if(check_option(option, "-V", "--version"))
             print_version();
+        else if(check_option(option, "-F", "--format"))
+        {
+            if(++count >= argc)
+                write_message(ENOFORMAT, UNKNOWN);
+            else if(output_set_format(argv[count]) != 0)
+                write_message(EOUTPUTFORMAT, UNKNOWN);
+        }
+        else if(check_option(option, "--textfile", "--textfile"))
+        {
+            if(++count >= argc)
+                write_message(ENOTEXTFILE, UNKNOWN);
+            else
+                output_set_textfile(argv[count]);
+        }
+        else if(check_option(option, "--cache-ttl", "--cache-ttl"))
+        {
+            if(++count >= argc || (cache_ttl = strtod(argv[count], NULL)) <= 0)
+                write_message(ECACHETTL, UNKNOWN);
+        }
+        else if(check_option(option, "--deadline-ms", "--deadline-ms"))
+        {
+            if(++count >= argc ||
+                    (deadline_ms = strtol(argv[count], NULL, 10)) <= 0)
+                write_message(ENODEADLINE, UNKNOWN);
+        }
+        else if(check_option(option, "--io-uring", "--io-uring"))
+            procfs_set_uring(1);
+        else if(check_option(option, "--profile", "--profile"))
+        {
+            if(!profile_enable())
+                write_message(ENOPROFILE, UNKNOWN);
+        }
         else if(check_option(option, "-e", "--executable"))
         {
             if(++count >= argc)
@@ -555,6 +1177,13 @@ int main(int argc, const char *argv[])
             else
                 t_arguments.s_process_name = argv[count];
         }
+        else if(check_option(option, "-P", "--procfs-root"))
+        {
+            if(++count >= argc)
+                write_message(ENOPROCFSROOT, UNKNOWN);
+            else
+                procfs_set_root(argv[count]);
+        }
         else if(check_option(option, "-w", "--warning"))
         {
             if(++count >= argc)
@@ -575,6 +1204,27 @@ int main(int argc, const char *argv[])
                 t_arguments.nofiles_crit_threshold = strtod(option, NULL);
             }
         }
+        else if(check_option(option, "--warning-hard", "--warning-hard"))
+        {
+            if(++count >= argc)
+                write_message(ENOHARDWARN, UNKNOWN);
+            else
+                t_arguments.hard_warn_threshold = strtod(argv[count], NULL);
+        }
+        else if(check_option(option, "--critical-hard", "--critical-hard"))
+        {
+            if(++count >= argc)
+                write_message(ENOHARDCRIT, UNKNOWN);
+            else
+                t_arguments.hard_crit_threshold = strtod(argv[count], NULL);
+        }
+        else if(check_option(option, "-l", "--limits"))
+        {
+            if(++count >= argc)
+                write_message(ENOLIMITS, UNKNOWN);
+            else if(!(t_arguments.limits = parse_limit_names(argv[count])))
+                write_message(EUNKNOWNLIMIT, UNKNOWN);
+        }
     }
 
     /*
@@ -592,170 +1242,220 @@ int main(int argc, const char *argv[])
     if(t_arguments.nofiles_crit_threshold <= t_arguments.nofiles_warn_threshold)
         write_message(EWARNCRIT, UNKNOWN);
 
+    if(t_arguments.hard_crit_threshold <= t_arguments.hard_warn_threshold)
+        write_message(EHARDWARNCRIT, UNKNOWN);
+
+    /* All limits but the open files are used as given by the status file. */
+    status_limits = t_arguments.limits & ~(1U << LIMIT_NOFILE);
+
+    if(cache_ttl > 0)
+        cache_init(PROCNAME, argc, argv, cache_ttl);
+
     /*
-     * We got the executable name, so we can got to work.
+     * The budget counts from the start, what is left after DEADLINESHARE
+     * of it is reserved for evaluating and printing the results.
      */
-    dir_proc = opendir(PROCFS);
+    if(deadline_ms)
+    {
+        deadline = started + (int64_t) (deadline_ms * 1e6 * DEADLINESHARE);
+        state_path(s_state_path, sizeof(s_state_path), &t_arguments);
+        previous = read_state(s_state_path, &n_previous);
+    }
 
-    while(NULL != (dir_entry = readdir(dir_proc)))
+    /*
+     * We got the executable name, so we can got to work. The snapshot
+     * lists the pids, their files are loaded for the selected rows only.
+     */
+    PROFILE_BEGIN("scan");
+    if((listed = procsnap_open_until(&snap, listing_reached)) < 0)
     {
-        long     pid;
+        snprintf(s_message, sizeof(s_message),
+                "ERROR: while open procfs root \"%s\": \"%s\"",
+                procfs_root(), strerror(errno));
+        write_message(s_message, UNKNOWN);
+    }
+    PROFILE_END("scan");
+    n_listed = snap.count;
 
-        /* Skip directories and files which are not of format [0-9]* */
-        if (!(strspn(dir_entry->d_name, PIDCHARS) == strlen(dir_entry->d_name))) {
-            continue;
-        }
-        pid = atoi(dir_entry->d_name);
-        /*printf("dirname %s\n", dir_entry->d_name);*/
+    if(!(rows = malloc((snap.count + 1) * sizeof(size_t))))
+        write_message(ENOMEMORY, UNKNOWN);
+    if(deadline_ms && !(state_pids = malloc((snap.count + n_previous + 1) *
+                    sizeof(int32_t))))
+        write_message(ENOMEMORY, UNKNOWN);
 
-        if(t_arguments.s_executable)
-        {
-            /*
-             * Build the full path to the exe link.
-             */
-            rc = build_exe_link(s_exe_link, pid, sizeof(s_exe_link));
-
-            /*
-             * Resove the target of exe. If something went wront, move on.
-             */
-            rc = linktarget(s_exe_link, s_exe_link_target, MAXBUF);
-            if(rc < 0)
-                continue;
+    /* The listing was cut short, pids which matched last time may be left. */
+    if(listed > 0)
+        keep_unlisted(&snap, previous, n_previous, state_pids, &n_state);
 
-            /*
-             * Now that we got a valid processes we should check that processes
-             * againts the given executable name.
-             */
-            s_exe_name = basename(s_exe_link_target);
-            if(0 != strncmp(s_exe_name, t_arguments.s_executable, MAXBUF))
-                continue;
-        }
-        if(t_arguments.s_process_name)
-        {
-            /*
-             * Check against the process name.
-             */
-            rc = cmp_process_name(pid, t_arguments.s_process_name);
+    /*
+     * The processes which matched last time are matched first. Those which
+     * are gone by now are dropped like any other process which vanishes
+     * during the scan.
+     */
+    n_rows = order_rows(&snap, previous, n_previous, rows);
 
-            if(rc <= 0)
-                continue;
+    /*
+     * Match BATCH rows at a time, moving the matching ones to the front of
+     * rows.
+     */
+    PROFILE_BEGIN("match");
+    for(j = 0; j < n_rows; j += n_batch)
+    {
+        if(share_reached(MATCHSHARE))
+        {
+            n_unexamined = n_rows - j;
+            keep_unexamined(&snap, rows + j, n_rows - j, previous,
+                    n_previous, state_pids, &n_state);
+            break;
         }
 
-        /*
-         * At this point we got a valid pid with the target executable name.
-         */
+        n_batch = n_rows - j < BATCH ? n_rows - j : BATCH;
+        n_match = match_rows(&snap, rows + j, n_batch, &t_arguments);
+        memmove(rows + n_matched, rows + j, n_match * sizeof(size_t));
+        n_matched += n_match;
+    }
+    PROFILE_END("match");
 
-        /*
-         * Because we need to remember the found pids and limits we should save
-         * that values.
-         */
-        t_nofiles[n_pids].pid = pid;
-        read_nofiles_limit(&t_nofiles[n_pids]);
+    /*
+     * Remember the matching pids for the next run, along with those which
+     * matched last time and weren't examined in this one.
+     */
+    if(deadline_ms)
+    {
+        for(i = 0; i < n_matched; i++)
+            state_pids[n_state++] = snap.pids[rows[i]];
+        PROFILE_BEGIN("state");
+        write_state(s_state_path, state_pids, n_state);
+        PROFILE_END("state");
+        free(state_pids);
+        free(previous);
+    }
 
-        /*
-         * Get the number of currently open files to this process.
-         */
-        t_nofiles[n_pids].current = read_num_open_files(t_nofiles[n_pids].pid);
+    if(!(t_nofiles = calloc(n_matched + 1, sizeof(nofiles_t))))
+        write_message(ENOMEMORY, UNKNOWN);
+
+    /*
+     * Load the limits, and the status if it holds the usage of a requested
+     * limit, of the matched processes. Processes which are gone in the
+     * meantime are skipped.
+     */
+    columns = PROCSNAP_LIMITS | (status_limits ? PROCSNAP_STATUS : 0);
 
-        n_pids++;
+    PROFILE_BEGIN("limits");
+    for(j = 0; j < (size_t) n_matched && !deadline_reached(); j += n_batch)
+    {
+        size_t  k;
+
+        n_batch = n_matched - j < BATCH ? n_matched - j : BATCH;
+        if(procsnap_load(&snap, columns, rows + j, n_batch) < 0)
+            write_message(ENOMEMORY, UNKNOWN);
+
+        for(k = 0; k < n_batch; k++)
+            if(!snap.gone[rows[j + k]])
+                read_process(&t_nofiles[n_pids++], &snap, rows[j + k],
+                        t_arguments.limits);
     }
+    PROFILE_END("limits");
 
-    /* At this point we don't need the dir_proc anymore */
-    closedir(dir_proc);
+    if(t_arguments.limits & (1U << LIMIT_NPROC))
+        count_user_threads(&snap, t_nofiles, n_pids);
+
+    /*
+     * Get the number of currently open files to each process.
+     */
+    if(t_arguments.limits & (1U << LIMIT_NOFILE))
+    {
+        PROFILE_BEGIN("fds");
+        n_tables = count_fd_tables(&snap, t_nofiles, n_pids);
+        PROFILE_END("fds");
+    }
+
+    free(rows);
+    procsnap_close(&snap);
+
+    for(count = 0; count < n_pids; count++)
+        n_scanned += t_nofiles[count].scanned;
 
     /* Reset rc, just to be sure */
     rc = OK;
-    /* We also need to initialize s_message_pids */
-    s_message_pids[0] = '\0';
+    s_message[0] = '\0';
 
     /*
-     * Check each process against the specified thresholds
+     * Check each process against the specified thresholds, limit by limit.
      */
-    for(count=0; count<n_pids; count++)
+    for(i = 0; i < NLIMITS; i++)
     {
-        /*
-         * Count the total number of files, that where in use by all processes.
-         */
-        n_files_total += t_nofiles[count].current;
-
-        snprintf(s_message_tmp, MAXBUF, " %lu (%lu/%lu)",
-                t_nofiles[count].pid, t_nofiles[count].current,
-                t_nofiles[count].soft_limit);
+        if(!(t_arguments.limits & (1U << i)))
+            continue;
 
-        limit_percent =
-            ( (double) t_nofiles[count].current / t_nofiles[count].soft_limit * 100);
+        state = check_limit(t_nofiles, n_pids, i, &t_arguments, s_message,
+                sizeof(s_message), &max_soft, &max_hard);
+        if(state > rc)
+            rc = state;
 
-        if(limit_percent > limit_percent_max)
+        /* The open files keep their unlabeled perfdata. */
+        if(i == LIMIT_NOFILE)
         {
-            limit_percent_max = limit_percent;
-
-            /* Check against critical values */
-            if(limit_percent > t_arguments.nofiles_crit_threshold)
-            {
-                rc = CRITICAL;
-                strncat(s_message_pids_crit, s_message_tmp,
-                        sizeof(s_message_pids_crit)-strlen(s_message_pids_crit));
-            }
-            /* Check against warning values */
-            else if(limit_percent > t_arguments.nofiles_warn_threshold)
-            {
-                rc = WARNING;
-                strncat(s_message_pids_warn, s_message_tmp,
-                        sizeof(s_message_pids_warn)-strlen(s_message_pids_warn));
-            }
-        }
-        else
-        {
-            /* All non warning or critical pids */
-            strncat(s_message_pids, s_message_tmp,
-                    sizeof(s_message_pids)-strlen(s_message_pids));
+            for(count = 0; count < n_pids; count++)
+                if(t_nofiles[count].table == count)
+                    n_files_total += t_nofiles[count].current[LIMIT_NOFILE];
+
+            output_add("total_files", "", n_files_total,
+                    OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+            output_add("number_of_processes", "", n_scanned,
+                    OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+            output_add("max_usage", "%", max_soft,
+                    t_arguments.nofiles_warn_threshold,
+                    t_arguments.nofiles_crit_threshold, 0, 100);
+            output_add("number_of_fd_tables", "", n_tables,
+                    OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+            output_add("max_hard_usage", "%", max_hard,
+                    t_arguments.hard_warn_threshold,
+                    t_arguments.hard_crit_threshold, 0, 100);
+            continue;
         }
+
+        output_add_labeled("limit", limits[i].name, "max_usage", "%",
+                max_soft, t_arguments.nofiles_warn_threshold,
+                t_arguments.nofiles_crit_threshold, 0, 100);
+        output_add_labeled("limit", limits[i].name, "max_hard_usage", "%",
+                max_hard, t_arguments.hard_warn_threshold,
+                t_arguments.hard_crit_threshold, 0, 100);
     }
 
-    /*
-     * Build the coresponding s_message.
-     */
-    snprintf(s_message, sizeof(s_message),
-            "Files in use: total: %d / per PID - ", n_files_total);
-    snprintf(s_message_perfdata, sizeof(s_message_perfdata),
-            "| total_files=%d;0;0 number_of_processes=%d;0;0",
-            n_files_total, n_pids);
+    if(!(t_arguments.limits & (1U << LIMIT_NOFILE)))
+        output_add("number_of_processes", "", n_scanned,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
 
-    /*
-     * Print critical pids.
-     */
-    if(strlen(s_message_pids_crit))
+    if(deadline_ms)
     {
-        strncat(s_message, " CRITICAL PIDs ",
-                sizeof(s_message)-strlen(s_message));
-        strncat(s_message, s_message_pids_crit,
-                sizeof(s_message)-strlen(s_message));
+        output_add("pids_scanned", "", n_listed - n_unexamined,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        output_add("pids_total", "", n_listed,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
     }
 
+    free(t_nofiles);
+
     /*
-     * Print warning pids.
+     * Thresholds were evaluated on what was collected before the deadline,
+     * the message tells how much that is.
      */
-    if(strlen(s_message_pids_warn))
+    if(partial)
     {
-        strncat(s_message, " WARNING PIDs ",
-                sizeof(s_message)-strlen(s_message));
-        strncat(s_message, s_message_pids_warn,
-                sizeof(s_message)-strlen(s_message));
+        snprintf(s_partial, sizeof(s_partial), "PARTIAL: deadline of %ld ms "
+                "reached after %d of %s%d PIDs, %d of %d matching "
+                "processes checked - ", deadline_ms, n_listed - n_unexamined,
+                listed > 0 ? "at least " : "", n_listed, n_scanned,
+                n_matched);
+        output_exit(rc, "%s%s", s_partial, s_message);
     }
 
-    /*
-     * Print all other pids.
-     */
-    strncat(s_message, " OK PIDs ",
-            sizeof(s_message)-strlen(s_message));
-
-    strncat(s_message, s_message_pids,
-            sizeof(s_message)-strlen(s_message));
-    strncat(s_message, s_message_perfdata,
-            sizeof(s_message)-strlen(s_message));
-
     /*
      * Last but no least: print the message.
      */
     write_message(s_message, rc);
+
+    /* suppress compiler warnings */
+    return rc;
 }
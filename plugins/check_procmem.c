@@ -0,0 +1,938 @@
+/*
+ * filename: check_procmem.c
+ *
+ * Names the processes which use the most memory: the top N by resident
+ * set (rss), proportional set (pss), anonymous memory (anon) or swap, of
+ * all processes or those of a name or a cgroup. Thresholds apply to the
+ * sorted by value of every single process.
+ *
+ * /proc/<pid>/smaps_rollup has the pss and anonymous memory, but the
+ * kernel walks all page tables of the process to generate it. So every
+ * process is weighed with a cheap upper bound first, the resident pages of
+ * statm (rss, pss and anon are never more) or the VmSwap of status, and
+ * smaps_rollup is read in the order of that bound only until no remaining
+ * process can make it into the top N. The bound is the value itself with
+ * --sort rss or swap, which need no smaps_rollup at all.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/procsnap.h"
+#include "../include/profile.h"
+
+#define VERSION "0.1"
+#define BUFFER_LEN 4096
+
+#define DEFAULT_TOP     5
+#define MAXTOP          64
+#define MAXTHREADS      64
+
+/* Pids a worker claims at once while weighing the processes. */
+#define PIDCHUNK        64
+
+/* Rows of the process snapshot matched at once. */
+#define BATCH           256
+
+/*
+ * --deadline-ms: the scan stops after DEADLINESHARE of the budget, weighing
+ * the processes after WEIGHSHARE of it.
+ */
+#define DEADLINESHARE   0.9
+#define WEIGHSHARE      0.6
+
+/* Values to sort by, the index of the value in proc_mem_t. */
+#define SORT_RSS        0
+#define SORT_PSS        1
+#define SORT_ANON       2
+#define SORT_SWAP       3
+#define NVALUES         4
+
+static const char *value_names[NVALUES] = { "rss", "pss", "anon", "swap" };
+
+/*
+ * Structure to hold the memory of a process.
+ *
+ * Members:
+ *  - long     pid:     the process
+ *  - size_t   row:     its row in the process snapshot
+ *  - uint64_t bound:   upper bound of the sorted by value (kB)
+ *  - uint64_t values:  rss, pss, anon and swap (kB)
+ *  - int      rollup:  1 once smaps_rollup was read, -1 if it is not
+ *                      readable and the bound stands in for the value
+ */
+typedef struct proc_mem {
+    long        pid;
+    size_t      row;
+    uint64_t    bound;
+    uint64_t    values[NVALUES];
+    int         rollup;
+} proc_mem_t;
+
+/*
+ * Structure to hold a scan, shared by the worker threads.
+ *
+ * Members:
+ *  - proc_mem_t  *procs:    the matching processes
+ *  - size_t       count:    number of procs
+ *  - size_t       next:     next entry to claim
+ *  - const char  *name:     process name to match or NULL
+ *  - const char  *cgroup:   cgroup (and below) to match or NULL
+ *  - int          sort:     value to sort by, SORT_*
+ *  - int          n_top:    size of the top
+ *  - long         page_kb:  size of a page in kB
+ *  - uint64_t     cutoff:   a value the top N exceeds at least, the
+ *                           largest minimum of the workers' heaps
+ *  - int          stopped:  1 once the deadline passed
+ *  - long         reads:    number of files read
+ *  - long         rollups:  number of smaps_rollup files read
+ *  - long         denied:   number of smaps_rollup files not readable
+ *  - proc_mem_t **top:      the top N of every worker
+ *  - int         *n_tops:   size of these tops
+ *  - int          workers:  number of workers which registered their top
+ */
+typedef struct proc_scan {
+    proc_mem_t     *procs;
+    size_t          count,
+                    next;
+    const char     *name,
+                   *cgroup;
+    int             sort,
+                    n_top;
+    long            page_kb;
+    uint64_t        cutoff;
+    int             stopped;
+    long            reads,
+                    rollups,
+                    denied;
+    proc_mem_t    **top[MAXTHREADS];
+    int             n_tops[MAXTHREADS];
+    int             workers;
+} proc_scan_t;
+
+/*
+ * CLOCK_MONOTONIC ns the plugin started at and the scan has to stop at,
+ * the latter is 0 without --deadline-ms.
+ */
+static int64_t  started = 0,
+                deadline = 0;
+
+/*
+ * print_help:
+ *
+ * print help output to stdout
+ */
+static void print_help (const char *progname)
+{
+    printf("Usage:\n");
+    printf(" %s [options]\n", progname);
+    printf("\n");
+    printf("Options\n");
+    printf(" -s, --sort\t\trss, pss (default), anon or swap\n");
+    printf(" -t, --top\t\tnumber of processes to report (default: %d)\n",
+            DEFAULT_TOP);
+    printf(" -w, --warning\t\twarning threshold of any process (bytes, or\n"
+           "\t\t\twith a suffix k, M, G or T)\n");
+    printf(" -c, --critical\t\tcritical threshold of any process\n");
+    printf(" -n, --name\t\tonly check the processes of this name\n");
+    printf(" -g, --cgroup\t\tonly check the processes in this cgroup (v2)\n"
+           "\t\t\tand below, e.g. /system.slice/nginx.service\n");
+    printf("     --threads\t\tscan the processes with N threads (default: 1)\n");
+    printf("     --deadline-ms\tstop scanning before this many ms passed\n"
+           "\t\t\tand report the processes checked so far\n");
+    printf(" -v, --verbose\t\tverbose output\n");
+    printf(" -F, --format\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("     --textfile\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("     --profile\t\tappend timings of the plugin to the perfdata\n");
+    printf(" -P, --procfs-root\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf("     --cache-ttl\tshare results younger than this (seconds)\n"
+           "\t\t\twith invocations with the same arguments\n");
+    printf("\n");
+    printf(" -h, --help\t\tdisplay this help text\n");
+    printf(" -V, --version\t\toutput version information\n");
+}
+
+/*
+ * print_version:
+ *
+ * prints version information to stdout
+ */
+static void print_version()
+{
+    printf("check_procmem (%s)\n", VERSION);
+}
+
+/*
+ * exit_with_message:
+ *
+ * print a message to stdout and exit with return code rc
+ */
+static void exit_with_message(int rc, char *message)
+{
+    output_exit(rc, "%s", message);
+}
+
+/*
+ * now_ns:
+ *
+ * returns CLOCK_MONOTONIC in nanoseconds
+ */
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * share_reached:
+ *
+ * returns 1 if --deadline-ms was given and a phase which may use the given
+ * share of the scan budget has to stop
+ */
+static int share_reached(double share)
+{
+    return deadline && now_ns() >= started + (int64_t) ((deadline - started) *
+            share);
+}
+
+/*
+ * parse_size:
+ *
+ * parses a size in bytes with an optional suffix k, M, G or T (powers of
+ * 1024) into kB. Returns -1 if it is invalid.
+ */
+static double parse_size(const char *s)
+{
+    const char  *suffixes = "kMGT";
+    const char  *suffix;
+    char        *end;
+    double       size = strtod(s, &end);
+
+    if(end == s || size < 0)
+        return -1;
+    if(!*end)
+        return size / 1024;
+    if(end[1] || !(suffix = strchr(suffixes, *end)))
+        return -1;
+
+    /* k is 1024 bytes, i.e. 1 kB */
+    for(; suffix > suffixes; suffix--)
+        size *= 1024;
+
+    return size;
+}
+
+/*
+ * format_size:
+ *
+ * formats kB like "1.21 GB"
+ */
+static void format_size(char *buffer, size_t len, uint64_t kb)
+{
+    const char  *units[] = { "kB", "MB", "GB", "TB" };
+    double       size = kb;
+    int          unit = 0;
+
+    while(size >= 1024 && unit < 3)
+    {
+        size /= 1024;
+        unit++;
+    }
+
+    snprintf(buffer, len, unit ? "%.2f %s" : "%.0f %s", size, units[unit]);
+}
+
+/*
+ * parse_kb:
+ *
+ * returns the number of the line starting with key in buffer, e.g. the kB
+ * of "VmSwap:", 0 if there is no such line
+ */
+static uint64_t parse_kb(const char *buffer, const char *key)
+{
+    size_t       key_len = strlen(key);
+    const char  *line;
+
+    for(line = buffer; line; line = strchr(line, '\n'))
+    {
+        line += *line == '\n';
+        if(0 == strncmp(line, key, key_len))
+            return strtoull(line + key_len, NULL, 10);
+    }
+
+    return 0;
+}
+
+/*
+ * in_cgroup:
+ *
+ * returns 1 if the unified (v2) cgroup path of a process is cgroup or
+ * below it, 0 if it is not or the process has none
+ */
+static int in_cgroup(const char *path, const char *cgroup)
+{
+    size_t       len = strlen(cgroup);
+
+    /* "/" is the root, everything is below it. */
+    while(len > 0 && cgroup[len - 1] == '/')
+        len--;
+
+    return path && 0 == strncmp(path, cgroup, len) &&
+        (path[len] == '/' || path[len] == '\0');
+}
+
+/*
+ * match_rows:
+ *
+ * loads the comm of the rows with --name and drops those of other names,
+ * then the cgroup of the rest with --cgroup and drops those outside of it.
+ * Returns the number of rows kept at the start of rows.
+ */
+static size_t match_rows(procsnap_t *snap, const proc_scan_t *scan,
+        size_t *rows, size_t n_rows)
+{
+    size_t  i,
+            n;
+
+    if(scan->name)
+    {
+        if(procsnap_load(snap, PROCSNAP_COMM, rows, n_rows) < 0)
+            exit_with_message(UNKNOWN, "out of memory");
+        for(n = 0, i = 0; i < n_rows; i++)
+            if(!snap->gone[rows[i]] &&
+                    0 == strcmp(snap->comm[rows[i]], scan->name))
+                rows[n++] = rows[i];
+        n_rows = n;
+    }
+
+    if(scan->cgroup)
+    {
+        if(procsnap_load(snap, PROCSNAP_CGROUP, rows, n_rows) < 0)
+            exit_with_message(UNKNOWN, "out of memory");
+        for(n = 0, i = 0; i < n_rows; i++)
+            if(!snap->gone[rows[i]] &&
+                    in_cgroup(snap->cgroup[rows[i]], scan->cgroup))
+                rows[n++] = rows[i];
+        n_rows = n;
+    }
+
+    return n_rows;
+}
+
+/*
+ * weigh_process:
+ *
+ * reads the upper bound of the sorted by value of a matching process: the
+ * resident pages of statm, with --sort swap the VmSwap of status. Keeps
+ * pid 0 for processes which are gone.
+ */
+static void weigh_process(const proc_scan_t *scan, proc_mem_t *proc,
+        long *reads)
+{
+    char     path[BUFFER_LEN],
+             buffer[BUFFER_LEN];
+    long     pid = proc->pid;
+
+    proc->pid = 0;
+
+    if(scan->sort == SORT_SWAP)
+    {
+        procfs_path(path, sizeof(path), "%ld/status", pid);
+        (*reads)++;
+        if(procfs_read(path, buffer, sizeof(buffer)) <= 0)
+            return;
+        proc->values[SORT_RSS] = parse_kb(buffer, "VmRSS:");
+        proc->values[SORT_SWAP] = parse_kb(buffer, "VmSwap:");
+        proc->bound = proc->values[SORT_SWAP];
+    }
+    else
+    {
+        char       *p;
+
+        /* "size resident shared text lib data dt", in pages */
+        procfs_path(path, sizeof(path), "%ld/statm", pid);
+        (*reads)++;
+        if(procfs_read(path, buffer, sizeof(buffer)) <= 0)
+            return;
+        strtoull(buffer, &p, 10);
+        proc->values[SORT_RSS] = strtoull(p, NULL, 10) * scan->page_kb;
+        proc->bound = proc->values[SORT_RSS];
+    }
+
+    proc->pid = pid;
+}
+
+/*
+ * weigh_worker:
+ *
+ * weighs the pids of the scan, chunk by chunk
+ */
+static void *weigh_worker(void *arg)
+{
+    proc_scan_t *scan = arg;
+    size_t       i,
+                 end;
+    long         reads = 0;
+
+    while((i = __atomic_fetch_add(&scan->next, PIDCHUNK, __ATOMIC_RELAXED)) <
+            scan->count)
+    {
+        end = i + PIDCHUNK < scan->count ? i + PIDCHUNK : scan->count;
+
+        /* Processes left out are no candidates, like vanished ones. */
+        if(share_reached(WEIGHSHARE))
+        {
+            __atomic_store_n(&scan->stopped, 1, __ATOMIC_RELAXED);
+            for(; i < end; i++)
+                scan->procs[i].pid = -1;
+            continue;
+        }
+
+        for(; i < end; i++)
+            weigh_process(scan, &scan->procs[i], &reads);
+    }
+
+    __atomic_fetch_add(&scan->reads, reads, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+/*
+ * heap_push:
+ *
+ * adds proc to the min heap of at most max processes ordered by the value
+ * sort, replacing the smallest one when it is full. Returns the new size.
+ */
+static int heap_push(proc_mem_t **heap, int n, int max, proc_mem_t *proc,
+        int sort)
+{
+    proc_mem_t  *tmp;
+    int          i,
+                 child;
+
+    if(n < max)
+    {
+        /* sift up */
+        for(i = n++; i > 0 && heap[(i - 1) / 2]->values[sort] >
+                proc->values[sort]; i = (i - 1) / 2)
+            heap[i] = heap[(i - 1) / 2];
+        heap[i] = proc;
+        return n;
+    }
+
+    if(proc->values[sort] <= heap[0]->values[sort])
+        return n;
+
+    /* sift down */
+    for(heap[0] = proc, i = 0; (child = 2 * i + 1) < n; i = child)
+    {
+        if(child + 1 < n &&
+                heap[child + 1]->values[sort] < heap[child]->values[sort])
+            child++;
+        if(heap[i]->values[sort] <= heap[child]->values[sort])
+            break;
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+    }
+
+    return n;
+}
+
+/*
+ * raise_cutoff:
+ *
+ * raises the cutoff of the scan to value, if that is more
+ */
+static void raise_cutoff(proc_scan_t *scan, uint64_t value)
+{
+    uint64_t    cutoff = __atomic_load_n(&scan->cutoff, __ATOMIC_RELAXED);
+
+    while(value > cutoff && !__atomic_compare_exchange_n(&scan->cutoff,
+                &cutoff, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * read_rollup:
+ *
+ * reads pss, anon and swap of a process from its smaps_rollup. Returns 0
+ * if the process is gone, -1 if reading smaps_rollup is not permitted,
+ * which needs the permission to ptrace the process.
+ */
+static int read_rollup(proc_mem_t *proc)
+{
+    char     path[BUFFER_LEN],
+             buffer[BUFFER_LEN];
+
+    procfs_path(path, sizeof(path), "%ld/smaps_rollup", proc->pid);
+    if(procfs_read(path, buffer, sizeof(buffer)) <= 0)
+        return errno == EACCES || errno == EPERM ? -1 : 0;
+
+    proc->values[SORT_PSS] = parse_kb(buffer, "Pss:");
+    proc->values[SORT_ANON] = parse_kb(buffer, "Anonymous:");
+    proc->values[SORT_SWAP] = parse_kb(buffer, "Swap:");
+    proc->rollup = 1;
+
+    return 1;
+}
+
+/*
+ * rollup_worker:
+ *
+ * reads the smaps_rollup of the processes of the scan, which are sorted
+ * by their bound, into a top of its own until the bound of the next
+ * process doesn't exceed the cutoff anymore. Then no process left can
+ * make it into the top N of any worker. A process whose smaps_rollup is
+ * not readable stays in the ranking with its bound.
+ */
+static void *rollup_worker(void *arg)
+{
+    proc_scan_t *scan = arg;
+    proc_mem_t  *heap[MAXTOP];
+    proc_mem_t  *proc;
+    size_t       i;
+    long         reads = 0,
+                 denied = 0;
+    int          n = 0,
+                 rc,
+                 worker;
+
+    while((i = __atomic_fetch_add(&scan->next, 1, __ATOMIC_RELAXED)) <
+            scan->count)
+    {
+        /* Processes of no memory at all are not worth naming either. */
+        proc = &scan->procs[i];
+        if(proc->bound <= __atomic_load_n(&scan->cutoff, __ATOMIC_RELAXED))
+            break;
+        if(share_reached(1.0))
+        {
+            __atomic_store_n(&scan->stopped, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        reads++;
+        if((rc = read_rollup(proc)) == 0)
+            continue;
+        if(rc < 0)
+        {
+            denied++;
+            proc->rollup = -1;
+            proc->values[scan->sort] = proc->bound;
+        }
+
+        n = heap_push(heap, n, scan->n_top, proc, scan->sort);
+        if(n == scan->n_top)
+            raise_cutoff(scan, heap[0]->values[scan->sort]);
+    }
+
+    worker = __atomic_fetch_add(&scan->workers, 1, __ATOMIC_RELAXED);
+    if((scan->top[worker] = malloc((n + 1) * sizeof(proc_mem_t *))))
+    {
+        memcpy(scan->top[worker], heap, n * sizeof(proc_mem_t *));
+        scan->n_tops[worker] = n;
+    }
+
+    __atomic_fetch_add(&scan->rollups, reads, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&scan->denied, denied, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+/*
+ * run_workers:
+ *
+ * runs worker on the scan with n_threads threads, including this one
+ */
+static void run_workers(proc_scan_t *scan, void *(*worker)(void *),
+        int n_threads)
+{
+    pthread_t   threads[MAXTHREADS];
+    int         started_threads = 0,
+                i;
+
+    scan->next = 0;
+    for(i = 1; i < n_threads; i++)
+        if(0 == pthread_create(&threads[started_threads], NULL, worker, scan))
+            started_threads++;
+    worker(scan);
+    for(i = 0; i < started_threads; i++)
+        pthread_join(threads[i], NULL);
+}
+
+/*
+ * value_known:
+ *
+ * returns 1 if value k of the process was read: rss always, pss and anon
+ * from smaps_rollup, swap from smaps_rollup or, with --sort swap, status
+ */
+static int value_known(const proc_scan_t *scan, const proc_mem_t *proc,
+        int k)
+{
+    return k == SORT_RSS || proc->rollup > 0 ||
+        (k == SORT_SWAP && scan->sort == SORT_SWAP);
+}
+
+/*
+ * cmp_bound:
+ *
+ * sorts processes by their bound, the largest first
+ */
+static int cmp_bound(const void *a, const void *b)
+{
+    const proc_mem_t    *pa = a,
+                        *pb = b;
+
+    return pa->bound < pb->bound ? 1 : pa->bound > pb->bound ? -1 :
+        (pa->pid > pb->pid) - (pa->pid < pb->pid);
+}
+
+/*
+ * listing_stopped:
+ *
+ * stops listing the pids once it took the time weighing the processes may
+ */
+static int listing_stopped(void)
+{
+    return share_reached(WEIGHSHARE / 2);
+}
+
+int PLUGIN_MAIN(check_procmem)(int argc, char *argv[])
+{
+    proc_scan_t      scan;
+    procsnap_t       snap;
+    proc_mem_t      *heap[MAXTOP],
+                    *top[MAXTOP],
+                    *proc;
+    const char      *progname,
+                    *arg;
+
+    char             err_message[BUFFER_LEN],
+                     message[BUFFER_LEN],
+                     rank[16],
+                     size[32];
+
+    size_t           rows[BATCH > MAXTOP ? BATCH : MAXTOP],
+                     i,
+                     m,
+                     n_rows,
+                     n_examined;
+
+    long             deadline_ms = 0;
+
+    int              verbose = 0,
+                     n_threads = 1,
+                     n_listed,
+                     n_weighed,
+                     listed_all,
+                     opened,
+                     n = 0,
+                     len,
+                     rc = OK,
+                     j,
+                     k;
+
+    double           cache_ttl = 0,
+                     warning = OUTPUT_UNSET,
+                     critical = OUTPUT_UNSET;
+
+    started = now_ns();
+    output_init("check_procmem");
+
+    memset(&scan, 0, sizeof(scan));
+    scan.sort = SORT_PSS;
+    scan.n_top = DEFAULT_TOP;
+    scan.page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+    /*
+     * parse the given arguments
+     */
+    if(argc > 0)
+    {
+        progname = argv[0];
+        for(j = 1; j < argc; j++)
+        {
+            arg = argv[j];
+
+            /*
+             * if we got a parameter without a value, complain about it
+             */
+            if((check_option(arg, "-s", "--sort") ||
+               check_option(arg, "-t", "--top") ||
+               check_option(arg, "-w", "--warning") ||
+               check_option(arg, "-c", "--critical") ||
+               check_option(arg, "-n", "--name") ||
+               check_option(arg, "-g", "--cgroup") ||
+               check_option(arg, "--threads", "--threads") ||
+               check_option(arg, "--deadline-ms", "--deadline-ms") ||
+               check_option(arg, "-P", "--procfs-root") ||
+               check_option(arg, "-F", "--format") ||
+               check_option(arg, "--textfile", "--textfile") ||
+               check_option(arg, "--cache-ttl", "--cache-ttl")) &&
+               j + 1 >= argc)
+            {
+                snprintf(err_message, BUFFER_LEN,
+                        "you have to provide a value for %s", arg);
+                exit_with_message(UNKNOWN, err_message);
+            }
+
+            if(check_option(arg, "-s", "--sort"))
+            {
+                for(k = 0; k < NVALUES && strcmp(argv[j + 1], value_names[k]);
+                        k++)
+                    ;
+                if(k == NVALUES)
+                    exit_with_message(UNKNOWN, "--sort must be rss, pss, "
+                            "anon or swap");
+                scan.sort = k;
+                j++;
+            }
+            if(check_option(arg, "-t", "--top"))
+            {
+                scan.n_top = atoi(argv[++j]);
+                if(scan.n_top < 1 || scan.n_top > MAXTOP)
+                    exit_with_message(UNKNOWN, "--top must be between 1 "
+                            "and 64");
+            }
+            if(check_option(arg, "-w", "--warning") &&
+                    (warning = parse_size(argv[++j])) < 0)
+                exit_with_message(UNKNOWN, "invalid size for --warning");
+            if(check_option(arg, "-c", "--critical") &&
+                    (critical = parse_size(argv[++j])) < 0)
+                exit_with_message(UNKNOWN, "invalid size for --critical");
+            if(check_option(arg, "-n", "--name"))
+                scan.name = argv[++j];
+            if(check_option(arg, "-g", "--cgroup"))
+                scan.cgroup = argv[++j];
+            if(check_option(arg, "--threads", "--threads"))
+            {
+                n_threads = atoi(argv[++j]);
+                if(n_threads < 1 || n_threads > MAXTHREADS)
+                    exit_with_message(UNKNOWN, "--threads must be between 1 "
+                            "and 64");
+            }
+            if(check_option(arg, "--deadline-ms", "--deadline-ms") &&
+                    (deadline_ms = atol(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, "--deadline-ms needs a number of "
+                        "milliseconds");
+            if(check_option(arg, "-P", "--procfs-root"))
+                procfs_set_root(argv[++j]);
+            if(check_option(arg, "-F", "--format") &&
+                    output_set_format(argv[++j]) != 0)
+                exit_with_message(UNKNOWN, EOUTPUTFORMAT);
+            if(check_option(arg, "--textfile", "--textfile"))
+                output_set_textfile(argv[++j]);
+            if(check_option(arg, "--cache-ttl", "--cache-ttl") &&
+                    (cache_ttl = atof(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, ECACHETTL);
+            if(check_option(arg, "-v", "--verbose"))
+                verbose = 1;
+            if(check_option(arg, "--profile", "--profile") && !profile_enable())
+                exit_with_message(UNKNOWN, ENOPROFILE);
+            if(check_option(arg, "-h", "--help"))
+            {
+                print_help(progname);
+                exit(OK);
+            }
+            if(check_option(arg, "-V", "--version"))
+            {
+                print_version();
+                exit(OK);
+            }
+        }
+    }
+
+    /* comparisons with unset (NaN) thresholds are false */
+    if(critical < warning)
+        exit_with_message(UNKNOWN, "critical must not be smaller than "
+                "warning");
+
+    if(verbose)
+    {
+        printf("Environment Variables used:\n");
+        printf("  - procfs root: %s\n", procfs_root());
+        printf("Parameters:\n");
+        printf("  - sort: %s, top %d\n", value_names[scan.sort], scan.n_top);
+        printf("  - warning %f kB critical %f kB\n", warning, critical);
+        printf("  - name: %s\n", scan.name ? scan.name : "(none)");
+        printf("  - cgroup: %s\n", scan.cgroup ? scan.cgroup : "(none)");
+    }
+
+    if(cache_ttl > 0)
+        cache_init("check_procmem", argc, argv, cache_ttl);
+
+    if(deadline_ms)
+        deadline = started + (int64_t) (deadline_ms * 1e6 * DEADLINESHARE);
+
+    /* procfs_root() caches the root, look it up before the threads do. */
+    procfs_root();
+
+    PROFILE_BEGIN("scan");
+    if((opened = procsnap_open_until(&snap, listing_stopped)) < 0)
+        exit_with_message(UNKNOWN, "could not open the procfs root");
+    listed_all = opened == 0;
+    snap.threads = n_threads;
+    n_listed = snap.count;
+    if(!(scan.procs = calloc(snap.count + 1, sizeof(proc_mem_t))))
+        exit_with_message(UNKNOWN, "out of memory");
+    PROFILE_END("scan");
+
+    /* Match the rows batch by batch, so the deadline can stop it. */
+    PROFILE_BEGIN("match");
+    for(n_examined = 0; n_examined < snap.count; n_examined += n_rows)
+    {
+        if(share_reached(WEIGHSHARE))
+        {
+            scan.stopped = 1;
+            break;
+        }
+
+        n_rows = snap.count - n_examined < BATCH ? snap.count - n_examined :
+            BATCH;
+        for(i = 0; i < n_rows; i++)
+            rows[i] = n_examined + i;
+        m = match_rows(&snap, &scan, rows, n_rows);
+        for(i = 0; i < m; i++)
+        {
+            scan.procs[scan.count].pid = snap.pids[rows[i]];
+            scan.procs[scan.count++].row = rows[i];
+        }
+    }
+    PROFILE_END("match");
+
+    PROFILE_BEGIN("weigh");
+    run_workers(&scan, weigh_worker, n_threads);
+    PROFILE_END("weigh");
+
+    /* Keep the matching processes, those of the largest bound first. */
+    for(n_weighed = n_examined, i = 0, j = 0; i < scan.count; i++)
+    {
+        n_weighed -= scan.procs[i].pid < 0;
+        if(scan.procs[i].pid > 0)
+            scan.procs[j++] = scan.procs[i];
+    }
+    scan.count = j;
+    qsort(scan.procs, scan.count, sizeof(proc_mem_t), cmp_bound);
+
+    if(scan.sort == SORT_PSS || scan.sort == SORT_ANON)
+    {
+        PROFILE_BEGIN("rollup");
+        run_workers(&scan, rollup_worker, n_threads);
+        PROFILE_END("rollup");
+
+        /* Merge the tops of the workers. */
+        for(k = 0; k < scan.workers; k++)
+        {
+            for(j = 0; j < scan.n_tops[k]; j++)
+                n = heap_push(heap, n, scan.n_top, scan.top[k][j], scan.sort);
+            free(scan.top[k]);
+        }
+    }
+    else
+    {
+        /* The bound is the value, the first processes are the top. */
+        for(i = 0; i < scan.count && scan.procs[i].bound > 0 &&
+                n < scan.n_top; i++)
+            n = heap_push(heap, n, scan.n_top, &scan.procs[i], scan.sort);
+    }
+
+    PROFILE_ADD(PROFILE_OPENS, scan.reads + scan.rollups);
+    PROFILE_ADD(PROFILE_READS, scan.reads + scan.rollups);
+
+    /* Sort the top descending. */
+    for(j = 0; j < n; j++)
+    {
+        for(k = j; k > 0 && top[k - 1]->values[scan.sort] <
+                heap[j]->values[scan.sort]; k--)
+            top[k] = top[k - 1];
+        top[k] = heap[j];
+    }
+
+    /* Only the names of the top are needed without --name. */
+    for(j = 0; j < n; j++)
+        rows[j] = top[j]->row;
+    if(procsnap_load(&snap, PROCSNAP_COMM, rows, n) < 0)
+        exit_with_message(UNKNOWN, "out of memory");
+
+    len = snprintf(message, sizeof(message), "top %s:",
+            value_names[scan.sort]);
+    for(j = 0; j < n; j++)
+    {
+        proc = top[j];
+
+        /* Pids change with every restart, the rank is a stable label. */
+        snprintf(rank, sizeof(rank), "%d", j + 1);
+        for(k = 0; k < NVALUES; k++)
+            if(value_known(&scan, proc, k) || k == scan.sort)
+                output_add_labeled("rank", rank, value_names[k], "KB",
+                        proc->values[k],
+                        k == scan.sort ? warning : OUTPUT_UNSET,
+                        k == scan.sort ? critical : OUTPUT_UNSET, 0,
+                        OUTPUT_UNSET);
+
+        /* comparisons with unset (NaN) thresholds are false */
+        if(proc->values[scan.sort] > critical)
+            rc = CRITICAL;
+        else if(proc->values[scan.sort] > warning && rc < WARNING)
+            rc = WARNING;
+
+        format_size(size, sizeof(size), proc->values[scan.sort]);
+        if(len > 0 && (size_t) len < sizeof(message))
+            len += snprintf(message + len, sizeof(message) - len,
+                    "%s %s[%ld] %s%s", j ? "," : "", snap.comm[proc->row], proc->pid,
+                    proc->rollup < 0 ? "<= " : "", size);
+    }
+    if(n == 0 && len > 0 && (size_t) len < sizeof(message))
+        len += snprintf(message + len, sizeof(message) - len, " none");
+
+    if(len > 0 && (size_t) len < sizeof(message))
+        len += snprintf(message + len, sizeof(message) - len,
+                " (%zu processes, %ld smaps_rollup read", scan.count,
+                scan.rollups);
+    if(scan.denied && len > 0 && (size_t) len < sizeof(message))
+        len += snprintf(message + len, sizeof(message) - len,
+                ", %ld not readable", scan.denied);
+    if(len > 0 && (size_t) len < sizeof(message))
+        len += snprintf(message + len, sizeof(message) - len, ")");
+
+    output_add("processes", "", scan.count, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+            OUTPUT_UNSET);
+    output_add("rollups_read", "", scan.rollups, OUTPUT_UNSET, OUTPUT_UNSET,
+            0, OUTPUT_UNSET);
+    output_add("rollups_denied", "", scan.denied, OUTPUT_UNSET, OUTPUT_UNSET,
+            0, OUTPUT_UNSET);
+
+    if(deadline_ms)
+    {
+        output_add("pids_scanned", "", n_weighed, OUTPUT_UNSET, OUTPUT_UNSET,
+                0, OUTPUT_UNSET);
+        output_add("pids_total", "", n_listed, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+                OUTPUT_UNSET);
+    }
+
+    free(scan.procs);
+    procsnap_close(&snap);
+
+    /* Thresholds apply to what was collected before the deadline. */
+    if(scan.stopped || !listed_all)
+        output_exit(rc, "PARTIAL: deadline of %ld ms reached after %d of "
+                "%s%d PIDs - %s", deadline_ms, n_weighed,
+                listed_all ? "" : "at least ", n_listed, message);
+    output_exit(rc, "%s", message);
+
+    /* suppress compiler warnings */
+    return rc;
+}
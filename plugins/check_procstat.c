@@ -1,21 +1,58 @@
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+#include "../include/cache.h"
 #include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/procsnap.h"
+#include "../include/profile.h"
+#include "../include/tokenize.h"
 
 #define VERSION "0.1"
-#define PROCFS_STAT "/proc/stat"
+#define PROCFS_STAT "stat"
 #define BUFFER_LEN 1024
 
+/* --top */
+#define TOP_STATE_FILE  "/check_procstat_top.tmp"
+#define TOP_STATE_MAGIC 0x31747370      /* "pst1" */
+#define MAXTOP          64
+#define MAXTHREADS      64
+
+/* --sampler and --burst */
+#define RING_NAME           "procstat-ring"
+#define RING_MAGIC          0x31727370      /* "psr1" */
+#define RING_SLOTS          32768
+#define RING_INTERVAL       100             /* ms */
+#define RING_STALE          10              /* intervals without a sample */
+#define BURST_STATE_FILE    "/check_procstat_burst.tmp"
+#define BURST_STATE_MAGIC   0x31627370      /* "psb1" */
+
+/* --cgroup */
+#define CGROUP_DEFAULT_ROOT "/sys/fs/cgroup"
+#define CGROUP_STATE_FILE   "check_procstat_cgroup"
+#define CGROUP_STATE_MAGIC  0x31677370      /* "psg1" */
+#define CGROUP_MAXDEPTH     32
+#define CGROUP_STATE_LEN    (BUFFER_LEN + 64)
+
 /*
  * define error messages
  */
 #define ENOWARNING  "you must provide a warning threshold\n"
 #define ENOCRITICAL "you must provide a critical threshold\n"
 
-typedef struct stat
+typedef struct cpu_stat
 {
     long long    user;
     long long    nice;
@@ -27,14 +64,168 @@ typedef struct stat
     time_t      taken;
 } stat_t;
 
-char fallback_tmpdir[] = "/tmp/";
+/*
+ * Structure to hold the cpu ticks of one process. This is also the record
+ * of the --top state file, so keep it free of padding.
+ *
+ * Members:
+ *  - int32_t  pid:       pid of the process, 0 for an empty slot
+ *  - uint32_t reserved:  padding
+ *  - uint64_t starttime: start of the process in ticks after boot, tells
+ *                        a reused pid apart
+ *  - uint64_t ticks:     utime + stime
+ */
+typedef struct proc_sample
+{
+    int32_t     pid;
+    uint32_t    reserved;
+    uint64_t    starttime;
+    uint64_t    ticks;
+} proc_sample_t;
+
+/*
+ * Header of the --top state file.
+ */
+typedef struct top_header
+{
+    uint32_t    magic;
+    uint32_t    count;
+    long long   cpu_total;
+} top_header_t;
+
+/*
+ * Open addressing hash table (linear probing) of the previous samples,
+ * keyed by pid and starttime. The size is a power of two.
+ */
+typedef struct proc_table
+{
+    proc_sample_t  *slots;
+    size_t          mask;
+} proc_table_t;
+
+/*
+ * Structure to hold one scan of all /proc/<pid>/stat files: the snapshot
+ * and a sample of every row, pid 0 if the process is gone or its stat
+ * file can't be parsed.
+ */
+typedef struct proc_scan
+{
+    procsnap_t      snap;
+    proc_sample_t  *samples;
+    size_t          count;
+} proc_scan_t;
+
+/*
+ * One sample of the --sampler ring.
+ *
+ * Members:
+ *  - uint64_t index:    number of the sample, UINT64_MAX while it is written
+ *  - uint32_t busy:     ticks neither idle nor iowait since the last sample
+ *  - uint32_t total:    all ticks since the last sample
+ *  - uint32_t duration: microseconds since the last sample
+ *  - uint32_t reserved: padding
+ */
+typedef struct ring_slot
+{
+    uint64_t    index;
+    uint32_t    busy;
+    uint32_t    total;
+    uint32_t    duration;
+    uint32_t    reserved;
+} ring_slot_t;
+
+/*
+ * Header of the --sampler ring in CACHE_DIR, followed by RING_SLOTS slots.
+ * The sampler is the only writer, it holds a flock() on the ring. Readers
+ * never block: they take the samples whose slot still holds the index they
+ * expect before and after copying it.
+ *
+ * Members:
+ *  - uint32_t magic:    RING_MAGIC once the ring is set up
+ *  - uint32_t slots:    number of slots
+ *  - uint32_t interval: sampling interval in ms
+ *  - uint32_t reserved: padding
+ *  - int64_t  started:  CLOCK_BOOTTIME ns the sampler started at, tells
+ *                       a restarted sampler apart
+ *  - int64_t  updated:  CLOCK_BOOTTIME ns of the last sample
+ *  - int64_t  cpu:      cpu time (user and system) of the sampler in ns
+ *  - uint64_t head:     number of samples written
+ */
+typedef struct ring_header
+{
+    uint32_t    magic;
+    uint32_t    slots;
+    uint32_t    interval;
+    uint32_t    reserved;
+    int64_t     started;
+    int64_t     updated;
+    int64_t     cpu;
+    uint64_t    head;
+} ring_header_t;
+
+/*
+ * State of the last --burst run: the samples up to head were evaluated.
+ */
+typedef struct burst_state
+{
+    uint32_t    magic;
+    uint32_t    reserved;
+    int64_t     started;
+    uint64_t    head;
+} burst_state_t;
+
+/*
+ * Counters of one cgroup from its cpu.stat. This is also the record of the
+ * --cgroup state file, so keep it free of padding.
+ *
+ * Members:
+ *  - uint64_t hash:           hash of the path below the --cgroup cgroup
+ *  - uint64_t usage_usec:     cpu time used
+ *  - uint64_t nr_periods:     enforcement periods with runnable tasks
+ *  - uint64_t nr_throttled:   periods the quota ran out in
+ *  - uint64_t throttled_usec: time the tasks were throttled
+ */
+typedef struct cgroup_sample
+{
+    uint64_t    hash;
+    uint64_t    usage_usec;
+    uint64_t    nr_periods;
+    uint64_t    nr_throttled;
+    uint64_t    throttled_usec;
+} cgroup_sample_t;
+
+/*
+ * Header of the --cgroup state file, followed by the samples sorted by
+ * hash.
+ */
+typedef struct cgroup_header
+{
+    uint32_t    magic;
+    uint32_t    count;
+    int64_t     taken;
+} cgroup_header_t;
+
+/*
+ * The cgroups of one --cgroup run: the --cgroup cgroup first, with --top
+ * all cgroups below it. paths[i] is the path of samples[i] below the
+ * --cgroup cgroup, "" for itself.
+ */
+typedef struct cgroup_walk
+{
+    cgroup_sample_t    *samples;
+    char              **paths;
+    size_t              count;
+    size_t              size;
+} cgroup_walk_t;
+
+static char fallback_tmpdir[] = "/tmp/";
 
 /*
  * print_help:
  *
  * print help output to stdout
  */
-void print_help (const char *progname)
+static void print_help (const char *progname)
 {
     printf("Usage:\n");
     printf(" %s [options]\n", progname);
@@ -43,6 +234,40 @@ void print_help (const char *progname)
     printf(" -wu, --warning_user\t\twarning threshold (in percent)\n");
     printf(" -cu, --critical_user\t\tcriticalthreshold (in percent)\n");
     printf(" -v,      --verbose\t\tverbose output\n");
+    printf(" -F,      --format\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("          --textfile\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("          --profile\t\tappend timings of the plugin to the perfdata\n");
+    printf(" -P,      --procfs-root\t\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf(" -t,      --top\t\t\tname the N processes using the most cpu\n");
+    printf("          --threads\t\tscan the processes with N threads (default: 1)\n");
+    printf("          --cache-ttl\t\tshare results younger than this (seconds)\n"
+           "\t\t\t\twith invocations with the same arguments\n");
+    printf("\n");
+    printf("Bursts\n");
+    printf("          --sampler\t\trun the sampler: read %s every interval\n"
+           "\t\t\t\tinto a ring in %s (runs until killed)\n",
+            PROCFS_STAT, CACHE_DIR);
+    printf("          --interval\t\tsampling interval in ms (default: %d)\n",
+            RING_INTERVAL);
+    printf("          --burst\t\tevaluate the samples since the last run, busy\n"
+           "\t\t\t\tabove this percentage counts as burst\n");
+    printf("          --warning-burst\twarning threshold (seconds of burst)\n");
+    printf("          --critical-burst\tcritical threshold (seconds of burst)\n");
+    printf("\n");
+    printf("Cgroups\n");
+    printf("          --cgroup\t\tcheck the cpu usage and throttling of this\n"
+           "\t\t\t\tcgroup (v2) instead of %s, with --top\n"
+           "\t\t\t\tname the N most throttled cgroups below it\n",
+            PROCFS_STAT);
+    printf("          --cgroup-root\t\tcgroup root (default: %s)\n",
+            CGROUP_DEFAULT_ROOT);
+    printf("          --warning-quota\twarning threshold (percent of cpu.max)\n");
+    printf("          --critical-quota\tcritical threshold (percent of cpu.max)\n");
+    printf("          --warning-throttled\twarning threshold (percent of periods\n"
+           "\t\t\t\tthrottled)\n");
+    printf("          --critical-throttled\tcritical threshold (percent of periods\n"
+           "\t\t\t\tthrottled)\n");
     printf("\n");
     printf(" -h,      --help\t\tdisplay this help text\n");
     printf(" -V,      --version\t\toutput version information\n");
@@ -53,7 +278,7 @@ void print_help (const char *progname)
  *
  * prints version information to stdout
  */
-void print_version()
+static void print_version()
 {
     printf("check_procstat (%s)\n", VERSION);
 }
@@ -63,11 +288,9 @@ void print_version()
  *
  * print a message to stdout and exit with return code rc
  */
-void exit_with_message(int rc, char *message)
+static void exit_with_message(int rc, char *message)
 {
-    fprintf(stdout, "%s - %s\n", state[rc], message);
-
-    exit(rc);
+    output_exit(rc, "%s", message);
 }
 
 /*
@@ -79,7 +302,7 @@ void exit_with_message(int rc, char *message)
  * this function will return UNKNOWN if we are not able to open that file for
  * writing
  */
-void write_tmp_stats(char *tmpdir, stat_t *stat)
+static void write_tmp_stats(char *tmpdir, stat_t *stat)
 {
     FILE    *stats_file;
     char     path[BUFFER_LEN];
@@ -108,7 +331,7 @@ void write_tmp_stats(char *tmpdir, stat_t *stat)
  * If it fails in some way opening the file (does not exists, no permission,
  * etc) it will return 0. Otherwise 1.
  */
-int read_tmp_stats(char* tmpdir, stat_t *stat)
+static int read_tmp_stats(char* tmpdir, stat_t *stat)
 {
     FILE    *stats_file;
     char     path[BUFFER_LEN];
@@ -138,7 +361,7 @@ int read_tmp_stats(char* tmpdir, stat_t *stat)
  * If both are unset it returns a hard coded temporary
  * directory defined by global "fallback_tmpdir".
  */
-char* get_tmpdir()
+static char* get_tmpdir()
 {
     char    *tmpdir;
     tmpdir = getenv("TMPDIR");
@@ -152,11 +375,1095 @@ char* get_tmpdir()
     return tmpdir;
 }
 
-int main(int argc, const char *argv[])
+/*
+ * scan_processes:
+ *
+ * lists all pids below the procfs root and reads utime, stime and
+ * starttime of their stat files with n_threads threads
+ */
+static void scan_processes(proc_scan_t *scan, int n_threads)
+{
+    procsnap_t  *snap = &scan->snap;
+    size_t       i;
+
+    if(procsnap_open(snap) < 0)
+        exit_with_message(UNKNOWN, "could not open the procfs root");
+
+    snap->threads = n_threads;
+    if(procsnap_load(snap, PROCSNAP_STAT, NULL, 0) < 0 ||
+            !(scan->samples = calloc(snap->count + 1, sizeof(proc_sample_t))))
+        exit_with_message(UNKNOWN, "out of memory");
+    scan->count = snap->count;
+
+    /* the state is a letter once the stat was parsed */
+    for(i = 0; i < snap->count; i++)
+    {
+        if(snap->gone[i] || !snap->state[i])
+            continue;
+        scan->samples[i].pid = snap->pids[i];
+        scan->samples[i].starttime = snap->starttime[i];
+        scan->samples[i].ticks = snap->utime[i] + snap->stime[i];
+    }
+}
+
+/*
+ * proc_hash:
+ */
+static size_t proc_hash(int32_t pid, uint64_t starttime)
+{
+    uint64_t    h = ((uint64_t) (uint32_t) pid << 32) ^ starttime;
+
+    h *= 0x9e3779b97f4a7c15ULL;
+
+    return (size_t) (h ^ (h >> 32));
+}
+
+/*
+ * build_proc_table:
+ *
+ * builds the hash table of count samples, at most half of its slots are used
+ */
+static void build_proc_table(proc_table_t *table, const proc_sample_t *samples,
+        size_t count)
+{
+    size_t  size = 16,
+            i,
+            slot;
+
+    while(size < count * 2)
+        size *= 2;
+
+    table->mask = size - 1;
+    if(!(table->slots = calloc(size, sizeof(proc_sample_t))))
+        exit_with_message(UNKNOWN, "out of memory");
+
+    for(i = 0; i < count; i++)
+    {
+        if(samples[i].pid <= 0)
+            continue;
+        slot = proc_hash(samples[i].pid, samples[i].starttime) & table->mask;
+        while(table->slots[slot].pid)
+            slot = (slot + 1) & table->mask;
+        table->slots[slot] = samples[i];
+    }
+}
+
+/*
+ * lookup_proc_table:
+ *
+ * returns the previous sample of the process or NULL
+ */
+static const proc_sample_t *lookup_proc_table(const proc_table_t *table,
+        int32_t pid, uint64_t starttime)
+{
+    size_t  slot = proc_hash(pid, starttime) & table->mask;
+
+    for(; table->slots[slot].pid; slot = (slot + 1) & table->mask)
+        if(table->slots[slot].pid == pid &&
+                table->slots[slot].starttime == starttime)
+            return &table->slots[slot];
+
+    return NULL;
+}
+
+/*
+ * read_top_state:
+ *
+ * reads the samples of the last --top run into table. Returns 0 if there
+ * is no (valid) state, 1 otherwise.
+ */
+static int read_top_state(char *tmpdir, top_header_t *header,
+        proc_table_t *table)
+{
+    FILE            *state_file;
+    proc_sample_t   *samples;
+    char             path[BUFFER_LEN];
+    int              rc = 0;
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, TOP_STATE_FILE);
+
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    if(1 == fread(header, sizeof(top_header_t), 1, state_file) &&
+            header->magic == TOP_STATE_MAGIC &&
+            (samples = calloc(header->count + 1, sizeof(proc_sample_t))))
+    {
+        if(header->count == fread(samples, sizeof(proc_sample_t),
+                    header->count, state_file))
+        {
+            build_proc_table(table, samples, header->count);
+            rc = 1;
+        }
+        free(samples);
+    }
+
+    fclose(state_file);
+
+    return rc;
+}
+
+/*
+ * write_top_state:
+ *
+ * writes the samples of this run for the next --top run. The file is
+ * replaced atomically, so concurrent runs never read a partial state.
+ */
+static void write_top_state(char *tmpdir, long long cpu_total,
+        const proc_scan_t *scan)
+{
+    FILE            *state_file;
+    top_header_t     header = { TOP_STATE_MAGIC, 0, cpu_total };
+    char             path[BUFFER_LEN],
+                     tmp_path[BUFFER_LEN + 32];
+    size_t           i;
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, TOP_STATE_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the --top state file "
+                "for writing");
+
+    for(i = 0; i < scan->count; i++)
+        header.count += scan->samples[i].pid > 0;
+
+    fwrite(&header, sizeof(header), 1, state_file);
+    for(i = 0; i < scan->count; i++)
+        if(scan->samples[i].pid > 0)
+            fwrite(&scan->samples[i], sizeof(proc_sample_t), 1, state_file);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the --top state file");
+    }
+}
+
+/*
+ * check_top:
+ *
+ * scans all processes, adds the cpu share of the n_top processes which used
+ * the most cpu time since the last run to the measurements and describes
+ * them in message
+ */
+static void check_top(char *tmpdir, long long cpu_total, int n_top,
+        int n_threads, char *message, size_t message_len)
+{
+    proc_scan_t              scan;
+    proc_table_t             table = { NULL, 0 };
+    top_header_t             header;
+    const proc_sample_t     *old;
+    size_t                   top[MAXTOP],
+                             i;
+    uint64_t                 deltas[MAXTOP],
+                             delta;
+    long long                cpu_diff;
+    char                     rank[16];
+    int                      n = 0,
+                             stats_read,
+                             j,
+                             len;
+
+    PROFILE_BEGIN("top");
+    scan_processes(&scan, n_threads);
+    stats_read = read_top_state(tmpdir, &header, &table);
+    write_top_state(tmpdir, cpu_total, &scan);
+    PROFILE_END("top");
+
+    cpu_diff = cpu_total - (stats_read ? header.cpu_total : 0);
+    if(!stats_read || cpu_diff <= 0)
+    {
+        snprintf(message, message_len, " top: %s",
+                stats_read ? "no cpu time passed" : "no previous sample");
+        return;
+    }
+
+    /*
+     * Keep the n_top largest deltas sorted. Processes unknown to the last
+     * sample were started since, so all their ticks count.
+     */
+    for(i = 0; i < scan.count; i++)
+    {
+        if(scan.samples[i].pid <= 0)
+            continue;
+
+        old = lookup_proc_table(&table, scan.samples[i].pid,
+                scan.samples[i].starttime);
+        delta = scan.samples[i].ticks - (old ? old->ticks : 0);
+        if(old && old->ticks > scan.samples[i].ticks)
+            continue;
+        if(delta == 0 || (n == n_top && delta <= deltas[n - 1]))
+            continue;
+
+        for(j = n < n_top ? n++ : n - 1; j > 0 && deltas[j - 1] < delta; j--)
+        {
+            deltas[j] = deltas[j - 1];
+            top[j] = top[j - 1];
+        }
+        deltas[j] = delta;
+        top[j] = i;
+    }
+
+    len = snprintf(message, message_len, " top:");
+    for(j = 0; j < n; j++)
+    {
+        double  share = (double) deltas[j] / cpu_diff * 100;
+
+        /* Pids change with every restart, the rank is a stable label. */
+        snprintf(rank, sizeof(rank), "%d", j + 1);
+        output_add_labeled("rank", rank, "top_cpu", "%", share,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, 100);
+
+        if(len > 0 && (size_t) len < message_len)
+            len += snprintf(message + len, message_len - len, "%s %s[%d] %.2f%%",
+                    j ? "," : "", scan.snap.comm[top[j]],
+                    scan.samples[top[j]].pid, share);
+    }
+    if(n == 0)
+        snprintf(message, message_len, " top: idle");
+
+    free(table.slots);
+    free(scan.samples);
+    procsnap_close(&scan.snap);
+}
+
+/*
+ * now_ns:
+ */
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * ring_path:
+ *
+ * builds the path of the --sampler ring, which is per user like the result
+ * cache
+ */
+static void ring_path(char *path, size_t len)
+{
+    snprintf(path, len, "%s/%s.%u.%s", CACHE_DIR, MULTICALL_NAME,
+            (unsigned) getuid(), RING_NAME);
+}
+
+/*
+ * parse_cpu_ticks:
+ *
+ * sums the ticks of the "cpu" line of PROCFS_STAT: total counts user, nice,
+ * system, idle, iowait, irq, softirq and steal, busy all of them but idle
+ * and iowait. Returns 0 if the line can't be parsed.
+ */
+static int parse_cpu_ticks(const char *buffer, uint64_t *busy, uint64_t *total)
+{
+    uint64_t    ticks[8] = { 0 };
+    size_t      used,
+                i;
+
+    if(0 != strncmp(buffer, "cpu ", 4) ||
+            tokenize_u64(buffer + 4, strlen(buffer + 4), ticks, 8, &used) < 7)
+        return 0;
+
+    *busy = *total = 0;
+    for(i = 0; i < 8; i++)
+    {
+        *total += ticks[i];
+        if(i != 3 && i != 4)
+            *busy += ticks[i];
+    }
+
+    return 1;
+}
+
+/*
+ * run_sampler:
+ *
+ * reads PROCFS_STAT every interval ms and writes the busy and total ticks
+ * since the last sample to the ring. PROCFS_STAT is kept open and read with
+ * pread(), so a sample costs one read plus a getrusage() for the own cpu
+ * time. Never returns.
+ */
+static void run_sampler(int interval)
+{
+    ring_header_t   *ring;
+    ring_slot_t     *slots,
+                    *slot;
+    struct timespec  next,
+                     current;
+    struct rusage    usage;
+    char             path[BUFFER_LEN],
+                     buffer[BUFFER_LEN];
+    uint64_t         busy = 0,
+                     total = 0,
+                     last_busy = 0,
+                     last_total = 0,
+                     head = 0;
+    int64_t          now,
+                     last = 0;
+    size_t           size = sizeof(ring_header_t) +
+                            RING_SLOTS * sizeof(ring_slot_t);
+    ssize_t          len;
+    int              fd,
+                     fd_stat,
+                     valid,
+                     i;
+
+    ring_path(path, sizeof(path));
+    fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if(fd < 0)
+        exit_with_message(UNKNOWN, "could not open the sampler ring");
+
+    /* The lock is held until we are killed. */
+    if(0 != flock(fd, LOCK_EX | LOCK_NB))
+        exit_with_message(UNKNOWN, "another sampler is running");
+
+    if(0 != ftruncate(fd, size) || MAP_FAILED == (ring = mmap(NULL, size,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)))
+        exit_with_message(UNKNOWN, "could not map the sampler ring");
+    slots = (ring_slot_t *) (ring + 1);
+
+    procfs_path(path, sizeof(path), PROCFS_STAT);
+    if((fd_stat = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        exit_with_message(UNKNOWN, "could not open " PROCFS_STAT);
+
+    /* Readers ignore the ring until it is set up again. */
+    __atomic_store_n(&ring->magic, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for(i = 0; i < RING_SLOTS; i++)
+        slots[i].index = UINT64_MAX;
+    ring->slots = RING_SLOTS;
+    ring->interval = interval;
+    ring->started = ring->updated = now_ns();
+    ring->cpu = 0;
+    ring->head = 0;
+    __atomic_store_n(&ring->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for(;;)
+    {
+        if((len = pread(fd_stat, buffer, sizeof(buffer) - 1, 0)) <= 0)
+            exit_with_message(UNKNOWN, "could not read " PROCFS_STAT);
+        buffer[len] = '\0';
+        now = now_ns();
+
+        /*
+         * Counters going backwards (e.g. cpu hotplug) and samples delayed
+         * by more than an interval (e.g. a suspend) are skipped.
+         */
+        valid = parse_cpu_ticks(buffer, &busy, &total);
+        if(valid && last &&
+                now - last < 2 * interval * 1000000LL &&
+                busy >= last_busy && total >= last_total)
+        {
+            slot = &slots[head % RING_SLOTS];
+            __atomic_store_n(&slot->index, UINT64_MAX, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            __atomic_store_n(&slot->busy, busy - last_busy, __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->total, total - last_total,
+                    __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->duration, (now - last) / 1000,
+                    __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->index, head, __ATOMIC_RELEASE);
+
+            getrusage(RUSAGE_SELF, &usage);
+            __atomic_store_n(&ring->cpu,
+                    (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+                    1000000000 + (int64_t) (usage.ru_utime.tv_usec +
+                        usage.ru_stime.tv_usec) * 1000, __ATOMIC_RELAXED);
+            __atomic_store_n(&ring->updated, now, __ATOMIC_RELAXED);
+            __atomic_store_n(&ring->head, ++head, __ATOMIC_RELEASE);
+        }
+        last_busy = busy;
+        last_total = total;
+        last = valid ? now : 0;
+
+        /*
+         * Sleep until the next multiple of the interval, so the samples
+         * don't drift. Missed samples are not caught up.
+         */
+        next.tv_nsec += interval * 1000000L;
+        next.tv_sec += next.tv_nsec / 1000000000;
+        next.tv_nsec %= 1000000000;
+        clock_gettime(CLOCK_MONOTONIC, &current);
+        if(current.tv_sec > next.tv_sec || (current.tv_sec == next.tv_sec &&
+                    current.tv_nsec > next.tv_nsec))
+            next = current;
+        while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+                    NULL))
+            ;
+    }
+}
+
+/*
+ * cmp_double:
+ *
+ * qsort() callback for ascending doubles
+ */
+static int cmp_double(const void *p1, const void *p2)
+{
+    double  d1 = *(const double *) p1,
+            d2 = *(const double *) p2;
+
+    return (d1 > d2) - (d1 < d2);
+}
+
+/*
+ * read_burst_state:
+ *
+ * reads the ring position of the last --burst run. Returns 0 if there is no
+ * (valid) state, 1 otherwise.
+ */
+static int read_burst_state(char *tmpdir, burst_state_t *state)
+{
+    FILE    *state_file;
+    char     path[BUFFER_LEN];
+    int      rc;
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, BURST_STATE_FILE);
+
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    rc = 1 == fread(state, sizeof(burst_state_t), 1, state_file) &&
+        state->magic == BURST_STATE_MAGIC;
+
+    fclose(state_file);
+
+    return rc;
+}
+
+/*
+ * write_burst_state:
+ *
+ * writes the ring position of this run for the next --burst run, replacing
+ * the file atomically
+ */
+static void write_burst_state(char *tmpdir, int64_t started, uint64_t head)
+{
+    FILE            *state_file;
+    burst_state_t    state = { BURST_STATE_MAGIC, 0, started, head };
+    char             path[BUFFER_LEN],
+                     tmp_path[BUFFER_LEN + 32];
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, BURST_STATE_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the --burst state file "
+                "for writing");
+
+    fwrite(&state, sizeof(state), 1, state_file);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the --burst state file");
+    }
+}
+
+/*
+ * map_ring:
+ *
+ * maps the ring of the sampler read only. Returns NULL if there is none,
+ * it isn't ours or it isn't set up.
+ */
+static const ring_header_t *map_ring(size_t *size)
+{
+    const ring_header_t *ring;
+    struct stat          t_stat;
+    char                 path[BUFFER_LEN];
+    int                  fd;
+
+    ring_path(path, sizeof(path));
+    if((fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0)
+        return NULL;
+
+    *size = sizeof(ring_header_t) + RING_SLOTS * sizeof(ring_slot_t);
+    if(0 != fstat(fd, &t_stat) || t_stat.st_uid != getuid() ||
+            (t_stat.st_mode & 077) || t_stat.st_size < (off_t) *size ||
+            MAP_FAILED == (ring = mmap(NULL, *size, PROT_READ, MAP_SHARED,
+                    fd, 0)))
+    {
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    if(RING_MAGIC != __atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) ||
+            ring->slots != RING_SLOTS || ring->interval == 0)
+    {
+        munmap((void *) ring, *size);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/*
+ * check_burst:
+ *
+ * evaluates the samples of the --sampler ring since the last --burst run:
+ * the peak and the 99th percentile of the busy share and how long it was
+ * above threshold (percent). Adds them to the measurements, describes them
+ * in message and returns the state of the time above threshold against
+ * warn and crit (seconds).
+ */
+static int check_burst(char *tmpdir, double threshold, double warn,
+        double crit, char *message, size_t message_len)
+{
+    const ring_header_t *ring;
+    const ring_slot_t   *slots,
+                        *slot;
+    burst_state_t        state;
+    double              *values,
+                         value,
+                         peak = 0,
+                         above = 0;
+    uint64_t             head,
+                         from = 0,
+                         index;
+    uint32_t             busy,
+                         total,
+                         duration;
+    int64_t              started,
+                         updated;
+    size_t               size,
+                         n = 0;
+    int                  rc = OK;
+
+    PROFILE_BEGIN("burst");
+    if(!(ring = map_ring(&size)))
+    {
+        snprintf(message, message_len, " burst: no sampler");
+        PROFILE_END("burst");
+        return OK;
+    }
+    slots = (const ring_slot_t *) (ring + 1);
+
+    started = ring->started;
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    updated = __atomic_load_n(&ring->updated, __ATOMIC_RELAXED);
+
+    if(now_ns() - updated > (int64_t) RING_STALE * ring->interval * 1000000)
+    {
+        snprintf(message, message_len, " burst: sampler stopped");
+        munmap((void *) ring, size);
+        PROFILE_END("burst");
+        return OK;
+    }
+
+    /* Samples overwritten since the last run are lost. */
+    if(read_burst_state(tmpdir, &state) && state.started == started &&
+            state.head <= head)
+        from = state.head;
+    if(head > RING_SLOTS && from < head - RING_SLOTS)
+        from = head - RING_SLOTS;
+
+    if(!(values = calloc(head - from + 1, sizeof(double))))
+        exit_with_message(UNKNOWN, "out of memory");
+
+    for(index = from; index < head; index++)
+    {
+        slot = &slots[index % RING_SLOTS];
+        if(index != __atomic_load_n(&slot->index, __ATOMIC_ACQUIRE))
+            continue;
+        busy = __atomic_load_n(&slot->busy, __ATOMIC_RELAXED);
+        total = __atomic_load_n(&slot->total, __ATOMIC_RELAXED);
+        duration = __atomic_load_n(&slot->duration, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(index != __atomic_load_n(&slot->index, __ATOMIC_RELAXED) ||
+                total == 0)
+            continue;
+
+        value = (double) busy / total * 100;
+        values[n++] = value;
+        if(value > peak)
+            peak = value;
+        if(value > threshold)
+            above += duration / 1e6;
+    }
+
+    write_burst_state(tmpdir, started, head);
+    PROFILE_END("burst");
+
+    if(n == 0)
+        snprintf(message, message_len, " burst: no samples");
+    else
+    {
+        /* Nearest rank */
+        qsort(values, n, sizeof(double), cmp_double);
+        value = values[(n * 99 + 99) / 100 - 1];
+
+        if(above > crit)
+            rc = CRITICAL;
+        else if(above > warn)
+            rc = WARNING;
+
+        output_add("burst_peak", "%", peak, OUTPUT_UNSET, OUTPUT_UNSET,
+                0, 100);
+        output_add("burst_p99", "%", value, OUTPUT_UNSET, OUTPUT_UNSET,
+                0, 100);
+        output_add("burst_time", "s", above, warn, crit, 0, OUTPUT_UNSET);
+        output_add("burst_samples", "", n, OUTPUT_UNSET, OUTPUT_UNSET,
+                0, OUTPUT_UNSET);
+        snprintf(message, message_len, " burst: peak=%.2f p99=%.2f "
+                "above %.0f%% for %.1fs", peak, value, threshold, above);
+    }
+
+    /* The cost of the sampler, in percent of one cpu. */
+    if(updated > started)
+        output_add("sampler_cpu", "%", (double) __atomic_load_n(&ring->cpu,
+                    __ATOMIC_RELAXED) / (updated - started) * 100,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+
+    free(values);
+    munmap((void *) ring, size);
+
+    return rc;
+}
+
+/*
+ * hash_path:
+ */
+static uint64_t hash_path(const char *path)
+{
+    uint64_t    hash = 14695981039346656037ULL;
+
+    for(; *path; path++)
+        hash = (hash ^ (unsigned char) *path) * 1099511628211ULL;
+
+    return hash;
+}
+
+/*
+ * read_cgroup_sample:
+ *
+ * reads the cpu.stat of the cgroup in dir. Counters the kernel does not
+ * report (e.g. without a cpu controller) stay 0. Returns 0 if the file
+ * can't be read.
+ */
+static int read_cgroup_sample(const char *dir, cgroup_sample_t *sample)
+{
+    char    path[BUFFER_LEN],
+            buffer[BUFFER_LEN],
+           *line,
+           *next,
+           *value;
+
+    snprintf(path, sizeof(path), "%s/cpu.stat", dir);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read(path, buffer, sizeof(buffer)) <= 0)
+        return 0;
+
+    for(line = buffer; *line; line = next)
+    {
+        next = line + strcspn(line, "\n");
+        if(*next)
+            *next++ = '\0';
+        if(!(value = strchr(line, ' ')))
+            continue;
+        *value++ = '\0';
+
+        if(0 == strcmp(line, "usage_usec"))
+            sample->usage_usec = strtoull(value, NULL, 10);
+        else if(0 == strcmp(line, "nr_periods"))
+            sample->nr_periods = strtoull(value, NULL, 10);
+        else if(0 == strcmp(line, "nr_throttled"))
+            sample->nr_throttled = strtoull(value, NULL, 10);
+        else if(0 == strcmp(line, "throttled_usec"))
+            sample->throttled_usec = strtoull(value, NULL, 10);
+    }
+
+    return 1;
+}
+
+/*
+ * read_cgroup_quota:
+ *
+ * returns the quota of the cgroup in dir from its cpu.max in cpus, 0 if it
+ * has none
+ */
+static double read_cgroup_quota(const char *dir)
+{
+    char                path[BUFFER_LEN],
+                        buffer[64];
+    unsigned long long  quota,
+                        period;
+
+    snprintf(path, sizeof(path), "%s/cpu.max", dir);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read(path, buffer, sizeof(buffer)) <= 0 ||
+            2 != sscanf(buffer, "%llu %llu", &quota, &period) || period == 0)
+        return 0;
+
+    return (double) quota / period;
+}
+
+/*
+ * walk_cgroups:
+ *
+ * adds the cgroup in dir, path below the --cgroup cgroup, to walk and with
+ * descend all cgroups below it. Every cpu.stat is read once.
+ */
+static void walk_cgroups(cgroup_walk_t *walk, const char *dir,
+        const char *path, int descend, int depth)
+{
+    DIR             *dir_cgroup;
+    struct dirent   *dir_entry;
+    cgroup_sample_t *sample;
+    char             child_dir[BUFFER_LEN],
+                     child_path[BUFFER_LEN];
+
+    if(walk->count == walk->size)
+    {
+        walk->size = walk->size ? walk->size * 2 : 64;
+        if(!(walk->samples = realloc(walk->samples,
+                        walk->size * sizeof(cgroup_sample_t))) ||
+                !(walk->paths = realloc(walk->paths,
+                        walk->size * sizeof(char *))))
+            exit_with_message(UNKNOWN, "out of memory");
+    }
+
+    sample = &walk->samples[walk->count];
+    memset(sample, 0, sizeof(cgroup_sample_t));
+    if(!read_cgroup_sample(dir, sample))
+        return;
+    sample->hash = hash_path(path);
+    if(!(walk->paths[walk->count++] = strdup(path)))
+        exit_with_message(UNKNOWN, "out of memory");
+
+    if(!descend || depth >= CGROUP_MAXDEPTH || !(dir_cgroup = opendir(dir)))
+        return;
+
+    while(NULL != (dir_entry = readdir(dir_cgroup)))
+    {
+        PROFILE_COUNT(PROFILE_DIRENTS);
+        if(dir_entry->d_type != DT_DIR || dir_entry->d_name[0] == '.')
+            continue;
+
+        /* Too deep for the buffers, skip it rather than mix up paths. */
+        if((size_t) snprintf(child_dir, sizeof(child_dir), "%s/%s", dir,
+                    dir_entry->d_name) >= sizeof(child_dir) ||
+                (size_t) snprintf(child_path, sizeof(child_path), "%s%s%s",
+                    path, path[0] ? "/" : "", dir_entry->d_name)
+                >= sizeof(child_path))
+            continue;
+
+        walk_cgroups(walk, child_dir, child_path, descend, depth + 1);
+    }
+
+    closedir(dir_cgroup);
+}
+
+/*
+ * cmp_cgroup_sample:
+ */
+static int cmp_cgroup_sample(const void *p1, const void *p2)
+{
+    const cgroup_sample_t *s1 = p1,
+                          *s2 = p2;
+
+    return (s1->hash > s2->hash) - (s1->hash < s2->hash);
+}
+
+/*
+ * cgroup_state_path:
+ *
+ * builds the path of the --cgroup state file from a hash of the cgroup
+ * directory, a run with --top keeps its own state as it has more samples
+ */
+static void cgroup_state_path(char *path, size_t len, const char *tmpdir,
+        const char *dir, int top)
+{
+    snprintf(path, len, "%s/%s-%016llx%s.tmp", tmpdir, CGROUP_STATE_FILE,
+            (unsigned long long) hash_path(dir), top ? "-top" : "");
+}
+
+/*
+ * read_cgroup_state:
+ *
+ * reads the samples of the last --cgroup run, sorted by hash. Returns 0 if
+ * there are none or the file is truncated, *samples is NULL then.
+ */
+static int read_cgroup_state(const char *path, cgroup_header_t *header,
+        cgroup_sample_t **samples)
+{
+    FILE        *state_file;
+    struct stat  t_stat;
+    int          rc = 0;
+
+    *samples = NULL;
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    /* A count which doesn't match the size is a corrupt file. */
+    if(1 == fread(header, sizeof(cgroup_header_t), 1, state_file) &&
+            header->magic == CGROUP_STATE_MAGIC &&
+            0 == fstat(fileno(state_file), &t_stat) &&
+            t_stat.st_size == (off_t) (sizeof(cgroup_header_t) +
+                (size_t) header->count * sizeof(cgroup_sample_t)) &&
+            (*samples = calloc(header->count + 1, sizeof(cgroup_sample_t))))
+    {
+        if(header->count == fread(*samples, sizeof(cgroup_sample_t),
+                    header->count, state_file))
+            rc = 1;
+        else
+        {
+            free(*samples);
+            *samples = NULL;
+        }
+    }
+
+    fclose(state_file);
+
+    return rc;
+}
+
+/*
+ * write_cgroup_state:
+ *
+ * writes the samples of this run sorted by hash, the file is replaced
+ * atomically
+ */
+static void write_cgroup_state(const char *path, int64_t taken,
+        const cgroup_walk_t *walk)
+{
+    FILE            *state_file;
+    cgroup_header_t  header = { CGROUP_STATE_MAGIC, walk->count, taken };
+    cgroup_sample_t *samples;
+    char             tmp_path[CGROUP_STATE_LEN + 32];
+
+    if(!(samples = malloc((walk->count + 1) * sizeof(cgroup_sample_t))))
+        exit_with_message(UNKNOWN, "out of memory");
+    memcpy(samples, walk->samples, walk->count * sizeof(cgroup_sample_t));
+    qsort(samples, walk->count, sizeof(cgroup_sample_t), cmp_cgroup_sample);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the --cgroup state file "
+                "for writing");
+
+    fwrite(&header, sizeof(header), 1, state_file);
+    fwrite(samples, sizeof(cgroup_sample_t), walk->count, state_file);
+    free(samples);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the --cgroup state file");
+    }
+}
+
+/*
+ * counter_delta:
+ *
+ * returns the increase of a counter, all of it if the counter was reset
+ * (the cgroup was created again)
+ */
+static uint64_t counter_delta(uint64_t value, uint64_t old_value)
+{
+    return value >= old_value ? value - old_value : value;
+}
+
+/* Cgroups without an old sample were created since, all of it counts. */
+#define CGROUP_DELTA(sample, old, member) \
+    counter_delta((sample)->member, (old) ? (old)->member : 0)
+
+/*
+ * threshold_rc:
+ */
+static int threshold_rc(double value, double warn, double crit)
+{
+    if(value > crit)
+        return CRITICAL;
+    if(value > warn)
+        return WARNING;
+    return OK;
+}
+
+/*
+ * check_cgroup:
+ *
+ * checks the cpu usage of the cgroup path below root against its cpu.max
+ * quota and how much it was throttled since the last run. With n_top it
+ * names the n_top cgroups below it which were throttled the longest.
+ * Describes the result in message and returns the state.
+ */
+static int check_cgroup(char *tmpdir, const char *root, const char *cgroup,
+        int n_top, double w_quota, double c_quota, double w_throttled,
+        double c_throttled, char *message, size_t message_len)
+{
+    cgroup_walk_t            walk = { NULL, NULL, 0, 0 };
+    cgroup_header_t          header;
+    cgroup_sample_t         *old_samples = NULL;
+    const cgroup_sample_t   *sample,
+                            *old;
+    char                     dir[BUFFER_LEN],
+                             child_dir[2 * BUFFER_LEN],
+                             state[CGROUP_STATE_LEN];
+    const char              *name;
+    size_t                   top[MAXTOP],
+                             i;
+    uint64_t                 deltas[MAXTOP],
+                             delta,
+                             periods;
+    int64_t                  taken;
+    double                   elapsed,
+                             usage,
+                             quota,
+                             throttled,
+                             throttled_time;
+    int                      stats_read,
+                             rc = OK,
+                             n = 0,
+                             j,
+                             len;
+
+    cgroup += strspn(cgroup, "/");
+    name = cgroup[0] ? cgroup : "/";
+    if(strstr(cgroup, ".."))
+        exit_with_message(UNKNOWN, "--cgroup must be below the cgroup root");
+    snprintf(dir, sizeof(dir), "%s/%s", root, cgroup);
+
+    PROFILE_BEGIN("cgroup");
+    walk_cgroups(&walk, dir, "", n_top > 0, 0);
+    taken = procfs_clock_ns();
+    if(walk.count == 0)
+        output_exit(UNKNOWN, "could not read %s/cpu.stat", dir);
+    quota = read_cgroup_quota(dir);
+
+    cgroup_state_path(state, sizeof(state), tmpdir, dir, n_top > 0);
+    stats_read = read_cgroup_state(state, &header, &old_samples);
+    write_cgroup_state(state, taken, &walk);
+    PROFILE_END("cgroup");
+
+    if(quota > 0)
+        output_add("cgroup_quota", "", quota, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+                OUTPUT_UNSET);
+
+    if(!stats_read || taken <= header.taken)
+    {
+        snprintf(message, message_len, "cgroup %s: no previous sample", name);
+        goto out;
+    }
+
+    /* All counters are in microseconds. */
+    elapsed = (taken - header.taken) / 1e3;
+    sample = &walk.samples[0];
+    old = bsearch(sample, old_samples, header.count, sizeof(cgroup_sample_t),
+            cmp_cgroup_sample);
+
+    usage = CGROUP_DELTA(sample, old, usage_usec) / elapsed;
+    periods = CGROUP_DELTA(sample, old, nr_periods);
+    throttled = periods ? (double) CGROUP_DELTA(sample, old, nr_throttled) /
+        periods * 100 : 0;
+    throttled_time = CGROUP_DELTA(sample, old, throttled_usec) / elapsed;
+
+    output_add("cgroup_usage", "", usage, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+            OUTPUT_UNSET);
+    if(quota > 0)
+    {
+        output_add("cgroup_quota_usage", "%", usage / quota * 100, w_quota,
+                c_quota, 0, OUTPUT_UNSET);
+        rc = threshold_rc(usage / quota * 100, w_quota, c_quota);
+    }
+    output_add("cgroup_throttled_periods", "%", throttled, w_throttled,
+            c_throttled, 0, 100);
+    output_add("cgroup_throttled_time", "s", throttled_time, OUTPUT_UNSET,
+            OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    if(threshold_rc(throttled, w_throttled, c_throttled) > rc)
+        rc = threshold_rc(throttled, w_throttled, c_throttled);
+
+    if(quota > 0)
+        len = snprintf(message, message_len, "cgroup %s: usage=%.2f cpus "
+                "(%.2f%% of %.2f) throttled=%.2f%% of periods, %.3fs/s",
+                name, usage, usage / quota * 100, quota, throttled,
+                throttled_time);
+    else
+        len = snprintf(message, message_len, "cgroup %s: usage=%.2f cpus "
+                "(no quota) throttled=%.2f%% of periods, %.3fs/s", name, usage,
+                throttled, throttled_time);
+
+    if(!n_top)
+        goto out;
+
+    /* Keep the n_top largest throttled times sorted. */
+    for(i = 1; i < walk.count; i++)
+    {
+        sample = &walk.samples[i];
+        old = bsearch(sample, old_samples, header.count,
+                sizeof(cgroup_sample_t), cmp_cgroup_sample);
+        delta = CGROUP_DELTA(sample, old, throttled_usec);
+        if(delta == 0 || (n == n_top && delta <= deltas[n - 1]))
+            continue;
+
+        for(j = n < n_top ? n++ : n - 1; j > 0 && deltas[j - 1] < delta; j--)
+        {
+            deltas[j] = deltas[j - 1];
+            top[j] = top[j - 1];
+        }
+        deltas[j] = delta;
+        top[j] = i;
+    }
+
+    if(len > 0 && (size_t) len < message_len)
+        len += snprintf(message + len, message_len - len, " top throttled:%s",
+                n ? "" : " none");
+    for(j = 0; j < n; j++)
+    {
+        sample = &walk.samples[top[j]];
+        old = bsearch(sample, old_samples, header.count,
+                sizeof(cgroup_sample_t), cmp_cgroup_sample);
+        periods = CGROUP_DELTA(sample, old, nr_periods);
+        throttled = periods ? (double) CGROUP_DELTA(sample, old,
+                nr_throttled) / periods * 100 : 0;
+
+        output_add_labeled("cgroup", walk.paths[top[j]],
+                "top_throttled_time", "s", deltas[j] / elapsed,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        output_add_labeled("cgroup", walk.paths[top[j]],
+                "top_throttled_periods", "%", throttled,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, 100);
+
+        /* Only the quotas of the named cgroups are read. */
+        snprintf(child_dir, sizeof(child_dir), "%s/%s", dir, walk.paths[top[j]]);
+        if((quota = read_cgroup_quota(child_dir)) > 0)
+            output_add_labeled("cgroup", walk.paths[top[j]],
+                    "top_quota_usage", "%", CGROUP_DELTA(sample, old,
+                        usage_usec) / elapsed / quota * 100,
+                    OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+
+        if(len > 0 && (size_t) len < message_len)
+            len += snprintf(message + len, message_len - len,
+                    "%s %s %.3fs/s %.2f%%", j ? "," : "", walk.paths[top[j]],
+                    deltas[j] / elapsed, throttled);
+    }
+
+out:
+    for(i = 0; i < walk.count; i++)
+        free(walk.paths[i]);
+    free(walk.paths);
+    free(walk.samples);
+    free(old_samples);
+
+    return rc;
+}
+
+int PLUGIN_MAIN(check_procstat)(int argc, char *argv[])
 {
     FILE            *fd_progfs_stat;
     const char      *progname,
-                    *arg;
+                    *arg,
+                    *cgroup = NULL,
+                    *cgroup_root = CGROUP_DEFAULT_ROOT;
 
     stat_t           stat,
                      /* initialize old_stat, just in case we got no old data */
@@ -166,17 +1473,38 @@ int main(int argc, const char *argv[])
     struct tm       *tm_taken;
 
     char             err_message[BUFFER_LEN],
-                     buffer[BUFFER_LEN];
+                     stat_path[BUFFER_LEN],
+                     buffer[BUFFER_LEN],
+                     top_message[BUFFER_LEN] = "",
+                     burst_message[BUFFER_LEN] = "",
+                     cgroup_message[4 * BUFFER_LEN];
 
     char            *tmpdir;
 
     int              verbose = 0,
                      stats_read = 0,
+                     n_top = 0,
+                     n_threads = 1,
+                     sampler = 0,
+                     interval = RING_INTERVAL,
                      rc = OK,
                      i;
 
     long long        sum;
 
+    uint64_t         ticks[7];
+
+    size_t           used;
+
+    double           cache_ttl = 0,
+                     burst = -1,
+                     w_burst = OUTPUT_UNSET,
+                     c_burst = OUTPUT_UNSET,
+                     w_quota = OUTPUT_UNSET,
+                     c_quota = OUTPUT_UNSET,
+                     w_throttled = OUTPUT_UNSET,
+                     c_throttled = OUTPUT_UNSET;
+
     double           p_user,
                      p_nice,
                      p_system,
@@ -201,6 +1529,8 @@ int main(int argc, const char *argv[])
                      c_irq     = 100.0,
                      c_softirq = 100.0;
 
+    output_init("check_procstat");
+
     /*
      * get the tmpdir from env (or fallback)
      */
@@ -219,8 +1549,24 @@ int main(int argc, const char *argv[])
              * if we got a parameter like -w or -c without a value, complain
              * about it
              */
-            if((strcmp(arg,"-wu") == 0 || strcmp(arg,"--warning_user") == 0 ||
-               strcmp(arg,"-cu") == 0  || strcmp(arg,"--critical_user") == 0) &&
+            if((check_option(arg, "-wu", "--warning_user") ||
+               check_option(arg, "-cu", "--critical_user") ||
+               check_option(arg, "-P", "--procfs-root") ||
+               check_option(arg, "-F", "--format") ||
+               check_option(arg, "--textfile", "--textfile") ||
+               check_option(arg, "-t", "--top") ||
+               check_option(arg, "--threads", "--threads") ||
+               check_option(arg, "--interval", "--interval") ||
+               check_option(arg, "--burst", "--burst") ||
+               check_option(arg, "--warning-burst", "--warning-burst") ||
+               check_option(arg, "--critical-burst", "--critical-burst") ||
+               check_option(arg, "--cgroup", "--cgroup") ||
+               check_option(arg, "--cgroup-root", "--cgroup-root") ||
+               check_option(arg, "--warning-quota", "--warning-quota") ||
+               check_option(arg, "--critical-quota", "--critical-quota") ||
+               check_option(arg, "--warning-throttled", "--warning-throttled") ||
+               check_option(arg, "--critical-throttled", "--critical-throttled") ||
+               check_option(arg, "--cache-ttl", "--cache-ttl")) &&
                i+1 >= argc)
             {
                 snprintf(err_message, BUFFER_LEN,
@@ -228,16 +1574,79 @@ int main(int argc, const char *argv[])
                 exit_with_message(UNKNOWN, err_message);
             }
 
-            if(strcmp(arg,"-wu") == 0 || strcmp(arg,"--warning_user") == 0)
+            if(check_option(arg, "-wu", "--warning_user"))
                 w_user = atof(argv[++i]);
-            if(strcmp(arg,"-cu") == 0 || strcmp(arg,"--critical_user") == 0)
+            if(check_option(arg, "-cu", "--critical_user"))
                 c_user = atof(argv[++i]);
-            if(strcmp(arg,"-v") == 0 || strcmp(arg,"--verbose") == 0)
+            if(check_option(arg, "-P", "--procfs-root"))
+                procfs_set_root(argv[++i]);
+            if(check_option(arg, "-F", "--format") &&
+                    output_set_format(argv[++i]) != 0)
+                exit_with_message(UNKNOWN, EOUTPUTFORMAT);
+            if(check_option(arg, "--textfile", "--textfile"))
+                output_set_textfile(argv[++i]);
+            if(check_option(arg, "-t", "--top"))
+            {
+                n_top = atoi(argv[++i]);
+                if(n_top < 1 || n_top > MAXTOP)
+                    exit_with_message(UNKNOWN, "--top must be between 1 and 64");
+            }
+            if(check_option(arg, "--cache-ttl", "--cache-ttl") &&
+                    (cache_ttl = atof(argv[++i])) <= 0)
+                exit_with_message(UNKNOWN, ECACHETTL);
+            if(check_option(arg, "--threads", "--threads"))
+            {
+                n_threads = atoi(argv[++i]);
+                if(n_threads < 1 || n_threads > MAXTHREADS)
+                    exit_with_message(UNKNOWN,
+                            "--threads must be between 1 and 64");
+            }
+            if(check_option(arg, "--sampler", "--sampler"))
+                sampler = 1;
+            if(check_option(arg, "--interval", "--interval"))
+            {
+                interval = atoi(argv[++i]);
+                if(interval < 10 || interval > 60000)
+                    exit_with_message(UNKNOWN,
+                            "--interval must be between 10 and 60000");
+            }
+            if(check_option(arg, "--burst", "--burst"))
+            {
+                burst = atof(argv[++i]);
+                if(burst < 0 || burst >= 100)
+                    exit_with_message(UNKNOWN,
+                            "--burst must be between 0 and 100");
+            }
+            if(check_option(arg, "--warning-burst", "--warning-burst"))
+                w_burst = atof(argv[++i]);
+            if(check_option(arg, "--critical-burst", "--critical-burst"))
+                c_burst = atof(argv[++i]);
+            if(check_option(arg, "--cgroup", "--cgroup"))
+                cgroup = argv[++i];
+            if(check_option(arg, "--cgroup-root", "--cgroup-root"))
+                cgroup_root = argv[++i];
+            if(check_option(arg, "--warning-quota", "--warning-quota"))
+                w_quota = atof(argv[++i]);
+            if(check_option(arg, "--critical-quota", "--critical-quota"))
+                c_quota = atof(argv[++i]);
+            if(check_option(arg, "--warning-throttled", "--warning-throttled"))
+                w_throttled = atof(argv[++i]);
+            if(check_option(arg, "--critical-throttled", "--critical-throttled"))
+                c_throttled = atof(argv[++i]);
+            if(check_option(arg, "-v", "--verbose"))
                 verbose = 1;
-            if(strcmp(arg,"-h") == 0 || strcmp(arg,"--help") == 0)
-                print_help(progname);
-            if(strcmp(arg,"-V") == 0 || strcmp(arg,"--version") == 0)
+            if(check_option(arg, "--profile", "--profile") && !profile_enable())
+                exit_with_message(UNKNOWN, ENOPROFILE);
+            if(check_option(arg, "-h", "--help"))
+            {
                 print_help(progname);
+                exit(OK);
+            }
+            if(check_option(arg, "-V", "--version"))
+            {
+                print_version();
+                exit(OK);
+            }
         }
     }
 
@@ -245,6 +1654,7 @@ int main(int argc, const char *argv[])
     {
         printf("Environment Variables used:\n");
         printf("  - tmpdir: %s\n", tmpdir);
+        printf("  - procfs root: %s\n", procfs_root());
         printf("Parameters:\n");
         printf("  - warning user: %f\n", w_user);
         printf("  - critical user: %f\n", c_user);
@@ -252,11 +1662,28 @@ int main(int argc, const char *argv[])
     }
 
 
-    fd_progfs_stat = fopen(PROCFS_STAT, "r");
+    if(sampler)
+        run_sampler(interval);
+
+    if(cache_ttl > 0)
+        cache_init("check_procstat", argc, argv, cache_ttl);
+
+    if(cgroup)
+    {
+        rc = check_cgroup(tmpdir, cgroup_root, cgroup, n_top, w_quota,
+                c_quota, w_throttled, c_throttled, cgroup_message,
+                sizeof(cgroup_message));
+        output_exit(rc, "%s", cgroup_message);
+    }
+
+    PROFILE_BEGIN("read");
+    procfs_path(stat_path, sizeof(stat_path), PROCFS_STAT);
+    PROFILE_COUNT(PROFILE_OPENS);
+    fd_progfs_stat = fopen(stat_path, "r");
     if(fd_progfs_stat == 0)
     {
-        perror(PROCFS_STAT);
-        exit_with_message(CRITICAL, "could not open " PROCFS_STAT);
+        perror(stat_path);
+        output_exit(CRITICAL, "could not open %s", stat_path);
     }
 
     /*
@@ -264,22 +1691,33 @@ int main(int argc, const char *argv[])
      * format: cpu  11575308 719865 3133282 32173965 850628 555908 416221 0 0 0
      */
     fgets(buffer, BUFFER_LEN, fd_progfs_stat);
+    PROFILE_COUNT(PROFILE_READS);
 
     /* take the current (local) time */
     time(&stat.taken);
     tm_taken = localtime(&stat.taken);
 
     fclose(fd_progfs_stat);
+    PROFILE_END("read");
 
     if(verbose)
         printf("Buffer:\n%s", buffer);
 
-    sscanf(buffer, "cpu  %lld %lld %lld %lld %lld %lld %lld",
-            &stat.user, &stat.nice, &stat.system, &stat.idle,
-            &stat.iowait, &stat.irq, &stat.softirq);
+    memset(ticks, 0, sizeof(ticks));
+    if(0 == strncmp(buffer, "cpu ", 4))
+        tokenize_u64(buffer + 4, strlen(buffer + 4), ticks, 7, &used);
+    stat.user = ticks[0];
+    stat.nice = ticks[1];
+    stat.system = ticks[2];
+    stat.idle = ticks[3];
+    stat.iowait = ticks[4];
+    stat.irq = ticks[5];
+    stat.softirq = ticks[6];
 
+    PROFILE_BEGIN("state");
     stats_read = read_tmp_stats(tmpdir, &old_stat);
     write_tmp_stats(tmpdir, &stat);
+    PROFILE_END("state");
 
     if(verbose)
     {
@@ -375,17 +1813,32 @@ int main(int argc, const char *argv[])
             p_softirq > c_softirq)
         rc = CRITICAL;
 
-    sprintf(buffer, "user=%.2f nice=%.2f system=%.2f idle=%.2f iowait=%.2f irq=%.2f softirq=%.2f "
-            "|user=%f%%;0;0 nice=%f%%;0;0 "
-            "system=%f%%;0;0 idle=%f%%;0;0 "
-            "iowait=%f%%;0;0 irq=%f%%;0;0 "
-            "softirq=%f%%;0;0",
+    output_add("user", "%", p_user, w_user, c_user, 0, 100);
+    output_add("nice", "%", p_nice, OUTPUT_UNSET, OUTPUT_UNSET, 0, 100);
+    output_add("system", "%", p_system, OUTPUT_UNSET, OUTPUT_UNSET, 0, 100);
+    output_add("idle", "%", p_idle, OUTPUT_UNSET, OUTPUT_UNSET, 0, 100);
+    output_add("iowait", "%", p_iowait, OUTPUT_UNSET, OUTPUT_UNSET, 0, 100);
+    output_add("irq", "%", p_irq, OUTPUT_UNSET, OUTPUT_UNSET, 0, 100);
+    output_add("softirq", "%", p_softirq, OUTPUT_UNSET, OUTPUT_UNSET, 0, 100);
+
+    if(n_top)
+        check_top(tmpdir, stat.user + stat.nice + stat.system + stat.idle +
+                stat.iowait + stat.irq + stat.softirq, n_top, n_threads,
+                top_message, sizeof(top_message));
+
+    if(burst >= 0)
+    {
+        int burst_rc = check_burst(tmpdir, burst, w_burst, c_burst,
+                burst_message, sizeof(burst_message));
+
+        if(burst_rc > rc)
+            rc = burst_rc;
+    }
+
+    output_exit(rc, "user=%.2f nice=%.2f system=%.2f idle=%.2f iowait=%.2f "
+            "irq=%.2f softirq=%.2f%s%s",
             p_user, p_nice, p_system, p_idle, p_iowait, p_irq, p_softirq,
-            p_user, p_nice,
-            p_system, p_idle,
-            p_iowait, p_irq,
-            p_softirq);
-    exit_with_message(rc, buffer);
+            top_message, burst_message);
 
     /* suppress compiler warnings */
     return rc;
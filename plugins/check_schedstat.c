@@ -0,0 +1,655 @@
+/*
+ * filename: check_schedstat.c
+ *
+ * Checks how long runnable tasks wait for a CPU. /proc/schedstat has per
+ * CPU the time tasks ran, the time they waited on the run queue (both in
+ * nanoseconds) and the number of timeslices; the average scheduling delay
+ * is the increase of the wait time divided by the increase of timeslices
+ * since the last run. Unlike the CPU usage of check_procstat it shows
+ * contention before the CPUs are saturated.
+ *
+ * With --name the same is computed for the processes of that name from
+ * /proc/<pid>/schedstat, which exists without CONFIG_SCHEDSTATS as well.
+ *
+ * The counters of the last run are kept in $TMPDIR/check_schedstat.tmp,
+ * with --name in $TMPDIR/check_schedstat-<hash of the name>.tmp.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/procsnap.h"
+#include "../include/profile.h"
+
+#define VERSION "0.1"
+#define PROCFS_SCHEDSTAT "schedstat"
+#define BUFFER_LEN 1024
+
+#define STATE_FILE      "check_schedstat"
+#define STATE_MAGIC     0x31637373      /* "ssc1" */
+
+/* Fields of a cpu<N> line of /proc/schedstat, counted after the name. */
+#define SCHED_FIELDS    9
+#define SCHED_RUN       6
+#define SCHED_WAIT      7
+#define SCHED_SLICES    8
+
+/*
+ * Structure to hold the counters of a CPU or a process. This is also the
+ * record of the state file, so keep it free of padding.
+ *
+ * Members:
+ *  - int32_t  id:        number of the CPU or pid of the process
+ *  - uint32_t reserved:  padding
+ *  - uint64_t starttime: start of the process in ticks, 0 for CPUs
+ *  - uint64_t run:       nanoseconds spent running
+ *  - uint64_t wait:      nanoseconds spent waiting on a run queue
+ *  - uint64_t slices:    number of timeslices
+ */
+typedef struct sched_sample
+{
+    int32_t     id;
+    uint32_t    reserved;
+    uint64_t    starttime;
+    uint64_t    run;
+    uint64_t    wait;
+    uint64_t    slices;
+} sched_sample_t;
+
+/*
+ * Header of the state file, followed by the CPUs and the processes, both
+ * sorted by id.
+ */
+typedef struct state_header
+{
+    uint32_t    magic;
+    uint32_t    n_cpus;
+    uint32_t    n_procs;
+    uint32_t    reserved;
+    int64_t     taken;
+} state_header_t;
+
+/*
+ * Structure to hold a list of samples.
+ */
+typedef struct samples
+{
+    sched_sample_t *samples;
+    size_t          count,
+                    size;
+} samples_t;
+
+static char fallback_tmpdir[] = "/tmp/";
+
+/*
+ * print_help:
+ *
+ * print help output to stdout
+ */
+static void print_help (const char *progname)
+{
+    printf("Usage:\n");
+    printf(" %s [options]\n", progname);
+    printf("\n");
+    printf("Options\n");
+    printf(" -w, --warning\t\twarning threshold of the mean delay (ms)\n");
+    printf(" -c, --critical\t\tcritical threshold of the mean delay (ms)\n");
+    printf(" -W, --warning-cpu\twarning threshold of the worst CPU's delay (ms)\n");
+    printf(" -C, --critical-cpu\tcritical threshold of the worst CPU's delay (ms)\n");
+    printf(" -n, --name\t\talso check the processes of this name\n");
+    printf(" -v, --verbose\t\tverbose output\n");
+    printf(" -F, --format\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("     --textfile\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("     --profile\t\tappend timings of the plugin to the perfdata\n");
+    printf(" -P, --procfs-root\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf("     --cache-ttl\tshare results younger than this (seconds)\n"
+           "\t\t\twith invocations with the same arguments\n");
+    printf("\n");
+    printf(" -h, --help\t\tdisplay this help text\n");
+    printf(" -V, --version\t\toutput version information\n");
+}
+
+/*
+ * print_version:
+ *
+ * prints version information to stdout
+ */
+static void print_version()
+{
+    printf("check_schedstat (%s)\n", VERSION);
+}
+
+/*
+ * exit_with_message:
+ *
+ * print a message to stdout and exit with return code rc
+ */
+static void exit_with_message(int rc, char *message)
+{
+    output_exit(rc, "%s", message);
+}
+
+/*
+ * get_tmpdir:
+ *
+ * returns TMPDIR or TMP from the environment, "/tmp/" if both are unset
+ */
+static char* get_tmpdir()
+{
+    char    *tmpdir;
+    tmpdir = getenv("TMPDIR");
+
+    if(NULL == tmpdir)
+        tmpdir = getenv("TMP");
+
+    if(NULL == tmpdir)
+        tmpdir = fallback_tmpdir;
+
+    return tmpdir;
+}
+
+/*
+ * parse_number:
+ *
+ * parses a decimal number after optional blanks
+ */
+static char *parse_number(char *p, uint64_t *value)
+{
+    uint64_t    n = 0;
+
+    while(*p == ' ' || *p == '\t')
+        p++;
+    while(*p >= '0' && *p <= '9')
+        n = n * 10 + (*p++ - '0');
+    *value = n;
+
+    return p;
+}
+
+/*
+ * add_sample:
+ *
+ * returns a new, zeroed sample of the list
+ */
+static sched_sample_t *add_sample(samples_t *list)
+{
+    sched_sample_t *sample;
+
+    if(list->count == list->size)
+    {
+        list->size = list->size ? list->size * 2 : 64;
+        if(!(list->samples = realloc(list->samples,
+                        list->size * sizeof(sched_sample_t))))
+            exit_with_message(UNKNOWN, "out of memory");
+    }
+
+    sample = &list->samples[list->count++];
+    memset(sample, 0, sizeof(*sample));
+
+    return sample;
+}
+
+/*
+ * cmp_sample:
+ */
+static int cmp_sample(const void *a, const void *b)
+{
+    const sched_sample_t    *sa = a,
+                            *sb = b;
+
+    return sa->id < sb->id ? -1 : sa->id > sb->id;
+}
+
+/*
+ * find_sample:
+ *
+ * returns the sample of the same CPU or process in the sorted list or NULL
+ */
+static const sched_sample_t *find_sample(const samples_t *list,
+        const sched_sample_t *sample)
+{
+    const sched_sample_t    *old;
+
+    old = bsearch(sample, list->samples, list->count, sizeof(sched_sample_t),
+            cmp_sample);
+
+    return old && old->starttime == sample->starttime ? old : NULL;
+}
+
+/*
+ * read_cpus:
+ *
+ * reads the cpu<N> lines of schedstat. The domain lines in between, which
+ * make up most of the file on large hosts, are skipped unparsed. Returns 0
+ * if there is no schedstat, which is fatal unless the processes of
+ * --name are checked.
+ */
+static int read_cpus(samples_t *cpus, int optional)
+{
+    sched_sample_t *cpu;
+    uint64_t        fields[SCHED_FIELDS],
+                    id;
+    char            path[BUFFER_LEN],
+                   *buffer = NULL,
+                   *p;
+    size_t          size = 0;
+    int             i;
+
+    procfs_path(path, sizeof(path), PROCFS_SCHEDSTAT);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read_file(path, &buffer, &size) < 0)
+    {
+        free(buffer);
+        if(optional)
+            return 0;
+        output_exit(UNKNOWN, "could not read %s (is the kernel built with "
+                "CONFIG_SCHEDSTATS?)", path);
+    }
+
+    for(p = buffer; p && *p; p = strchr(p, '\n'), p = p ? p + 1 : NULL)
+    {
+        if(p[0] != 'c' || p[1] != 'p' || p[2] != 'u' ||
+                p[3] < '0' || p[3] > '9')
+            continue;
+
+        p = parse_number(p + 3, &id);
+        for(i = 0; i < SCHED_FIELDS; i++)
+            p = parse_number(p, &fields[i]);
+
+        cpu = add_sample(cpus);
+        cpu->id = id;
+        cpu->run = fields[SCHED_RUN];
+        cpu->wait = fields[SCHED_WAIT];
+        cpu->slices = fields[SCHED_SLICES];
+    }
+
+    free(buffer);
+    qsort(cpus->samples, cpus->count, sizeof(sched_sample_t), cmp_sample);
+
+    return 1;
+}
+
+/*
+ * read_processes:
+ *
+ * reads the schedstat of all processes named name. The stat of every
+ * process is read for its comm and starttime, the schedstat only of the
+ * matching ones.
+ */
+static void read_processes(const char *name, samples_t *procs)
+{
+    sched_sample_t  *proc;
+    procsnap_t       snap;
+    size_t          *rows,
+                     n,
+                     i;
+
+    if(procsnap_open(&snap) < 0 ||
+            procsnap_load(&snap, PROCSNAP_STAT, NULL, 0) < 0 ||
+            !(rows = malloc((snap.count + 1) * sizeof(size_t))))
+        exit_with_message(UNKNOWN, "could not list the processes");
+
+    n = procsnap_match_comm(&snap, name, rows);
+    if(procsnap_load(&snap, PROCSNAP_SCHEDSTAT, rows, n) < 0)
+        exit_with_message(UNKNOWN, "out of memory");
+
+    for(i = 0; i < n; i++)
+    {
+        /* gone in between */
+        if(snap.gone[rows[i]])
+            continue;
+
+        proc = add_sample(procs);
+        proc->id = snap.pids[rows[i]];
+        proc->starttime = snap.starttime[rows[i]];
+        proc->run = snap.run_ns[rows[i]];
+        proc->wait = snap.wait_ns[rows[i]];
+        proc->slices = snap.slices[rows[i]];
+    }
+
+    free(rows);
+    procsnap_close(&snap);
+
+    qsort(procs->samples, procs->count, sizeof(sched_sample_t), cmp_sample);
+}
+
+/*
+ * state_path:
+ *
+ * builds the path of the state file, with --name it includes a hash of the
+ * name, so checks of different processes don't share their state
+ */
+static void state_path(char *path, size_t len, const char *tmpdir,
+        const char *name)
+{
+    uint64_t    hash = 14695981039346656037ULL;
+
+    if(!name)
+    {
+        snprintf(path, len, "%s/%s.tmp", tmpdir, STATE_FILE);
+        return;
+    }
+
+    for(; *name; name++)
+        hash = (hash ^ (unsigned char) *name) * 1099511628211ULL;
+    snprintf(path, len, "%s/%s-%016llx.tmp", tmpdir, STATE_FILE,
+            (unsigned long long) hash);
+}
+
+/*
+ * read_state:
+ *
+ * reads the samples of the last run, returns 0 if there are none
+ */
+static int read_state(const char *path, state_header_t *header,
+        samples_t *cpus, samples_t *procs)
+{
+    FILE    *state_file;
+    int      rc = 0;
+
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    if(1 == fread(header, sizeof(*header), 1, state_file) &&
+            header->magic == STATE_MAGIC &&
+            (cpus->samples = malloc((header->n_cpus + 1) *
+                                    sizeof(sched_sample_t))) &&
+            (procs->samples = malloc((header->n_procs + 1) *
+                                     sizeof(sched_sample_t))) &&
+            header->n_cpus == fread(cpus->samples, sizeof(sched_sample_t),
+                header->n_cpus, state_file) &&
+            header->n_procs == fread(procs->samples, sizeof(sched_sample_t),
+                header->n_procs, state_file))
+    {
+        cpus->count = header->n_cpus;
+        procs->count = header->n_procs;
+        rc = 1;
+    }
+
+    fclose(state_file);
+
+    return rc;
+}
+
+/*
+ * write_state:
+ *
+ * writes the samples of this run, the file is replaced atomically
+ */
+static void write_state(const char *path, int64_t taken, const samples_t *cpus,
+        const samples_t *procs)
+{
+    FILE            *state_file;
+    state_header_t   header = { STATE_MAGIC, cpus->count, procs->count, 0,
+                                taken };
+    char             tmp_path[BUFFER_LEN + 32];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the state file "
+                "for writing");
+
+    fwrite(&header, sizeof(header), 1, state_file);
+    fwrite(cpus->samples, sizeof(sched_sample_t), cpus->count, state_file);
+    fwrite(procs->samples, sizeof(sched_sample_t), procs->count, state_file);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the state file");
+    }
+}
+
+/*
+ * delay_ms:
+ *
+ * returns the average delay per timeslice in ms
+ */
+static double delay_ms(uint64_t wait, uint64_t slices)
+{
+    return slices ? wait / 1e6 / slices : 0;
+}
+
+int PLUGIN_MAIN(check_schedstat)(int argc, char *argv[])
+{
+    state_header_t           header;
+    samples_t                cpus = { NULL, 0, 0 },
+                             procs = { NULL, 0, 0 },
+                             old_cpus = { NULL, 0, 0 },
+                             old_procs = { NULL, 0, 0 };
+    const sched_sample_t    *old;
+    const char              *progname,
+                            *arg,
+                            *name = NULL;
+
+    char                     err_message[BUFFER_LEN],
+                             path[BUFFER_LEN],
+                             message[BUFFER_LEN],
+                             cpu_name[16],
+                             proc_message[BUFFER_LEN] = "",
+                            *tmpdir;
+
+    uint64_t                 wait = 0,
+                             slices = 0,
+                             p_wait = 0,
+                             p_slices = 0;
+
+    size_t                   i;
+
+    int64_t                  taken;
+
+    int                      verbose = 0,
+                             stats_read,
+                             has_cpus,
+                             n_checked = 0,
+                             n_procs = 0,
+                             worst_cpu = -1,
+                             rc = OK,
+                             j;
+
+    double                   seconds,
+                             delay,
+                             mean,
+                             p_mean = 0,
+                             worst = 0,
+                             cache_ttl = 0,
+                             w_mean = OUTPUT_UNSET,
+                             c_mean = OUTPUT_UNSET,
+                             w_cpu = OUTPUT_UNSET,
+                             c_cpu = OUTPUT_UNSET;
+
+    output_init("check_schedstat");
+
+    tmpdir = get_tmpdir();
+
+    /*
+     * parse the given arguments
+     */
+    if(argc > 0)
+    {
+        progname = argv[0];
+        for(j = 1; j < argc; j++)
+        {
+            arg = argv[j];
+
+            /*
+             * if we got a parameter without a value, complain about it
+             */
+            if((check_option(arg, "-w", "--warning") ||
+               check_option(arg, "-c", "--critical") ||
+               check_option(arg, "-W", "--warning-cpu") ||
+               check_option(arg, "-C", "--critical-cpu") ||
+               check_option(arg, "-n", "--name") ||
+               check_option(arg, "-P", "--procfs-root") ||
+               check_option(arg, "-F", "--format") ||
+               check_option(arg, "--textfile", "--textfile") ||
+               check_option(arg, "--cache-ttl", "--cache-ttl")) &&
+               j + 1 >= argc)
+            {
+                snprintf(err_message, BUFFER_LEN,
+                        "you have to provide a value for %s", arg);
+                exit_with_message(UNKNOWN, err_message);
+            }
+
+            if(check_option(arg, "-w", "--warning"))
+                w_mean = atof(argv[++j]);
+            if(check_option(arg, "-c", "--critical"))
+                c_mean = atof(argv[++j]);
+            if(check_option(arg, "-W", "--warning-cpu"))
+                w_cpu = atof(argv[++j]);
+            if(check_option(arg, "-C", "--critical-cpu"))
+                c_cpu = atof(argv[++j]);
+            if(check_option(arg, "-n", "--name"))
+                name = argv[++j];
+            if(check_option(arg, "-P", "--procfs-root"))
+                procfs_set_root(argv[++j]);
+            if(check_option(arg, "-F", "--format") &&
+                    output_set_format(argv[++j]) != 0)
+                exit_with_message(UNKNOWN, EOUTPUTFORMAT);
+            if(check_option(arg, "--textfile", "--textfile"))
+                output_set_textfile(argv[++j]);
+            if(check_option(arg, "--cache-ttl", "--cache-ttl") &&
+                    (cache_ttl = atof(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, ECACHETTL);
+            if(check_option(arg, "-v", "--verbose"))
+                verbose = 1;
+            if(check_option(arg, "--profile", "--profile") && !profile_enable())
+                exit_with_message(UNKNOWN, ENOPROFILE);
+            if(check_option(arg, "-h", "--help"))
+            {
+                print_help(progname);
+                exit(OK);
+            }
+            if(check_option(arg, "-V", "--version"))
+            {
+                print_version();
+                exit(OK);
+            }
+        }
+    }
+
+    if(verbose)
+    {
+        printf("Environment Variables used:\n");
+        printf("  - tmpdir: %s\n", tmpdir);
+        printf("  - procfs root: %s\n", procfs_root());
+        printf("Parameters:\n");
+        printf("  - mean delay: warning %f critical %f\n", w_mean, c_mean);
+        printf("  - cpu delay: warning %f critical %f\n", w_cpu, c_cpu);
+        printf("  - name: %s\n", name ? name : "(none)");
+    }
+
+    if(cache_ttl > 0)
+        cache_init("check_schedstat", argc, argv, cache_ttl);
+
+    PROFILE_BEGIN("read");
+    has_cpus = read_cpus(&cpus, name != NULL);
+    if(name)
+        read_processes(name, &procs);
+    taken = procfs_clock_ns();
+    PROFILE_END("read");
+
+    PROFILE_BEGIN("state");
+    state_path(path, sizeof(path), tmpdir, name);
+    stats_read = read_state(path, &header, &old_cpus, &old_procs);
+    write_state(path, taken, &cpus, &procs);
+    PROFILE_END("state");
+
+    seconds = stats_read ? (taken - header.taken) / 1e9 : 0;
+    if(!stats_read || seconds <= 0)
+        exit_with_message(OK, stats_read ? "no time passed" :
+                "no previous sample");
+
+    for(i = 0; i < cpus.count; i++)
+    {
+        if(!(old = find_sample(&old_cpus, &cpus.samples[i])) ||
+                cpus.samples[i].wait < old->wait ||
+                cpus.samples[i].slices < old->slices)
+            continue;
+
+        delay = delay_ms(cpus.samples[i].wait - old->wait,
+                cpus.samples[i].slices - old->slices);
+        wait += cpus.samples[i].wait - old->wait;
+        slices += cpus.samples[i].slices - old->slices;
+        n_checked++;
+
+        snprintf(cpu_name, sizeof(cpu_name), "%d", cpus.samples[i].id);
+        output_add_labeled("cpu", cpu_name, "delay", "ms", delay, w_cpu, c_cpu,
+                0, OUTPUT_UNSET);
+        /* nanoseconds waited per second: the mean number of waiting tasks */
+        output_add_labeled("cpu", cpu_name, "waiting", "",
+                (cpus.samples[i].wait - old->wait) / 1e9 / seconds,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+
+        if(verbose)
+            printf("  - cpu%d: %.3fms per timeslice\n", cpus.samples[i].id,
+                    delay);
+
+        if(worst_cpu < 0 || delay > worst)
+        {
+            worst = delay;
+            worst_cpu = cpus.samples[i].id;
+        }
+    }
+
+    if(has_cpus && n_checked == 0)
+        exit_with_message(OK, "no previous sample of any cpu");
+
+    mean = delay_ms(wait, slices);
+    if(has_cpus)
+    {
+        output_add("delay", "ms", mean, w_mean, c_mean, 0, OUTPUT_UNSET);
+        output_add("max_cpu_delay", "ms", worst, w_cpu, c_cpu, 0,
+                OUTPUT_UNSET);
+        output_add("waiting", "", wait / 1e9 / seconds, OUTPUT_UNSET,
+                OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        snprintf(message, sizeof(message), "mean delay %.3fms, cpu%d %.3fms",
+                mean, worst_cpu, worst);
+    }
+    else
+        snprintf(message, sizeof(message), "no schedstat");
+
+    /* Only processes which existed during the whole interval count. */
+    if(name)
+    {
+        for(i = 0; i < procs.count; i++)
+        {
+            if(!(old = find_sample(&old_procs, &procs.samples[i])) ||
+                    procs.samples[i].wait < old->wait)
+                continue;
+            p_wait += procs.samples[i].wait - old->wait;
+            p_slices += procs.samples[i].slices - old->slices;
+            n_procs++;
+        }
+
+        p_mean = delay_ms(p_wait, p_slices);
+        output_add("process_delay", "ms", p_mean, w_mean, c_mean, 0,
+                OUTPUT_UNSET);
+        output_add("processes", "", n_procs, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+                OUTPUT_UNSET);
+        snprintf(proc_message, sizeof(proc_message), "%s: %.3fms (%d "
+                "processes)", name, p_mean, n_procs);
+    }
+
+    /* comparisons with unset (NaN) thresholds are false */
+    if(mean > w_mean || worst > w_cpu || p_mean > w_mean)
+        rc = WARNING;
+    if(mean > c_mean || worst > c_cpu || p_mean > c_mean)
+        rc = CRITICAL;
+
+    if(name && has_cpus)
+        output_exit(rc, "%s, %s", message, proc_message);
+    output_exit(rc, "%s", name ? proc_message : message);
+
+    /* suppress compiler warnings */
+    return rc;
+}
@@ -0,0 +1,846 @@
+/*
+ * filename: check_slabinfo.c
+ *
+ * Checks the memory of the kernel slab caches, which check_meminfo doesn't
+ * see: dentries, inodes or a leaking kmalloc-* cache. The total and its
+ * reclaimable and unreclaimable part come from /proc/meminfo, the top N
+ * caches by bytes or growth from /proc/slabinfo, which only root can read.
+ * Without it only the totals are checked.
+ *
+ * Growth is measured against a baseline kept in $TMPDIR/check_slabinfo.tmp
+ * with the bytes of every cache. A second sample is taken once the baseline
+ * is a --window old and replaces it one window later, so the growth always
+ * spans between one and two windows after the first one.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/profile.h"
+#include "../include/tokenize.h"
+
+#define VERSION "0.1"
+#define PROCFS_SLABINFO "slabinfo"
+#define PROCFS_MEMINFO "meminfo"
+#define BUFFER_LEN 1024
+
+#define STATE_FILE      "/check_slabinfo.tmp"
+#define STATE_MAGIC     0x31626c73      /* "slb1" */
+#define HASH_INIT       14695981039346656037ULL
+
+#define DEFAULT_TOP     5
+#define MAXTOP          64
+#define DEFAULT_WINDOW  3600
+
+/* Values to sort the caches by. */
+#define SORT_BYTES      0
+#define SORT_GROWTH     1
+
+/*
+ * Structure to hold a slab cache.
+ *
+ * Members:
+ *  - const char *name:   name of the cache, points into the slabinfo buffer
+ *  - uint64_t    hash:   hash of the name
+ *  - uint64_t    bytes:  memory of all its slabs
+ *  - uint64_t    active: memory of its active objects
+ *  - double      growth: bytes per hour against the baseline
+ *  - double      key:    value the top is sorted by
+ */
+typedef struct slab_cache
+{
+    const char *name;
+    uint64_t    hash;
+    uint64_t    bytes;
+    uint64_t    active;
+    double      growth;
+    double      key;
+} slab_cache_t;
+
+/*
+ * Header of a sample in the state file. The baseline and the pending
+ * sample follow each other, each with n_caches state_cache_t sorted by
+ * the hash.
+ *
+ * Members:
+ *  - uint32_t magic:         STATE_MAGIC
+ *  - uint32_t n_caches:      number of caches, 0 without slabinfo
+ *  - int64_t  taken:         CLOCK_BOOTTIME nanoseconds of the sample, 0 if
+ *                            there is none
+ *  - uint64_t unreclaimable: SUnreclaim of meminfo (bytes)
+ */
+typedef struct state_header
+{
+    uint32_t    magic;
+    uint32_t    n_caches;
+    int64_t     taken;
+    uint64_t    unreclaimable;
+} state_header_t;
+
+typedef struct state_cache
+{
+    uint64_t    hash;
+    uint64_t    bytes;
+} state_cache_t;
+
+typedef struct sample
+{
+    state_header_t  header;
+    state_cache_t  *caches;
+} sample_t;
+
+static char fallback_tmpdir[] = "/tmp/";
+
+/*
+ * print_help:
+ *
+ * print help output to stdout
+ */
+static void print_help (const char *progname)
+{
+    printf("Usage:\n");
+    printf(" %s [options]\n", progname);
+    printf("\n");
+    printf("Options\n");
+    printf(" -t, --top\t\treport the top N caches (default: %d)\n",
+            DEFAULT_TOP);
+    printf(" -s, --sort\t\tsort the caches by bytes (default) or growth\n");
+    printf(" -w, --warning\t\twarning threshold of the unreclaimable slab\n"
+           "\t\t\t(bytes, or with a suffix k, M, G or T)\n");
+    printf(" -c, --critical\t\tcritical threshold of the unreclaimable slab\n");
+    printf("     --warning-growth\twarning threshold of the growth of the\n"
+           "\t\t\tunreclaimable slab (bytes per hour)\n");
+    printf("     --critical-growth\tcritical threshold of the growth of the\n"
+           "\t\t\tunreclaimable slab (bytes per hour)\n");
+    printf("     --window\t\tage of the baseline in seconds (default: %d)\n",
+            DEFAULT_WINDOW);
+    printf(" -v, --verbose\t\tverbose output, with every cache\n");
+    printf(" -F, --format\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("     --textfile\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("     --profile\t\tappend timings of the plugin to the perfdata\n");
+    printf(" -P, --procfs-root\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf("     --cache-ttl\tshare results younger than this (seconds)\n"
+           "\t\t\twith invocations with the same arguments\n");
+    printf("\n");
+    printf("Without root, slabinfo is not readable and only the totals of\n"
+           "meminfo are checked.\n");
+    printf("\n");
+    printf(" -h, --help\t\tdisplay this help text\n");
+    printf(" -V, --version\t\toutput version information\n");
+}
+
+/*
+ * print_version:
+ *
+ * prints version information to stdout
+ */
+static void print_version()
+{
+    printf("check_slabinfo (%s)\n", VERSION);
+}
+
+/*
+ * exit_with_message:
+ *
+ * print a message to stdout and exit with return code rc
+ */
+static void exit_with_message(int rc, char *message)
+{
+    output_exit(rc, "%s", message);
+}
+
+/*
+ * get_tmpdir:
+ *
+ * returns TMPDIR or TMP from the environment, "/tmp/" if both are unset
+ */
+static char* get_tmpdir()
+{
+    char    *tmpdir;
+    tmpdir = getenv("TMPDIR");
+
+    if(NULL == tmpdir)
+        tmpdir = getenv("TMP");
+
+    if(NULL == tmpdir)
+        tmpdir = fallback_tmpdir;
+
+    return tmpdir;
+}
+
+/*
+ * hash_bytes:
+ *
+ * continues the FNV-1a hash with len bytes
+ */
+static uint64_t hash_bytes(uint64_t hash, const char *s, size_t len)
+{
+    for(; len > 0; len--, s++)
+        hash = (hash ^ (unsigned char) *s) * 1099511628211ULL;
+
+    return hash;
+}
+
+/*
+ * parse_size:
+ *
+ * parses a size in bytes with an optional suffix k, M, G or T (powers of
+ * 1024). Returns -1 if it is invalid.
+ */
+static double parse_size(const char *s)
+{
+    const char  *suffixes = "kMGT";
+    const char  *suffix;
+    char        *end;
+    double       size = strtod(s, &end);
+
+    if(end == s || size < 0)
+        return -1;
+    if(!*end)
+        return size;
+    if(end[1] || !(suffix = strchr(suffixes, *end)))
+        return -1;
+
+    for(; suffix >= suffixes; suffix--)
+        size *= 1024;
+
+    return size;
+}
+
+/*
+ * format_size:
+ *
+ * formats bytes like "1.21 GB", with a sign if sign is set
+ */
+static void format_size(char *buffer, size_t len, double bytes, int sign)
+{
+    const char  *units[] = { "B", "kB", "MB", "GB", "TB" };
+    double       size = bytes < 0 ? -bytes : bytes;
+    int          unit = 0;
+
+    while(size >= 1024 && unit < 4)
+    {
+        size /= 1024;
+        unit++;
+    }
+
+    snprintf(buffer, len, unit ? "%s%.2f %s" : "%s%.0f %s",
+            bytes < 0 ? "-" : sign ? "+" : "", size, units[unit]);
+}
+
+/*
+ * read_meminfo:
+ *
+ * reads Slab, SReclaimable and SUnreclaim of meminfo in bytes
+ */
+static void read_meminfo(uint64_t *slab, uint64_t *reclaimable,
+        uint64_t *unreclaimable)
+{
+    FILE    *fd;
+    char     path[BUFFER_LEN],
+             buffer[BUFFER_LEN];
+    int      found = 0;
+
+    procfs_path(path, sizeof(path), PROCFS_MEMINFO);
+    PROFILE_COUNT(PROFILE_OPENS);
+    if(!(fd = fopen(path, "r")))
+        output_exit(UNKNOWN, "%s: %s", path, strerror(errno));
+
+    while(found < 3 && fgets(buffer, sizeof(buffer), fd))
+    {
+        PROFILE_COUNT(PROFILE_READS);
+        if(1 == sscanf(buffer, "Slab: %" SCNu64, slab))
+            found++;
+        else if(1 == sscanf(buffer, "SReclaimable: %" SCNu64, reclaimable))
+            found++;
+        else if(1 == sscanf(buffer, "SUnreclaim: %" SCNu64, unreclaimable))
+            found++;
+    }
+
+    fclose(fd);
+
+    if(found < 3)
+        output_exit(UNKNOWN, "%s: no Slab, SReclaimable or SUnreclaim", path);
+
+    *slab *= 1024;
+    *reclaimable *= 1024;
+    *unreclaimable *= 1024;
+}
+
+/*
+ * read_slabinfo:
+ *
+ * reads all caches of slabinfo into caches, their names point into
+ * buffer. Every line is split once, a cache takes
+ * num_slabs * pagesperslab pages. Returns the number of caches or -1 if
+ * slabinfo is not readable.
+ */
+static long read_slabinfo(char **buffer, slab_cache_t **caches)
+{
+    char         path[BUFFER_LEN],
+                *line,
+                *next,
+                *slabdata;
+    size_t       size = 0,
+                 len,
+                 used,
+                 allocated = 0;
+    uint64_t     values[5],
+                 slabs[2];
+    long         page_size = sysconf(_SC_PAGESIZE),
+                 count = 0;
+    slab_cache_t *cache;
+
+    procfs_path(path, sizeof(path), PROCFS_SLABINFO);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read_file(path, buffer, &size) < 0)
+    {
+        free(*buffer);
+        *buffer = NULL;
+        return -1;
+    }
+
+    for(line = *buffer; *line; line = next)
+    {
+        next = line + strcspn(line, "\n");
+        if(*next)
+            *next++ = '\0';
+
+        /* "slabinfo - version: 2.1" and "# name ..." */
+        if(0 == strncmp(line, "slabinfo", 8) || *line == '#')
+            continue;
+
+        len = strcspn(line, " \t");
+        if(len == 0 || !line[len])
+            continue;
+        line[len] = '\0';
+
+        /* active_objs num_objs objsize objperslab pagesperslab */
+        if(5 != tokenize_u64(line + len + 1, strlen(line + len + 1), values,
+                    5, &used) ||
+                !(slabdata = strstr(line + len + 1 + used, "slabdata")) ||
+                2 != tokenize_u64(slabdata + 8, strlen(slabdata + 8), slabs,
+                    2, &used))
+            continue;
+
+        if((size_t) count == allocated)
+        {
+            allocated = allocated ? allocated * 2 : 256;
+            if(!(*caches = realloc(*caches,
+                            allocated * sizeof(slab_cache_t))))
+                exit_with_message(UNKNOWN, "out of memory");
+        }
+
+        cache = &(*caches)[count++];
+        cache->name = line;
+        cache->hash = hash_bytes(HASH_INIT, line, len);
+        cache->bytes = slabs[1] * values[4] * page_size;
+        cache->active = values[0] * values[2];
+        cache->growth = OUTPUT_UNSET;
+    }
+
+    return count;
+}
+
+/*
+ * cmp_state_cache:
+ *
+ * compares two state_cache_t by their hash
+ */
+static int cmp_state_cache(const void *a, const void *b)
+{
+    const state_cache_t *x = a,
+                        *y = b;
+
+    return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+/*
+ * cache_less:
+ *
+ * returns 1 if cache x sorts below y: by the key, then by the bytes, so
+ * the largest caches lead a top by growth on a quiet host
+ */
+static int cache_less(const slab_cache_t *x, const slab_cache_t *y)
+{
+    return x->key < y->key || (x->key == y->key && x->bytes < y->bytes);
+}
+
+/*
+ * cmp_key:
+ *
+ * compares two slab_cache_t pointers by their key, descending
+ */
+static int cmp_key(const void *a, const void *b)
+{
+    const slab_cache_t  *x = *(slab_cache_t * const *) a,
+                        *y = *(slab_cache_t * const *) b;
+
+    return cache_less(x, y) ? 1 : cache_less(y, x) ? -1 : 0;
+}
+
+/*
+ * read_sample:
+ *
+ * reads the next sample of the state file, returns 0 if there is none
+ */
+static int read_sample(FILE *state_file, sample_t *sample)
+{
+    if(1 != fread(&sample->header, sizeof(sample->header), 1, state_file) ||
+            sample->header.magic != STATE_MAGIC || !sample->header.taken)
+        return 0;
+
+    if(sample->header.n_caches && (!(sample->caches = malloc(
+                        sample->header.n_caches * sizeof(state_cache_t))) ||
+                sample->header.n_caches != fread(sample->caches,
+                    sizeof(state_cache_t), sample->header.n_caches,
+                    state_file)))
+    {
+        free(sample->caches);
+        sample->caches = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * read_state:
+ *
+ * reads the baseline and the pending sample, returns the number of samples
+ */
+static int read_state(const char *path, sample_t *baseline, sample_t *pending)
+{
+    FILE    *state_file;
+    int      n = 0;
+
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    if(read_sample(state_file, baseline))
+        n = 1 + read_sample(state_file, pending);
+
+    fclose(state_file);
+
+    return n;
+}
+
+/*
+ * write_sample:
+ *
+ * writes a sample, an empty header if it is NULL
+ */
+static void write_sample(FILE *state_file, const sample_t *sample)
+{
+    state_header_t   empty = { STATE_MAGIC, 0, 0, 0 };
+
+    if(!sample)
+    {
+        fwrite(&empty, sizeof(empty), 1, state_file);
+        return;
+    }
+
+    fwrite(&sample->header, sizeof(sample->header), 1, state_file);
+    if(sample->header.n_caches)
+        fwrite(sample->caches, sizeof(state_cache_t),
+                sample->header.n_caches, state_file);
+}
+
+/*
+ * write_state:
+ *
+ * writes the baseline and the pending sample, the file is replaced
+ * atomically
+ */
+static void write_state(const char *path, const sample_t *baseline,
+        const sample_t *pending)
+{
+    FILE    *state_file;
+    char     tmp_path[BUFFER_LEN + 32];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the state file for writing");
+
+    write_sample(state_file, baseline);
+    write_sample(state_file, pending);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the state file");
+    }
+}
+
+/*
+ * heap_push:
+ *
+ * adds cache to the min heap of at most max caches ordered by
+ * cache_less(), replacing the smallest one when it is full. Returns the new size.
+ */
+static int heap_push(slab_cache_t **heap, int n, int max, slab_cache_t *cache)
+{
+    slab_cache_t    *tmp;
+    int              i,
+                     child;
+
+    if(n < max)
+    {
+        /* sift up */
+        for(i = n++; i > 0 && cache_less(cache, heap[(i - 1) / 2]);
+                i = (i - 1) / 2)
+            heap[i] = heap[(i - 1) / 2];
+        heap[i] = cache;
+        return n;
+    }
+
+    if(!cache_less(heap[0], cache))
+        return n;
+
+    /* sift down */
+    for(heap[0] = cache, i = 0; (child = 2 * i + 1) < n; i = child)
+    {
+        if(child + 1 < n && cache_less(heap[child + 1], heap[child]))
+            child++;
+        if(!cache_less(heap[child], heap[i]))
+            break;
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+    }
+
+    return n;
+}
+
+/*
+ * check_option_value:
+ *
+ * returns 1 if arg is one of the options taking a value
+ */
+static int check_option_value(const char *arg)
+{
+    return check_option(arg, "-t", "--top") ||
+        check_option(arg, "-s", "--sort") ||
+        check_option(arg, "-w", "--warning") ||
+        check_option(arg, "-c", "--critical") ||
+        check_option(arg, "--warning-growth", "--warning-growth") ||
+        check_option(arg, "--critical-growth", "--critical-growth") ||
+        check_option(arg, "--window", "--window") ||
+        check_option(arg, "-P", "--procfs-root") ||
+        check_option(arg, "-F", "--format") ||
+        check_option(arg, "--textfile", "--textfile") ||
+        check_option(arg, "--cache-ttl", "--cache-ttl");
+}
+
+int PLUGIN_MAIN(check_slabinfo)(int argc, char *argv[])
+{
+    slab_cache_t    *caches = NULL,
+                    *top[MAXTOP];
+    sample_t         baseline = { { 0, 0, 0, 0 }, NULL },
+                     pending = { { 0, 0, 0, 0 }, NULL },
+                     current;
+    state_cache_t   *old;
+    const char      *progname,
+                    *arg;
+
+    char             err_message[BUFFER_LEN],
+                     path[BUFFER_LEN],
+                     message[4 * BUFFER_LEN],
+                     size[32],
+                     growth[32],
+                     suffix[48],
+                     unreclaimable_size[32],
+                    *slabinfo = NULL,
+                    *tmpdir;
+
+    uint64_t         slab = 0,
+                     reclaimable = 0,
+                     unreclaimable = 0;
+
+    int64_t          taken;
+
+    long             n_caches,
+                     i;
+
+    int              verbose = 0,
+                     n_top = DEFAULT_TOP,
+                     sort = SORT_BYTES,
+                     n_samples,
+                     n = 0,
+                     rc = OK,
+                     len,
+                     j;
+
+    double           hours = 0,
+                     unreclaimable_growth = OUTPUT_UNSET,
+                     cache_ttl = 0,
+                     window = DEFAULT_WINDOW,
+                     w_bytes = OUTPUT_UNSET,
+                     c_bytes = OUTPUT_UNSET,
+                     w_growth = OUTPUT_UNSET,
+                     c_growth = OUTPUT_UNSET;
+
+    output_init("check_slabinfo");
+
+    tmpdir = get_tmpdir();
+
+    /*
+     * parse the given arguments
+     */
+    if(argc > 0)
+    {
+        progname = argv[0];
+        for(j = 1; j < argc; j++)
+        {
+            arg = argv[j];
+
+            /*
+             * if we got a parameter without a value, complain about it
+             */
+            if(check_option_value(arg) && j + 1 >= argc)
+            {
+                snprintf(err_message, BUFFER_LEN,
+                        "you have to provide a value for %s", arg);
+                exit_with_message(UNKNOWN, err_message);
+            }
+
+            if(check_option(arg, "-t", "--top") &&
+                    ((n_top = atoi(argv[++j])) < 1 || n_top > MAXTOP))
+                exit_with_message(UNKNOWN, "--top must be between 1 and 64");
+            if(check_option(arg, "-s", "--sort"))
+            {
+                arg = argv[++j];
+                if(0 == strcmp(arg, "bytes"))
+                    sort = SORT_BYTES;
+                else if(0 == strcmp(arg, "growth"))
+                    sort = SORT_GROWTH;
+                else
+                    exit_with_message(UNKNOWN,
+                            "--sort must be bytes or growth");
+            }
+            if(check_option(arg, "-w", "--warning") &&
+                    (w_bytes = parse_size(argv[++j])) < 0)
+                exit_with_message(UNKNOWN, "invalid warning threshold");
+            if(check_option(arg, "-c", "--critical") &&
+                    (c_bytes = parse_size(argv[++j])) < 0)
+                exit_with_message(UNKNOWN, "invalid critical threshold");
+            if(check_option(arg, "--warning-growth", "--warning-growth") &&
+                    (w_growth = parse_size(argv[++j])) < 0)
+                exit_with_message(UNKNOWN, "invalid warning-growth threshold");
+            if(check_option(arg, "--critical-growth", "--critical-growth") &&
+                    (c_growth = parse_size(argv[++j])) < 0)
+                exit_with_message(UNKNOWN, "invalid critical-growth threshold");
+            if(check_option(arg, "--window", "--window") &&
+                    (window = atof(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, "--window must be positive");
+            if(check_option(arg, "-P", "--procfs-root"))
+                procfs_set_root(argv[++j]);
+            if(check_option(arg, "-F", "--format") &&
+                    output_set_format(argv[++j]) != 0)
+                exit_with_message(UNKNOWN, EOUTPUTFORMAT);
+            if(check_option(arg, "--textfile", "--textfile"))
+                output_set_textfile(argv[++j]);
+            if(check_option(arg, "--cache-ttl", "--cache-ttl") &&
+                    (cache_ttl = atof(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, ECACHETTL);
+            if(check_option(arg, "-v", "--verbose"))
+                verbose = 1;
+            if(check_option(arg, "--profile", "--profile") && !profile_enable())
+                exit_with_message(UNKNOWN, ENOPROFILE);
+            if(check_option(arg, "-h", "--help"))
+            {
+                print_help(progname);
+                exit(OK);
+            }
+            if(check_option(arg, "-V", "--version"))
+            {
+                print_version();
+                exit(OK);
+            }
+        }
+    }
+
+    if(verbose)
+    {
+        printf("Environment Variables used:\n");
+        printf("  - tmpdir: %s\n", tmpdir);
+        printf("  - procfs root: %s\n", procfs_root());
+        printf("Parameters:\n");
+        printf("  - top: %d by %s\n", n_top,
+                sort == SORT_BYTES ? "bytes" : "growth");
+        printf("  - unreclaimable: warning %f critical %f\n", w_bytes,
+                c_bytes);
+        printf("  - growth: warning %f critical %f\n", w_growth, c_growth);
+        printf("  - window: %f\n", window);
+    }
+
+    if(cache_ttl > 0)
+        cache_init("check_slabinfo", argc, argv, cache_ttl);
+
+    PROFILE_BEGIN("read");
+    taken = procfs_clock_ns();
+    read_meminfo(&slab, &reclaimable, &unreclaimable);
+    if((n_caches = read_slabinfo(&slabinfo, &caches)) < 0)
+        n_caches = 0;
+    PROFILE_END("read");
+
+    /*
+     * the current sample, sorted by hash to look the caches up in the
+     * baseline of the next run
+     */
+    current.header.magic = STATE_MAGIC;
+    current.header.n_caches = n_caches;
+    current.header.taken = taken;
+    current.header.unreclaimable = unreclaimable;
+    if(!(current.caches = malloc((n_caches ? n_caches : 1) *
+                    sizeof(state_cache_t))))
+        exit_with_message(UNKNOWN, "out of memory");
+    for(i = 0; i < n_caches; i++)
+    {
+        current.caches[i].hash = caches[i].hash;
+        current.caches[i].bytes = caches[i].bytes;
+    }
+    qsort(current.caches, n_caches, sizeof(state_cache_t), cmp_state_cache);
+
+    PROFILE_BEGIN("state");
+    snprintf(path, sizeof(path), "%s%s", tmpdir, STATE_FILE);
+    n_samples = read_state(path, &baseline, &pending);
+
+    /* CLOCK_BOOTTIME starts over after a reboot */
+    if(n_samples > 0 && baseline.header.taken > taken)
+        n_samples = 0;
+
+    if(n_samples == 0)
+        write_state(path, &current, NULL);
+    else if(n_samples == 1 && (taken - baseline.header.taken) / 1e9 >= window)
+        write_state(path, &baseline, &current);
+    else if(n_samples == 2 && (taken - pending.header.taken) / 1e9 >= window)
+        write_state(path, &pending, &current);
+    PROFILE_END("state");
+
+    if(n_samples > 0)
+        hours = (taken - baseline.header.taken) / 3600e9;
+
+    /*
+     * growth of every cache against the baseline, caches which are not in
+     * it have grown from nothing
+     */
+    if(hours > 0)
+    {
+        unreclaimable_growth = ((double) unreclaimable -
+                baseline.header.unreclaimable) / hours;
+
+        for(i = 0; baseline.header.n_caches && i < n_caches; i++)
+        {
+            old = bsearch(&caches[i].hash, baseline.caches,
+                    baseline.header.n_caches, sizeof(state_cache_t),
+                    cmp_state_cache);
+            caches[i].growth = ((double) caches[i].bytes -
+                    (old ? old->bytes : 0)) / hours;
+        }
+    }
+
+    /* the top N in a bounded heap, O(caches log N) */
+    for(i = 0; i < n_caches; i++)
+    {
+        if(sort == SORT_GROWTH && caches[i].growth != caches[i].growth)
+            continue;
+        caches[i].key = sort == SORT_BYTES ? caches[i].bytes :
+            caches[i].growth;
+        n = heap_push(top, n, n_top, &caches[i]);
+    }
+    qsort(top, n, sizeof(slab_cache_t *), cmp_key);
+
+    if(verbose)
+    {
+        printf("Slab: %" PRIu64 " reclaimable: %" PRIu64
+                " unreclaimable: %" PRIu64 "\n", slab, reclaimable,
+                unreclaimable);
+        if(!slabinfo)
+            printf("%s is not readable\n", PROCFS_SLABINFO);
+        for(i = 0; i < n_caches; i++)
+            printf("  - %s: %" PRIu64 " bytes, %" PRIu64 " active, %f/h\n",
+                    caches[i].name, caches[i].bytes, caches[i].active,
+                    caches[i].growth);
+    }
+
+    /* comparisons with unset (NaN) thresholds and growth are false */
+    if(unreclaimable > w_bytes || unreclaimable_growth > w_growth)
+        rc = WARNING;
+    if(unreclaimable > c_bytes || unreclaimable_growth > c_growth)
+        rc = CRITICAL;
+
+    output_add("slab", "B", slab, OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add("reclaimable", "B", reclaimable, OUTPUT_UNSET, OUTPUT_UNSET,
+            0, slab);
+    output_add("unreclaimable", "B", unreclaimable, w_bytes, c_bytes, 0, slab);
+    if(hours > 0)
+        output_add("unreclaimable_growth", "", unreclaimable_growth,
+                w_growth, c_growth, OUTPUT_UNSET, OUTPUT_UNSET);
+    if(slabinfo)
+        output_add("caches", "", n_caches, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+                OUTPUT_UNSET);
+
+    format_size(size, sizeof(size), slab, 0);
+    format_size(unreclaimable_size, sizeof(unreclaimable_size),
+            unreclaimable, 0);
+    if(hours > 0)
+    {
+        format_size(growth, sizeof(growth), unreclaimable_growth, 1);
+        len = snprintf(message, sizeof(message),
+                "slab %s (unreclaimable %s, %s/h)", size, unreclaimable_size,
+                growth);
+    }
+    else
+        len = snprintf(message, sizeof(message),
+                "slab %s (unreclaimable %s, no baseline yet)", size,
+                unreclaimable_size);
+
+    for(j = 0; j < n; j++)
+    {
+        output_add_labeled("cache", top[j]->name, "bytes", "B", top[j]->bytes,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, OUTPUT_UNSET);
+        output_add_labeled("cache", top[j]->name, "active", "B",
+                top[j]->active, OUTPUT_UNSET, OUTPUT_UNSET, 0, top[j]->bytes);
+        if(top[j]->growth == top[j]->growth)
+            output_add_labeled("cache", top[j]->name, "growth", "",
+                    top[j]->growth, OUTPUT_UNSET, OUTPUT_UNSET, OUTPUT_UNSET,
+                    OUTPUT_UNSET);
+
+        format_size(size, sizeof(size), top[j]->bytes, 0);
+        suffix[0] = '\0';
+        if(top[j]->growth == top[j]->growth)
+        {
+            format_size(growth, sizeof(growth), top[j]->growth, 1);
+            snprintf(suffix, sizeof(suffix), " (%s/h)", growth);
+        }
+        if(len >= 0 && (size_t) len < sizeof(message))
+            len += snprintf(message + len, sizeof(message) - len,
+                    "%s%s %s%s", j ? ", " : ", top: ", top[j]->name, size,
+                    suffix);
+    }
+
+    if(!slabinfo && len >= 0 && (size_t) len < sizeof(message))
+        snprintf(message + len, sizeof(message) - len,
+                ", %s not readable", PROCFS_SLABINFO);
+
+    free(current.caches);
+    free(baseline.caches);
+    free(pending.caches);
+    free(caches);
+    free(slabinfo);
+
+    exit_with_message(rc, message);
+
+    return rc;
+}
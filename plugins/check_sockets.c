@@ -0,0 +1,740 @@
+/*
+ * filename: check_sockets.c
+ *
+ * Counts TCP sockets by state and UDP sockets, checks the accept queues of
+ * all TCP listeners and the rate of ListenOverflows and ListenDrops.
+ *
+ * The sockets are dumped with NETLINK_SOCK_DIAG instead of parsing
+ * /proc/net/tcp{,6}, which formats every socket as text while holding the
+ * locks of the hash tables, and takes seconds on load balancers with
+ * millions of sockets. The kernel only dumps the sockets in the requested
+ * states (idiag_states), so e.g. "-s listen" checks the accept queues
+ * without looking at any established or TIME_WAIT socket.
+ *
+ * For a listener idiag_rqueue is the number of connections in its accept
+ * queue and idiag_wqueue its backlog. ListenOverflows and ListenDrops are
+ * read from <procfs>/net/netstat; their values of the last run are kept in
+ * $TMPDIR/check_sockets.tmp. The sockets always are those of the network
+ * namespace of the plugin, regardless of the procfs root.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../include/cache.h"
+#include "../include/icinga.h"
+#include "../include/output.h"
+#include "../include/procfs.h"
+#include "../include/profile.h"
+
+#define VERSION "0.1"
+#define PROCFS_NETSTAT "net/netstat"
+#define BUFFER_LEN 1024
+
+#define STATE_FILE      "/check_sockets.tmp"
+#define STATE_MAGIC     0x31736b73      /* "sks1" */
+
+/* Size of the netlink receive buffer, a dump fills up to 32k per recv. */
+#define NL_BUFFER_LEN   65536
+
+/* Length of "[<ipv6 address>]:<port>" */
+#define LISTENER_LEN    (INET6_ADDRSTRLEN + 8)
+
+/* TCP states as in include/net/tcp_states.h. */
+#define TCP_STATES      13
+#define TCP_LISTEN      10
+#define TCP_TIME_WAIT   6
+#define TCP_SYN_RECV    3
+#define TCP_NEW_SYN_RECV 12
+#define TCPF(state)     (1U << (state))
+
+/*
+ * define error messages
+ */
+#define ESTATE      "unknown state, use e.g. established, time_wait or listen"
+#define ENETLINK    "could not dump the sockets with NETLINK_SOCK_DIAG"
+
+/*
+ * Names of the TCP states, as labels of the tcp_sockets metric and values
+ * of --state. Request sockets (NEW_SYN_RECV) are counted as syn_recv.
+ */
+static const char *tcp_states[TCP_STATES] = {
+    NULL, "established", "syn_sent", "syn_recv", "fin_wait1", "fin_wait2",
+    "time_wait", "close", "close_wait", "last_ack", "listen", "closing", NULL
+};
+
+/*
+ * Structure to hold an accept queue.
+ *
+ * Members:
+ *  - char     name[]:  "<address>:<port>" of the listener
+ *  - uint32_t queued:  connections waiting to be accepted
+ *  - uint32_t backlog: maximal length of the accept queue
+ */
+typedef struct listener
+{
+    char        name[LISTENER_LEN];
+    uint32_t    queued;
+    uint32_t    backlog;
+} listener_t;
+
+/*
+ * Structure to hold the result of the dumps.
+ */
+typedef struct sockets
+{
+    unsigned long   tcp[TCP_STATES];
+    unsigned long   udp;
+    listener_t     *listeners;
+    size_t          n_listeners,
+                    size;
+} sockets_t;
+
+/*
+ * State file: the ListenOverflows and ListenDrops counters of the last
+ * run.
+ *
+ * Members:
+ *  - uint32_t magic:     STATE_MAGIC
+ *  - uint32_t reserved:  padding
+ *  - int64_t  taken:     CLOCK_BOOTTIME nanoseconds
+ *  - uint64_t overflows: ListenOverflows
+ *  - uint64_t drops:     ListenDrops
+ */
+typedef struct netstat_state
+{
+    uint32_t    magic;
+    uint32_t    reserved;
+    int64_t     taken;
+    uint64_t    overflows;
+    uint64_t    drops;
+} netstat_state_t;
+
+static char fallback_tmpdir[] = "/tmp/";
+
+/*
+ * print_help:
+ *
+ * print help output to stdout
+ */
+static void print_help (const char *progname)
+{
+    printf("Usage:\n");
+    printf(" %s [options]\n", progname);
+    printf("\n");
+    printf("Options\n");
+    printf(" -s, --state\t\t\tcount only TCP sockets in this state, may be\n"
+           "\t\t\t\tgiven more than once (default: all states)\n");
+    printf(" -w, --warning\t\t\twarning threshold of the accept queue fill (%%)\n");
+    printf(" -c, --critical\t\t\tcritical threshold of the accept queue fill (%%)\n");
+    printf("     --warning-timewait\twarning threshold of TIME_WAIT sockets\n");
+    printf("     --critical-timewait\tcritical threshold of TIME_WAIT sockets\n");
+    printf("     --warning-overflows\twarning threshold of listen overflows per second\n");
+    printf("     --critical-overflows\tcritical threshold of listen overflows per second\n");
+    printf(" -v, --verbose\t\t\tverbose output\n");
+    printf(" -F, --format\t\t\toutput format: nagios (default), json or openmetrics\n");
+    printf("     --textfile\t\t\talso write OpenMetrics to this file (atomically)\n");
+    printf("     --profile\t\t\tappend timings of the plugin to the perfdata\n");
+    printf(" -P, --procfs-root\t\tprocfs root (default: $%s or %s)\n",
+            PROCFS_ROOT_ENV, PROCFS_DEFAULT_ROOT);
+    printf("     --cache-ttl\t\tshare results younger than this (seconds)\n"
+           "\t\t\t\twith invocations with the same arguments\n");
+    printf("\n");
+    printf(" -h, --help\t\t\tdisplay this help text\n");
+    printf(" -V, --version\t\t\toutput version information\n");
+}
+
+/*
+ * print_version:
+ *
+ * prints version information to stdout
+ */
+static void print_version()
+{
+    printf("check_sockets (%s)\n", VERSION);
+}
+
+/*
+ * exit_with_message:
+ *
+ * print a message to stdout and exit with return code rc
+ */
+static void exit_with_message(int rc, char *message)
+{
+    output_exit(rc, "%s", message);
+}
+
+/*
+ * get_tmpdir:
+ *
+ * returns TMPDIR or TMP from the environment, "/tmp/" if both are unset
+ */
+static char* get_tmpdir()
+{
+    char    *tmpdir;
+    tmpdir = getenv("TMPDIR");
+
+    if(NULL == tmpdir)
+        tmpdir = getenv("TMP");
+
+    if(NULL == tmpdir)
+        tmpdir = fallback_tmpdir;
+
+    return tmpdir;
+}
+
+/*
+ * parse_state:
+ *
+ * returns the TCP state named name or -1
+ */
+static int parse_state(const char *name)
+{
+    int     i;
+
+    for(i = 1; i < TCP_STATES; i++)
+        if(tcp_states[i] && 0 == strcmp(name, tcp_states[i]))
+            return i;
+
+    return -1;
+}
+
+/*
+ * add_listener:
+ *
+ * records the accept queue of a listener
+ */
+static void add_listener(sockets_t *sockets, const struct inet_diag_msg *msg)
+{
+    listener_t *l;
+    char        address[INET6_ADDRSTRLEN];
+
+    if(sockets->n_listeners == sockets->size)
+    {
+        sockets->size = sockets->size ? sockets->size * 2 : 16;
+        if(!(sockets->listeners = realloc(sockets->listeners,
+                        sockets->size * sizeof(listener_t))))
+            exit_with_message(UNKNOWN, "out of memory");
+    }
+    l = &sockets->listeners[sockets->n_listeners++];
+
+    inet_ntop(msg->idiag_family, msg->id.idiag_src, address, sizeof(address));
+    snprintf(l->name, sizeof(l->name), msg->idiag_family == AF_INET6 ?
+            "[%s]:%u" : "%s:%u", address, ntohs(msg->id.idiag_sport));
+    l->queued = msg->idiag_rqueue;
+    l->backlog = msg->idiag_wqueue;
+}
+
+/*
+ * dump_sockets:
+ *
+ * dumps the sockets of a family and protocol in the given states and
+ * counts them. Returns 0 on success, -1 with errno set otherwise.
+ */
+static int dump_sockets(int nl, int family, int protocol, uint32_t states,
+        sockets_t *sockets)
+{
+    static char                 buffer[NL_BUFFER_LEN]
+                                    __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct sockaddr_nl          kernel = { .nl_family = AF_NETLINK };
+    struct nlmsghdr            *nlh;
+    struct inet_diag_msg       *msg;
+    struct nlmsgerr            *err;
+    struct {
+        struct nlmsghdr             nlh;
+        struct inet_diag_req_v2     req;
+    }                           request;
+    ssize_t                     len;
+    int                         state;
+
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = sizeof(request);
+    request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.req.sdiag_family = family;
+    request.req.sdiag_protocol = protocol;
+    request.req.idiag_states = states;
+
+    if(sendto(nl, &request, sizeof(request), 0, (struct sockaddr *) &kernel,
+                sizeof(kernel)) < 0)
+        return -1;
+
+    for(;;)
+    {
+        len = recv(nl, buffer, sizeof(buffer), 0);
+        if(len < 0 && errno == EINTR)
+            continue;
+        if(len <= 0)
+            return -1;
+        PROFILE_COUNT(PROFILE_READS);
+
+        for(nlh = (struct nlmsghdr *) buffer; NLMSG_OK(nlh, len);
+                nlh = NLMSG_NEXT(nlh, len))
+        {
+            if(nlh->nlmsg_type == NLMSG_DONE)
+                return 0;
+            if(nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                err = NLMSG_DATA(nlh);
+                errno = err->error ? -err->error : EPROTO;
+                return -1;
+            }
+            if(nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+                continue;
+
+            msg = NLMSG_DATA(nlh);
+            if(protocol == IPPROTO_UDP)
+            {
+                sockets->udp++;
+                continue;
+            }
+
+            state = msg->idiag_state;
+            if(state == TCP_NEW_SYN_RECV)
+                state = TCP_SYN_RECV;
+            if(state > 0 && state < TCP_STATES)
+                sockets->tcp[state]++;
+            if(state == TCP_LISTEN)
+                add_listener(sockets, msg);
+        }
+    }
+}
+
+/*
+ * cmp_listener:
+ *
+ * orders listeners by name and the fullest queue first
+ */
+static int cmp_listener(const void *a, const void *b)
+{
+    const listener_t    *la = a,
+                        *lb = b;
+    int                  rc = strcmp(la->name, lb->name);
+    uint64_t             fill_a,
+                         fill_b;
+
+    if(rc)
+        return rc;
+
+    /* queued / backlog descending, without dividing */
+    fill_a = (uint64_t) la->queued * lb->backlog;
+    fill_b = (uint64_t) lb->queued * la->backlog;
+
+    return fill_a < fill_b ? 1 : fill_a > fill_b ? -1 : 0;
+}
+
+/*
+ * merge_listeners:
+ *
+ * sorts the listeners and keeps the fullest queue of listeners sharing an
+ * address with SO_REUSEPORT
+ */
+static void merge_listeners(sockets_t *sockets)
+{
+    size_t  i,
+            n = 0;
+
+    qsort(sockets->listeners, sockets->n_listeners, sizeof(listener_t),
+            cmp_listener);
+
+    for(i = 0; i < sockets->n_listeners; i++)
+        if(n == 0 || strcmp(sockets->listeners[n - 1].name,
+                    sockets->listeners[i].name))
+            sockets->listeners[n++] = sockets->listeners[i];
+
+    sockets->n_listeners = n;
+}
+
+/*
+ * read_netstat:
+ *
+ * reads ListenOverflows and ListenDrops from the TcpExt lines of netstat.
+ * Returns 1 if both were found, 0 otherwise.
+ */
+static int read_netstat(uint64_t *overflows, uint64_t *drops)
+{
+    char    path[BUFFER_LEN],
+           *buffer = NULL,
+           *names,
+           *values,
+           *name,
+           *value,
+           *save_names,
+           *save_values;
+    size_t  size = 0;
+    int     found = 0;
+
+    procfs_path(path, sizeof(path), PROCFS_NETSTAT);
+    PROFILE_COUNT(PROFILE_OPENS);
+    PROFILE_COUNT(PROFILE_READS);
+    if(procfs_read_file(path, &buffer, &size) < 0)
+    {
+        free(buffer);
+        return 0;
+    }
+
+    /* "TcpExt: <names>\nTcpExt: <values>\n" */
+    if((names = strstr(buffer, "TcpExt:")) &&
+            (values = strstr(names + 1, "TcpExt:")))
+    {
+        names[strcspn(names, "\n")] = '\0';
+        values[strcspn(values, "\n")] = '\0';
+
+        name = strtok_r(names, " ", &save_names);
+        value = strtok_r(values, " ", &save_values);
+        for(; name && value; name = strtok_r(NULL, " ", &save_names),
+                value = strtok_r(NULL, " ", &save_values))
+        {
+            if(0 == strcmp(name, "ListenOverflows"))
+            {
+                *overflows = strtoull(value, NULL, 10);
+                found |= 1;
+            }
+            if(0 == strcmp(name, "ListenDrops"))
+            {
+                *drops = strtoull(value, NULL, 10);
+                found |= 2;
+            }
+        }
+    }
+
+    free(buffer);
+
+    return found == 3;
+}
+
+/*
+ * read_state:
+ *
+ * reads the counters of the last run, returns 0 if there are none
+ */
+static int read_state(char *tmpdir, netstat_state_t *state)
+{
+    FILE    *state_file;
+    char     path[BUFFER_LEN];
+    int      rc;
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, STATE_FILE);
+
+    if(!(state_file = fopen(path, "r")))
+        return 0;
+
+    rc = 1 == fread(state, sizeof(*state), 1, state_file) &&
+        state->magic == STATE_MAGIC;
+
+    fclose(state_file);
+
+    return rc;
+}
+
+/*
+ * write_state:
+ *
+ * writes the counters of this run, the file is replaced atomically
+ */
+static void write_state(char *tmpdir, const netstat_state_t *state)
+{
+    FILE    *state_file;
+    char     path[BUFFER_LEN],
+             tmp_path[BUFFER_LEN + 32];
+
+    snprintf(path, sizeof(path), "%s%s", tmpdir, STATE_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path, (long) getpid());
+
+    if(!(state_file = fopen(tmp_path, "w")))
+        exit_with_message(UNKNOWN, "could not open the state file "
+                "for writing");
+
+    fwrite(state, sizeof(*state), 1, state_file);
+
+    if(0 != fclose(state_file) || 0 != rename(tmp_path, path))
+    {
+        unlink(tmp_path);
+        exit_with_message(UNKNOWN, "could not write the state file");
+    }
+}
+
+/*
+ * check_option_value:
+ *
+ * returns 1 if arg is one of the options taking a value
+ */
+static int check_option_value(const char *arg)
+{
+    return check_option(arg, "-s", "--state") ||
+        check_option(arg, "-w", "--warning") ||
+        check_option(arg, "-c", "--critical") ||
+        check_option(arg, "--warning-timewait", "--warning-timewait") ||
+        check_option(arg, "--critical-timewait", "--critical-timewait") ||
+        check_option(arg, "--warning-overflows", "--warning-overflows") ||
+        check_option(arg, "--critical-overflows", "--critical-overflows") ||
+        check_option(arg, "-P", "--procfs-root") ||
+        check_option(arg, "-F", "--format") ||
+        check_option(arg, "--textfile", "--textfile") ||
+        check_option(arg, "--cache-ttl", "--cache-ttl");
+}
+
+int PLUGIN_MAIN(check_sockets)(int argc, char *argv[])
+{
+    static const int families[] = { AF_INET, AF_INET6 };
+
+    sockets_t        sockets;
+    netstat_state_t  state = { STATE_MAGIC, 0, 0, 0, 0 },
+                     old_state;
+    const char      *progname,
+                    *arg;
+
+    char             err_message[BUFFER_LEN],
+                     message[BUFFER_LEN] = "",
+                    *tmpdir;
+
+    uint32_t         states = 0,
+                     dump_states;
+
+    size_t           i;
+
+    int              verbose = 0,
+                     has_netstat,
+                     has_rates = 0,
+                     nl,
+                     rc = OK,
+                     q_rc,
+                     len = 0,
+                     state_index,
+                     j;
+
+    double           cache_ttl = 0,
+                     seconds,
+                     fill,
+                     overflows = 0,
+                     drops = 0,
+                     max_fill = 0,
+                     w_fill = OUTPUT_UNSET,
+                     c_fill = OUTPUT_UNSET,
+                     w_timewait = OUTPUT_UNSET,
+                     c_timewait = OUTPUT_UNSET,
+                     w_overflows = OUTPUT_UNSET,
+                     c_overflows = OUTPUT_UNSET;
+
+    output_init("check_sockets");
+
+    memset(&sockets, 0, sizeof(sockets));
+    tmpdir = get_tmpdir();
+
+    /*
+     * parse the given arguments
+     */
+    if(argc > 0)
+    {
+        progname = argv[0];
+        for(j = 1; j < argc; j++)
+        {
+            arg = argv[j];
+
+            /*
+             * if we got a parameter without a value, complain about it
+             */
+            if(check_option_value(arg) && j + 1 >= argc)
+            {
+                snprintf(err_message, BUFFER_LEN,
+                        "you have to provide a value for %s", arg);
+                exit_with_message(UNKNOWN, err_message);
+            }
+
+            if(check_option(arg, "-s", "--state"))
+            {
+                if((state_index = parse_state(argv[++j])) < 0)
+                    exit_with_message(UNKNOWN, ESTATE);
+                states |= TCPF(state_index);
+            }
+            if(check_option(arg, "-w", "--warning"))
+                w_fill = atof(argv[++j]);
+            if(check_option(arg, "-c", "--critical"))
+                c_fill = atof(argv[++j]);
+            if(check_option(arg, "--warning-timewait", "--warning-timewait"))
+                w_timewait = atof(argv[++j]);
+            if(check_option(arg, "--critical-timewait", "--critical-timewait"))
+                c_timewait = atof(argv[++j]);
+            if(check_option(arg, "--warning-overflows", "--warning-overflows"))
+                w_overflows = atof(argv[++j]);
+            if(check_option(arg, "--critical-overflows",
+                        "--critical-overflows"))
+                c_overflows = atof(argv[++j]);
+            if(check_option(arg, "-P", "--procfs-root"))
+                procfs_set_root(argv[++j]);
+            if(check_option(arg, "-F", "--format") &&
+                    output_set_format(argv[++j]) != 0)
+                exit_with_message(UNKNOWN, EOUTPUTFORMAT);
+            if(check_option(arg, "--textfile", "--textfile"))
+                output_set_textfile(argv[++j]);
+            if(check_option(arg, "--cache-ttl", "--cache-ttl") &&
+                    (cache_ttl = atof(argv[++j])) <= 0)
+                exit_with_message(UNKNOWN, ECACHETTL);
+            if(check_option(arg, "-v", "--verbose"))
+                verbose = 1;
+            if(check_option(arg, "--profile", "--profile") && !profile_enable())
+                exit_with_message(UNKNOWN, ENOPROFILE);
+            if(check_option(arg, "-h", "--help"))
+            {
+                print_help(progname);
+                exit(OK);
+            }
+            if(check_option(arg, "-V", "--version"))
+            {
+                print_version();
+                exit(OK);
+            }
+        }
+    }
+
+    /* Without --state all states are counted. */
+    if(states == 0)
+        states = ~0U & ~TCPF(0);
+    if(states & TCPF(TCP_SYN_RECV))
+        states |= TCPF(TCP_NEW_SYN_RECV);
+
+    /* Listeners are always checked, TIME_WAIT if it has thresholds. */
+    dump_states = states | TCPF(TCP_LISTEN);
+    if(!isnan(w_timewait) || !isnan(c_timewait))
+        dump_states |= TCPF(TCP_TIME_WAIT);
+
+    if(verbose)
+    {
+        printf("Environment Variables used:\n");
+        printf("  - tmpdir: %s\n", tmpdir);
+        printf("  - procfs root: %s\n", procfs_root());
+        printf("Parameters:\n");
+        printf("  - states: 0x%x\n", dump_states);
+        printf("  - queue fill: warning %f critical %f\n", w_fill, c_fill);
+        printf("  - time_wait: warning %f critical %f\n", w_timewait,
+                c_timewait);
+        printf("  - overflows: warning %f critical %f\n", w_overflows,
+                c_overflows);
+    }
+
+    if(cache_ttl > 0)
+        cache_init("check_sockets", argc, argv, cache_ttl);
+
+    PROFILE_BEGIN("dump");
+    if((nl = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+                    NETLINK_SOCK_DIAG)) < 0)
+        exit_with_message(UNKNOWN, ENETLINK);
+
+    for(j = 0; j < 2; j++)
+    {
+        /* The kernel lacks IPv6 (or UDP) diag if the module is missing. */
+        if(dump_sockets(nl, families[j], IPPROTO_TCP, dump_states,
+                    &sockets) < 0 && !(j == 1 && errno == ENOENT))
+            exit_with_message(UNKNOWN, ENETLINK);
+        if(dump_sockets(nl, families[j], IPPROTO_UDP, ~0U, &sockets) < 0 &&
+                errno != ENOENT)
+            exit_with_message(UNKNOWN, ENETLINK);
+    }
+    close(nl);
+    merge_listeners(&sockets);
+    PROFILE_END("dump");
+
+    PROFILE_BEGIN("netstat");
+    has_netstat = read_netstat(&state.overflows, &state.drops);
+    state.taken = procfs_clock_ns();
+    if(has_netstat)
+    {
+        if(read_state(tmpdir, &old_state) &&
+                (seconds = (state.taken - old_state.taken) / 1e9) > 0 &&
+                state.overflows >= old_state.overflows &&
+                state.drops >= old_state.drops)
+        {
+            overflows = (state.overflows - old_state.overflows) / seconds;
+            drops = (state.drops - old_state.drops) / seconds;
+            has_rates = 1;
+        }
+        write_state(tmpdir, &state);
+    }
+    PROFILE_END("netstat");
+
+    for(j = 1; j < TCP_STATES; j++)
+        if(tcp_states[j] && (states & TCPF(j)))
+            output_add_labeled("state", tcp_states[j], "tcp_sockets", "",
+                    sockets.tcp[j], j == TCP_TIME_WAIT ? w_timewait :
+                    OUTPUT_UNSET, j == TCP_TIME_WAIT ? c_timewait :
+                    OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    output_add("udp_sockets", "", sockets.udp, OUTPUT_UNSET, OUTPUT_UNSET, 0,
+            OUTPUT_UNSET);
+
+    if(has_rates)
+    {
+        output_add("listen_overflows_per_second", "", overflows, w_overflows,
+                c_overflows, 0, OUTPUT_UNSET);
+        output_add("listen_drops_per_second", "", drops, OUTPUT_UNSET,
+                OUTPUT_UNSET, 0, OUTPUT_UNSET);
+    }
+
+    /* comparisons with unset (NaN) thresholds are false */
+    if(sockets.tcp[TCP_TIME_WAIT] > w_timewait || overflows > w_overflows)
+        rc = WARNING;
+    if(sockets.tcp[TCP_TIME_WAIT] > c_timewait || overflows > c_overflows)
+        rc = CRITICAL;
+    if(rc != OK)
+        len = snprintf(message, sizeof(message), "%lu time_wait, "
+                "%.2f overflows/s", sockets.tcp[TCP_TIME_WAIT], overflows);
+
+    for(i = 0; i < sockets.n_listeners; i++)
+    {
+        listener_t  *l = &sockets.listeners[i];
+
+        fill = l->backlog ? (double) l->queued / l->backlog * 100 : 0;
+        if(fill >= max_fill)
+            max_fill = fill;
+
+        output_add_labeled("listener", l->name, "accept_queue", "", l->queued,
+                OUTPUT_UNSET, OUTPUT_UNSET, 0, l->backlog);
+        output_add_labeled("listener", l->name, "accept_queue_fill", "%",
+                fill, w_fill, c_fill, 0, 100);
+
+        if(verbose)
+            printf("  - %s: %u/%u\n", l->name, l->queued, l->backlog);
+
+        q_rc = fill > c_fill ? CRITICAL : fill > w_fill ? WARNING : OK;
+        if(q_rc == OK)
+            continue;
+        if(q_rc > rc)
+            rc = q_rc;
+
+        /* name the listeners exceeding a threshold */
+        if(len >= 0 && (size_t) len < sizeof(message))
+            len += snprintf(message + len, sizeof(message) - len,
+                    "%s%s accept queue %u/%u", len ? ", " : "", l->name,
+                    l->queued, l->backlog);
+    }
+
+    if(rc == OK)
+    {
+        len = 0;
+        if(states & TCPF(1))
+            len += snprintf(message + len, sizeof(message) - len,
+                    "%lu established, ", sockets.tcp[1]);
+        if(dump_states & TCPF(TCP_TIME_WAIT))
+            len += snprintf(message + len, sizeof(message) - len,
+                    "%lu time_wait, ", sockets.tcp[TCP_TIME_WAIT]);
+        len += snprintf(message + len, sizeof(message) - len,
+                "%zu listeners (max fill %.2f%%), %lu udp",
+                sockets.n_listeners, max_fill, sockets.udp);
+        if(has_rates)
+            snprintf(message + len, sizeof(message) - len, ", %.2f listen "
+                    "overflows/s", overflows);
+    }
+
+    output_exit(rc, "%s", message);
+
+    /* suppress compiler warnings */
+    return rc;
+}
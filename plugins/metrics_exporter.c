@@ -0,0 +1,977 @@
+/*
+ * filename: metrics_exporter.c
+ *
+ * Small embedded exporter, which serves the measurements of the plugins at
+ * /metrics in OpenMetrics format, e.g. for Prometheus.
+ *
+ * Every collector is a plugin invocation, which is run with
+ * "--format openmetrics" in the background whenever its result is older than
+ * its TTL. Scrapes are always answered from the cached results, so bursts of
+ * scrapes cost no procfs reads at all and a slow collector never delays a
+ * scrape. All work is done by one thread with epoll: the listening socket
+ * (TCP or a Unix socket), the clients, the pipes of the running collectors
+ * and a timerfd driving the refreshes.
+ *
+ * Samples of all collectors are merged by metric family and labeled with
+ * collector="<name>", so the same plugin can be used by several collectors.
+ */
+
+/* accept4() and pipe2() */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/icinga.h"
+
+#define PROCNAME    "metrics_exporter"
+#define VERSION     "0.1"
+
+/* Defaults. */
+#define DEFAULT_LISTEN      "127.0.0.1:9773"
+#define DEFAULT_TTL         30
+#define DEFAULT_TIMEOUT     10
+
+/*
+ * check_nofiles_limits is no default, it needs the name of the processes
+ * to check and is added with -C.
+ */
+#define DEFAULT_COLLECTORS  { "check_meminfo", "check_procstat" }
+
+/* Seconds a client may take to send its request and read the response. */
+#define CLIENT_TIMEOUT      10
+
+/* Limits. */
+#define MAXBUF          512
+#define MAXCOLLECTORS   64
+#define MAXARGS         64
+#define MAXREQUEST      8192
+#define MAXOUTPUT       (16 * 1024 * 1024)
+#define MAXEVENTS       64
+
+/* Tags to tell the epoll events apart. */
+#define TAG_LISTEN      1
+#define TAG_TIMER       2
+#define TAG_COLLECTOR   3
+#define TAG_CLIENT      4
+
+/*
+ * Structure to hold a growing buffer.
+ */
+typedef struct buffer {
+    char           *data;
+    size_t          len;
+    size_t          size;
+} buffer_t;
+
+/*
+ * Structure to hold one collector.
+ *
+ * Members:
+ *  - char    *name:     value of the collector label
+ *  - char    *argv[]:   command line of the plugin
+ *  - int      ttl:      seconds a result is served before it is refreshed
+ *  - time_t   due:      when the next refresh is due (CLOCK_MONOTONIC)
+ *  - pid_t    pid:      pid of the running plugin, 0 if idle
+ *  - int      fd:       read end of the plugin's stdout while running
+ *  - double   started:  start of the running refresh
+ *  - buffer_t output:   output of the running refresh
+ *  - buffer_t result:   last complete output
+ *  - int      rc:       exit code of the last refresh
+ *  - double   duration: duration of the last refresh in seconds
+ */
+typedef struct collector {
+    int             tag;
+    char           *name;
+    char           *argv[MAXARGS];
+    int             ttl;
+    double          due;
+    pid_t           pid;
+    int             fd;
+    double          started;
+    buffer_t        output;
+    buffer_t        result;
+    int             rc;
+    double          duration;
+} collector_t;
+
+/*
+ * Structure to hold one client connection. All clients are linked, so the
+ * timer can close the ones which stay idle.
+ *
+ * Members:
+ *  - double accepted: when the connection was accepted (CLOCK_MONOTONIC)
+ */
+typedef struct client {
+    int             tag;
+    int             fd;
+    double          accepted;
+    char            request[MAXREQUEST];
+    size_t          request_len;
+    buffer_t        response;
+    size_t          sent;
+    struct client  *prev;
+    struct client  *next;
+} client_t;
+
+static int          tag_listen = TAG_LISTEN;
+static int          tag_timer = TAG_TIMER;
+
+static collector_t  collectors[MAXCOLLECTORS];
+static int          n_collectors = 0;
+static int          collector_timeout = DEFAULT_TIMEOUT;
+static int          epoll_fd = -1;
+static client_t    *clients = NULL;
+static buffer_t     metrics;
+static int          verbose = 0;
+
+/*
+ * print_help:
+ *
+ * print help output to stdout
+ */
+static void print_help(const char *progname)
+{
+    printf("Usage: %s [options] [-C [name=]ttl:plugin [args...]] ...\n"
+           "\n"
+           "Options\n"
+           " -l, --listen\t\taddress:port to listen on (default: %s)\n"
+           " -u, --unix\t\tlisten on this Unix socket instead\n"
+           " -C, --collector\tcollector, e.g. \"nginx=60:check_nofiles_limits -n nginx\"\n"
+           " -t, --ttl\t\tdefault TTL of the collectors in seconds (default: %d)\n"
+           " -T, --timeout\t\tkill collectors running longer (default: %d s)\n"
+           " -d, --plugindir\tdirectory of the plugins (default: our own)\n"
+           " -v, --verbose\t\tlog refreshes to stderr\n"
+           "\n"
+           " -h, --help\t\tdisplay this help text\n"
+           " -V, --version\t\toutput version information\n"
+           "\n"
+           "Without -C check_meminfo and check_procstat are collected.\n"
+           "check_nofiles_limits needs the processes to check (-n or -e),\n"
+           "add it with -C like above.\n",
+           progname, DEFAULT_LISTEN, DEFAULT_TTL, DEFAULT_TIMEOUT);
+}
+
+/*
+ * die:
+ *
+ * print an error message to stderr and exit with UNKNOWN
+ */
+static void die(const char *what)
+{
+    fprintf(stderr, "%s: %s: %s\n", PROCNAME, what,
+            errno ? strerror(errno) : "invalid");
+    exit(UNKNOWN);
+}
+
+/*
+ * now:
+ *
+ * returns the seconds of CLOCK_MONOTONIC
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * buffer_append:
+ *
+ * appends len bytes of data to buffer, growing it as needed
+ */
+static int buffer_append(buffer_t *buffer, const char *data, size_t len)
+{
+    if(buffer->len + len + 1 > buffer->size)
+    {
+        size_t  size = buffer->size ? buffer->size : 4096;
+        char   *grown;
+
+        while(size < buffer->len + len + 1)
+            size *= 2;
+        if(size > MAXOUTPUT || !(grown = realloc(buffer->data, size)))
+            return -1;
+        buffer->data = grown;
+        buffer->size = size;
+    }
+
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = '\0';
+
+    return 0;
+}
+
+static void buffer_printf(buffer_t *buffer, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void buffer_printf(buffer_t *buffer, const char *format, ...)
+{
+    char        line[MAXBUF * 4];
+    va_list     ap;
+    int         len;
+
+    va_start(ap, format);
+    len = vsnprintf(line, sizeof(line), format, ap);
+    va_end(ap);
+
+    if(len > 0)
+        buffer_append(buffer, line, (size_t) len < sizeof(line) ?
+                (size_t) len : sizeof(line) - 1);
+}
+
+/*
+ * add_collector:
+ *
+ * parses "[name=]ttl:plugin [args...]" and adds the collector. Plugins
+ * without a path are taken from plugindir.
+ */
+static void add_collector(const char *spec, const char *plugindir)
+{
+    collector_t    *c;
+    char           *copy,
+                   *command,
+                   *colon,
+                   *space,
+                   *equal,
+                   *token,
+                    path[PATH_MAX];
+    int             argc = 0,
+                    i;
+
+    if(n_collectors >= MAXCOLLECTORS)
+    {
+        errno = 0;
+        die("too many collectors");
+    }
+
+    c = &collectors[n_collectors];
+    c->tag = TAG_COLLECTOR;
+    c->ttl = DEFAULT_TTL;
+    c->fd = -1;
+    c->rc = UNKNOWN;
+
+    copy = strdup(spec);
+    command = copy;
+
+    /* Optional name and TTL. */
+    colon = strchr(command, ':');
+    space = strpbrk(command, " \t");
+    if(colon && (!space || colon < space))
+    {
+        *colon = '\0';
+        if((equal = strchr(command, '=')))
+        {
+            *equal = '\0';
+            c->name = strdup(command);
+            c->ttl = atoi(equal + 1);
+        }
+        else
+            c->ttl = atoi(command);
+        command = colon + 1;
+    }
+
+    for(token = strtok(command, " \t"); token && argc < MAXARGS - 3;
+            token = strtok(NULL, " \t"))
+    {
+        if(argc == 0 && !strchr(token, '/'))
+        {
+            snprintf(path, sizeof(path), "%s/%s", plugindir, token);
+            c->argv[argc++] = strdup(path);
+        }
+        else
+            c->argv[argc++] = strdup(token);
+    }
+
+    if(argc == 0 || c->ttl <= 0)
+    {
+        errno = 0;
+        die(spec);
+    }
+
+    c->argv[argc++] = "--format";
+    c->argv[argc++] = "openmetrics";
+    c->argv[argc] = NULL;
+
+    if(!c->name)
+        c->name = strdup(basename(c->argv[0]));
+
+    /* Collector names have to be unique, so number duplicates. */
+    for(i = 0; i < n_collectors; i++)
+    {
+        if(0 == strcmp(collectors[i].name, c->name))
+        {
+            snprintf(path, sizeof(path), "%s_%d", c->name, n_collectors);
+            free(c->name);
+            c->name = strdup(path);
+            break;
+        }
+    }
+
+    free(copy);
+    n_collectors++;
+}
+
+/*
+ * start_collector:
+ *
+ * runs the plugin of collector c in the background, its stdout is read from
+ * a pipe registered in epoll
+ */
+static void start_collector(collector_t *c)
+{
+    struct epoll_event  event;
+    int                 pipe_fds[2],
+                        devnull;
+
+    if(pipe2(pipe_fds, O_CLOEXEC) < 0)
+        return;
+
+    c->started = now();
+    c->output.len = 0;
+    c->pid = fork();
+
+    if(c->pid < 0)
+    {
+        c->pid = 0;
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return;
+    }
+
+    if(c->pid == 0)
+    {
+        /* Don't outlive the exporter. */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        devnull = open("/dev/null", O_RDONLY);
+        dup2(devnull, STDIN_FILENO);
+        dup2(pipe_fds[1], STDOUT_FILENO);
+        execv(c->argv[0], c->argv);
+        _exit(127);
+    }
+
+    close(pipe_fds[1]);
+    c->fd = pipe_fds[0];
+    fcntl(c->fd, F_SETFL, O_NONBLOCK);
+
+    event.events = EPOLLIN;
+    event.data.ptr = c;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &event);
+}
+
+/*
+ * family_of:
+ *
+ * returns the length of the metric name at the beginning of line
+ */
+static size_t family_of(const char *line)
+{
+    return strcspn(line, "{ \n");
+}
+
+/*
+ * render_metrics:
+ *
+ * rebuilds the /metrics response from the last results of all collectors.
+ * Samples are grouped by their family, which is announced once, and every
+ * sample gets a collector label.
+ */
+static void render_metrics(void)
+{
+    char   *line,
+           *end,
+           *type,
+           *other,
+           *other_end,
+           *other_type;
+    size_t  len;
+    int     i,
+            j,
+            seen;
+
+    metrics.len = 0;
+    buffer_append(&metrics, "", 0);
+
+    for(i = 0; i < n_collectors; i++)
+    {
+        for(type = collectors[i].result.data; type && *type; type = end)
+        {
+            end = strchr(type, '\n');
+            end = end ? end + 1 : type + strlen(type);
+
+            if(0 != strncmp(type, "# TYPE ", 7))
+                continue;
+
+            /* Was the family already announced by a former collector? */
+            len = family_of(type + 7);
+            seen = 0;
+            for(j = 0; j < i && !seen; j++)
+            {
+                for(other_type = collectors[j].result.data;
+                        other_type && *other_type && !seen;
+                        other_type = other_end)
+                {
+                    other_end = strchr(other_type, '\n');
+                    other_end = other_end ? other_end + 1 :
+                        other_type + strlen(other_type);
+                    seen = (0 == strncmp(other_type, type, 7 + len) &&
+                            family_of(other_type + 7) == len);
+                }
+            }
+            if(seen)
+                continue;
+
+            buffer_append(&metrics, type, end - type);
+
+            /* Print the samples of this family from all collectors. */
+            for(j = i; j < n_collectors; j++)
+            {
+                int     in_family = 0;
+
+                for(line = collectors[j].result.data; line && *line;
+                        line = other)
+                {
+                    other = strchr(line, '\n');
+                    other = other ? other + 1 : line + strlen(line);
+
+                    if(0 == strncmp(line, "# TYPE ", 7))
+                    {
+                        in_family = (family_of(line + 7) == len &&
+                                0 == strncmp(line + 7, type + 7, len));
+                        continue;
+                    }
+                    if(line[0] == '#' || !in_family)
+                        continue;
+
+                    /* Insert the collector label. */
+                    len = family_of(line);
+                    buffer_append(&metrics, line, len);
+                    buffer_printf(&metrics, "{collector=\"%s\"%s",
+                            collectors[j].name,
+                            line[len] == '{' ? "," : "}");
+                    if(line[len] == '{')
+                        len++;
+                    buffer_append(&metrics, line + len, other - line - len);
+                    len = family_of(type + 7);
+                }
+            }
+        }
+    }
+
+    /* Our own metrics about the collectors. */
+    buffer_printf(&metrics, "# TYPE %s_collector_rc gauge\n", PROCNAME);
+    for(i = 0; i < n_collectors; i++)
+        buffer_printf(&metrics, "%s_collector_rc{collector=\"%s\"} %d\n",
+                PROCNAME, collectors[i].name, collectors[i].rc);
+    buffer_printf(&metrics, "# TYPE %s_collector_duration_seconds gauge\n",
+            PROCNAME);
+    for(i = 0; i < n_collectors; i++)
+        buffer_printf(&metrics,
+                "%s_collector_duration_seconds{collector=\"%s\"} %.6f\n",
+                PROCNAME, collectors[i].name, collectors[i].duration);
+    buffer_printf(&metrics, "# EOF\n");
+}
+
+/*
+ * finish_collector:
+ *
+ * reads the output of a running collector and, once it closed its stdout,
+ * reaps it and publishes the result
+ */
+static void finish_collector(collector_t *c)
+{
+    char        chunk[MAXBUF * 8];
+    ssize_t     n;
+    int         status = 0;
+
+    while((n = read(c->fd, chunk, sizeof(chunk))) > 0)
+        buffer_append(&c->output, chunk, n);
+
+    if(n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+
+    waitpid(c->pid, &status, 0);
+    c->pid = 0;
+    c->duration = now() - c->started;
+    c->due = c->started + c->ttl;
+    c->rc = WIFEXITED(status) ? WEXITSTATUS(status) : UNKNOWN;
+
+    /*
+     * Only publish OpenMetrics. A plugin which failed before it could
+     * render its output, e.g. on wrong arguments, keeps its last result.
+     */
+    if(c->output.len >= 6 &&
+            0 == strcmp(c->output.data + c->output.len - 6, "# EOF\n"))
+    {
+        buffer_t    tmp = c->result;
+
+        c->result = c->output;
+        c->output = tmp;
+    }
+    else if(c->output.len)
+        fprintf(stderr, "%s: %s: %s", PROCNAME, c->name, c->output.data);
+
+    if(verbose)
+        fprintf(stderr, "%s: refreshed %s in %.3f s, rc %d\n", PROCNAME,
+                c->name, c->duration, c->rc);
+
+    render_metrics();
+}
+
+/*
+ * refresh_collectors:
+ *
+ * starts all collectors whose results expired and kills collectors running
+ * longer than the timeout
+ */
+static void refresh_collectors(void)
+{
+    double  t = now();
+    int     i;
+
+    for(i = 0; i < n_collectors; i++)
+    {
+        collector_t    *c = &collectors[i];
+
+        if(c->pid && t - c->started > collector_timeout)
+            kill(c->pid, SIGKILL);
+        else if(!c->pid && t >= c->due)
+            start_collector(c);
+    }
+}
+
+/*
+ * close_client:
+ */
+static void close_client(client_t *client)
+{
+    if(client->prev)
+        client->prev->next = client->next;
+    else
+        clients = client->next;
+    if(client->next)
+        client->next->prev = client->prev;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    free(client->response.data);
+    free(client);
+}
+
+/*
+ * write_client:
+ *
+ * sends as much of the response as possible, closes the connection once
+ * everything was sent
+ */
+static void write_client(client_t *client)
+{
+    struct epoll_event  event;
+    ssize_t             n;
+
+    while(client->sent < client->response.len)
+    {
+        n = write(client->fd, client->response.data + client->sent,
+                client->response.len - client->sent);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && errno == EAGAIN)
+        {
+            event.events = EPOLLOUT;
+            event.data.ptr = client;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+            return;
+        }
+        if(n <= 0)
+            break;
+        client->sent += n;
+    }
+
+    close_client(client);
+}
+
+/*
+ * read_client:
+ *
+ * reads the request of a client and answers it, once it is complete
+ */
+static void read_client(client_t *client)
+{
+    const char *status = "200 OK",
+               *content_type =
+                   "application/openmetrics-text; version=1.0.0; charset=utf-8",
+               *body = metrics.data;
+    ssize_t     n;
+
+    n = read(client->fd, client->request + client->request_len,
+            sizeof(client->request) - client->request_len - 1);
+    if(n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if(n <= 0)
+    {
+        close_client(client);
+        return;
+    }
+    client->request_len += n;
+    client->request[client->request_len] = '\0';
+
+    if(!strstr(client->request, "\r\n\r\n") &&
+            !strstr(client->request, "\n\n"))
+    {
+        if(client->request_len >= sizeof(client->request) - 1)
+            close_client(client);
+        return;
+    }
+
+    if(0 != strncmp(client->request, "GET ", 4) &&
+            0 != strncmp(client->request, "HEAD ", 5))
+    {
+        status = "405 Method Not Allowed";
+        content_type = "text/plain";
+        body = "method not allowed\n";
+    }
+    else if(0 != strncmp(strchr(client->request, ' ') + 1, "/metrics", 8) ||
+            !strchr(" ?", strchr(client->request, ' ')[9]))
+    {
+        status = "404 Not Found";
+        content_type = "text/plain";
+        body = "try /metrics\n";
+    }
+
+    buffer_printf(&client->response,
+            "HTTP/1.1 %s\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %zu\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            status, content_type, strlen(body));
+    if(0 != strncmp(client->request, "HEAD ", 5))
+        buffer_append(&client->response, body, strlen(body));
+
+    write_client(client);
+}
+
+/*
+ * accept_clients:
+ */
+static void accept_clients(int listen_fd)
+{
+    struct epoll_event  event;
+    client_t           *client;
+    int                 fd;
+
+    while((fd = accept4(listen_fd, NULL, NULL,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        if(!(client = calloc(1, sizeof(client_t))))
+        {
+            close(fd);
+            continue;
+        }
+        client->tag = TAG_CLIENT;
+        client->fd = fd;
+        client->accepted = now();
+        client->next = clients;
+        if(clients)
+            clients->prev = client;
+        clients = client;
+
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+/*
+ * expire_clients:
+ *
+ * closes the clients which didn't send a request or read the response
+ * within CLIENT_TIMEOUT, so idle connections can't use up the open files
+ */
+static void expire_clients(void)
+{
+    client_t   *client,
+               *next;
+    double      t = now();
+
+    for(client = clients; client; client = next)
+    {
+        next = client->next;
+        if(t - client->accepted > CLIENT_TIMEOUT)
+        {
+            if(verbose)
+                fprintf(stderr, "%s: closing idle client\n", PROCNAME);
+            close_client(client);
+        }
+    }
+}
+
+/*
+ * open_listener:
+ *
+ * creates the listening socket, on a Unix socket if unix_path is given,
+ * otherwise on address:port. With -v the bound address is logged, which
+ * tells the port chosen for port 0.
+ */
+static int open_listener(const char *address, const char *unix_path)
+{
+    struct addrinfo         hints,
+                           *result;
+    struct sockaddr_un      sun;
+    struct sockaddr_storage bound;
+    socklen_t               bound_len = sizeof(bound);
+    char                    host[MAXBUF],
+                            service[32],
+                           *port;
+    int                     fd,
+                            on = 1;
+
+    if(unix_path)
+    {
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if(strlen(unix_path) >= sizeof(sun.sun_path))
+        {
+            errno = ENAMETOOLONG;
+            die(unix_path);
+        }
+        strcpy(sun.sun_path, unix_path);
+        unlink(unix_path);
+
+        if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                        0)) < 0 ||
+                bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0 ||
+                listen(fd, SOMAXCONN) < 0)
+            die(unix_path);
+
+        return fd;
+    }
+
+    /* Split address:port, the host may be a bracketed IPv6 address. */
+    snprintf(host, sizeof(host), "%s", address);
+    if(!(port = strrchr(host, ':')))
+    {
+        errno = 0;
+        die(address);
+    }
+    *port++ = '\0';
+    if(host[0] == '[' && host[strlen(host) - 1] == ']')
+    {
+        memmove(host, host + 1, strlen(host));
+        host[strlen(host) - 1] = '\0';
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if(getaddrinfo(host[0] ? host : NULL, port, &hints, &result) != 0)
+    {
+        errno = 0;
+        die(address);
+    }
+
+    if((fd = socket(result->ai_family,
+                    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+        die(address);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(bind(fd, result->ai_addr, result->ai_addrlen) < 0 ||
+            listen(fd, SOMAXCONN) < 0)
+        die(address);
+
+    freeaddrinfo(result);
+
+    if(verbose && 0 == getsockname(fd, (struct sockaddr *) &bound,
+                &bound_len) &&
+            0 == getnameinfo((struct sockaddr *) &bound, bound_len, host,
+                sizeof(host), service, sizeof(service),
+                NI_NUMERICHOST | NI_NUMERICSERV))
+        fprintf(stderr, bound.ss_family == AF_INET6 ?
+                "%s: listening on [%s]:%s\n" : "%s: listening on %s:%s\n",
+                PROCNAME, host, service);
+
+    return fd;
+}
+
+int PLUGIN_MAIN(metrics_exporter)(int argc, char *argv[])
+{
+    struct epoll_event  event,
+                        events[MAXEVENTS];
+    struct itimerspec   tick = { { 1, 0 }, { 0, 1 } };
+    const char         *address = DEFAULT_LISTEN,
+                       *unix_path = NULL,
+                       *defaults[] = DEFAULT_COLLECTORS,
+                       *specs[MAXCOLLECTORS];
+    char                plugindir[PATH_MAX],
+                        spec[MAXBUF];
+    ssize_t             len;
+    int                 listen_fd,
+                        timer_fd,
+                        default_ttl = DEFAULT_TTL,
+                        n_specs = 0,
+                        expire,
+                        n,
+                        i;
+
+    /* The plugins are installed next to us. */
+    len = readlink("/proc/self/exe", spec, sizeof(spec) - 1);
+    spec[len > 0 ? len : 0] = '\0';
+    snprintf(plugindir, sizeof(plugindir), "%s", len > 0 ? dirname(spec) : ".");
+
+    for(i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+
+        if(check_option(option, "-h", "--help"))
+        {
+            print_help(argv[0]);
+            exit(OK);
+        }
+        else if(check_option(option, "-V", "--version"))
+        {
+            printf("%s (%s)\n", PROCNAME, VERSION);
+            exit(OK);
+        }
+        else if(check_option(option, "-v", "--verbose"))
+            verbose = 1;
+        else if(i + 1 >= argc)
+        {
+            fprintf(stderr, "%s: you have to provide a value for %s\n",
+                    PROCNAME, option);
+            exit(UNKNOWN);
+        }
+        else if(check_option(option, "-l", "--listen"))
+            address = argv[++i];
+        else if(check_option(option, "-u", "--unix"))
+            unix_path = argv[++i];
+        else if(check_option(option, "-t", "--ttl"))
+            default_ttl = atoi(argv[++i]);
+        else if(check_option(option, "-T", "--timeout"))
+            collector_timeout = atoi(argv[++i]);
+        else if(check_option(option, "-d", "--plugindir"))
+            snprintf(plugindir, sizeof(plugindir), "%s", argv[++i]);
+        else if(check_option(option, "-C", "--collector") &&
+                n_specs < MAXCOLLECTORS)
+            specs[n_specs++] = argv[++i];
+        else
+        {
+            fprintf(stderr, "%s: unknown option %s\n", PROCNAME, option);
+            exit(UNKNOWN);
+        }
+    }
+
+    if(default_ttl <= 0 || collector_timeout <= 0)
+    {
+        fprintf(stderr, "%s: TTL and timeout must be positive\n", PROCNAME);
+        exit(UNKNOWN);
+    }
+
+    /* Collectors without a TTL get the default one. */
+    if(n_specs == 0)
+        for(n_specs = 0; n_specs < (int) (sizeof(defaults) / sizeof(*defaults));
+                n_specs++)
+            specs[n_specs] = defaults[n_specs];
+    for(i = 0; i < n_specs; i++)
+    {
+        const char *colon = strchr(specs[i], ':'),
+                   *space = strpbrk(specs[i], " \t");
+
+        if(colon && (!space || colon < space))
+            add_collector(specs[i], plugindir);
+        else
+        {
+            snprintf(spec, sizeof(spec), "%d:%s", default_ttl, specs[i]);
+            add_collector(spec, plugindir);
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        die("epoll_create1");
+
+    listen_fd = open_listener(address, unix_path);
+    event.events = EPOLLIN;
+    event.data.ptr = &tag_listen;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+    if((timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                    TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+            timerfd_settime(timer_fd, 0, &tick, NULL) < 0)
+        die("timerfd");
+    event.events = EPOLLIN;
+    event.data.ptr = &tag_timer;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+
+    render_metrics();
+
+    for(;;)
+    {
+        n = epoll_wait(epoll_fd, events, MAXEVENTS, -1);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            die("epoll_wait");
+
+        /* clients are expired after the batch, which may still use them */
+        for(expire = 0, i = 0; i < n; i++)
+        {
+            int    *tag = events[i].data.ptr;
+
+            switch(*tag)
+            {
+                case TAG_LISTEN:
+                    accept_clients(listen_fd);
+                    break;
+                case TAG_TIMER:
+                {
+                    unsigned long long  expirations;
+
+                    if(read(timer_fd, &expirations, sizeof(expirations)) < 0)
+                        break;
+                    refresh_collectors();
+                    expire = 1;
+                    break;
+                }
+                case TAG_COLLECTOR:
+                    finish_collector((collector_t *) tag);
+                    break;
+                case TAG_CLIENT:
+                    if(events[i].events & EPOLLOUT)
+                        write_client((client_t *) tag);
+                    else
+                        read_client((client_t *) tag);
+                    break;
+            }
+        }
+
+        if(expire)
+            expire_clients();
+    }
+
+    return UNKNOWN;
+}
@@ -0,0 +1,110 @@
+/*
+ * filename: multicall.c
+ *
+ * Busybox style multi-call binary. All plugins are linked into this single
+ * executable, which is installed once and symlinked to the names of the
+ * plugins. The plugin to run is chosen by the name we were invoked with
+ * (argv[0]), or by the first argument if we are called as MULTICALL_NAME
+ * directly, e.g. "monitoring-plugins check_meminfo -w 1024".
+ */
+
+#include <libgen.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/icinga.h"
+
+/*
+ * Entry points of all plugins, see PLUGIN_MAIN() in icinga.h.
+ */
+int check_diskstats_main(int argc, char **argv);
+int check_dstate_main(int argc, char **argv);
+int check_interrupts_main(int argc, char **argv);
+int check_meminfo_main(int argc, char **argv);
+int check_netdev_main(int argc, char **argv);
+int check_nofiles_limits_main(int argc, char **argv);
+int check_procmem_main(int argc, char **argv);
+int check_procstat_main(int argc, char **argv);
+int check_schedstat_main(int argc, char **argv);
+int check_slabinfo_main(int argc, char **argv);
+int check_sockets_main(int argc, char **argv);
+int metrics_exporter_main(int argc, char **argv);
+
+/*
+ * Structure to map a plugin name to its entry point.
+ */
+typedef struct applet {
+    const char    *name;
+    int          (*main)(int argc, char **argv);
+} applet_t;
+
+static const applet_t applets[] = {
+    { "check_diskstats",        check_diskstats_main },
+    { "check_dstate",           check_dstate_main },
+    { "check_interrupts",       check_interrupts_main },
+    { "check_meminfo",          check_meminfo_main },
+    { "check_netdev",           check_netdev_main },
+    { "check_nofiles_limits",   check_nofiles_limits_main },
+    { "check_procmem",          check_procmem_main },
+    { "check_procstat",         check_procstat_main },
+    { "check_schedstat",        check_schedstat_main },
+    { "check_slabinfo",         check_slabinfo_main },
+    { "check_sockets",          check_sockets_main },
+    { "metrics_exporter",       metrics_exporter_main },
+    { NULL,                     NULL }
+};
+
+/*
+ * print_applets:
+ *
+ * print usage and a list of all plugins linked into this binary to stdout
+ */
+static void print_applets(void)
+{
+    const applet_t  *applet;
+
+    printf("Usage: %s <plugin> [options]\n", MULTICALL_NAME);
+    printf("   or: <plugin> [options]\n");
+    printf("\n");
+    printf("Plugins:\n");
+    for(applet = applets; applet->name; applet++)
+        printf("  %s\n", applet->name);
+}
+
+int main(int argc, char **argv)
+{
+    const applet_t  *applet;
+    char            *name;
+
+    if(argc < 1)
+        return UNKNOWN;
+
+    name = basename(argv[0]);
+
+    /*
+     * Called by our own name, the plugin is the first argument.
+     */
+    if(0 == strcmp(name, MULTICALL_NAME))
+    {
+        if(argc < 2 || check_option(argv[1], "-h", "--help"))
+        {
+            print_applets();
+            return (argc < 2) ? UNKNOWN : OK;
+        }
+
+        argc--;
+        argv++;
+        name = basename(argv[0]);
+    }
+
+    for(applet = applets; applet->name; applet++)
+    {
+        if(0 == strcmp(name, applet->name))
+            return applet->main(argc, argv);
+    }
+
+    printf("%s - %s: unknown plugin \"%s\"\n", state[UNKNOWN],
+            MULTICALL_NAME, name);
+
+    return UNKNOWN;
+}
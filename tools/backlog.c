@@ -0,0 +1,77 @@
+/*
+ * filename: backlog.c
+ *
+ * Opens a TCP listener on a free port of 127.0.0.1 and connects as many
+ * clients to it as its backlog allows without ever accepting them, so its
+ * accept queue is full. Prints the address of the listener and waits until
+ * it is killed. It is used by loopback.sh to test check_sockets and is not
+ * installed.
+ *
+ * Usage: backlog [-n backlog]
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DEFAULT_BACKLOG 4
+#define MAXBACKLOG      128
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_in  address;
+    socklen_t           address_len = sizeof(address);
+    int                 backlog = DEFAULT_BACKLOG,
+                        listener,
+                        client,
+                        i;
+
+    if(argc == 3 && 0 == strcmp(argv[1], "-n"))
+        backlog = atoi(argv[2]);
+    else if(argc != 1)
+        backlog = 0;
+    if(backlog < 1 || backlog > MAXBACKLOG)
+    {
+        fprintf(stderr, "Usage: %s [-n backlog], at most %d\n", argv[0],
+                MAXBACKLOG);
+        return 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if((listener = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+            bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+            listen(listener, backlog) < 0 ||
+            getsockname(listener, (struct sockaddr *) &address,
+                &address_len) < 0)
+    {
+        perror("listener");
+        return 1;
+    }
+
+    /* The handshake of a loopback connection is done when connect returns. */
+    for(i = 0; i < backlog; i++)
+    {
+        if((client = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+                connect(client, (struct sockaddr *) &address,
+                    sizeof(address)) < 0)
+        {
+            perror("connect");
+            return 1;
+        }
+    }
+
+    printf("127.0.0.1:%u\n", ntohs(address.sin_port));
+    fflush(stdout);
+
+    for(;;)
+        pause();
+
+    return 0;
+}
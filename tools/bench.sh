@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# bench.sh - benchmark the plugins against synthetic procfs trees
+#
+# Generates procfs trees with tools/mkprocfs and runs every plugin against
+# them with tools/bench_exec, which reports latency percentiles, peak RSS
+# and the number of system calls of one run.
+#
+# The trees are generated in $BENCH_WORKDIR (default: a temporary directory
+# which is removed afterwards). Set $BENCH_WORKDIR to keep and reuse them.
+#
+# Usage: bench.sh [-n iterations] [-l] <plugin dir>
+#   -l  additionally run the large cases (100k processes, 1M fds)
+
+TOOLS=$(dirname "$0")
+BENCH_EXEC=${BENCH_EXEC:-$TOOLS/bench_exec}
+MKPROCFS=${MKPROCFS:-$TOOLS/mkprocfs}
+ITERATIONS=50
+LARGE=no
+
+while [ $# -gt 1 ]; do
+    case "$1" in
+        -n) ITERATIONS=$2; shift 2 ;;
+        -l) LARGE=yes; shift ;;
+        *) break ;;
+    esac
+done
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 [-n iterations] [-l] <plugin dir>" >&2
+    exit 1
+fi
+PLUGINDIR=$1
+
+# name:processes:fds per process:cpus:disks:interfaces
+CASES="small:1000:16:4:8:16 medium:10000:64:64:128:1000"
+if [ "$LARGE" = yes ]; then
+    CASES="$CASES 100k-pids:100000:4:256:512:5000 1m-fds:1000:1000:256:512:5000"
+fi
+
+if [ -n "$BENCH_WORKDIR" ]; then
+    WORKDIR=$BENCH_WORKDIR
+    mkdir -p "$WORKDIR" || exit 1
+else
+    WORKDIR=$(mktemp -d) || exit 1
+    trap 'rm -rf "$WORKDIR"' EXIT
+fi
+
+# run <label> <plugin> [args...]
+run() {
+    label=$1
+    shift
+    "$BENCH_EXEC" -s -n "$ITERATIONS" -l "$label" "$PLUGINDIR/$@" || exit 1
+}
+
+for case in $CASES; do
+    IFS=: read -r name procs fds cpus disks ifaces <<EOF_CASE
+$case
+EOF_CASE
+    root=$WORKDIR/$name
+    if [ ! -d "$root" ]; then
+        echo "generating $name: $procs processes, $fds fds each, $cpus cpus," \
+            "$disks disks, $ifaces interfaces"
+        "$MKPROCFS" -o "$root" -p "$procs" -f "$fds" -c "$cpus" -d "$disks" \
+            -i "$ifaces" || exit 1
+    fi
+
+    # check_procstat, check_schedstat, check_diskstats, check_netdev,
+    # check_interrupts, check_slabinfo, check_dstate and check_meminfo
+    # --fragmentation keep their state in $TMPDIR.
+    mkdir -p "$WORKDIR/tmp-$name"
+    export PROCFS_ROOT="$root" TMPDIR="$WORKDIR/tmp-$name"
+
+    run "$name check_meminfo" check_meminfo
+    run "$name check_meminfo --fragmentation" check_meminfo --fragmentation \
+        --pagetypeinfo
+    run "$name check_slabinfo" check_slabinfo
+    run "$name check_slabinfo -s growth" check_slabinfo -s growth -t 10
+    run "$name check_procstat" check_procstat
+    run "$name check_procstat --top" check_procstat --top 10
+    run "$name check_procstat --top --threads 4" check_procstat --top 10 \
+        --threads 4
+    run "$name check_diskstats" check_diskstats
+    run "$name check_diskstats -d" check_diskstats -d 'nvme*n1'
+    run "$name check_schedstat" check_schedstat
+    run "$name check_schedstat -n" check_schedstat -n nginx
+    run "$name check_dstate" check_dstate
+    run "$name check_dstate --no-threads" check_dstate --no-threads
+    run "$name check_netdev" check_netdev
+    run "$name check_netdev -i" check_netdev -i eth0
+    run "$name check_interrupts" check_interrupts
+    run "$name check_interrupts -i" check_interrupts -i 'eth*-TxRx-*' \
+        -i LOC -s NET_RX
+    run "$name check_nofiles_limits -n" check_nofiles_limits -n nginx
+    run "$name check_nofiles_limits -e" check_nofiles_limits -e nginx
+    run "$name check_nofiles_limits -n --io-uring" check_nofiles_limits \
+        -n nginx --io-uring
+    run "$name check_nofiles_limits -n -l" check_nofiles_limits \
+        -n nginx -l nofile,nproc,memlock,stack,as
+    run "$name check_procmem" check_procmem
+    run "$name check_procmem -s rss" check_procmem -s rss
+    run "$name check_procmem -n" check_procmem -n nginx
+    run "$name check_procmem --threads 4" check_procmem --threads 4
+done
@@ -0,0 +1,244 @@
+/*
+ * filename: bench_exec.c
+ *
+ * Runs a command a number of times and reports the exec-to-exit latency
+ * percentiles and the peak resident set size of the children. With -s the
+ * command is run once more under ptrace(2) to count its system calls. This
+ * is used by the benchmark scripts in this directory and is not installed.
+ *
+ * Usage: bench_exec [-s] [-n iterations] [-l label] command [args...]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_ITERATIONS  200
+#define USAGE "Usage: %s [-s] [-n iterations] [-l label] command [args...]\n"
+
+/*
+ * cmp_double:
+ *
+ * qsort() callback to sort an array of doubles ascending
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double  da = *(const double *) a,
+            db = *(const double *) b;
+
+    return (da > db) - (da < db);
+}
+
+/*
+ * percentile:
+ *
+ * returns the p-th percentile of the sorted array samples of size n
+ */
+static double percentile(const double *samples, int n, double p)
+{
+    int     idx = (int) (p / 100.0 * (n - 1) + 0.5);
+
+    return samples[idx];
+}
+
+/*
+ * run_once:
+ *
+ * fork and exec argv with stdout and stderr redirected to /dev/null. Returns
+ * the wall clock time in milliseconds until the child exited and stores the
+ * peak RSS of the child in kB in maxrss.
+ */
+static double run_once(char **argv, long *maxrss)
+{
+    struct timespec  start,
+                     end;
+    struct rusage    usage;
+    pid_t            pid;
+    int              status,
+                     devnull;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid = fork();
+    if(pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+    if(pid == 0)
+    {
+        devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    if(wait4(pid, &status, 0, &usage) < 0)
+    {
+        perror("wait4");
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 127)
+    {
+        fprintf(stderr, "could not execute %s\n", argv[0]);
+        exit(1);
+    }
+
+    *maxrss = usage.ru_maxrss;
+
+    return (end.tv_sec - start.tv_sec) * 1e3 +
+        (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+/*
+ * count_syscalls:
+ *
+ * run argv once under ptrace(2), including all threads and children, and
+ * return the number of system calls it made, or -1 if it can't be traced
+ */
+static long count_syscalls(char **argv)
+{
+    pid_t    pid,
+             tid;
+    int      status,
+             sig,
+             devnull;
+    long     stops = 0;
+
+    pid = fork();
+    if(pid < 0)
+        return -1;
+    if(pid == 0)
+    {
+        devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        if(ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
+            _exit(126);
+        raise(SIGSTOP);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    if(waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status))
+        return -1;
+
+    ptrace(PTRACE_SETOPTIONS, pid, NULL,
+            PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE |
+            PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+    while((tid = waitpid(-1, &status, __WALL)) > 0)
+    {
+        if(!WIFSTOPPED(status))
+            continue;
+
+        sig = WSTOPSIG(status);
+        if(sig == (SIGTRAP | 0x80))
+        {
+            /* Every system call stops once on entry and once on exit. */
+            stops++;
+            sig = 0;
+        }
+        else if(sig == SIGTRAP || sig == SIGSTOP)
+        {
+            /* ptrace events and the initial stop of new tasks */
+            sig = 0;
+        }
+
+        ptrace(PTRACE_SYSCALL, tid, NULL, sig);
+    }
+
+    return (stops + 1) / 2;
+}
+
+int main(int argc, char **argv)
+{
+    const char  *label = NULL;
+    double      *samples;
+    long         maxrss,
+                 peak_rss = 0;
+    long         syscalls = -1;
+    int          iterations = DEFAULT_ITERATIONS,
+                 trace = 0,
+                 opt,
+                 i;
+
+    while((opt = getopt(argc, argv, "+sn:l:")) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                trace = 1;
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind >= argc || iterations < 1)
+    {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+
+    if(!label)
+        label = argv[optind];
+
+    samples = malloc(sizeof(double) * iterations);
+    if(!samples)
+    {
+        perror("malloc");
+        return 1;
+    }
+
+    /* One warm up run, so the page cache is hot for everybody. */
+    run_once(&argv[optind], &maxrss);
+
+    for(i = 0; i < iterations; i++)
+    {
+        samples[i] = run_once(&argv[optind], &maxrss);
+        if(maxrss > peak_rss)
+            peak_rss = maxrss;
+    }
+
+    qsort(samples, iterations, sizeof(double), cmp_double);
+
+    if(trace)
+        syscalls = count_syscalls(&argv[optind]);
+
+    printf("%-40s n=%-5d p50=%8.3fms p90=%8.3fms p99=%8.3fms "
+            "max=%8.3fms maxrss=%ldkB",
+            label, iterations,
+            percentile(samples, iterations, 50),
+            percentile(samples, iterations, 90),
+            percentile(samples, iterations, 99),
+            samples[iterations - 1], peak_rss);
+    if(trace)
+        printf(" syscalls=%ld", syscalls);
+    printf("\n");
+
+    free(samples);
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# bench_startup.sh - compare the startup cost of plugin builds
+#
+# Runs every plugin with --version from each given directory, so only the
+# exec, dynamic loading and exit path is measured. Pass the plugins
+# directory of a regular build and of a --enable-multicall (or
+# --enable-static-multicall) build to compare them.
+#
+# The plugins are the applets listed in plugins/multicall.c, set PLUGINS to
+# benchmark only some of them.
+#
+# Usage: bench_startup.sh [-n iterations] <plugin dir> [<plugin dir> ...]
+
+BENCH_EXEC=${BENCH_EXEC:-$(dirname "$0")/bench_exec}
+
+# Every applet of the multi-call binary, unless PLUGINS is set.
+MULTICALL_C=$(dirname "$0")/../plugins/multicall.c
+if [ -z "$PLUGINS" ]; then
+    PLUGINS=$(sed -n 's/^ *{ "\([a-z_]*\)", .*/\1/p' "$MULTICALL_C")
+    if [ -z "$PLUGINS" ]; then
+        echo "$0: no plugins found in $MULTICALL_C" >&2
+        exit 1
+    fi
+fi
+ITERATIONS=500
+
+if [ "$1" = "-n" ]; then
+    ITERATIONS=$2
+    shift 2
+fi
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 [-n iterations] <plugin dir> [<plugin dir> ...]" >&2
+    exit 1
+fi
+
+for plugin in $PLUGINS; do
+    for dir in "$@"; do
+        [ -x "$dir/$plugin" ] || continue
+        "$BENCH_EXEC" -n "$ITERATIONS" -l "$dir/$plugin" \
+            "$dir/$plugin" --version || exit 1
+    done
+done
@@ -0,0 +1,330 @@
+/*
+ * filename: bench_tokenize.c
+ *
+ * Compares the integer tokenizer kernels of lib/tokenize.c with sscanf()
+ * and strtoull() loops on procfs samples: synthetic ones of a large host,
+ * which are the same on every machine, and the lines of the running system
+ * (/proc/stat, /proc/self/stat, /proc/interrupts). Every method must return
+ * the values of strtoull(). Reports ns per line and per number. This is
+ * not installed.
+ *
+ * Usage: bench_tokenize [-t seconds per method] [-P procfs root]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/tokenize.h"
+
+#define DEFAULT_SECONDS 0.2
+#define MAXVALUES       8192
+#define MAXSAMPLES      16
+#define USAGE "Usage: %s [-t seconds per method] [-P procfs root]\n"
+
+/*
+ * Structure to hold one sample: the numbers of a procfs line, without
+ * its prefix like "intr" or "pid (comm) S".
+ */
+typedef struct sample {
+    char       *name;
+    char       *text;
+    size_t      len;
+} sample_t;
+
+typedef size_t (*method_t)(const char *s, size_t len, uint64_t *values,
+        size_t max);
+
+static sample_t samples[MAXSAMPLES];
+static int      n_samples = 0;
+
+/*
+ * now:
+ *
+ * returns CLOCK_MONOTONIC in seconds
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * add_sample:
+ *
+ * adds a copy of the first line of text, without a trailing newline
+ */
+static void add_sample(const char *name, const char *text)
+{
+    size_t  len = strcspn(text, "\n");
+
+    if(n_samples == MAXSAMPLES || len == 0)
+        return;
+
+    samples[n_samples].name = strdup(name);
+    samples[n_samples].text = strndup(text, len);
+    samples[n_samples].len = len;
+    if(!samples[n_samples].name || !samples[n_samples].text)
+    {
+        perror("strdup");
+        exit(1);
+    }
+    n_samples++;
+}
+
+/*
+ * add_synthetic:
+ *
+ * adds samples of a host with 256 cpus and 4096 interrupts. Most interrupt
+ * counters are 0, like on real hosts.
+ */
+static void add_synthetic(void)
+{
+    static char text[MAXVALUES * 24];
+    size_t      len;
+    int         i;
+
+    srand(4711);
+
+    /* The "intr" line of /proc/stat, after "intr". */
+    for(len = 0, i = 0; i < 4096; i++)
+        len += sprintf(text + len, " %d", rand() % 8 ? 0 :
+                rand() % 1000 * (rand() % 100000));
+    add_sample("synthetic /proc/stat intr", text);
+
+    /* A line of /proc/interrupts, after "IRQ:". */
+    for(len = 0, i = 0; i < 256; i++)
+        len += sprintf(text + len, " %10d", rand() % 4 ? rand() % 100 :
+                rand() % 100000000);
+    add_sample("synthetic /proc/interrupts", text);
+
+    /* /proc/<pid>/stat, after the state. */
+    add_sample("synthetic /proc/pid/stat",
+            " 1 4711 4711 0 -1 4194560 12345 0 12 0 32977 23550 0 0 20 0 "
+            "5 0 51821 408334336 14690 18446744073709551615 1 1 0 0 0 0 0 "
+            "4096 16384 0 0 0 17 3 0 0 0 0 0 0 0 0 0 0 0 0");
+
+    /* The "cpu" line of /proc/stat, after "cpu". */
+    add_sample("synthetic /proc/stat cpu",
+            "  11575308 719865 3133282 32173965 850628 555908 416221 0 0 0");
+}
+
+/*
+ * read_line:
+ *
+ * reads the first line of path starting with prefix and adds the text
+ * after the prefix as a sample
+ */
+static void read_line(const char *root, const char *file, const char *prefix,
+        const char *name)
+{
+    static char  buffer[1 << 20];
+    char         path[4096],
+                *line;
+    size_t       len;
+    FILE        *f;
+
+    snprintf(path, sizeof(path), "%s/%s", root, file);
+    if(!(f = fopen(path, "r")))
+        return;
+    len = fread(buffer, 1, sizeof(buffer) - 1, f);
+    buffer[len] = '\0';
+    fclose(f);
+
+    for(line = buffer; line && *line; line = strchr(line, '\n'))
+    {
+        line += *line == '\n';
+        line += strspn(line, " ");
+        if(0 == strncmp(line, prefix, strlen(prefix)))
+        {
+            add_sample(name, line + strlen(prefix));
+            return;
+        }
+    }
+}
+
+/*
+ * read_stat:
+ *
+ * adds the fields of <root>/self/stat after the state
+ */
+static void read_stat(const char *root)
+{
+    char     path[4096],
+             buffer[4096],
+            *s;
+    size_t   len;
+    FILE    *f;
+
+    snprintf(path, sizeof(path), "%s/self/stat", root);
+    if(!(f = fopen(path, "r")))
+        return;
+    len = fread(buffer, 1, sizeof(buffer) - 1, f);
+    buffer[len] = '\0';
+    fclose(f);
+
+    /* The comm may contain blanks and parentheses, skip to the last ')'. */
+    if((s = strrchr(buffer, ')')) && s[1] && s[2])
+        add_sample("/proc/self/stat", s + 3);
+}
+
+/*
+ * by_sscanf:
+ */
+static size_t by_sscanf(const char *s, size_t len, uint64_t *values,
+        size_t max)
+{
+    size_t  n = 0;
+    int     used;
+
+    (void) len;
+    while(n < max && 1 == sscanf(s, "%" SCNu64 "%n", &values[n], &used))
+    {
+        s += used;
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * by_strtoull:
+ */
+static size_t by_strtoull(const char *s, size_t len, uint64_t *values,
+        size_t max)
+{
+    const char  *end = s + len;
+    char        *next;
+    size_t       n = 0;
+
+    while(n < max && s < end)
+    {
+        values[n] = strtoull(s, &next, 10);
+        if(next == s)
+            break;
+        s = next;
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * by_tokenize:
+ */
+static size_t by_tokenize(const char *s, size_t len, uint64_t *values,
+        size_t max)
+{
+    size_t  used;
+
+    return tokenize_u64(s, len, values, max, &used);
+}
+
+/*
+ * bench:
+ *
+ * runs method on sample for about seconds and reports its cost. Returns
+ * 0 if the values differ from the expected ones.
+ */
+static int bench(const char *label, method_t method, const sample_t *sample,
+        const uint64_t *expected, size_t n_expected, double seconds)
+{
+    static uint64_t  values[MAXVALUES];
+    double           start,
+                     elapsed;
+    long             iterations = 0,
+                     batch = 1;
+    size_t           n;
+
+    n = method(sample->text, sample->len, values, MAXVALUES);
+    if(n != n_expected || 0 != memcmp(values, expected, n * sizeof(uint64_t)))
+    {
+        printf("  %-10s MISMATCH (%zu of %zu values)\n", label, n, n_expected);
+        return 0;
+    }
+
+    start = now();
+    do
+    {
+        long    i;
+
+        for(i = 0; i < batch; i++)
+            method(sample->text, sample->len, values, MAXVALUES);
+        iterations += batch;
+        batch *= 2;
+        elapsed = now() - start;
+    }
+    while(elapsed < seconds);
+
+    printf("  %-10s %12.1f ns/line %8.2f ns/number %8.1f MB/s\n", label,
+            elapsed / iterations * 1e9,
+            elapsed / iterations / (n ? n : 1) * 1e9,
+            sample->len * iterations / elapsed / 1e6);
+
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    static const char  *kernels[] = { "scalar", "sse4.2", "avx2" };
+    static uint64_t     expected[MAXVALUES];
+    const char         *root = "/proc";
+    double              seconds = DEFAULT_SECONDS;
+    size_t              n;
+    int                 ok = 1,
+                        opt,
+                        i,
+                        k;
+
+    while((opt = getopt(argc, argv, "t:P:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                seconds = atof(optarg);
+                break;
+            case 'P':
+                root = optarg;
+                break;
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return 1;
+        }
+    }
+
+    add_synthetic();
+    read_line(root, "stat", "intr", "/proc/stat intr");
+    read_line(root, "stat", "cpu ", "/proc/stat cpu");
+    read_line(root, "interrupts", "0:", "/proc/interrupts 0:");
+    read_stat(root);
+
+    printf("default kernel: %s\n", tokenize_kernel());
+    for(i = 0; i < n_samples; i++)
+    {
+        /*
+         * strtoull() saturates and takes a sign, the others don't. The
+         * samples hold neither, so it is the reference.
+         */
+        n = by_strtoull(samples[i].text, samples[i].len, expected, MAXVALUES);
+        printf("%s: %zu numbers, %zu bytes\n", samples[i].name, n,
+                samples[i].len);
+
+        ok &= bench("sscanf", by_sscanf, &samples[i], expected, n, seconds);
+        ok &= bench("strtoull", by_strtoull, &samples[i], expected, n,
+                seconds);
+        for(k = 0; k < (int) (sizeof(kernels) / sizeof(kernels[0])); k++)
+            if(tokenize_set_kernel(kernels[k]))
+                ok &= bench(kernels[k], by_tokenize, &samples[i], expected, n,
+                        seconds);
+            else
+                printf("  %-10s not supported\n", kernels[k]);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# loopback.sh - test metrics_exporter and check_sockets over loopback
+#
+# Generates a procfs tree with tools/mkprocfs, starts metrics_exporter on a
+# free port of 127.0.0.1 with collectors reading that tree and scrapes
+# /metrics with curl until the samples of every collector are there.
+#
+# Then tools/backlog opens a listener on 127.0.0.1 whose accept queue is
+# full, which check_sockets has to report with an accept_queue_fill of 100%.
+#
+# Usage: loopback.sh <plugin dir>
+
+TOOLS=$(dirname "$0")
+MKPROCFS=${MKPROCFS:-$TOOLS/mkprocfs}
+BACKLOG=${BACKLOG:-$TOOLS/backlog}
+TIMEOUT=20
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 <plugin dir>" >&2
+    exit 1
+fi
+PLUGINDIR=$(cd "$1" && pwd) || exit 1
+
+WORKDIR=$(mktemp -d) || exit 1
+EXPORTER=
+LISTENER=
+cleanup() {
+    [ -n "$EXPORTER" ] && kill "$EXPORTER" 2>/dev/null
+    [ -n "$LISTENER" ] && kill "$LISTENER" 2>/dev/null
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+"$MKPROCFS" -o "$WORKDIR/proc" -p 20 -f 8 || fail "mkprocfs"
+mkdir "$WORKDIR/tmp"
+export TMPDIR="$WORKDIR/tmp"
+
+# The exporter logs the port it got for port 0.
+"$PLUGINDIR/metrics_exporter" -v -l 127.0.0.1:0 \
+    -C "meminfo=1:check_meminfo -P $WORKDIR/proc" \
+    -C "nofiles=1:check_nofiles_limits -P $WORKDIR/proc -n nginx" \
+    2>"$WORKDIR/exporter.log" &
+EXPORTER=$!
+
+# wait_for <seconds> <command...>
+wait_for() {
+    n=$1
+    shift
+    while [ "$n" -gt 0 ]; do
+        "$@" && return 0
+        sleep 1
+        n=$((n - 1))
+    done
+    return 1
+}
+
+listening() {
+    ADDRESS=$(sed -n 's/^metrics_exporter: listening on //p' \
+        "$WORKDIR/exporter.log")
+    [ -n "$ADDRESS" ]
+}
+wait_for "$TIMEOUT" listening || fail "metrics_exporter is not listening"
+echo "metrics_exporter listening on $ADDRESS"
+
+scraped() {
+    curl -sf "http://$ADDRESS/metrics" >"$WORKDIR/metrics" &&
+        grep -q '^check_meminfo_.*collector="meminfo"' "$WORKDIR/metrics" &&
+        grep -q '^check_nofiles_limits_.*collector="nofiles"' \
+            "$WORKDIR/metrics"
+}
+wait_for "$TIMEOUT" scraped || {
+    cat "$WORKDIR/exporter.log" "$WORKDIR/metrics" >&2
+    fail "/metrics lacks the samples of the collectors"
+}
+tail -n 1 "$WORKDIR/metrics" | grep -q '^# EOF$' ||
+    fail "/metrics doesn't end with # EOF"
+echo "ok /metrics has the meminfo and nofiles collectors"
+
+# A full accept queue is a fill of 100%, i.e. 1 in OpenMetrics.
+"$BACKLOG" -n 4 >"$WORKDIR/backlog" &
+LISTENER=$!
+
+backlogged() {
+    LISTEN=$(cat "$WORKDIR/backlog")
+    [ -n "$LISTEN" ]
+}
+wait_for "$TIMEOUT" backlogged || fail "backlog is not listening"
+echo "backlog listening on $LISTEN"
+
+"$PLUGINDIR/check_sockets" -s listen -F openmetrics >"$WORKDIR/sockets"
+grep -qx "check_sockets_accept_queue_fill_ratio{listener=\"$LISTEN\"} 1" \
+        "$WORKDIR/sockets" || {
+    cat "$WORKDIR/sockets" >&2
+    fail "check_sockets doesn't report the full accept queue of $LISTEN"
+}
+"$PLUGINDIR/check_sockets" -s listen -w 50 -c 90 >/dev/null
+[ $? -eq 2 ] || fail "check_sockets -c 90 is not CRITICAL for a full queue"
+echo "ok check_sockets reports the full accept queue of $LISTEN"
@@ -0,0 +1,826 @@
+/*
+ * filename: mkprocfs.c
+ *
+ * Generates a synthetic procfs tree, which the plugins can be pointed to
+ * with --procfs-root (or $PROCFS_ROOT). The tree contains meminfo, stat with
+ * per-CPU lines, schedstat, diskstats, net/dev, interrupts and softirqs
+ * with a column per CPU, buddyinfo, pagetypeinfo, vmstat, slabinfo with
+ * a line per cache and a directory for every process with status,
+ * stat, statm, smaps_rollup, schedstat, limits, cgroup, comm, an exe link,
+ * a fd directory and a task directory with the stat of every thread (every
+ * 97th thread is in uninterruptible sleep, with a wchan and a stack). The
+ * memory usage differs
+ * from process to process, but is the same for a pid in every tree. It is
+ * used by bench.sh to benchmark the plugins reproducibly and is not
+ * installed.
+ *
+ * Usage: mkprocfs -o <dir> [-p processes] [-f fds per process] [-c cpus]
+ *                 [-d disks] [-i interfaces] [-k slab caches]
+ *                 [-n name[,name...]] [-s first pid]
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MAXBUF          4096
+#define MAXNAMES        64
+
+/* Defaults, the names are cycled over all processes. */
+#define DEFAULT_PROCS   100
+#define DEFAULT_FDS     16
+#define DEFAULT_CPUS    4
+#define DEFAULT_DISKS   8
+#define DEFAULT_IFACES  4
+#define DEFAULT_SLABS   200
+#define DEFAULT_NAMES   "nginx,postgres,java,sshd,Web Content"
+#define DEFAULT_FIRSTPID 1000
+
+/* Threads get tids above all pids. */
+#define FIRST_TID       4000000
+#define DSTATE_EVERY    97
+
+/* Where the threads in uninterruptible sleep wait, with their callers. */
+static const struct
+{
+    const char *wchan;
+    const char *stack;
+} blocked[] = {
+    { "io_schedule",
+        "[<0>] io_schedule+0x46/0x70\n"
+        "[<0>] folio_wait_bit_common+0x13d/0x350\n"
+        "[<0>] filemap_fault+0x5c4/0xa10\n"
+        "[<0>] __do_fault+0x3a/0x130\n" },
+    { "rwsem_down_write_slowpath",
+        "[<0>] rwsem_down_write_slowpath+0x2a4/0x6b0\n"
+        "[<0>] ext4_buffered_write_iter+0x4f/0x140\n"
+        "[<0>] vfs_write+0x245/0x420\n"
+        "[<0>] ksys_write+0x6f/0xf0\n" },
+    { "rpc_wait_bit_killable",
+        "[<0>] rpc_wait_bit_killable+0x11/0x70\n"
+        "[<0>] __wait_on_bit+0x42/0x110\n"
+        "[<0>] out_of_line_wait_on_bit+0x8c/0xb0\n"
+        "[<0>] nfs4_do_call_sync+0x72/0xb0\n"
+        "[<0>] nfs4_proc_getattr+0x9f/0x140\n" },
+};
+
+/* The per process limits, the same for every process. */
+#define LIMITS \
+    "Limit                     Soft Limit           Hard Limit           Units     \n" \
+    "Max cpu time              unlimited            unlimited            seconds   \n" \
+    "Max file size             unlimited            unlimited            bytes     \n" \
+    "Max data size             unlimited            unlimited            bytes     \n" \
+    "Max stack size            8388608              unlimited            bytes     \n" \
+    "Max core file size        0                    unlimited            bytes     \n" \
+    "Max resident set          unlimited            unlimited            bytes     \n" \
+    "Max processes             63448                63448                processes \n" \
+    "Max open files            %-20d %-20d files     \n" \
+    "Max locked memory         65536                65536                bytes     \n" \
+    "Max address space         unlimited            unlimited            bytes     \n" \
+    "Max file locks            unlimited            unlimited            locks     \n" \
+    "Max pending signals       63448                63448                signals   \n" \
+    "Max msgqueue size         819200               819200               bytes     \n" \
+    "Max nice priority         0                    0                    \n" \
+    "Max realtime priority     0                    0                    \n" \
+    "Max realtime timeout      unlimited            unlimited            us        \n"
+
+/*
+ * die:
+ *
+ * print a message including errno to stderr and exit
+ */
+static void die(const char *what)
+{
+    fprintf(stderr, "mkprocfs: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+/*
+ * write_file:
+ *
+ * writes the NUL terminated content to dir/name
+ */
+static void write_file(const char *dir, const char *name, const char *content)
+{
+    char     path[MAXBUF];
+    FILE    *file;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if(!(file = fopen(path, "w")))
+        die(path);
+    fputs(content, file);
+    fclose(file);
+}
+
+/*
+ * write_meminfo:
+ *
+ * writes a meminfo of a machine with 16 GB of memory
+ */
+static void write_meminfo(const char *root)
+{
+    write_file(root, "meminfo",
+            "MemTotal:       16318412 kB\n"
+            "MemFree:         1843540 kB\n"
+            "MemAvailable:    9612388 kB\n"
+            "Buffers:          512260 kB\n"
+            "Cached:          7123476 kB\n"
+            "SwapCached:        10240 kB\n"
+            "Active:          8123412 kB\n"
+            "Inactive:        4734116 kB\n"
+            "Active(anon):    5012344 kB\n"
+            "Inactive(anon):   612400 kB\n"
+            "Active(file):    3111068 kB\n"
+            "Inactive(file):  4121716 kB\n"
+            "Unevictable:       65432 kB\n"
+            "Mlocked:           65432 kB\n"
+            "SwapTotal:       8388604 kB\n"
+            "SwapFree:        8123400 kB\n"
+            "Dirty:              1204 kB\n"
+            "Writeback:             0 kB\n"
+            "AnonPages:       5612340 kB\n"
+            "Mapped:          1123404 kB\n"
+            "Shmem:            412340 kB\n"
+            "KReclaimable:     623412 kB\n"
+            "Slab:             934512 kB\n"
+            "SReclaimable:     623412 kB\n"
+            "SUnreclaim:       311100 kB\n"
+            "KernelStack:       23456 kB\n"
+            "PageTables:        61234 kB\n"
+            "NFS_Unstable:          0 kB\n"
+            "Bounce:                0 kB\n"
+            "WritebackTmp:          0 kB\n"
+            "CommitLimit:    16547808 kB\n"
+            "Committed_AS:   21345678 kB\n"
+            "VmallocTotal:   34359738367 kB\n"
+            "VmallocUsed:       71234 kB\n"
+            "VmallocChunk:          0 kB\n"
+            "Percpu:            12345 kB\n"
+            "HardwareCorrupted:     0 kB\n"
+            "AnonHugePages:    204800 kB\n"
+            "ShmemHugePages:        0 kB\n"
+            "ShmemPmdMapped:        0 kB\n"
+            "HugePages_Total:       0\n"
+            "HugePages_Free:        0\n"
+            "HugePages_Rsvd:        0\n"
+            "HugePages_Surp:        0\n"
+            "Hugepagesize:       2048 kB\n"
+            "Hugetlb:               0 kB\n"
+            "DirectMap4k:      412340 kB\n"
+            "DirectMap2M:    12345678 kB\n"
+            "DirectMap1G:     4194304 kB\n");
+}
+
+/*
+ * write_stat:
+ *
+ * writes a stat with an aggregated cpu line, one line per CPU and the
+ * remaining system wide counters
+ */
+static void write_stat(const char *root, int n_cpus, int n_procs)
+{
+    char     path[MAXBUF];
+    FILE    *file;
+    int      cpu,
+             i;
+
+    snprintf(path, sizeof(path), "%s/stat", root);
+    if(!(file = fopen(path, "w")))
+        die(path);
+
+    fprintf(file, "cpu  %lld %lld %lld %lld %lld %lld %lld 0 0 0\n",
+            11575308LL * n_cpus, 719865LL * n_cpus, 3133282LL * n_cpus,
+            32173965LL * n_cpus, 850628LL * n_cpus, 555908LL * n_cpus,
+            416221LL * n_cpus);
+    for(cpu = 0; cpu < n_cpus; cpu++)
+        fprintf(file, "cpu%d %d %d %d %d %d %d %d 0 0 0\n", cpu,
+                11575308 + cpu, 719865 + cpu, 3133282 + cpu, 32173965 + cpu,
+                850628 + cpu, 555908 + cpu, 416221 + cpu);
+
+    /* The intr line has one counter per interrupt, most of them zero. */
+    fprintf(file, "intr 1234567890");
+    for(i = 0; i < 1024; i++)
+        fprintf(file, " %d", (i % 17) ? 0 : i * 1000);
+    fprintf(file, "\n");
+
+    fprintf(file, "ctxt 9876543210\n"
+            "btime 1500000000\n"
+            "processes %d\n"
+            "procs_running %d\n"
+            "procs_blocked 0\n"
+            "softirq 123456789 12 34567890 1234 5678901 123456 0 12345 "
+            "23456789 0 3456789\n",
+            n_procs * 10, n_cpus);
+
+    fclose(file);
+}
+
+/*
+ * write_schedstat:
+ *
+ * writes a schedstat of version 15 with the lines of two scheduling domains
+ * after every cpu line
+ */
+static void write_schedstat(const char *root, int n_cpus)
+{
+    char     path[MAXBUF];
+    FILE    *file;
+    long     n;
+    int      cpu,
+             domain;
+
+    snprintf(path, sizeof(path), "%s/schedstat", root);
+    if(!(file = fopen(path, "w")))
+        die(path);
+
+    fprintf(file, "version 15\ntimestamp 4295874445\n");
+    for(cpu = 0; cpu < n_cpus; cpu++)
+    {
+        n = cpu + 1;
+        fprintf(file, "cpu%d 0 0 %ld %ld %ld %ld %ld %ld %ld\n", cpu,
+                n * 123456, n * 45678, n * 98765, n * 54321,
+                n * 987654321012, n * 12345678901, n * 123456);
+        for(domain = 0; domain < 2; domain++)
+            fprintf(file, "domain%d %08x,%08x 123 4 5 6 7 8 9 10 11 12 13 14 "
+                    "15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31 32 "
+                    "33 34 35 36 0 0 0 0 0 0 0 0 0 0 0 0\n", domain,
+                    domain ? ~0U : 1U << (cpu % 32), domain ? ~0U : 0U);
+    }
+
+    fclose(file);
+}
+
+/*
+ * write_diskstats:
+ *
+ * writes a diskstats in the format of 5.5+ with discard and flush counters:
+ * NVMe namespaces with two partitions each and every fourth device a device
+ * mapper target
+ */
+static void write_diskstats(const char *root, int n_disks)
+{
+    char     path[MAXBUF];
+    FILE    *file;
+    long     n;
+    int      i,
+             part;
+
+    snprintf(path, sizeof(path), "%s/diskstats", root);
+    if(!(file = fopen(path, "w")))
+        die(path);
+
+    for(i = 0; i < n_disks; i++)
+    {
+        n = i + 1;
+        if(i % 4 == 3)
+        {
+            fprintf(file, " 253 %8d dm-%d %ld 0 %ld %ld %ld 0 %ld %ld 0 %ld "
+                    "%ld 0 0 0 0 0 0\n", i, i, n * 123456, n * 9876543,
+                    n * 45678, n * 234567, n * 8765432, n * 98765, n * 87654,
+                    n * 144443);
+            continue;
+        }
+
+        fprintf(file, " 259 %8d nvme%dn1 %ld %ld %ld %ld %ld %ld %ld %ld 0 "
+                "%ld %ld %ld 0 %ld %ld %ld %ld\n", i * 3, i, n * 123456,
+                n * 12, n * 9876543, n * 45678, n * 234567, n * 3456,
+                n * 8765432, n * 98765, n * 87654, n * 144443, n * 1234,
+                n * 987654, n * 321, n * 4567, n * 89);
+        for(part = 1; part <= 2; part++)
+            fprintf(file, " 259 %8d nvme%dn1p%d %ld 0 %ld %ld %ld 0 %ld %ld 0 "
+                    "%ld %ld 0 0 0 0 0 0\n", i * 3 + part, i, part,
+                    n * 61728 / part, n * 4938271 / part, n * 22839 / part,
+                    n * 117283 / part, n * 4382716 / part, n * 49382 / part,
+                    n * 43827 / part, n * 72221 / part);
+    }
+
+    fclose(file);
+}
+
+/*
+ * write_netdev:
+ *
+ * writes a net/dev with lo, two ethernet interfaces and veth interfaces of
+ * containers for the rest
+ */
+static void write_netdev(const char *root, int n_ifaces)
+{
+    char     path[MAXBUF],
+             name[32];
+    FILE    *file;
+    long     n;
+    int      i;
+
+    snprintf(path, sizeof(path), "%s/net", root);
+    if(mkdir(path, 0755) < 0 && errno != EEXIST)
+        die(path);
+
+    snprintf(path, sizeof(path), "%s/net/dev", root);
+    if(!(file = fopen(path, "w")))
+        die(path);
+
+    fprintf(file, "Inter-|   Receive                            "
+            "                    |  Transmit\n"
+            " face |bytes    packets errs drop fifo frame compressed "
+            "multicast|bytes    packets errs drop fifo colls carrier "
+            "compressed\n");
+
+    for(i = 0; i < n_ifaces; i++)
+    {
+        n = i + 1;
+        if(i == 0)
+            snprintf(name, sizeof(name), "lo");
+        else if(i < 3)
+            snprintf(name, sizeof(name), "eth%d", i - 1);
+        else
+            snprintf(name, sizeof(name), "veth%08lx", n * 2654435761UL &
+                    0xffffffffUL);
+
+        fprintf(file, "%6s: %8ld %7ld %4ld %4ld %4d %5d %10d %9ld %8ld %7ld "
+                "%4d %4ld %4d %5d %7d %10d\n", name, n * 987654321,
+                n * 1234567, n % 7, n * 13, 0, 0, 0, n * 17, n * 876543210,
+                n * 1134567, 0, n % 3, 0, 0, 0, 0);
+    }
+
+    fclose(file);
+}
+
+/*
+ * write_interrupts:
+ *
+ * writes interrupts with a few legacy interrupts, a queue interrupt per cpu
+ * for eth0 and eth1 and the per-cpu system interrupts. The queues of eth0
+ * are spread over the cpus, those of eth1 all fire on cpu 0.
+ */
+static void write_interrupts(const char *root, int n_cpus, int n_ifaces)
+{
+    static const char *system[] = { "NMI", "LOC", "RES", "CAL", "TLB" };
+    char     path[MAXBUF];
+    FILE    *file;
+    int      irq = 24,
+             queue,
+             cpu,
+             i;
+
+    snprintf(path, sizeof(path), "%s/interrupts", root);
+    if(!(file = fopen(path, "w")))
+        die(path);
+
+    fprintf(file, "     ");
+    for(cpu = 0; cpu < n_cpus; cpu++)
+        fprintf(file, " CPU%-8d", cpu);
+    fprintf(file, "\n");
+
+    for(i = 0; i < 4; i++, irq++)
+    {
+        fprintf(file, "%4d: ", irq);
+        for(cpu = 0; cpu < n_cpus; cpu++)
+            fprintf(file, "%10d ", cpu ? 0 : irq * 7);
+        fprintf(file, " IO-APIC   %d-edge      ttyS%d\n", i + 4, i);
+    }
+
+    for(i = 0; i < 2 && i < n_ifaces - 1; i++)
+    {
+        for(queue = 0; queue < n_cpus; queue++, irq++)
+        {
+            fprintf(file, "%4d: ", irq);
+            for(cpu = 0; cpu < n_cpus; cpu++)
+                fprintf(file, "%10ld ", cpu == (i ? 0 : queue) ?
+                        123456L * (queue + 1) : 0L);
+            fprintf(file, " PCI-MSIX-0000:%02x:00.0 %4d-edge      "
+                    "eth%d-TxRx-%d\n", i + 1, queue, i, queue);
+        }
+    }
+
+    for(i = 0; i < 5; i++)
+    {
+        fprintf(file, "%4s: ", system[i]);
+        for(cpu = 0; cpu < n_cpus; cpu++)
+            fprintf(file, "%10d ", (i + 1) * 98765 + cpu);
+        fprintf(file, "  %s interrupts\n", system[i]);
+    }
+    fprintf(file, " ERR:          0\n MIS:          0\n");
+
+    fclose(file);
+}
+
+/*
+ * write_softirqs:
+ *
+ * writes softirqs, NET_RX lands mostly on cpu 0
+ */
+static void write_softirqs(const char *root, int n_cpus)
+{
+    static const char *softirqs[] = { "HI", "TIMER", "NET_TX", "NET_RX",
+        "BLOCK", "IRQ_POLL", "TASKLET", "SCHED", "HRTIMER", "RCU" };
+    char     path[MAXBUF];
+    FILE    *file;
+    int      cpu,
+             i;
+
+    snprintf(path, sizeof(path), "%s/softirqs", root);
+    if(!(file = fopen(path, "w")))
+        die(path);
+
+    fprintf(file, "                    ");
+    for(cpu = 0; cpu < n_cpus; cpu++)
+        fprintf(file, "CPU%-8d", cpu);
+    fprintf(file, "\n");
+
+    for(i = 0; i < 10; i++)
+    {
+        fprintf(file, "%12s:", softirqs[i]);
+        for(cpu = 0; cpu < n_cpus; cpu++)
+            fprintf(file, " %10d", i == 3 && cpu == 0 ? 987654321 :
+                    (i + 1) * 12345 + cpu);
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+}
+
+/*
+ * write_buddyinfo:
+ *
+ * writes buddyinfo and pagetypeinfo of a single node, the Normal zone is
+ * fragmented: little of its free memory is in blocks of order 9 and above
+ */
+static void write_buddyinfo(const char *root)
+{
+    write_file(root, "buddyinfo",
+            "Node 0, zone      DMA      0      0      0      0      0      0      0      0      1      1      3 \n"
+            "Node 0, zone    DMA32   1204    987    812    634    412    201     87     32     11      4    102 \n"
+            "Node 0, zone   Normal  48312  31204  18734   9812   2103    412     61     12      3      1      0 \n");
+    write_file(root, "pagetypeinfo",
+            "Page block order: 9\n"
+            "Pages per block:  512\n"
+            "\n"
+            "Free pages count per migrate type at order       0      1      2      3      4      5      6      7      8      9     10 \n"
+            "Node    0, zone      DMA, type    Unmovable      0      0      0      0      0      0      0      0      1      0      0 \n"
+            "Node    0, zone      DMA, type      Movable      0      0      0      0      0      0      0      0      0      1      3 \n"
+            "Node    0, zone      DMA, type  Reclaimable      0      0      0      0      0      0      0      0      0      0      0 \n"
+            "Node    0, zone    DMA32, type    Unmovable    204    187    112     34     12      1      0      0      0      0      0 \n"
+            "Node    0, zone    DMA32, type      Movable    912    734    654    582    392    198     87     32     11      4    102 \n"
+            "Node    0, zone    DMA32, type  Reclaimable     88     66     46     18      8      2      0      0      0      0      0 \n"
+            "Node    0, zone   Normal, type    Unmovable  21034  14012   8123   4012    812     92      3      0      0      0      0 \n"
+            "Node    0, zone   Normal, type      Movable  19234  12987   7812   4234   1034    298     58     12      3      1      0 \n"
+            "Node    0, zone   Normal, type  Reclaimable   8044   4205   2799   1566    257     22      0      0      0      0      0 \n"
+            "\n"
+            "Number of blocks type     Unmovable      Movable  Reclaimable   HighAtomic      Isolate \n"
+            "Node 0, zone      DMA            1            7            0            0            0 \n"
+            "Node 0, zone    DMA32           12         1508           12            0            0 \n"
+            "Node 0, zone   Normal          412         6612          168            0            0 \n");
+}
+
+/*
+ * write_vmstat:
+ *
+ * writes a vmstat with the page and compaction counters
+ */
+static void write_vmstat(const char *root)
+{
+    write_file(root, "vmstat",
+            "nr_free_pages 460885\n"
+            "nr_inactive_anon 153100\n"
+            "nr_active_anon 1253086\n"
+            "nr_inactive_file 1030429\n"
+            "nr_active_file 777767\n"
+            "pgpgin 81234567\n"
+            "pgpgout 123456789\n"
+            "pswpin 1234\n"
+            "pswpout 5678\n"
+            "pgfault 9876543210\n"
+            "pgmajfault 123456\n"
+            "pgscan_kswapd 3456789\n"
+            "pgscan_direct 12345\n"
+            "pgsteal_kswapd 3012345\n"
+            "pgsteal_direct 11234\n"
+            "compact_migrate_scanned 45678912\n"
+            "compact_free_scanned 98765432\n"
+            "compact_isolated 1234567\n"
+            "compact_stall 4321\n"
+            "compact_fail 3012\n"
+            "compact_success 1309\n"
+            "compact_daemon_wake 812\n"
+            "thp_fault_alloc 34567\n"
+            "thp_fault_fallback 4321\n");
+}
+
+/*
+ * write_slabinfo:
+ *
+ * writes a slabinfo with n_caches caches, those beyond the common ones are
+ * per cgroup copies of them like on kernels before 5.9
+ */
+static void write_slabinfo(const char *root, int n_caches)
+{
+    static const struct {
+        const char *name;
+        int         size;
+        int         pages;
+    } common[] = {
+        { "ext4_inode_cache", 1080, 8 }, { "dentry", 192, 1 },
+        { "inode_cache", 600, 4 }, { "buffer_head", 104, 1 },
+        { "radix_tree_node", 576, 4 }, { "vm_area_struct", 232, 2 },
+        { "task_struct", 6528, 8 }, { "filp", 256, 2 },
+        { "sock_inode_cache", 832, 8 }, { "skbuff_head_cache", 256, 2 },
+        { "kmalloc-8", 8, 1 }, { "kmalloc-16", 16, 1 },
+        { "kmalloc-32", 32, 1 }, { "kmalloc-64", 64, 1 },
+        { "kmalloc-128", 128, 1 }, { "kmalloc-256", 256, 1 },
+        { "kmalloc-512", 512, 2 }, { "kmalloc-1k", 1024, 4 },
+        { "kmalloc-2k", 2048, 8 }, { "kmalloc-4k", 4096, 8 },
+        { "kmalloc-8k", 8192, 8 }
+    };
+    char     path[MAXBUF],
+             name[MAXBUF];
+    FILE    *file;
+    int      n_common = sizeof(common) / sizeof(common[0]),
+             i,
+             c,
+             per_slab;
+    long     slabs;
+
+    snprintf(path, sizeof(path), "%s/slabinfo", root);
+    if(!(file = fopen(path, "w")))
+        die(path);
+
+    fprintf(file, "slabinfo - version: 2.1\n"
+            "# name            <active_objs> <num_objs> <objsize> "
+            "<objperslab> <pagesperslab> : tunables <limit> <batchcount> "
+            "<sharedfactor> : slabdata <active_slabs> <num_slabs> "
+            "<sharedavail>\n");
+
+    for(i = 0; i < n_caches; i++)
+    {
+        c = i % n_common;
+        if(i < n_common)
+            snprintf(name, sizeof(name), "%s", common[c].name);
+        else
+            snprintf(name, sizeof(name), "%s(%d:app-%d.scope)",
+                    common[c].name, 1000 + i, i / n_common);
+
+        per_slab = common[c].pages * 4096 / common[c].size;
+        slabs = i < n_common ? (n_common - c) * 997L : (i * 37) % 100 + 1;
+        fprintf(file, "%-17s %6ld %6ld %6d %4d %4d : tunables %4d %4d %4d"
+                " : slabdata %6ld %6ld %6d\n", name,
+                slabs * per_slab * 9 / 10, slabs * per_slab, common[c].size,
+                per_slab, common[c].pages, 0, 0, 0, slabs, slabs, 0);
+    }
+
+    fclose(file);
+}
+
+/*
+ * write_process:
+ *
+ * writes the directory of one process
+ */
+static void write_process(const char *root, long pid, const char *name,
+        int n_fds, long *next_tid)
+{
+    char     dir[MAXBUF],
+             path[MAXBUF],
+             target[MAXBUF],
+             content[MAXBUF];
+    int      fd;
+    long     t,
+             tid;
+    size_t   which;
+
+    /* Memory in kB: up to 2 GB resident, every fourth process swaps. */
+    long     rss = 1024 + (long) ((pid * 2654435761UL >> 8) % 2097152),
+             anon = rss * 2 / 3,
+             pss = rss * 3 / 4,
+             swap = pid % 4 ? 0 : rss / 8;
+
+    snprintf(dir, sizeof(dir), "%s/%ld", root, pid);
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST)
+        die(dir);
+
+    snprintf(content, sizeof(content),
+            "Name:\t%s\n"
+            "Umask:\t0022\n"
+            "State:\tS (sleeping)\n"
+            "Tgid:\t%ld\n"
+            "Ngid:\t0\n"
+            "Pid:\t%ld\n"
+            "PPid:\t1\n"
+            "TracerPid:\t0\n"
+            "Uid:\t1000\t1000\t1000\t1000\n"
+            "Gid:\t1000\t1000\t1000\t1000\n"
+            "FDSize:\t%d\n"
+            "Groups:\t1000\n"
+            "VmPeak:\t  412340 kB\n"
+            "VmSize:\t  398764 kB\n"
+            "VmLck:\t       0 kB\n"
+            "VmPin:\t       0 kB\n"
+            "VmHWM:\t%8ld kB\n"
+            "VmRSS:\t%8ld kB\n"
+            "RssAnon:\t%8ld kB\n"
+            "RssFile:\t%8ld kB\n"
+            "RssShmem:\t       0 kB\n"
+            "VmData:\t  123456 kB\n"
+            "VmStk:\t     132 kB\n"
+            "VmExe:\t    1234 kB\n"
+            "VmLib:\t   12345 kB\n"
+            "VmPTE:\t     234 kB\n"
+            "VmSwap:\t%8ld kB\n"
+            "Threads:\t%ld\n"
+            "SigQ:\t0/63448\n"
+            "voluntary_ctxt_switches:\t%ld\n"
+            "nonvoluntary_ctxt_switches:\t%ld\n",
+            name, pid, pid, (n_fds + 63) & ~63, rss, rss, anon, rss - anon,
+            swap, 1 + pid % 8, pid * 3, pid);
+    write_file(dir, "status", content);
+
+    /* In pages of 4 kB. */
+    snprintf(content, sizeof(content), "99691 %ld %ld 309 0 30864 0\n",
+            rss / 4, (rss - anon) / 4);
+    write_file(dir, "statm", content);
+
+    snprintf(content, sizeof(content),
+            "00400000-7ffd8a5f2000 ---p 00000000 00:00 0"
+            "                          [rollup]\n"
+            "Rss:             %8ld kB\n"
+            "Pss:             %8ld kB\n"
+            "Pss_Dirty:       %8ld kB\n"
+            "Pss_Anon:        %8ld kB\n"
+            "Pss_File:        %8ld kB\n"
+            "Pss_Shmem:              0 kB\n"
+            "Shared_Clean:    %8ld kB\n"
+            "Shared_Dirty:           0 kB\n"
+            "Private_Clean:          0 kB\n"
+            "Private_Dirty:   %8ld kB\n"
+            "Referenced:      %8ld kB\n"
+            "Anonymous:       %8ld kB\n"
+            "KSM:                    0 kB\n"
+            "LazyFree:               0 kB\n"
+            "AnonHugePages:          0 kB\n"
+            "ShmemPmdMapped:         0 kB\n"
+            "FilePmdMapped:          0 kB\n"
+            "Shared_Hugetlb:         0 kB\n"
+            "Private_Hugetlb:        0 kB\n"
+            "Swap:            %8ld kB\n"
+            "SwapPss:         %8ld kB\n"
+            "Locked:                 0 kB\n",
+            rss, pss, anon, anon, pss - anon, rss - anon, anon, rss, anon,
+            swap, swap);
+    write_file(dir, "smaps_rollup", content);
+
+    snprintf(content, sizeof(content), "0::/system.slice/%s.service\n", name);
+    write_file(dir, "cgroup", content);
+
+    snprintf(content, sizeof(content), "%.15s\n", name);
+    write_file(dir, "comm", content);
+
+    snprintf(content, sizeof(content),
+            "%ld (%.15s) S 1 %ld %ld 0 -1 4194560 12345 0 12 0 %ld %ld 0 0 "
+            "20 0 %ld 0 %ld 408334336 14690 18446744073709551615 1 1 0 0 0 "
+            "0 0 4096 16384 0 0 0 17 %ld 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+            pid, name, pid, pid, pid * 7, pid * 3, 1 + pid % 8, pid * 11,
+            pid % 4);
+    write_file(dir, "stat", content);
+
+    snprintf(content, sizeof(content), "%ld %ld %ld\n", pid * 7000000,
+            pid * 300000, pid * 11);
+    write_file(dir, "schedstat", content);
+
+    snprintf(content, sizeof(content), LIMITS, 65536, 65536);
+    write_file(dir, "limits", content);
+
+    snprintf(path, sizeof(path), "%s/exe", dir);
+    snprintf(target, sizeof(target), "/usr/sbin/%s", name);
+    if(symlink(target, path) < 0 && errno != EEXIST)
+        die(path);
+
+    snprintf(path, sizeof(path), "%s/fd", dir);
+    if(mkdir(path, 0755) < 0 && errno != EEXIST)
+        die(path);
+
+    for(fd = 0; fd < n_fds; fd++)
+    {
+        snprintf(path, sizeof(path), "%s/fd/%d", dir, fd);
+        if(fd < 3)
+            snprintf(target, sizeof(target), "/dev/null");
+        else
+            snprintf(target, sizeof(target), "socket:[%ld]", pid * 100000 + fd);
+        if(symlink(target, path) < 0 && errno != EEXIST)
+            die(path);
+    }
+
+    /* The first thread is the process itself. */
+    snprintf(path, sizeof(path), "%s/task", dir);
+    if(mkdir(path, 0755) < 0 && errno != EEXIST)
+        die(path);
+
+    for(t = 0; t < 1 + pid % 8; t++)
+    {
+        tid = t ? (*next_tid)++ : pid;
+        snprintf(path, sizeof(path), "%s/task/%ld", dir, tid);
+        if(mkdir(path, 0755) < 0 && errno != EEXIST)
+            die(path);
+
+        snprintf(content, sizeof(content),
+                "%ld (%.15s) %c 1 %ld %ld 0 -1 4194560 1234 0 1 0 %ld %ld "
+                "0 0 20 0 %ld 0 %ld 408334336 14690 18446744073709551615 1 "
+                "1 0 0 0 0 0 4096 16384 0 0 0 -1 %ld 0 0 0 0 0 0 0 0 0 0 0 "
+                "0 0\n",
+                tid, name, t && tid % DSTATE_EVERY == 0 ? 'D' : 'S', pid,
+                pid, tid, tid / 3, 1 + pid % 8, pid * 11, pid % 4);
+        write_file(path, "stat", content);
+
+        if(t && tid % DSTATE_EVERY == 0)
+        {
+            which = tid / DSTATE_EVERY % (sizeof(blocked) / sizeof(blocked[0]));
+            write_file(path, "wchan", blocked[which].wchan);
+            write_file(path, "stack", blocked[which].stack);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char  *root = NULL;
+    char        *names[MAXNAMES],
+                *name_list,
+                *token;
+    int          n_procs = DEFAULT_PROCS,
+                 n_fds = DEFAULT_FDS,
+                 n_cpus = DEFAULT_CPUS,
+                 n_disks = DEFAULT_DISKS,
+                 n_ifaces = DEFAULT_IFACES,
+                 n_slabs = DEFAULT_SLABS,
+                 n_names = 0,
+                 opt,
+                 i;
+    long         first_pid = DEFAULT_FIRSTPID,
+                 next_tid = FIRST_TID;
+
+    name_list = strdup(DEFAULT_NAMES);
+
+    while((opt = getopt(argc, argv, "o:p:f:c:d:i:k:n:s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'o': root = optarg; break;
+            case 'p': n_procs = atoi(optarg); break;
+            case 'f': n_fds = atoi(optarg); break;
+            case 'c': n_cpus = atoi(optarg); break;
+            case 'd': n_disks = atoi(optarg); break;
+            case 'i': n_ifaces = atoi(optarg); break;
+            case 'k': n_slabs = atoi(optarg); break;
+            case 'n': free(name_list); name_list = strdup(optarg); break;
+            case 's': first_pid = atol(optarg); break;
+            default:
+                root = NULL;
+                optind = argc;
+                break;
+        }
+    }
+
+    if(!root || n_procs < 0 || n_fds < 0 || n_cpus < 1 ||
+            n_disks < 0 || n_ifaces < 0 || n_slabs < 0)
+    {
+        fprintf(stderr, "Usage: %s -o <dir> [-p processes] "
+                "[-f fds per process] [-c cpus] [-d disks] "
+                "[-i interfaces] [-k slab caches] [-n name[,name...]] "
+                "[-s first pid]\n", argv[0]);
+        return 1;
+    }
+
+    for(token = strtok(name_list, ","); token && n_names < MAXNAMES;
+            token = strtok(NULL, ","))
+        names[n_names++] = token;
+
+    if(0 == n_names)
+    {
+        fprintf(stderr, "mkprocfs: no process names given\n");
+        return 1;
+    }
+
+    if(mkdir(root, 0755) < 0 && errno != EEXIST)
+        die(root);
+
+    write_meminfo(root);
+    write_stat(root, n_cpus, n_procs);
+    write_schedstat(root, n_cpus);
+    write_diskstats(root, n_disks);
+    write_netdev(root, n_ifaces);
+    write_interrupts(root, n_cpus, n_ifaces);
+    write_softirqs(root, n_cpus);
+    write_buddyinfo(root);
+    write_vmstat(root);
+    write_slabinfo(root, n_slabs);
+
+    for(i = 0; i < n_procs; i++)
+        write_process(root, first_pid + i, names[i % n_names], n_fds,
+                &next_tid);
+
+    free(name_list);
+
+    return 0;
+}
@@ -0,0 +1,1227 @@
+/*
+ * filename: procrec.c
+ *
+ * Records the part of a procfs tree the plugins read into an archive and
+ * replays it, to benchmark the plugins on the shapes of real hosts (odd
+ * process names, huge fd tables, hundreds of cpus) instead of synthetic
+ * trees. This is not installed.
+ *
+ *  record:  takes -s snapshots every -i ms of the files the plugins given
+ *           with -p (default: all) read. With -A pids are renumbered from
+ *           1000 on and process names become "proc<N>", consistently over
+ *           all files and snapshots; the names are mapped on stderr, so
+ *           they can be used with -n. Paths of fd links, exe links and
+ *           cgroups are anonymised as well.
+ *  extract: writes snapshot N of the archive to <dir>/N, e.g. for bench.sh
+ *           or bench_exec with PROCFS_ROOT=<dir>/N.
+ *  replay:  extracts the archive to a temporary directory and runs a plugin
+ *           on all snapshots in order, with a state directory of its own
+ *           as TMPDIR, so stateful plugins like check_procstat see the
+ *           recorded counters progress. Between the snapshots it waits as
+ *           long as passed between recording them (not with -f), so rates
+ *           per second match, too. This is repeated -n times; the output of
+ *           the first round and the latencies of every snapshot are
+ *           reported.
+ *
+ * The archive is a stream of records in host byte order. Every distinct
+ * content is stored once and referred to by the files and links, so the
+ * many identical limits files and the unchanged files of later snapshots
+ * take no space.
+ *
+ * Usage: procrec record -o archive [-p plugin[,plugin...]] [-s snapshots]
+ *                       [-i interval ms] [-A] [-P procfs root]
+ *        procrec extract -a archive -o dir
+ *        procrec replay -a archive [-n iterations] [-f] -- plugin [args]
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/procfs.h"
+
+#define MAXBUF          4096
+#define MAXSNAPSHOTS    1024
+#define MAXITERATIONS   1000
+#define ARCHIVE_MAGIC   "PROCREC1"
+#define FIRST_PID       1000
+
+/* Record types of the archive. */
+#define REC_SNAPSHOT    'S'     /* uint32 index, int64 ns since the first */
+#define REC_BLOB        'B'     /* uint32 length, content */
+#define REC_FILE        'F'     /* uint16 length, path, uint32 blob */
+#define REC_LINK        'L'     /* uint16 length, path, uint32 blob */
+#define REC_DIR         'D'     /* uint16 length, path */
+
+/* Kinds of sources. */
+#define SRC_GLOBAL      0       /* a file below the root */
+#define SRC_PID         1       /* a file below every pid directory */
+#define SRC_PIDLINK     2       /* a link below every pid directory */
+#define SRC_FDS         3       /* the fd directory of every pid */
+
+#define USAGE \
+    "Usage: %s record -o archive [-p plugin[,plugin...]] [-s snapshots]\n" \
+    "                 [-i interval ms] [-A] [-P procfs root]\n" \
+    "       %s extract -a archive -o dir\n" \
+    "       %s replay -a archive [-n iterations] [-f] -- plugin [args]\n"
+
+/*
+ * Structure to describe a file a plugin reads.
+ */
+typedef struct source {
+    const char *plugin;
+    const char *path;
+    int         type;
+} source_t;
+
+static const source_t sources[] =
+{
+    { "meminfo",        "meminfo",      SRC_GLOBAL },
+    { "procstat",       "stat",         SRC_GLOBAL },
+    { "procstat",       "stat",         SRC_PID },
+    { "diskstats",      "diskstats",    SRC_GLOBAL },
+    { "netdev",         "net/dev",      SRC_GLOBAL },
+    { "sockets",        "net/netstat",  SRC_GLOBAL },
+    { "schedstat",      "schedstat",    SRC_GLOBAL },
+    { "schedstat",      "stat",         SRC_PID },
+    { "schedstat",      "schedstat",    SRC_PID },
+    { "nofiles_limits", "status",       SRC_PID },
+    { "nofiles_limits", "limits",       SRC_PID },
+    { "nofiles_limits", "stat",         SRC_PID },
+    { "nofiles_limits", "exe",          SRC_PIDLINK },
+    { "nofiles_limits", "fd",           SRC_FDS },
+    { "procmem",        "comm",         SRC_PID },
+    { "procmem",        "cgroup",       SRC_PID },
+    { "procmem",        "statm",        SRC_PID },
+    { "procmem",        "status",       SRC_PID },
+    { "procmem",        "smaps_rollup", SRC_PID }
+};
+
+#define NSOURCES    (sizeof(sources) / sizeof(sources[0]))
+
+/*
+ * Common head of the entries of a hash table.
+ */
+typedef struct entry {
+    uint64_t    hash;
+    int         used;
+} entry_t;
+
+/*
+ * A stored content, for the deduplication.
+ */
+typedef struct blob {
+    entry_t     head;
+    uint32_t    id;
+    uint32_t    len;
+    char       *data;
+} blob_t;
+
+/*
+ * A renumbered pid or an aliased name.
+ */
+typedef struct mapping {
+    entry_t     head;
+    long        pid,
+                to;
+    char       *name,
+               *alias;
+} mapping_t;
+
+/*
+ * Structure to hold a hash table with open addressing.
+ */
+typedef struct table {
+    char       *slots;
+    size_t      entry_size,
+                size,
+                count;
+} table_t;
+
+/*
+ * Structure to hold the state of a recording.
+ */
+typedef struct recorder {
+    FILE       *archive;
+    table_t     blobs,
+                pids,
+                names;
+    uint32_t    n_blobs;
+    long        next_pid;
+    int         anonymise;
+    char       *buffer;
+    size_t      buffer_size;
+    long        files;
+    long        bytes;
+} recorder_t;
+
+/*
+ * die:
+ *
+ * print a message including errno to stderr and exit
+ */
+static void die(const char *what)
+{
+    fprintf(stderr, "procrec: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+/*
+ * now_ns:
+ *
+ * returns CLOCK_BOOTTIME in nanoseconds
+ */
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * hash_bytes:
+ *
+ * FNV-1a
+ */
+static uint64_t hash_bytes(const char *data, size_t len)
+{
+    uint64_t    hash = 14695981039346656037ULL;
+    size_t      i;
+
+    for(i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char) data[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
+/*
+ * table_next:
+ *
+ * returns the first slot of the probe sequence of hash which is free or,
+ * if matches is given, holds the entry matches() accepts
+ */
+static entry_t *table_next(table_t *table, uint64_t hash,
+        int (*matches)(const entry_t *entry, const void *key), const void *key)
+{
+    entry_t *entry;
+    size_t   i;
+
+    for(i = hash & (table->size - 1); ; i = (i + 1) & (table->size - 1))
+    {
+        entry = (entry_t *) (table->slots + i * table->entry_size);
+        if(!entry->used || (matches && matches(entry, key)))
+            return entry;
+    }
+}
+
+/*
+ * table_find:
+ *
+ * returns the entry of the key in table, or a free slot for it. The table
+ * is grown first, so at most half of the slots are used.
+ */
+static entry_t *table_find(table_t *table, uint64_t hash,
+        int (*matches)(const entry_t *entry, const void *key), const void *key)
+{
+    table_t      grown;
+    entry_t     *entry;
+    size_t       i;
+
+    if(table->count * 2 >= table->size)
+    {
+        grown = *table;
+        grown.size = table->size ? table->size * 2 : 1024;
+        if(!(grown.slots = calloc(grown.size, grown.entry_size)))
+            die("calloc");
+        for(i = 0; i < table->size; i++)
+        {
+            entry = (entry_t *) (table->slots + i * table->entry_size);
+            if(entry->used)
+                memcpy(table_next(&grown, entry->hash, NULL, NULL), entry,
+                        table->entry_size);
+        }
+        free(table->slots);
+        *table = grown;
+    }
+
+    return table_next(table, hash, matches, key);
+}
+
+/*
+ * write_path:
+ *
+ * writes a record of type with a path and, unless it is a directory, the
+ * blob id
+ */
+static void write_path(recorder_t *rec, int type, const char *path,
+        uint32_t blob)
+{
+    uint16_t    len = strlen(path);
+
+    fputc(type, rec->archive);
+    fwrite(&len, sizeof(len), 1, rec->archive);
+    fwrite(path, 1, len, rec->archive);
+    if(type != REC_DIR)
+        fwrite(&blob, sizeof(blob), 1, rec->archive);
+}
+
+/*
+ * matches_blob:
+ */
+static int matches_blob(const entry_t *entry, const void *key)
+{
+    const blob_t    *blob = (const blob_t *) entry;
+    const blob_t    *wanted = key;
+
+    return blob->head.hash == wanted->head.hash && blob->len == wanted->len &&
+        0 == memcmp(blob->data, wanted->data, blob->len);
+}
+
+/*
+ * store_blob:
+ *
+ * returns the id of the content, which is written to the archive unless
+ * it is there already
+ */
+static uint32_t store_blob(recorder_t *rec, const char *data, size_t len)
+{
+    blob_t   key,
+            *blob;
+    uint32_t len32 = len;
+
+    key.head.hash = hash_bytes(data, len);
+    key.len = len;
+    key.data = (char *) data;
+
+    blob = (blob_t *) table_find(&rec->blobs, key.head.hash, matches_blob,
+            &key);
+    if(blob->head.used)
+        return blob->id;
+
+    blob->head.hash = key.head.hash;
+    blob->head.used = 1;
+    blob->id = rec->n_blobs++;
+    blob->len = len;
+    if(!(blob->data = malloc(len + 1)))
+        die("malloc");
+    memcpy(blob->data, data, len);
+    rec->blobs.count++;
+
+    fputc(REC_BLOB, rec->archive);
+    fwrite(&len32, sizeof(len32), 1, rec->archive);
+    fwrite(data, 1, len, rec->archive);
+    rec->bytes += len;
+
+    return blob->id;
+}
+
+/*
+ * matches_pid:
+ */
+static int matches_pid(const entry_t *entry, const void *key)
+{
+    return ((const mapping_t *) entry)->pid == *(const long *) key;
+}
+
+/*
+ * map_pid:
+ *
+ * returns the number a pid is replaced with when anonymising
+ */
+static long map_pid(recorder_t *rec, long pid)
+{
+    mapping_t   *mapping;
+
+    if(!rec->anonymise || pid <= 0)
+        return pid;
+
+    mapping = (mapping_t *) table_find(&rec->pids, hash_bytes((char *) &pid,
+                sizeof(pid)), matches_pid, &pid);
+    if(!mapping->head.used)
+    {
+        mapping->head.hash = hash_bytes((char *) &pid, sizeof(pid));
+        mapping->head.used = 1;
+        mapping->pid = pid;
+        mapping->to = rec->next_pid++;
+        rec->pids.count++;
+    }
+
+    return mapping->to;
+}
+
+/*
+ * matches_name:
+ */
+static int matches_name(const entry_t *entry, const void *key)
+{
+    return 0 == strcmp(((const mapping_t *) entry)->name, key);
+}
+
+/*
+ * map_name:
+ *
+ * returns the alias of a process name, or the name itself unless
+ * anonymising. New aliases are reported on stderr.
+ */
+static const char *map_name(recorder_t *rec, const char *name)
+{
+    mapping_t   *mapping;
+    uint64_t     hash = hash_bytes(name, strlen(name));
+
+    if(!rec->anonymise)
+        return name;
+
+    mapping = (mapping_t *) table_find(&rec->names, hash, matches_name, name);
+    if(!mapping->head.used)
+    {
+        mapping->head.hash = hash;
+        mapping->head.used = 1;
+        if(!(mapping->name = strdup(name)) ||
+                !(mapping->alias = malloc(32)))
+            die("malloc");
+        snprintf(mapping->alias, 32, "proc%lu",
+                (unsigned long) rec->names.count++);
+        fprintf(stderr, "%s\t%s\n", mapping->alias, name);
+    }
+
+    return mapping->alias;
+}
+
+/*
+ * map_path:
+ *
+ * anonymises a path: every component becomes the alias of its name, a
+ * suffix like ".service" or ".slice" is kept
+ */
+static void map_path(recorder_t *rec, const char *path, char *out,
+        size_t out_len)
+{
+    char         component[MAXBUF];
+    const char  *suffix;
+    size_t       len,
+                 used = 0;
+
+    while(*path && used < out_len)
+    {
+        if(*path == '/')
+        {
+            out[used++] = *path++;
+            continue;
+        }
+
+        len = strcspn(path, "/");
+        snprintf(component, sizeof(component), "%.*s", (int) len, path);
+        path += len;
+
+        suffix = strrchr(component, '.');
+        if(suffix && (0 == strcmp(suffix, ".service") ||
+                    0 == strcmp(suffix, ".slice") ||
+                    0 == strcmp(suffix, ".scope")))
+            component[suffix - component] = '\0';
+        else
+            suffix = "";
+
+        used += snprintf(out + used, out_len - used, "%s%s",
+                map_name(rec, component), suffix);
+    }
+
+    out[used < out_len ? used : out_len - 1] = '\0';
+}
+
+/*
+ * anonymise_status:
+ *
+ * replaces the name and the pids of a status file
+ */
+static size_t anonymise_status(recorder_t *rec, const char *in, char *out,
+        size_t out_len)
+{
+    static const char  *pid_keys[] = { "Tgid:", "Ngid:", "Pid:", "PPid:",
+                                       "TracerPid:" };
+    const char         *line,
+                       *end;
+    size_t              used = 0,
+                        k;
+    char                name[MAXBUF];
+    int                 done;
+
+    for(line = in; *line && used < out_len; line = end)
+    {
+        end = strchr(line, '\n');
+        end = end ? end + 1 : line + strlen(line);
+
+        done = 0;
+        if(0 == strncmp(line, "Name:\t", 6))
+        {
+            snprintf(name, sizeof(name), "%.*s", (int) (end - line - 6 -
+                        (end[-1] == '\n')), line + 6);
+            used += snprintf(out + used, out_len - used, "Name:\t%s\n",
+                    map_name(rec, name));
+            done = 1;
+        }
+        for(k = 0; !done && k < sizeof(pid_keys) / sizeof(pid_keys[0]); k++)
+            if(0 == strncmp(line, pid_keys[k], strlen(pid_keys[k])))
+            {
+                used += snprintf(out + used, out_len - used, "%s\t%ld\n",
+                        pid_keys[k], map_pid(rec,
+                            atol(line + strlen(pid_keys[k]))));
+                done = 1;
+            }
+        if(!done)
+            used += snprintf(out + used, out_len - used, "%.*s",
+                    (int) (end - line), line);
+    }
+
+    return used < out_len ? used : out_len - 1;
+}
+
+/*
+ * anonymise_stat:
+ *
+ * replaces the pid, the comm and the ppid, pgrp, session and tpgid of a
+ * stat file
+ */
+static size_t anonymise_stat(recorder_t *rec, const char *in, char *out,
+        size_t out_len)
+{
+    const char  *open = strchr(in, '('),
+                *close = strrchr(in, ')');
+    char         comm[MAXBUF],
+                 state;
+    long         ppid,
+                 pgrp,
+                 session,
+                 tty,
+                 tpgid;
+    int          used,
+                 n;
+
+    /* "pid (comm) state ppid pgrp session tty_nr tpgid ..." */
+    if(!open || !close || close < open ||
+            6 != sscanf(close + 1, " %c %ld %ld %ld %ld %ld%n", &state, &ppid,
+                &pgrp, &session, &tty, &tpgid, &n))
+        return snprintf(out, out_len, "%s", in) < (int) out_len ?
+            strlen(out) : out_len - 1;
+
+    snprintf(comm, sizeof(comm), "%.*s", (int) (close - open - 1), open + 1);
+    used = snprintf(out, out_len, "%ld (%s) %c %ld %ld %ld %ld %ld%s",
+            map_pid(rec, atol(in)), map_name(rec, comm), state,
+            map_pid(rec, ppid), map_pid(rec, pgrp), map_pid(rec, session),
+            tty, map_pid(rec, tpgid), close + 1 + n);
+
+    return used < (int) out_len ? (size_t) used : out_len - 1;
+}
+
+/*
+ * anonymise_cgroup:
+ *
+ * anonymises the paths of "id:controllers:path" lines
+ */
+static size_t anonymise_cgroup(recorder_t *rec, const char *in, char *out,
+        size_t out_len)
+{
+    const char  *line,
+                *end,
+                *path;
+    char         mapped[MAXBUF],
+                 original[MAXBUF];
+    size_t       used = 0;
+
+    for(line = in; *line && used < out_len; line = end)
+    {
+        end = strchr(line, '\n');
+        end = end ? end + 1 : line + strlen(line);
+
+        path = memchr(line, ':', end - line);
+        path = path ? memchr(path + 1, ':', end - path - 1) : NULL;
+        if(!path)
+        {
+            used += snprintf(out + used, out_len - used, "%.*s",
+                    (int) (end - line), line);
+            continue;
+        }
+
+        path++;
+        snprintf(original, sizeof(original), "%.*s", (int) (end - path -
+                    (end[-1] == '\n')), path);
+        map_path(rec, original, mapped, sizeof(mapped));
+        used += snprintf(out + used, out_len - used, "%.*s%s\n",
+                (int) (path - line), line, mapped);
+    }
+
+    return used < out_len ? used : out_len - 1;
+}
+
+/*
+ * anonymise_link:
+ *
+ * anonymises the target of an exe or fd link. Sockets, pipes, anonymous
+ * inodes and devices tell nothing and are kept.
+ */
+static void anonymise_link(recorder_t *rec, const char *target, char *out,
+        size_t out_len)
+{
+    if(0 == strncmp(target, "socket:", 7) ||
+            0 == strncmp(target, "pipe:", 5) ||
+            0 == strncmp(target, "anon_inode:", 11) ||
+            0 == strncmp(target, "/dev/", 5))
+        snprintf(out, out_len, "%s", target);
+    else
+        map_path(rec, target, out, out_len);
+}
+
+/*
+ * record_file:
+ *
+ * records the file path below the root as name, anonymised by its kind
+ */
+static void record_file(recorder_t *rec, const char *path, const char *name,
+        const char *kind)
+{
+    char    full_path[MAXBUF];
+    char   *out;
+    long    len;
+
+    procfs_path(full_path, sizeof(full_path), "%s", path);
+    if((len = procfs_read_file(full_path, &rec->buffer,
+                    &rec->buffer_size)) < 0)
+        return;
+
+    if(rec->anonymise && (0 == strcmp(kind, "status") ||
+                0 == strcmp(kind, "stat") || 0 == strcmp(kind, "comm") ||
+                0 == strcmp(kind, "cgroup")))
+    {
+        /* A name or pid may become longer, but not by much. */
+        if(!(out = malloc(len * 2 + MAXBUF)))
+            die("malloc");
+
+        if(0 == strcmp(kind, "status"))
+            len = anonymise_status(rec, rec->buffer, out, len * 2 + MAXBUF);
+        else if(0 == strcmp(kind, "stat"))
+            len = anonymise_stat(rec, rec->buffer, out, len * 2 + MAXBUF);
+        else if(0 == strcmp(kind, "cgroup"))
+            len = anonymise_cgroup(rec, rec->buffer, out, len * 2 + MAXBUF);
+        else
+        {
+            rec->buffer[strcspn(rec->buffer, "\n")] = '\0';
+            len = snprintf(out, len * 2 + MAXBUF, "%s\n",
+                    map_name(rec, rec->buffer));
+        }
+
+        write_path(rec, REC_FILE, name, store_blob(rec, out, len));
+        free(out);
+    }
+    else
+        write_path(rec, REC_FILE, name, store_blob(rec, rec->buffer, len));
+
+    rec->files++;
+}
+
+/*
+ * record_link:
+ *
+ * records the link path below the root as name
+ */
+static void record_link(recorder_t *rec, const char *path, const char *name)
+{
+    char        full_path[MAXBUF],
+                target[MAXBUF],
+                mapped[MAXBUF];
+    ssize_t     len;
+
+    procfs_path(full_path, sizeof(full_path), "%s", path);
+    if((len = readlink(full_path, target, sizeof(target) - 1)) < 0)
+        return;
+    target[len] = '\0';
+
+    if(rec->anonymise)
+        anonymise_link(rec, target, mapped, sizeof(mapped));
+    else
+        snprintf(mapped, sizeof(mapped), "%s", target);
+
+    write_path(rec, REC_LINK, name, store_blob(rec, mapped, strlen(mapped)));
+    rec->files++;
+}
+
+/*
+ * record_fds:
+ *
+ * records the fd directory of a pid with all its links
+ */
+static void record_fds(recorder_t *rec, const char *pid, const char *name)
+{
+    DIR             *dir;
+    struct dirent   *dir_entry;
+    char             path[MAXBUF],
+                     fd_path[MAXBUF],
+                     fd_name[MAXBUF];
+
+    procfs_path(path, sizeof(path), "%s/fd", pid);
+    if(!(dir = opendir(path)))
+        return;
+
+    write_path(rec, REC_DIR, name, 0);
+    while(NULL != (dir_entry = readdir(dir)))
+    {
+        if(dir_entry->d_name[0] == '.')
+            continue;
+        snprintf(fd_path, sizeof(fd_path), "%s/fd/%s", pid,
+                dir_entry->d_name);
+        snprintf(fd_name, sizeof(fd_name), "%s/%s", name, dir_entry->d_name);
+        record_link(rec, fd_path, fd_name);
+    }
+    closedir(dir);
+}
+
+/*
+ * record_snapshot:
+ *
+ * records the sources of the plugins selected in mask
+ */
+static void record_snapshot(recorder_t *rec, unsigned long mask,
+        uint32_t index, int64_t taken)
+{
+    DIR             *dir_proc;
+    struct dirent   *dir_entry;
+    char             path[MAXBUF],
+                     name[MAXBUF],
+                     pid_name[32];
+    size_t           i,
+                     j;
+    int              pids = 0,
+                     seen;
+
+    fputc(REC_SNAPSHOT, rec->archive);
+    fwrite(&index, sizeof(index), 1, rec->archive);
+    fwrite(&taken, sizeof(taken), 1, rec->archive);
+
+    /* Files needed by several plugins are recorded once. */
+    for(i = 0; i < NSOURCES; i++)
+    {
+        for(seen = 0, j = 0; j < i; j++)
+            seen |= (mask >> j & 1) && 0 == strcmp(sources[i].path,
+                    sources[j].path) && sources[i].type == sources[j].type;
+        if(!(mask >> i & 1) || seen)
+            continue;
+        if(sources[i].type == SRC_GLOBAL)
+            record_file(rec, sources[i].path, sources[i].path, "");
+        else
+            pids = 1;
+    }
+
+    if(!pids)
+        return;
+
+    if(!(dir_proc = opendir(procfs_root())))
+        die(procfs_root());
+
+    while(NULL != (dir_entry = readdir(dir_proc)))
+    {
+        if(dir_entry->d_name[0] < '1' || dir_entry->d_name[0] > '9')
+            continue;
+
+        snprintf(pid_name, sizeof(pid_name), "%ld",
+                map_pid(rec, atol(dir_entry->d_name)));
+
+        for(i = 0; i < NSOURCES; i++)
+        {
+            for(seen = 0, j = 0; j < i; j++)
+                seen |= (mask >> j & 1) && 0 == strcmp(sources[i].path,
+                        sources[j].path) && sources[i].type == sources[j].type;
+            if(!(mask >> i & 1) || seen || sources[i].type == SRC_GLOBAL)
+                continue;
+
+            snprintf(path, sizeof(path), "%s/%s", dir_entry->d_name,
+                    sources[i].path);
+            snprintf(name, sizeof(name), "%s/%s", pid_name, sources[i].path);
+            if(sources[i].type == SRC_PID)
+                record_file(rec, path, name, sources[i].path);
+            else if(sources[i].type == SRC_PIDLINK)
+                record_link(rec, path, name);
+            else
+                record_fds(rec, dir_entry->d_name, name);
+        }
+    }
+
+    closedir(dir_proc);
+}
+
+/*
+ * plugin_mask:
+ *
+ * returns the mask of the sources of a comma separated list of plugins,
+ * with or without "check_", 0 if one is unknown
+ */
+static unsigned long plugin_mask(char *list)
+{
+    unsigned long    mask = 0,
+                     found;
+    char            *token;
+    size_t           i;
+
+    for(token = strtok(list, ","); token; token = strtok(NULL, ","))
+    {
+        if(0 == strncmp(token, "check_", 6))
+            token += 6;
+        for(found = 0, i = 0; i < NSOURCES; i++)
+            if(0 == strcmp(sources[i].plugin, token))
+                found |= 1UL << i;
+        if(!found)
+        {
+            fprintf(stderr, "procrec: unknown plugin %s\n", token);
+            return 0;
+        }
+        mask |= found;
+    }
+
+    return mask;
+}
+
+/*
+ * record:
+ */
+static int record(int argc, char **argv)
+{
+    recorder_t       rec;
+    struct timespec  ts;
+    const char      *output = NULL;
+    unsigned long    mask = (1UL << NSOURCES) - 1;
+    int64_t          first = 0,
+                     next;
+    long             interval = 1000;
+    int              snapshots = 1,
+                     opt,
+                     i;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.blobs.entry_size = sizeof(blob_t);
+    rec.pids.entry_size = sizeof(mapping_t);
+    rec.names.entry_size = sizeof(mapping_t);
+    rec.next_pid = FIRST_PID;
+
+    while((opt = getopt(argc, argv, "o:p:s:i:AP:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'o': output = optarg; break;
+            case 'p': mask = plugin_mask(optarg); break;
+            case 's': snapshots = atoi(optarg); break;
+            case 'i': interval = atol(optarg); break;
+            case 'A': rec.anonymise = 1; break;
+            case 'P': procfs_set_root(optarg); break;
+            default: return 2;
+        }
+    }
+
+    if(!output || !mask || snapshots < 1 || snapshots > MAXSNAPSHOTS ||
+            interval < 0)
+        return 2;
+
+    if(!(rec.archive = fopen(output, "w")))
+        die(output);
+    fwrite(ARCHIVE_MAGIC, 1, strlen(ARCHIVE_MAGIC), rec.archive);
+
+    for(i = 0; i < snapshots; i++)
+    {
+        next = now_ns();
+        if(i == 0)
+            first = next;
+        record_snapshot(&rec, mask, i, next - first);
+
+        next = first + (int64_t) (i + 1) * interval * 1000000;
+        ts.tv_sec = next / 1000000000;
+        ts.tv_nsec = next % 1000000000;
+        if(i + 1 < snapshots)
+            clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    if(0 != fclose(rec.archive))
+        die(output);
+
+    fprintf(stderr, "procrec: %d snapshots, %ld files, %u distinct contents "
+            "of %ld bytes\n", snapshots, rec.files, rec.n_blobs, rec.bytes);
+
+    return 0;
+}
+
+/*
+ * make_parents:
+ *
+ * creates the directories path is in
+ */
+static void make_parents(char *path)
+{
+    char    *slash;
+
+    for(slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        if(mkdir(path, 0755) < 0 && errno != EEXIST)
+            die(path);
+        *slash = '/';
+    }
+}
+
+/*
+ * read_exactly:
+ */
+static void read_exactly(FILE *archive, void *buffer, size_t len)
+{
+    if(len && 1 != fread(buffer, len, 1, archive))
+    {
+        fprintf(stderr, "procrec: truncated archive\n");
+        exit(1);
+    }
+}
+
+/*
+ * extract:
+ *
+ * writes every snapshot of the archive to <dir>/<index> and stores their
+ * times in taken. Returns the number of snapshots.
+ */
+static int extract_archive(const char *archive_path, const char *dir,
+        int64_t *taken)
+{
+    FILE        *archive;
+    char       **blobs = NULL;
+    uint32_t    *lens = NULL,
+                 n_blobs = 0,
+                 size = 0,
+                 len32,
+                 index,
+                 blob;
+    uint16_t     len16;
+    char         magic[sizeof(ARCHIVE_MAGIC)],
+                 name[MAXBUF],
+                 path[2 * MAXBUF],
+                 snapshot[MAXBUF] = "";
+    int          type,
+                 n_snapshots = 0;
+    FILE        *file;
+
+    if(!(archive = fopen(archive_path, "r")))
+        die(archive_path);
+    read_exactly(archive, magic, strlen(ARCHIVE_MAGIC));
+    if(0 != memcmp(magic, ARCHIVE_MAGIC, strlen(ARCHIVE_MAGIC)))
+    {
+        fprintf(stderr, "procrec: %s is no archive\n", archive_path);
+        exit(1);
+    }
+
+    while(EOF != (type = fgetc(archive)))
+    {
+        switch(type)
+        {
+            case REC_SNAPSHOT:
+                read_exactly(archive, &index, sizeof(index));
+                if(index != (uint32_t) n_snapshots ||
+                        n_snapshots == MAXSNAPSHOTS)
+                    goto corrupt;
+                read_exactly(archive, &taken[n_snapshots], sizeof(int64_t));
+                snprintf(snapshot, sizeof(snapshot), "%s/%d", dir,
+                        n_snapshots++);
+                if(mkdir(snapshot, 0755) < 0 && errno != EEXIST)
+                    die(snapshot);
+                break;
+
+            case REC_BLOB:
+                if(n_blobs == size)
+                {
+                    size = size ? size * 2 : 4096;
+                    if(!(blobs = realloc(blobs, size * sizeof(char *))) ||
+                            !(lens = realloc(lens, size * sizeof(uint32_t))))
+                        die("realloc");
+                }
+                read_exactly(archive, &len32, sizeof(len32));
+                if(!(blobs[n_blobs] = malloc(len32 + 1)))
+                    die("malloc");
+                read_exactly(archive, blobs[n_blobs], len32);
+                blobs[n_blobs][len32] = '\0';
+                lens[n_blobs++] = len32;
+                break;
+
+            case REC_FILE:
+            case REC_LINK:
+            case REC_DIR:
+                read_exactly(archive, &len16, sizeof(len16));
+                if(!snapshot[0] || len16 >= sizeof(name))
+                    goto corrupt;
+                read_exactly(archive, name, len16);
+                name[len16] = '\0';
+                if(strstr(name, "..") || name[0] == '/')
+                    goto corrupt;
+                snprintf(path, sizeof(path), "%s/%s", snapshot, name);
+                make_parents(path);
+
+                if(type == REC_DIR)
+                {
+                    if(mkdir(path, 0755) < 0 && errno != EEXIST)
+                        die(path);
+                    break;
+                }
+
+                read_exactly(archive, &blob, sizeof(blob));
+                if(blob >= n_blobs)
+                    goto corrupt;
+                if(type == REC_LINK)
+                {
+                    if(symlink(blobs[blob], path) < 0 && errno != EEXIST)
+                        die(path);
+                    break;
+                }
+                if(!(file = fopen(path, "w")))
+                    die(path);
+                fwrite(blobs[blob], 1, lens[blob], file);
+                fclose(file);
+                break;
+
+            default:
+                goto corrupt;
+        }
+    }
+
+    fclose(archive);
+    while(n_blobs > 0)
+        free(blobs[--n_blobs]);
+    free(blobs);
+    free(lens);
+
+    return n_snapshots;
+
+corrupt:
+    fprintf(stderr, "procrec: %s is corrupt\n", archive_path);
+    exit(1);
+}
+
+/*
+ * extract:
+ */
+static int extract(int argc, char **argv)
+{
+    static int64_t   taken[MAXSNAPSHOTS];
+    const char      *archive = NULL,
+                    *dir = NULL;
+    int              opt,
+                     n;
+
+    while((opt = getopt(argc, argv, "a:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'a': archive = optarg; break;
+            case 'o': dir = optarg; break;
+            default: return 2;
+        }
+    }
+
+    if(!archive || !dir)
+        return 2;
+
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST)
+        die(dir);
+    n = extract_archive(archive, dir, taken);
+    fprintf(stderr, "procrec: %d snapshots extracted to %s\n", n, dir);
+
+    return 0;
+}
+
+/*
+ * run_plugin:
+ *
+ * runs the plugin on a snapshot, with the output to /dev/null unless
+ * verbose. Its clock is the time the snapshot was taken at, so rates don't
+ * depend on how fast the replay runs. Returns its exit code, the elapsed
+ * time goes to elapsed_ms.
+ */
+static int run_plugin(char **argv, const char *root, const char *state,
+        int64_t taken, int verbose, double *elapsed_ms)
+{
+    struct timespec  start,
+                     end;
+    pid_t            pid;
+    char             clock[32];
+    int              status;
+
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if((pid = fork()) < 0)
+        die("fork");
+    if(pid == 0)
+    {
+        setenv(PROCFS_ROOT_ENV, root, 1);
+        setenv("TMPDIR", state, 1);
+        snprintf(clock, sizeof(clock), "%lld", (long long) taken);
+        setenv(PROCFS_CLOCK_ENV, clock, 1);
+        if(!verbose && !freopen("/dev/null", "w", stdout))
+            _exit(126);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    if(waitpid(pid, &status, 0) < 0)
+        die("waitpid");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 +
+        (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*
+ * cmp_double:
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double  da = *(const double *) a,
+            db = *(const double *) b;
+
+    return (da > db) - (da < db);
+}
+
+/*
+ * remove_tree:
+ */
+static void remove_tree(const char *path)
+{
+    DIR             *dir;
+    struct dirent   *dir_entry;
+    char             child[MAXBUF];
+
+    if(!(dir = opendir(path)))
+    {
+        unlink(path);
+        return;
+    }
+
+    while(NULL != (dir_entry = readdir(dir)))
+    {
+        if(0 == strcmp(dir_entry->d_name, ".") ||
+                0 == strcmp(dir_entry->d_name, ".."))
+            continue;
+        snprintf(child, sizeof(child), "%s/%s", path, dir_entry->d_name);
+        if(dir_entry->d_type == DT_DIR)
+            remove_tree(child);
+        else
+            unlink(child);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+/*
+ * replay:
+ */
+static int replay(int argc, char **argv)
+{
+    static int64_t   taken[MAXSNAPSHOTS];
+    static double    elapsed[MAXSNAPSHOTS][MAXITERATIONS];
+    struct timespec  ts;
+    const char      *archive = NULL,
+                    *tmpdir = getenv("TMPDIR");
+    char             work[MAXBUF],
+                     root[MAXBUF],
+                     state[MAXBUF];
+    int64_t          start,
+                     wake;
+    int              iterations = 1,
+                     fast = 0,
+                     n_snapshots,
+                     opt,
+                     rc,
+                     i,
+                     s;
+
+    while((opt = getopt(argc, argv, "a:n:f")) != -1)
+    {
+        switch(opt)
+        {
+            case 'a': archive = optarg; break;
+            case 'n': iterations = atoi(optarg); break;
+            case 'f': fast = 1; break;
+            default: return 2;
+        }
+    }
+
+    if(!archive || optind >= argc || iterations < 1 ||
+            iterations > MAXITERATIONS)
+        return 2;
+
+    snprintf(work, sizeof(work), "%s/procrec.XXXXXX", tmpdir ? tmpdir : "/tmp");
+    if(!mkdtemp(work))
+        die(work);
+    n_snapshots = extract_archive(archive, work, taken);
+    snprintf(state, sizeof(state), "%s/state", work);
+
+    for(i = 0; i < iterations; i++)
+    {
+        /* Every round starts without state, like the first one. */
+        remove_tree(state);
+        if(mkdir(state, 0700) < 0)
+            die(state);
+
+        start = now_ns();
+        for(s = 0; s < n_snapshots; s++)
+        {
+            if(!fast && s > 0)
+            {
+                wake = start + taken[s] - taken[0];
+                ts.tv_sec = wake / 1000000000;
+                ts.tv_nsec = wake % 1000000000;
+                clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, NULL);
+            }
+
+            snprintf(root, sizeof(root), "%s/%d", work, s);
+            if(i == 0)
+                printf("snapshot %d: ", s);
+            rc = run_plugin(argv + optind, root, state, taken[s], i == 0,
+                    &elapsed[s][i]);
+            if(rc < 0 || rc > 3)
+            {
+                fprintf(stderr, "procrec: %s failed with %d\n", argv[optind],
+                        rc);
+                remove_tree(work);
+                return 1;
+            }
+        }
+    }
+
+    for(s = 0; s < n_snapshots; s++)
+    {
+        qsort(elapsed[s], iterations, sizeof(double), cmp_double);
+        printf("snapshot %d: n=%d p50=%8.3fms p90=%8.3fms max=%8.3fms\n", s,
+                iterations, elapsed[s][iterations / 2],
+                elapsed[s][iterations * 9 / 10], elapsed[s][iterations - 1]);
+    }
+
+    remove_tree(work);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int     rc = 2;
+
+    if(argc >= 2 && 0 == strcmp(argv[1], "record"))
+        rc = record(argc - 1, argv + 1);
+    else if(argc >= 2 && 0 == strcmp(argv[1], "extract"))
+        rc = extract(argc - 1, argv + 1);
+    else if(argc >= 2 && 0 == strcmp(argv[1], "replay"))
+        rc = replay(argc - 1, argv + 1);
+
+    if(rc == 2)
+        fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+
+    return rc;
+}